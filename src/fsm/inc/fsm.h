@@ -139,6 +139,33 @@ struct fsm_web_cat_ops
 };
 
 
+/**
+ * @brief flow attribute value types
+ */
+enum fsm_dpi_attr_type
+{
+    FSM_DPI_ATTR_STRING = 0,
+    FSM_DPI_ATTR_UINT,
+    FSM_DPI_ATTR_BINARY,
+};
+
+
+/**
+ * @brief typed flow attribute value
+ *
+ * Lets a dpi plugin report a value in its native form. The member
+ * matching the type is set.
+ */
+struct fsm_dpi_attr_value
+{
+    int type;
+    char *str;
+    uint64_t uint;
+    const uint8_t *buf;
+    size_t len;
+};
+
+
 /**
  * @brief dpi plugin specific operations
  *
@@ -156,6 +183,14 @@ struct fsm_dpi_plugin_ops
                          struct net_md_stats_accumulator *acc);
     void (*register_clients)(struct fsm_session *);
     void (*unregister_clients)(struct fsm_session *);
+
+    /* Returns the interned id of a flow attribute. Provided to the plugin */
+    int (*get_attr_id)(char *);
+
+    /* Id based variant of notify_client. Provided to the plugin */
+    int (*notify_client_id)(struct fsm_session *, int,
+                            struct fsm_dpi_attr_value *,
+                            struct net_md_stats_accumulator *acc);
 };
 
 
@@ -168,6 +203,14 @@ struct fsm_dpi_plugin_client_ops
 {
     int (*process_attr)(struct fsm_session *, char *, char *,
                         struct net_md_stats_accumulator *acc);
+
+    /*
+     * Typed variant of process_attr, passed the interned attribute id,
+     * the attribute name and the typed value. Preferred when provided.
+     */
+    int (*process_attr_value)(struct fsm_session *, int, char *,
+                              struct fsm_dpi_attr_value *,
+                              struct net_md_stats_accumulator *acc);
 };
 
 
@@ -297,6 +340,8 @@ struct fsm_dpi_plugin
     bool bound;
     bool clients_init;
     ds_tree_t dpi_clients;
+    struct dpi_client **clients_by_id;  /* dispatch table, by attribute id */
+    int nclients_by_id;
     ds_tree_node_t dpi_node;
 };
 
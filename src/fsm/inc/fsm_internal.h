@@ -44,6 +44,7 @@ struct dpi_client
 {
     struct fsm_session *session;
     char *attr;
+    int attr_id;
     ds_tree_node_t node;
 };
 
@@ -230,6 +231,39 @@ int
 fsm_dpi_call_client(struct fsm_session *dpi_plugin_session, char *attr, char *value,
                     struct net_md_stats_accumulator *acc);
 
+/**
+ * @brief call back registered client using the interned attribute id
+ *
+ * @param dpi_plugin_session the dpi plugin session
+ * @param attr_id the interned attribute id, as returned by fsm_dpi_attr_id()
+ * @param value the typed value of the attribute
+ * @return the action to take
+ */
+int
+fsm_dpi_call_client_id(struct fsm_session *dpi_plugin_session, int attr_id,
+                       struct fsm_dpi_attr_value *value,
+                       struct net_md_stats_accumulator *acc);
+
+/**
+ * @brief returns the interned id of a flow attribute
+ *
+ * Ids are small positive integers, allocated on first use and stable
+ * for the process lifetime.
+ * @param attr the flow attribute
+ * @return the attribute id, 0 if attr is NULL
+ */
+int
+fsm_dpi_attr_id(char *attr);
+
+/**
+ * @brief returns the name of an interned flow attribute
+ *
+ * @param attr_id the attribute id
+ * @return the attribute name, NULL if the id is unknown
+ */
+char *
+fsm_dpi_attr_name(int attr_id);
+
 int
 fsm_nfq_set_verdict(struct fsm_session *session, int action);
 
@@ -344,6 +344,8 @@ fsm_init_dpi_plugin(struct fsm_session *session)
     dpi_plugin->session = session;
     dpi_plugin->bound = false;
     dpi_plugin->clients_init = false;
+    dpi_plugin->clients_by_id = NULL;
+    dpi_plugin->nclients_by_id = 0;
 
     dpi_plugin->targets = fsm_get_other_config_val(session, "targeted_devices");
     dpi_plugin->excluded_targets = fsm_get_other_config_val(session,
@@ -354,6 +356,8 @@ fsm_init_dpi_plugin(struct fsm_session *session)
 
     ops = &session->p_ops->dpi_plugin_ops;
     ops->notify_client = fsm_dpi_call_client;
+    ops->notify_client_id = fsm_dpi_call_client_id;
+    ops->get_attr_id = fsm_dpi_attr_id;
     ops->register_clients = fsm_dpi_register_clients;
     ops->unregister_clients = fsm_dpi_unregister_clients;
 
@@ -1054,6 +1058,14 @@ fsm_dpi_on_acc_creation(struct net_md_aggregator *aggr,
     if (acc->direction != NET_MD_ACC_UNSET_DIR) return;
 
     rev_acc = net_md_lookup_reverse_acc(aggr, acc);
+
+    /* The conntrack mark covers both directions of the connection */
+    if ((rev_acc != NULL) && (rev_acc->dpi_done != 0))
+    {
+        acc->dpi_done = rev_acc->dpi_done;
+        acc->dpi_marked = rev_acc->dpi_marked;
+    }
+
     if ((rev_acc != NULL) && (rev_acc->direction != NET_MD_ACC_UNSET_DIR))
     {
         acc->direction = rev_acc->direction;
@@ -1577,6 +1589,61 @@ fsm_dpi_mark_for_report(struct fsm_session *session,
 }
 
 
+/* Conntrack mark requests sent for a flow before giving up */
+#define FSM_DPI_MARK_MAX_ATTEMPTS 3
+
+/**
+ * @brief propagates the dpi verdict of a flow to the kernel
+ *
+ * The flow's conntrack mark is set so the capture rules stop delivering
+ * its packets to userspace. The mark is set through the verdict in nfqueue
+ * mode, through a conntrack update otherwise. Conntrack updates are not
+ * repeated for packets still in flight once one succeeded, and are given
+ * up after FSM_DPI_MARK_MAX_ATTEMPTS failures.
+ * The mark covers both directions of the connection, so is the verdict.
+ *
+ * @param session the dispatcher session
+ * @param net_parser the parsed info for the current packet
+ * @param state the flow's verdict
+ */
+static void
+fsm_dpi_set_flow_done(struct fsm_session *session,
+                      struct net_header_parser *net_parser,
+                      int state)
+{
+    struct net_md_stats_accumulator *rev_acc;
+    struct net_md_stats_accumulator *acc;
+    struct fsm_mgr *mgr;
+    int verdict;
+    int rc;
+
+    acc = net_parser->acc;
+    acc->dpi_done = state;
+
+    if (session->tap_type == FSM_TAP_NFQ)
+    {
+        verdict = (state == FSM_DPI_DROP) ?
+                  NF_UTIL_NFQ_DROP : NF_UTIL_NFQ_ACCEPT;
+        nf_queue_set_verdict(net_parser->packet_id, verdict,
+                             net_parser->nfq_queue_num);
+    }
+    else if (!acc->dpi_marked &&
+             (acc->dpi_mark_attempts < FSM_DPI_MARK_MAX_ATTEMPTS))
+    {
+        mgr = fsm_get_mgr();
+        acc->dpi_mark_attempts++;
+        rc = mgr->set_dpi_state(net_parser, state);
+        acc->dpi_marked = (rc > 0);
+    }
+
+    rev_acc = net_md_lookup_reverse_acc(acc->aggr, acc);
+    if (rev_acc == NULL) return;
+
+    rev_acc->dpi_done = state;
+    rev_acc->dpi_marked = acc->dpi_marked;
+}
+
+
 /**
  * @brief dipatches a received packet to the dpi plugin handlers
  *
@@ -1596,7 +1663,6 @@ fsm_dispatch_pkt(struct fsm_session *session,
     struct fsm_session *dpi_plugin;
     struct fsm_dpi_plugin *plugin;
     struct eth_header *eth_hdr;
-    struct fsm_mgr *mgr;
     ds_tree_t *tree;
     bool excluded;
     bool included;
@@ -1608,23 +1674,11 @@ fsm_dispatch_pkt(struct fsm_session *session,
     acc = net_parser->acc;
 
     if (acc == NULL) return;
-    mgr = fsm_get_mgr();
 
+    /* All the plugins are done with the flow, do not dispatch */
     if (acc->dpi_done != 0)
     {
-        if (session->tap_type == FSM_TAP_NFQ)
-        {
-            int verdict;
-
-            verdict = (acc->dpi_done == FSM_DPI_DROP) ?
-                      NF_UTIL_NFQ_DROP : NF_UTIL_NFQ_ACCEPT;
-            nf_queue_set_verdict(net_parser->packet_id, verdict,
-                                 net_parser->nfq_queue_num);
-        }
-        else
-        {
-            mgr->set_dpi_state(net_parser, acc->dpi_done);
-        }
+        fsm_dpi_set_flow_done(session, net_parser, acc->dpi_done);
         return;
     }
 
@@ -1703,29 +1757,8 @@ fsm_dispatch_pkt(struct fsm_session *session,
         info = ds_tree_next(tree, info);
     }
 
-
-    if (session->tap_type == FSM_TAP_NFQ)
-    {
-        if (drop)
-        {
-            nf_queue_set_verdict(net_parser->packet_id, NF_UTIL_NFQ_DROP,
-                                 net_parser->nfq_queue_num);
-        }
-
-        if (pass)
-        {
-            nf_queue_set_verdict(net_parser->packet_id, NF_UTIL_NFQ_ACCEPT,
-                                 net_parser->nfq_queue_num);
-        }
-    }
-    else
-    {
-        if (drop) mgr->set_dpi_state(net_parser, FSM_DPI_DROP);
-        if (pass) mgr->set_dpi_state(net_parser, FSM_DPI_PASSTHRU);
-    }
-
-    if (drop) acc->dpi_done = FSM_DPI_DROP;
-    if (pass) acc->dpi_done = FSM_DPI_PASSTHRU;
+    if (drop) fsm_dpi_set_flow_done(session, net_parser, FSM_DPI_DROP);
+    else if (pass) fsm_dpi_set_flow_done(session, net_parser, FSM_DPI_PASSTHRU);
 }
 
 /**
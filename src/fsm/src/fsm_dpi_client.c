@@ -24,11 +24,111 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <inttypes.h>
+
 #include "fsm.h"
 #include "fsm_internal.h"
 #include "policy_tags.h"
 #include "memutil.h"
 
+/**
+ * @brief interned flow attribute name
+ */
+struct fsm_dpi_attr
+{
+    char *name;
+    int id;
+    ds_tree_node_t node;
+};
+
+static ds_tree_t fsm_dpi_attrs = DS_TREE_INIT((ds_key_cmp_t *)strcmp,
+                                              struct fsm_dpi_attr, node);
+
+/* Attribute names indexed by id. Id 0 is reserved */
+static struct fsm_dpi_attr **fsm_dpi_attrs_by_id;
+static int fsm_dpi_attrs_count;
+
+/**
+ * @brief returns the interned id of a flow attribute
+ *
+ * Ids are small positive integers, allocated on first use and stable
+ * for the process lifetime.
+ * @param attr the flow attribute
+ * @return the attribute id, 0 if attr is NULL
+ */
+int
+fsm_dpi_attr_id(char *attr)
+{
+    struct fsm_dpi_attr *entry;
+    size_t size;
+
+    if (attr == NULL) return 0;
+
+    entry = ds_tree_find(&fsm_dpi_attrs, attr);
+    if (entry != NULL) return entry->id;
+
+    entry = CALLOC(1, sizeof(*entry));
+    entry->name = STRDUP(attr);
+    entry->id = ++fsm_dpi_attrs_count;
+    ds_tree_insert(&fsm_dpi_attrs, entry, entry->name);
+
+    size = (fsm_dpi_attrs_count + 1) * sizeof(*fsm_dpi_attrs_by_id);
+    fsm_dpi_attrs_by_id = REALLOC(fsm_dpi_attrs_by_id, size);
+    fsm_dpi_attrs_by_id[0] = NULL;
+    fsm_dpi_attrs_by_id[entry->id] = entry;
+
+    LOGD("%s(): attribute %s interned as %d", __func__, attr, entry->id);
+
+    return entry->id;
+}
+
+/**
+ * @brief returns the name of an interned flow attribute
+ *
+ * @param attr_id the attribute id
+ * @return the attribute name, NULL if the id is unknown
+ */
+char *
+fsm_dpi_attr_name(int attr_id)
+{
+    if (attr_id <= 0 || attr_id > fsm_dpi_attrs_count) return NULL;
+
+    return fsm_dpi_attrs_by_id[attr_id]->name;
+}
+
+/**
+ * @brief sets the dispatch table entry of an attribute
+ *
+ * @param dpi_plugin the dpi plugin context
+ * @param attr_id the attribute id
+ * @param client the client to dispatch to, NULL to clear the entry
+ */
+static void
+fsm_dpi_set_client_by_id(struct fsm_dpi_plugin *dpi_plugin, int attr_id,
+                         struct dpi_client *client)
+{
+    size_t size;
+    int n;
+
+    if (attr_id <= 0) return;
+
+    if (attr_id >= dpi_plugin->nclients_by_id)
+    {
+        if (client == NULL) return;
+
+        /* Size the table to the interned attributes count */
+        n = fsm_dpi_attrs_count + 1;
+        size = n * sizeof(*dpi_plugin->clients_by_id);
+        dpi_plugin->clients_by_id = REALLOC(dpi_plugin->clients_by_id, size);
+        memset(&dpi_plugin->clients_by_id[dpi_plugin->nclients_by_id], 0,
+               (n - dpi_plugin->nclients_by_id) *
+               sizeof(*dpi_plugin->clients_by_id));
+        dpi_plugin->nclients_by_id = n;
+    }
+
+    dpi_plugin->clients_by_id[attr_id] = client;
+}
+
 /**
  * @brief check if a fsm session is a dpi client session
  *
@@ -337,7 +437,9 @@ fsm_dpi_register_client(struct fsm_session *dpi_plugin_session,
     if (to_add->attr == NULL) goto err_free_attr_node;
 
     to_add->session = dpi_client_session;
+    to_add->attr_id = fsm_dpi_attr_id(to_add->attr);
     ds_tree_insert(tree, to_add, to_add->attr);
+    fsm_dpi_set_client_by_id(dpi_plugin, to_add->attr_id, to_add);
 
     dpi_plugin_ops->register_client(dpi_plugin_session, dpi_client_session,
                                     to_add->attr);
@@ -394,6 +496,7 @@ fsm_dpi_unregister_client(struct fsm_session *dpi_plugin_session,
 
     /* unregister the client for the given attribute */
     ds_tree_remove(tree, client);
+    fsm_dpi_set_client_by_id(dpi_plugin, client->attr_id, NULL);
     dpi_plugin_ops->unregister_client(dpi_plugin_session, client->attr);
     fsm_free_dpi_client_node(client);
 }
@@ -481,6 +584,10 @@ fsm_dpi_unregister_clients(struct fsm_session *dpi_plugin_session)
         client = next;
     }
 
+    if (dpi_plugin->clients_by_id != NULL) FREE(dpi_plugin->clients_by_id);
+    dpi_plugin->clients_by_id = NULL;
+    dpi_plugin->nclients_by_id = 0;
+
     /* get the tag name associated with this session */
     mgr = fsm_get_mgr();
     dpi_tag = fsm_get_tag_by_name(mgr, dpi_plugin_session->name);
@@ -536,6 +643,61 @@ fsm_dpi_register_clients(struct fsm_session *dpi_plugin_session)
     }
 }
 
+/**
+ * @brief hand a flow attribute over to its registered client
+ *
+ * Calls the typed client callback when provided, falls back to the
+ * string callback otherwise.
+ * @param client the registered client
+ * @param value the typed value of the attribute
+ * @param acc the flow
+ */
+static int
+fsm_dpi_dispatch_client(struct dpi_client *client,
+                        struct fsm_dpi_attr_value *value,
+                        struct net_md_stats_accumulator *acc)
+{
+    struct fsm_dpi_plugin_client_ops *dpi_client_plugin_ops;
+    struct fsm_session *dpi_client_session;
+    char num[32];
+    char *str;
+
+    dpi_client_session = client->session;
+
+    /* Access the client call back */
+    dpi_client_plugin_ops = &dpi_client_session->p_ops->dpi_plugin_client_ops;
+    if (dpi_client_plugin_ops->process_attr_value != NULL)
+    {
+        return dpi_client_plugin_ops->process_attr_value(dpi_client_session,
+                                                         client->attr_id,
+                                                         client->attr,
+                                                         value, acc);
+    }
+
+    if (dpi_client_plugin_ops->process_attr == NULL) return FSM_DPI_IGNORED;
+
+    switch (value->type)
+    {
+        case FSM_DPI_ATTR_STRING:
+            str = value->str;
+            break;
+
+        case FSM_DPI_ATTR_UINT:
+            snprintf(num, sizeof(num), "%" PRIu64, value->uint);
+            str = num;
+            break;
+
+        default:
+            /* No string representation for the client */
+            LOGD("%s(): %s: no string callback for binary attribute %s",
+                 __func__, dpi_client_session->name, client->attr);
+            return FSM_DPI_IGNORED;
+    }
+
+    return dpi_client_plugin_ops->process_attr(dpi_client_session, client->attr,
+                                               str, acc);
+}
+
 /**
  * @brief call back registered client
  *
@@ -547,26 +709,51 @@ int
 fsm_dpi_call_client(struct fsm_session *dpi_plugin_session, char *attr, char *value,
                     struct net_md_stats_accumulator *acc)
 {
-    struct fsm_dpi_plugin_client_ops *dpi_client_plugin_ops;
-    struct fsm_session *dpi_client_session;
+    struct fsm_dpi_attr_value attr_value;
     struct dpi_client *client;
     ds_tree_t *attrs;
-    int rc;
 
     /* look up the client session */
     attrs = &dpi_plugin_session->dpi->plugin.dpi_clients;
     client = ds_tree_find(attrs, attr);
     if (client == NULL) return FSM_DPI_IGNORED;
 
-    dpi_client_session = client->session;
+    memset(&attr_value, 0, sizeof(attr_value));
+    attr_value.type = FSM_DPI_ATTR_STRING;
+    attr_value.str = value;
 
-    /* Access the client call back */
-    dpi_client_plugin_ops = &dpi_client_session->p_ops->dpi_plugin_client_ops;
-    if (dpi_client_plugin_ops->process_attr == NULL) return FSM_DPI_IGNORED;
+    return fsm_dpi_dispatch_client(client, &attr_value, acc);
+}
 
-    rc = dpi_client_plugin_ops->process_attr(dpi_client_session, attr, value, acc);
+/**
+ * @brief call back registered client using the interned attribute id
+ *
+ * @param dpi_plugin_session the dpi plugin session
+ * @param attr_id the interned attribute id, as returned by fsm_dpi_attr_id()
+ * @param value the typed value of the attribute
+ * @return the action to take
+ */
+int
+fsm_dpi_call_client_id(struct fsm_session *dpi_plugin_session, int attr_id,
+                       struct fsm_dpi_attr_value *value,
+                       struct net_md_stats_accumulator *acc)
+{
+    struct fsm_dpi_plugin *dpi_plugin;
+    struct dpi_client *client;
+
+    if (value == NULL) return FSM_DPI_IGNORED;
+
+    /* look up the client session */
+    dpi_plugin = &dpi_plugin_session->dpi->plugin;
+    if (attr_id <= 0 || attr_id >= dpi_plugin->nclients_by_id)
+    {
+        return FSM_DPI_IGNORED;
+    }
+
+    client = dpi_plugin->clients_by_id[attr_id];
+    if (client == NULL) return FSM_DPI_IGNORED;
 
-    return rc;
+    return fsm_dpi_dispatch_client(client, value, acc);
 }
 
 
@@ -162,6 +162,8 @@ fsm_nfq_net_header_parse(struct nfq_pkt_info *pkt_info, void *data)
         if (len == 0) return;
     }
 
+    /* Complete the packet descriptor shared with the plugins */
+    net_header_flow_hash(&net_parser);
 
     session = (struct fsm_session *)data;
     parser_ops = &session->p_ops->parser_ops;
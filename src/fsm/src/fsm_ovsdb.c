@@ -138,6 +138,7 @@ fsm_tag_update_cb(om_tag_t *tag,
                   struct ds_tree *added,
                   struct ds_tree *updated)
 {
+    fsm_policy_tag_update(tag, removed, added, updated);
     fsm_process_tag_update(tag, removed, added, updated);
     return true;
 }
@@ -760,10 +760,13 @@ test_init_plugin_fail(struct fsm_session *session)
 }
 
 
+static int g_set_dpi_state_calls;
+
 static int
 test_set_dpi_state(struct net_header_parser *net_hdr,
                    enum fsm_dpi_state state)
 {
+    g_set_dpi_state_calls++;
     return 1;
 }
 
@@ -2152,6 +2155,8 @@ void
 test_1_dpi_plugin_and_client_plugin(void)
 {
     struct schema_Flow_Service_Manager_Config *conf;
+    struct fsm_dpi_plugin_ops *dpi_plugin_ops;
+    struct fsm_dpi_attr_value value;
     union fsm_dpi_context *dispatcher_dpi_context;
     union fsm_dpi_context *plugin_dpi_context;
     struct fsm_session *dpi_plugin_client;
@@ -2166,6 +2171,8 @@ test_1_dpi_plugin_and_client_plugin(void)
     ds_tree_t *sessions;
     ds_tree_t *attrs;
     om_tag_t *tag;
+    int attr_id;
+    int rc;
 
     sessions = fsm_get_sessions();
 
@@ -2225,9 +2232,43 @@ test_1_dpi_plugin_and_client_plugin(void)
                                                         NULL, NULL);
     }
 
+    /* Validate the id based dispatch */
+    dpi_plugin_ops = &dpi_plugin->p_ops->dpi_plugin_ops;
+    TEST_ASSERT_NOT_NULL(dpi_plugin_ops->get_attr_id);
+    TEST_ASSERT_NOT_NULL(dpi_plugin_ops->notify_client_id);
+
+    memset(&value, 0, sizeof(value));
+    value.type = FSM_DPI_ATTR_UINT;
+    value.uint = 443;
+    ds_tree_foreach(tag_values, tag_item)
+    {
+        client = ds_tree_find(attrs, tag_item->value);
+        TEST_ASSERT_NOT_NULL(client);
+
+        attr_id = dpi_plugin_ops->get_attr_id(tag_item->value);
+        TEST_ASSERT_EQUAL_INT(client->attr_id, attr_id);
+        TEST_ASSERT_EQUAL_STRING(tag_item->value, fsm_dpi_attr_name(attr_id));
+
+        rc = dpi_plugin_ops->notify_client_id(dpi_plugin, attr_id, &value, NULL);
+        TEST_ASSERT_EQUAL_INT(0, rc);
+    }
+
+    /* Unknown attributes are ignored */
+    attr_id = dpi_plugin_ops->get_attr_id("ut.unregistered_attribute");
+    rc = dpi_plugin_ops->notify_client_id(dpi_plugin, attr_id, &value, NULL);
+    TEST_ASSERT_EQUAL_INT(FSM_DPI_IGNORED, rc);
+
     /* Remove the dpi client session */
     conf = &g_confs[14];
     fsm_delete_session(conf);
+
+    /* The dispatch table no longer references the client */
+    ds_tree_foreach(tag_values, tag_item)
+    {
+        attr_id = dpi_plugin_ops->get_attr_id(tag_item->value);
+        rc = dpi_plugin_ops->notify_client_id(dpi_plugin, attr_id, &value, NULL);
+        TEST_ASSERT_EQUAL_INT(FSM_DPI_IGNORED, rc);
+    }
 }
 
 void
@@ -3589,6 +3630,91 @@ test_13_dpi_dispatcher_icmpv6_req_reply(void)
 }
 
 
+/**
+ * @brief validate the propagation of a flow's dpi verdict
+ *
+ * Once the dpi plugin is done with a flow, the flow's conntrack mark is set
+ * once. Further packets of the flow, in either direction, are neither
+ * dispatched nor trigger conntrack updates.
+ */
+void
+test_14_dpi_dispatcher_flow_done(void)
+{
+    struct schema_Flow_Service_Manager_Config *conf;
+    union fsm_dpi_context *dispatcher_dpi_context;
+    struct fsm_dpi_dispatcher *dpi_dispatcher;
+    struct net_header_parser *net_parser;
+    struct fsm_parser_ops *dispatch_ops;
+    struct fsm_dpi_flow_info *info;
+    struct fsm_session *dispatcher;
+    struct fsm_session *plugin;
+    ds_tree_t *sessions;
+    size_t len;
+
+    /* Add a dpi plugin session */
+    conf = &g_confs[11];
+    fsm_add_session(conf);
+    sessions = fsm_get_sessions();
+    plugin = ds_tree_find(sessions, conf->handler);
+    TEST_ASSERT_NOT_NULL(plugin);
+
+    /* Add a dpi dispatcher session */
+    conf = &g_confs[10];
+    fsm_add_session(conf);
+    dispatcher = ds_tree_find(sessions, conf->handler);
+    TEST_ASSERT_NOT_NULL(dispatcher);
+
+    dispatcher_dpi_context = dispatcher->dpi;
+    TEST_ASSERT_NOT_NULL(dispatcher_dpi_context);
+    dpi_dispatcher = &dispatcher_dpi_context->dispatch;
+    net_parser = &dpi_dispatcher->net_parser;
+    dispatch_ops = &dispatcher->p_ops->parser_ops;
+    TEST_ASSERT_NOT_NULL(dispatch_ops->handler);
+
+    /* TCP SYN Packet */
+    g_set_dpi_state_calls = 0;
+    PREPARE_UT(pkt858, net_parser);
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    dispatch_ops->handler(dispatcher, net_parser);
+    TEST_ASSERT_NOT_NULL(net_parser->acc);
+
+    /* The plugin is done with the flow */
+    info = ds_tree_find(net_parser->acc->dpi_plugins, plugin);
+    TEST_ASSERT_NOT_NULL(info);
+    info->decision = FSM_DPI_PASSTHRU;
+
+    /* The flow verdict is set at the latest by the next packet */
+    PREPARE_UT(pkt858, net_parser);
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    dispatch_ops->handler(dispatcher, net_parser);
+    TEST_ASSERT_EQUAL_INT(FSM_DPI_PASSTHRU, net_parser->acc->dpi_done);
+    TEST_ASSERT_TRUE(net_parser->acc->dpi_marked);
+    TEST_ASSERT_EQUAL_INT(1, g_set_dpi_state_calls);
+
+    /* Packets in flight do not trigger another conntrack update */
+    PREPARE_UT(pkt858, net_parser);
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    dispatch_ops->handler(dispatcher, net_parser);
+    TEST_ASSERT_EQUAL_INT(1, g_set_dpi_state_calls);
+
+    /* The reverse direction of the connection is done as well */
+    PREPARE_UT(pkt862, net_parser);
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    dispatch_ops->handler(dispatcher, net_parser);
+    TEST_ASSERT_NOT_NULL(net_parser->acc);
+    TEST_ASSERT_EQUAL_INT(FSM_DPI_PASSTHRU, net_parser->acc->dpi_done);
+    TEST_ASSERT_EQUAL_INT(1, g_set_dpi_state_calls);
+
+    /* Remove the dpi plugin session */
+    conf = &g_confs[11];
+    fsm_delete_session(conf);
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -3632,6 +3758,7 @@ main(int argc, char *argv[])
     RUN_TEST(test_11_dpi_dispatcher_reserved_port_originator);
     RUN_TEST(test_12_dpi_dispatcher_icmp_req_reply);
     RUN_TEST(test_13_dpi_dispatcher_icmpv6_req_reply);
+    RUN_TEST(test_14_dpi_dispatcher_flow_done);
 
     return UNITY_END();
 }
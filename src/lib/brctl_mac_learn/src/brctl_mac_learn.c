@@ -26,16 +26,27 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /**
  * MAC learning of wired clients on the native linux bridge
+ *
+ * The bridge forwarding database is tracked using rtnetlink: the full table
+ * is dumped once at startup (and after the netlink socket overruns), then
+ * only the RTM_NEWNEIGH/RTM_DELNEIGH (AF_BRIDGE) notifications are
+ * processed and reported to NM as deltas.
  */
 
+#include <errno.h>
 #include <ev.h>
 #include <net/if.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libmnl/libmnl.h>
+#include <linux/neighbour.h>
+#include <linux/rtnetlink.h>
 
 #include "ds.h"
-#include "ds_list.h"
 #include "ds_tree.h"
 #include "log.h"
+#include "os_types.h"
 #include "schema.h"
 #include "schema_consts.h"
 #include "memutil.h"
@@ -44,8 +55,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /*****************************************************************************/
 
-#define MAC_LEARNING_INTERVAL   10.0
-
 #define MODULE_ID               LOG_MODULE_ID_TARGET
 
 #if defined(CONFIG_TARGET_LAN_BRIDGE_NAME)
@@ -58,13 +67,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 static int mac_learning_cmp(void *_a, void *_b);
 
-struct mac_learning_flt_t {
-    char                    brname[IFNAMSIZ];
-    char                    ifname[IFNAMSIZ];
-    int                     ifnum;
-    struct ds_dlist_node    list;
-};
-
 struct mac_learning_t {
     struct schema_OVS_MAC_Learning  oml;
     bool                            valid;
@@ -75,193 +77,176 @@ struct mac_learning_t {
  *  Global definitions
  *****************************************************************************/
 
-static struct ev_timer             g_mac_learning_timer;
+static struct mnl_socket          *g_mac_learning_nl = NULL;
+static struct ev_io                g_mac_learning_io;
 static target_mac_learning_cb_t   *g_mac_learning_cb = NULL;
 
 static ds_tree_t    g_mac_learning = DS_TREE_INIT(mac_learning_cmp,
                                                   struct mac_learning_t,
                                                   list);
-static ds_dlist_t   g_mac_learning_flt = DS_DLIST_INIT(struct mac_learning_flt_t,
-                                                       list);
 
 /******************************************************************************
  *  PROTECTED definitions
  *****************************************************************************/
 
-static struct mac_learning_flt_t *mac_learning_flt_find(int ifnum)
+/*
+ * Check if the port is an ethernet client port
+ */
+static bool mac_learning_iface_check(const char *ifname)
 {
-    struct mac_learning_flt_t *flt;
+    const char  **iflist;
+    int           ifidx;
 
-    ds_dlist_foreach(&g_mac_learning_flt, flt) {
-        if (flt->ifnum == ifnum) {
-            return flt;
+    iflist = target_ethclient_iflist_get();
+    for (ifidx=0; iflist[ifidx]; ifidx++)
+    {
+        if (!strcmp(ifname, iflist[ifidx]))
+        {
+            return true;
         }
     }
 
-    return NULL;
+    return false;
 }
 
-static bool mac_learning_flt_get(const char *brname)
+static void mac_learning_remove(struct mac_learning_t *ml)
 {
-    FILE         *fp;
-    char          cmd[512];
-    char          buf[512];
-    const char  **iflist;
-    int           ifidx;
-    char          ifname[IFNAMSIZ];
-
-    /* Find port numbers for eth interfaces. Expected output:
-     *
-     * eth1 (2)
-     * eth2 (3)
-     * eth3 (4)
-     * ...
-     */
-    snprintf(cmd, sizeof(cmd), "brctl showstp %s | grep eth", brname);
+    // Indicate deleted entry to NM
+    g_mac_learning_cb(&ml->oml, false);
 
-    fp = popen(cmd, "r");
-    if (!fp)
-    {
-        LOGE("BRCTLMAC: Unable to read bridge stp table! :: brname=%s", brname);
-        return false;
-    }
+    // Remove our entry
+    ds_tree_remove(&g_mac_learning, ml);
+    memset(ml, 0, sizeof(*ml));
+    FREE(ml);
+}
 
-    while (fgets(buf, sizeof(buf), fp))
-    {
-        int                         eth;
-        int                         ifnum;
-        struct mac_learning_flt_t  *flt;
+static int mac_learning_attr_cb(const struct nlattr *attr, void *data)
+{
+    const struct nlattr **tb = data;
 
-        if (2 != sscanf(buf, "eth%d (%d)", &eth, &ifnum))
-        {
-            continue;
-        }
+    if (mnl_attr_type_valid(attr, NDA_MAX) < 0)
+    {
+        return MNL_CB_OK;
+    }
 
-        // Skip non ethernet clients ports
-        snprintf(ifname, sizeof(ifname), "eth%d", eth);
-        iflist = target_ethclient_iflist_get();
-        for (ifidx=0; iflist[ifidx]; ifidx++)
-        {
-            if (!strcmp(ifname, iflist[ifidx]))
-            {
-                break;
-            }
-        }
-        if (iflist[ifidx] == NULL)
-        {
-            LOGT("BRCTLMAC: Skip %s", ifname);
-            continue;
-        }
+    tb[mnl_attr_get_type(attr)] = attr;
 
-        flt = mac_learning_flt_find(ifnum);
-        if (flt != NULL) {
-            LOGT("BRCTLMAC: Already exists %s @ %s :: ifnum=%d", flt->ifname, brname, flt->ifnum);
-            continue;
-        }
-        else
-        {
-            flt = CALLOC(1, sizeof(*flt));
-        }
+    return MNL_CB_OK;
+}
 
-        snprintf(flt->ifname, sizeof(flt->ifname), "eth%d", eth);
-        snprintf(flt->brname, sizeof(flt->brname), "%s", brname);
-        flt->ifnum = ifnum;
+/*
+ * Process a single bridge forwarding database entry, either from a dump or
+ * from a notification
+ */
+static int mac_learning_nl_cb(const struct nlmsghdr *nlh, void *data)
+{
+    const struct nlattr *tb[NDA_MAX + 1] = { NULL };
+    struct schema_OVS_MAC_Learning oml;
+    struct mac_learning_t *ml;
+    char ifname[IF_NAMESIZE];
+    struct ndmsg *ndm;
+    os_macaddr_t mac;
+    bool remove;
+    int brindex;
 
-        ds_dlist_insert_tail(&g_mac_learning_flt, flt);
+    (void)data;
 
-        LOGI("BRCTLMAC: Using %s @ %s :: ifnum=%d", flt->ifname, brname, flt->ifnum);
+    if (nlh->nlmsg_type != RTM_NEWNEIGH && nlh->nlmsg_type != RTM_DELNEIGH)
+    {
+        return MNL_CB_OK;
     }
 
-    if (fp)
-        pclose(fp);
-
-    return true;
-}
+    ndm = mnl_nlmsg_get_payload(nlh);
+    if (ndm->ndm_family != AF_BRIDGE)
+    {
+        return MNL_CB_OK;
+    }
 
-static bool mac_learning_parse(const char *brname)
-{
-    FILE *fp;
-    char cmd[512];
-    char buf[512];
-
-    /* Find bridge port numbers and mac addresses. Expected output:
-     *
-     * 6 00:c0:02:12:35:8a yes 0.00
-     * 1 40:b9:3c:1d:d9:09 no 1.80
-     * 1 68:05:ca:28:c1:45 no 5.40
-     * ...
+    /*
+     * Skip local (permanent) entries, the equivalent of "is local?: yes" in
+     * brctl showmacs, and entries that come from the port device itself
      */
-    snprintf(cmd,
-             sizeof(cmd),
-             "brctl showmacs %s | awk '{ print $1\" \"$2\" \"$3\" \"$4 }'",
-             brname);
+    if ((ndm->ndm_state & NUD_PERMANENT) || (ndm->ndm_flags & NTF_SELF))
+    {
+        return MNL_CB_OK;
+    }
 
-    fp = popen(cmd, "r");
-    if (!fp)
+    mnl_attr_parse(nlh, sizeof(*ndm), mac_learning_attr_cb, tb);
+    if (tb[NDA_LLADDR] == NULL || tb[NDA_MASTER] == NULL ||
+        mnl_attr_get_payload_len(tb[NDA_LLADDR]) != sizeof(mac.addr))
     {
-        LOGE("BRCTLMAC: Unable to read bridge mac table! :: brname=%s", brname);
-        return false;
+        return MNL_CB_OK;
     }
 
-    while (fgets(buf, sizeof(buf), fp))
+    brindex = if_nametoindex(BRCTL_LAN_BRIDGE);
+    if (brindex == 0 || (int)mnl_attr_get_u32(tb[NDA_MASTER]) != brindex)
     {
-        int   ifnum;
-        float age;
-        char  mac[64];
-        char  local[64];
+        return MNL_CB_OK;
+    }
 
-        if ((4 != sscanf(buf, "%d %64s %64s %f", &ifnum, mac, local, &age)) ||
-            (0 == strcmp(local, "yes")))
-        {
-            continue;
-        }
+    memcpy(mac.addr, mnl_attr_get_payload(tb[NDA_LLADDR]), sizeof(mac.addr));
 
-        // Look only at eth interfaces
-        struct mac_learning_flt_t *flt = mac_learning_flt_find(ifnum);
-        if (flt == NULL)
+    memset(&oml, 0, sizeof(oml));
+    snprintf(oml.hwaddr, sizeof(oml.hwaddr), PRI_os_macaddr_lower_t, FMT_os_macaddr_t(mac));
+
+    if (if_indextoname(ndm->ndm_ifindex, ifname) == NULL)
+    {
+        // The port was removed from the system, its entries are being flushed
+        ml = ds_tree_find(&g_mac_learning, &oml);
+        if (ml != NULL && nlh->nlmsg_type == RTM_DELNEIGH)
         {
-            continue;
+            mac_learning_remove(ml);
         }
+        return MNL_CB_OK;
+    }
 
-        struct schema_OVS_MAC_Learning oml;
-        memset(&oml, 0, sizeof(oml));
-        strscpy(oml.hwaddr, mac, sizeof(oml.hwaddr));
-        strscpy(oml.brname, BRCTL_LAN_BRIDGE, sizeof(oml.brname));
-        strscpy(oml.ifname, flt->ifname, sizeof(oml.ifname));
+    strscpy(oml.brname, BRCTL_LAN_BRIDGE, sizeof(oml.brname));
+    strscpy(oml.ifname, ifname, sizeof(oml.ifname));
 
-        // New entry
-        bool update = false;
-        struct mac_learning_t *ml;
-        ml = ds_tree_find(&g_mac_learning, &oml);
-        if (ml == NULL)
-        {
-            ml = CALLOC(1, sizeof(*ml));
+    // Look only at ethernet client interfaces
+    remove = (nlh->nlmsg_type == RTM_DELNEIGH) || !mac_learning_iface_check(ifname);
 
-            memcpy(&ml->oml, &oml, sizeof(ml->oml));
-            ds_tree_insert(&g_mac_learning, ml, &ml->oml);
+    LOGT("BRCTLMAC: mac table %s :: brname=%s ifname=%s mac=%s",
+         remove ? "delete" : "update",
+         oml.brname,
+         oml.ifname,
+         oml.hwaddr);
 
-            update = true;
+    ml = ds_tree_find(&g_mac_learning, &oml);
+    if (ml != NULL && strcmp(ml->oml.ifname, oml.ifname) != 0)
+    {
+        if (nlh->nlmsg_type == RTM_DELNEIGH)
+        {
+            // Stale delete, the client has already moved to another port
+            return MNL_CB_OK;
         }
 
-        ml->valid = true;
+        // The client moved to a different port
+        mac_learning_remove(ml);
+        ml = NULL;
+    }
+
+    if (remove)
+    {
+        if (ml != NULL) mac_learning_remove(ml);
+        return MNL_CB_OK;
+    }
+
+    // New entry
+    if (ml == NULL)
+    {
+        ml = CALLOC(1, sizeof(*ml));
 
-        LOGT("BRCTLMAC: parsed mac table entry :: brname=%s ifname=%s mac=%s update=%s",
-             oml.brname,
-             oml.ifname,
-             oml.hwaddr,
-             update ? "true" : "false");
+        memcpy(&ml->oml, &oml, sizeof(ml->oml));
+        ds_tree_insert(&g_mac_learning, ml, &ml->oml);
 
         // Pass new entry to NM
-        if (update)
-        {
-            g_mac_learning_cb(&ml->oml, true);
-        }
+        g_mac_learning_cb(&ml->oml, true);
     }
 
-    if (fp)
-        pclose(fp);
+    ml->valid = true;
 
-    return true;
+    return MNL_CB_OK;
 }
 
 static void mac_learning_invalidate(void)
@@ -298,6 +283,80 @@ static void mac_learning_flush(void)
     }
 }
 
+/*
+ * Dump the bridge forwarding database; entries that are no longer present
+ * are flushed
+ */
+static bool mac_learning_dump(void)
+{
+    char                buf[MNL_SOCKET_BUFFER_SIZE];
+    struct mnl_socket  *nl;
+    struct nlmsghdr    *nlh;
+    struct ndmsg       *ndm;
+    unsigned int        portid;
+    unsigned int        seq;
+    bool                rc;
+    int                 ret;
+
+    nlh = mnl_nlmsg_put_header(buf);
+    nlh->nlmsg_type = RTM_GETNEIGH;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    nlh->nlmsg_seq = seq = time(NULL);
+
+    ndm = mnl_nlmsg_put_extra_header(nlh, sizeof(*ndm));
+    ndm->ndm_family = AF_BRIDGE;
+
+    rc = false;
+
+    nl = mnl_socket_open(NETLINK_ROUTE);
+    if (nl == NULL)
+    {
+        LOGE("BRCTLMAC: Unable to open netlink socket: %s", strerror(errno));
+        return false;
+    }
+
+    if (mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID) < 0)
+    {
+        LOGE("BRCTLMAC: Unable to bind netlink socket: %s", strerror(errno));
+        goto exit;
+    }
+
+    portid = mnl_socket_get_portid(nl);
+
+    if (mnl_socket_sendto(nl, nlh, nlh->nlmsg_len) < 0)
+    {
+        LOGE("BRCTLMAC: Unable to read bridge mac table! :: brname=%s error=%s",
+             BRCTL_LAN_BRIDGE, strerror(errno));
+        goto exit;
+    }
+
+    mac_learning_invalidate();
+
+    while ((ret = mnl_socket_recvfrom(nl, buf, sizeof(buf))) > 0)
+    {
+        ret = mnl_cb_run(buf, ret, seq, portid, mac_learning_nl_cb, NULL);
+        if (ret <= MNL_CB_STOP)
+        {
+            break;
+        }
+    }
+
+    if (ret < 0)
+    {
+        // Keep the current entries, a partial dump is not reliable
+        LOGE("BRCTLMAC: Error dumping bridge mac table :: brname=%s error=%s",
+             BRCTL_LAN_BRIDGE, strerror(errno));
+        goto exit;
+    }
+
+    mac_learning_flush();
+    rc = true;
+
+exit:
+    mnl_socket_close(nl);
+    return rc;
+}
+
 static int mac_learning_cmp(void *_a, void *_b)
 {
     struct schema_OVS_MAC_Learning *a = _a;
@@ -305,19 +364,78 @@ static int mac_learning_cmp(void *_a, void *_b)
     return strcmp(a->hwaddr, b->hwaddr);
 }
 
-static void mac_learing_timer_cb(struct ev_loop *loop, ev_timer *watcher, int revents)
+static void mac_learning_io_cb(struct ev_loop *loop, ev_io *watcher, int revents)
 {
-    // Some vendors add/remove ethernet interface in runtime
-    if (!mac_learning_flt_get(BRCTL_LAN_BRIDGE))
+    char    buf[MNL_SOCKET_BUFFER_SIZE];
+    int     ret;
+
+    (void)loop;
+    (void)watcher;
+
+    if (EV_ERROR & revents)
     {
-        LOGE("BRCTLMAC: Unable to create MAC learning filter!");
+        LOGE("BRCTLMAC: Invalid netlink socket event");
         return;
     }
 
-    LOGD("BRCTLMAC: refreshing mac learning table");
-    mac_learning_invalidate();
-    mac_learning_parse(BRCTL_LAN_BRIDGE);
-    mac_learning_flush();
+    ret = mnl_socket_recvfrom(g_mac_learning_nl, buf, sizeof(buf));
+    if (ret < 0)
+    {
+        if (errno == ENOBUFS)
+        {
+            // Notifications were lost, resynchronize the whole table
+            LOGW("BRCTLMAC: Netlink socket overrun, refreshing mac learning table");
+            mac_learning_dump();
+            return;
+        }
+
+        LOGE("BRCTLMAC: Error receiving netlink notification: %s", strerror(errno));
+        return;
+    }
+
+    ret = mnl_cb_run(buf, ret, 0, 0, mac_learning_nl_cb, NULL);
+    if (ret < 0)
+    {
+        LOGE("BRCTLMAC: Error processing netlink notification");
+    }
+}
+
+static bool mac_learning_nl_init(void)
+{
+    int group;
+
+    g_mac_learning_nl = mnl_socket_open(NETLINK_ROUTE);
+    if (g_mac_learning_nl == NULL)
+    {
+        LOGE("BRCTLMAC: Unable to open netlink socket: %s", strerror(errno));
+        return false;
+    }
+
+    if (mnl_socket_bind(g_mac_learning_nl, 0, MNL_SOCKET_AUTOPID) < 0)
+    {
+        LOGE("BRCTLMAC: Unable to bind netlink socket: %s", strerror(errno));
+        goto error;
+    }
+
+    group = RTNLGRP_NEIGH;
+    if (mnl_socket_setsockopt(g_mac_learning_nl, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0)
+    {
+        LOGE("BRCTLMAC: Unable to subscribe to neighbor events: %s", strerror(errno));
+        goto error;
+    }
+
+    ev_io_init(&g_mac_learning_io,
+               mac_learning_io_cb,
+               mnl_socket_get_fd(g_mac_learning_nl),
+               EV_READ);
+    ev_io_start(EV_DEFAULT, &g_mac_learning_io);
+
+    return true;
+
+error:
+    mnl_socket_close(g_mac_learning_nl);
+    g_mac_learning_nl = NULL;
+    return false;
 }
 
 /******************************************************************************
@@ -332,12 +450,18 @@ bool brctl_mac_learning_register(target_mac_learning_cb_t *omac_cb)
     // Init NM callback
     g_mac_learning_cb = omac_cb;
 
-    // Init timer
-    ev_timer_init(&g_mac_learning_timer,
-                  mac_learing_timer_cb,
-                  MAC_LEARNING_INTERVAL,
-                  MAC_LEARNING_INTERVAL);
-    ev_timer_start(EV_DEFAULT, &g_mac_learning_timer);
+    // Subscribe to notifications first so no change is lost during the dump
+    if (!mac_learning_nl_init())
+    {
+        g_mac_learning_cb = NULL;
+        return false;
+    }
+
+    if (!mac_learning_dump())
+    {
+        LOGW("BRCTLMAC: Initial mac learning table dump failed :: brname=%s",
+             BRCTL_LAN_BRIDGE);
+    }
 
     LOGN("BRCTLMAC: Successfully registered MAC learning. :: brname=%s",
             BRCTL_LAN_BRIDGE);
@@ -37,7 +37,7 @@ UNIT_SRC := src/brctl_mac_learn.c
 UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 UNIT_CFLAGS += -I$(UNIT_BUILD)
 
-UNIT_LDFLAGS := -ldl -lpthread
+UNIT_LDFLAGS := -ldl -lpthread -lmnl
 
 UNIT_EXPORT_CFLAGS := -I$(UNIT_PATH)/inc
 UNIT_EXPORT_CFLAGS := $(UNIT_CFLAGS)
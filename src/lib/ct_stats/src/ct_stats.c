@@ -1322,54 +1322,59 @@ apply_filter(flow_stats_t *ct_stats, fcm_filter_l2_info_t *mac_filter,
              ct_flow_t *flow)
 {
     struct fcm_filter_client *client;
+    struct sockaddr_storage *ssrc;
+    struct sockaddr_storage *sdst;
     struct fcm_session *session;
     fcm_filter_l3_info_t filter;
-    struct fcm_filter_req *req;
+    struct fcm_filter_req req;
     fcm_filter_stats_t pkt;
-    bool action;
-    int rc;
 
     if (ct_stats == NULL) return true;
 
     session = ct_stats->session;
     if (session == NULL) return true;
 
-    rc = getnameinfo((struct sockaddr *)&flow->layer3_info.src_ip,
-                     sizeof(struct sockaddr_storage),
-                     filter.src_ip, sizeof(filter.src_ip),
-                     0, 0, NI_NUMERICHOST);
-    if (rc < 0) return false;
+    client = ct_stats->c_client;
+    if (client == NULL) return true;
 
-    rc = getnameinfo((struct sockaddr *)&flow->layer3_info.dst_ip,
-                     sizeof(struct sockaddr_storage),
-                     filter.dst_ip, sizeof(filter.dst_ip),
-                     0, 0, NI_NUMERICHOST);
-    if (rc < 0) return false;
+    /* Hand the binary addresses over, the filter compares them as is */
+    memset(&filter, 0, sizeof(filter));
+    ssrc = &flow->layer3_info.src_ip;
+    sdst = &flow->layer3_info.dst_ip;
+    if (ssrc->ss_family == AF_INET)
+    {
+        memcpy(filter.src_ip_bin, &((struct sockaddr_in *)ssrc)->sin_addr,
+               sizeof(struct in_addr));
+        memcpy(filter.dst_ip_bin, &((struct sockaddr_in *)sdst)->sin_addr,
+               sizeof(struct in_addr));
+    }
+    else if (ssrc->ss_family == AF_INET6)
+    {
+        memcpy(filter.src_ip_bin, &((struct sockaddr_in6 *)ssrc)->sin6_addr,
+               sizeof(struct in6_addr));
+        memcpy(filter.dst_ip_bin, &((struct sockaddr_in6 *)sdst)->sin6_addr,
+               sizeof(struct in6_addr));
+    }
+    else return false;
 
+    filter.ip_bin_set = true;
+    filter.ip_type = ssrc->ss_family;
     filter.sport = ntohs(flow->layer3_info.src_port);
     filter.dport = ntohs(flow->layer3_info.dst_port);
     filter.l4_proto = flow->layer3_info.proto_type;
-    filter.ip_type = flow->layer3_info.family_type;
 
     pkt.pkt_cnt = flow->pkt_info.pkt_cnt;
     pkt.bytes = flow->pkt_info.bytes;
 
-    client = ct_stats->c_client;
-    if (client == NULL) return true;
-
-    req = CALLOC(1, sizeof(struct fcm_filter));
-    if (req == NULL) return true;
-
-    req->pkts = &pkt;
-    req->l3_info = &filter;
-    req->l2_info = mac_filter;
-    req->table = client->table;
+    memset(&req, 0, sizeof(req));
+    req.pkts = &pkt;
+    req.l3_info = &filter;
+    req.l2_info = mac_filter;
+    req.table = client->table;
 
-    fcm_apply_filter(session, req);
-    action = req->action;
-    FREE(req);
+    fcm_apply_filter(session, &req);
 
-    return action;
+    return req.action;
 }
 
 /**
@@ -1426,16 +1431,10 @@ ct_flow_add_sample(flow_stats_t *ct_stats)
         }
 
 
-        snprintf(mac_filter.src_mac, sizeof(mac_filter.src_mac),
-                 "%02x:%02x:%02x:%02x:%02x:%02x",
-                 smac.addr[0], smac.addr[1],
-                 smac.addr[2], smac.addr[3],
-                 smac.addr[4], smac.addr[5]);
-        snprintf(mac_filter.dst_mac, sizeof(mac_filter.src_mac),
-                 "%02x:%02x:%02x:%02x:%02x:%02x",
-                 dmac.addr[0], dmac.addr[1],
-                 dmac.addr[2], dmac.addr[3],
-                 dmac.addr[4], dmac.addr[5]);
+        memset(&mac_filter, 0, sizeof(mac_filter));
+        mac_filter.smac_bin = smac;
+        mac_filter.dmac_bin = dmac;
+        mac_filter.mac_bin_set = true;
 
         if (apply_filter(ct_stats, &mac_filter, flow))
         {
@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/socket.h>
 
 #include "ds_tree.h"
+#include "ds_wheel.h"
 #include "os.h"
 #include "os_types.h"
 
@@ -43,12 +44,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define SERVICE_PROVIDER_MAX_ELEMS 3
 
+/* Initial number of ip2action hash buckets. Must be a power of 2 */
+#define DNS_CACHE_HASH_MIN_SIZE 256
+
+struct ip2action;
+
 struct dns_cache_mgr
 {
     bool        initialized;
     uint8_t     refcount;
     uint32_t    cache_hit_count[SERVICE_PROVIDER_MAX_ELEMS];
-    ds_tree_t   ip2a_tree;
+    struct ip2action **ip2a_buckets; /* ip2action entries by (mac, ip) */
+    size_t      ip2a_nbuckets;
+    uint32_t    generation;     /* entries of older generations are stale */
+    ds_wheel_t  ip2a_wheel;     /* ip2action entries by expiry time */
     int         entries;
 };
 
@@ -80,19 +89,21 @@ struct ip2action_gk_info
 
 struct ip2action
 {
-    os_macaddr_t                *device_mac;
-    struct sockaddr_storage     *ip_addr;
-    int                         action;
-    int                         cache_ttl;
-    time_t                      cache_ts;
-    int                         af_family;
-    uint8_t                     *ip_tbl;
+    struct ip2action            *ip2a_hnext;    /* hash bucket chain */
+    uint32_t                    hash;
+    uint32_t                    generation;
+    os_macaddr_t                device_mac;
+    uint8_t                     af_family;
+    uint8_t                     ip_tbl[16];
     uint8_t                     policy_idx;
-    int                         service_id;
     uint8_t                     nelems;
     bool                        redirect_flag;
-    uint8_t                     categories[URL_REPORT_MAX_ELEMS];
     bool                        cat_unknown_to_service;
+    int                         action;
+    int                         service_id;
+    int                         cache_ttl;
+    time_t                      cache_ts;
+    uint8_t                     categories[URL_REPORT_MAX_ELEMS];
     union
     {
         struct ip2action_bc_info bc_info;
@@ -102,7 +113,7 @@ struct ip2action
 #define cache_bc cache_info.bc_info
 #define cache_wb cache_info.wb_info
 #define cache_gk cache_info.gk_info
-    ds_tree_node_t              ip2a_tnode;
+    ds_wheel_node_t             ip2a_wnode;
 };
 
 struct ip2action_req
@@ -162,6 +173,18 @@ dns_cache_cleanup_mgr(void);
 void
 dns_cache_cleanup(void);
 
+/**
+ * @brief invalidate all the cached entries.
+ *
+ * Bumps the cache generation: entries added before the call are ignored
+ * by lookups and released lazily, so this is O(1) regardless of the
+ * cache size. Meant to be called on policy changes.
+ *
+ * @return void.
+ */
+void
+dns_cache_invalidate(void);
+
 /**
  * @brief Lookup cached action for given ip address and mac.
  *
@@ -51,65 +51,89 @@ dns_cache_get_mgr(void)
     return &mgr;
 }
 
-static int
-dns_cache_ip2action_cmp(void *_a, void *_b)
+static size_t
+dns_cache_ip_len(int af_family)
 {
-    struct ip2action *a = (struct ip2action *)_a;
-    struct ip2action *b = (struct ip2action *)_b;
+    return (af_family == AF_INET) ? 4 : 16;
+}
+
+/**
+ * @brief FNV-1a hash of the (mac, af, ip) key of an entry
+ */
+static uint32_t
+dns_cache_ip2action_hash(os_macaddr_t *mac, int af_family, uint8_t *ip)
+{
+    uint32_t hash = 2166136261u;
     size_t len;
-    uint8_t *i_a;
-    uint8_t *i_b;
-    int fdiff;
-    int idiff;
     size_t i;
-    int mac_cmp;
 
-    /* compare mac-address */
-    mac_cmp = memcmp(a->device_mac, b->device_mac, sizeof(os_macaddr_t));
-    if (mac_cmp != 0) return mac_cmp;
+    for (i = 0; i < sizeof(mac->addr); i++)
+    {
+        hash ^= mac->addr[i];
+        hash *= 16777619u;
+    }
 
-    /* Compare af families */
-    fdiff = (a->af_family - b->af_family);
-    if (fdiff != 0) return fdiff;
+    hash ^= (uint8_t)af_family;
+    hash *= 16777619u;
 
-    /* Compare ip address */
-    len = (a->af_family == AF_INET) ? 4 : 16;
-    i_a = a->ip_tbl;
-    i_b = b->ip_tbl;
+    len = dns_cache_ip_len(af_family);
+    for (i = 0; i < len; i++)
+    {
+        hash ^= ip[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
 
-    for (i = 0; i != len; i++)
+/**
+ * @brief extracts the address family and raw address of a request
+ *
+ * @return false if the address family is not supported
+ */
+static bool
+dns_cache_get_ip(struct sockaddr_storage *ipaddr, int *af_family, uint8_t **ip)
+{
+    if (ipaddr->ss_family == AF_INET)
+    {
+        struct sockaddr_in   *in4;
+        in4 = (struct sockaddr_in *)ipaddr;
+        *ip = (uint8_t *)(&in4->sin_addr.s_addr);
+    }
+    else if (ipaddr->ss_family == AF_INET6)
+    {
+        struct sockaddr_in6  *in6;
+        in6 = (struct sockaddr_in6 *)ipaddr;
+        *ip = (uint8_t *)(&in6->sin6_addr.s6_addr);
+    }
+    else
     {
-        idiff = (*i_a - *i_b);
-        if (idiff) return idiff;
-        i_a++;
-        i_b++;
+        return false;
     }
 
-    return 0;
+    *af_family = ipaddr->ss_family;
+    return true;
 }
 
 static void
 print_dns_cache_entry(struct ip2action *i2a)
 {
     char                   ipstr[INET6_ADDRSTRLEN] = { 0 };
-    os_macaddr_t           nullmac = {{ 0 }};
-    os_macaddr_t           *pmac;
     const char             *ip;
     size_t                 index;
 
     if (!i2a) return;
 
-    ip = inet_ntop(i2a->ip_addr->ss_family, i2a->ip_tbl, ipstr, sizeof(ipstr));
+    ip = inet_ntop(i2a->af_family, i2a->ip_tbl, ipstr, sizeof(ipstr));
     if (ip == NULL)
     {
         LOGD("%s: inet_ntop failed: %s", __func__, strerror(errno));
         return;
     }
 
-    pmac = (i2a->device_mac != NULL) ? i2a->device_mac : &nullmac;
     LOGD("ip %s, mac "PRI_os_macaddr_lower_t
          " action: %d ttl: %d policy_idx: %d service_id: %d redirect flag: %d"
-         " unknown_cat: %d", ipstr, FMT_os_macaddr_pt(pmac),
+         " unknown_cat: %d", ipstr, FMT_os_macaddr_t(i2a->device_mac),
          i2a->action, i2a->cache_ttl, i2a->policy_idx,
          i2a->service_id, i2a->redirect_flag, i2a->cat_unknown_to_service);
 
@@ -155,8 +179,10 @@ dns_cache_init_mgr(struct dns_cache_mgr *mgr)
         return;
     }
 
-    ds_tree_init(&mgr->ip2a_tree, dns_cache_ip2action_cmp,
-                 struct ip2action, ip2a_tnode);
+    mgr->ip2a_nbuckets = DNS_CACHE_HASH_MIN_SIZE;
+    mgr->ip2a_buckets = CALLOC(mgr->ip2a_nbuckets, sizeof(*mgr->ip2a_buckets));
+    mgr->generation = 0;
+    ds_wheel_init(&mgr->ip2a_wheel, struct ip2action, ip2a_wnode);
 
     mgr->initialized = true;
     mgr->refcount++;
@@ -204,35 +230,116 @@ dns_cache_free_ip2action(struct ip2action *i2a)
 {
    if (!i2a) return;
 
-   FREE(i2a->device_mac);
-   FREE(i2a->ip_addr);
    dns_cache_free_gk_cache_entry(i2a);
+   FREE(i2a);
    return;
 }
 
+/**
+ * @brief unlinks an entry from its hash bucket
+ */
+static void
+dns_cache_unhash_ip2action(struct dns_cache_mgr *mgr, struct ip2action *i2a)
+{
+    struct ip2action **pprev;
+
+    pprev = &mgr->ip2a_buckets[i2a->hash & (mgr->ip2a_nbuckets - 1)];
+    while (*pprev != NULL)
+    {
+        if (*pprev == i2a)
+        {
+            *pprev = i2a->ip2a_hnext;
+            break;
+        }
+        pprev = &(*pprev)->ip2a_hnext;
+    }
+    i2a->ip2a_hnext = NULL;
+}
+
+/**
+ * @brief removes an entry from the cache and releases it
+ */
+static void
+dns_cache_remove_ip2action(struct dns_cache_mgr *mgr, struct ip2action *i2a)
+{
+    dns_cache_unhash_ip2action(mgr, i2a);
+    ds_wheel_remove(&mgr->ip2a_wheel, i2a);
+    dns_cache_free_ip2action(i2a);
+    mgr->entries--;
+}
+
+/**
+ * @brief doubles the number of hash buckets once the chains grow long
+ */
+static void
+dns_cache_grow_hash(struct dns_cache_mgr *mgr)
+{
+    struct ip2action **buckets;
+    struct ip2action *i2a;
+    struct ip2action *next;
+    size_t nbuckets;
+    size_t idx;
+    size_t i;
+
+    if ((size_t)mgr->entries <= mgr->ip2a_nbuckets) return;
+
+    nbuckets = mgr->ip2a_nbuckets * 2;
+    buckets = CALLOC(nbuckets, sizeof(*buckets));
+
+    for (i = 0; i < mgr->ip2a_nbuckets; i++)
+    {
+        for (i2a = mgr->ip2a_buckets[i]; i2a != NULL; i2a = next)
+        {
+            next = i2a->ip2a_hnext;
+            idx = i2a->hash & (nbuckets - 1);
+            i2a->ip2a_hnext = buckets[idx];
+            buckets[idx] = i2a;
+        }
+    }
+
+    FREE(mgr->ip2a_buckets);
+    mgr->ip2a_buckets = buckets;
+    mgr->ip2a_nbuckets = nbuckets;
+}
+
 void
 dns_cache_cleanup(void)
 {
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
     struct ip2action *i2a_entry, *i2a_next;
-    ds_tree_t *tree;
+    size_t i;
 
     if (!mgr->initialized) return;
 
-    tree = &mgr->ip2a_tree;
-    i2a_entry = ds_tree_head(tree);
-    while (i2a_entry != NULL)
+    for (i = 0; i < mgr->ip2a_nbuckets; i++)
     {
-        i2a_next = ds_tree_next(tree, i2a_entry);
-        ds_tree_remove(tree, i2a_entry);
-        dns_cache_free_ip2action(i2a_entry);
-        FREE(i2a_entry);
-        mgr->entries--;
-        i2a_entry = i2a_next;
+        i2a_entry = mgr->ip2a_buckets[i];
+        while (i2a_entry != NULL)
+        {
+            i2a_next = i2a_entry->ip2a_hnext;
+            ds_wheel_remove(&mgr->ip2a_wheel, i2a_entry);
+            dns_cache_free_ip2action(i2a_entry);
+            mgr->entries--;
+            i2a_entry = i2a_next;
+        }
+        mgr->ip2a_buckets[i] = NULL;
     }
     return;
 }
 
+/**
+ * @brief invalidate all the cached entries.
+ */
+void
+dns_cache_invalidate(void)
+{
+    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
+
+    if (!mgr->initialized) return;
+
+    mgr->generation++;
+}
+
 /**
  * @brief cleanup allocated memory.
  *
@@ -252,6 +359,9 @@ dns_cache_cleanup_mgr(void)
     if (mgr->refcount == 0)
     {
         dns_cache_cleanup();
+        FREE(mgr->ip2a_buckets);
+        mgr->ip2a_buckets = NULL;
+        mgr->ip2a_nbuckets = 0;
         for (service_id = 0; service_id < SERVICE_PROVIDER_MAX_ELEMS; service_id++)
         {
             mgr->cache_hit_count[service_id] = 0;
@@ -261,32 +371,17 @@ dns_cache_cleanup_mgr(void)
 }
 
 
+/**
+ * @brief (re)arms the expiry of an entry after its ttl or timestamp changed
+ */
 static void
-dns_cache_set_ip(struct ip2action *i2a)
+dns_cache_arm_ip2action(struct ip2action *i2a)
 {
-    struct sockaddr_storage *ipaddr;
-
-    if (!i2a) return;
-
-    if (i2a->af_family == 0) i2a->af_family = i2a->ip_addr->ss_family;
+    struct dns_cache_mgr *mgr = dns_cache_get_mgr();
 
-    ipaddr = i2a->ip_addr;
-    if (i2a->af_family == AF_INET)
-    {
-        struct sockaddr_in   *in4;
-        in4 = (struct sockaddr_in *)ipaddr;
-        i2a->ip_tbl = (uint8_t *)(&in4->sin_addr.s_addr);
-    }
-    else if (i2a->af_family == AF_INET6)
-    {
-        struct sockaddr_in6  *in6;
-        in6 = (struct sockaddr_in6 *)ipaddr;
-        i2a->ip_tbl = (uint8_t *)(&in6->sin6_addr.s6_addr);
-    }
-    return;
+    ds_wheel_insert(&mgr->ip2a_wheel, i2a, i2a->cache_ts + i2a->cache_ttl);
 }
 
-
 static bool
 dns_cache_update_ip2action(struct ip2action *i2a, struct ip2action_req *to_upd)
 {
@@ -296,6 +391,7 @@ dns_cache_update_ip2action(struct ip2action *i2a, struct ip2action_req *to_upd)
     i2a->redirect_flag = to_upd->redirect_flag;
     i2a->cache_ttl = to_upd->cache_ttl;
     i2a->cache_ts  = time(NULL);
+    dns_cache_arm_ip2action(i2a);
     return true;
 }
 
@@ -303,23 +399,39 @@ static struct ip2action *
 dns_cache_lookup_ip2action(struct ip2action_req *req)
 {
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
-    struct ip2action     i2a_lkp;
     struct ip2action     *i2a;
+    uint32_t             hash;
+    int                  af_family;
+    uint8_t              *ip;
 
     if (!req) return NULL;
 
     if (!req->ip_addr || !req->device_mac) return NULL;
 
-    memset(&i2a_lkp, 0, sizeof(struct ip2action));
+    if (mgr->ip2a_buckets == NULL) return NULL;
+
+    if (!dns_cache_get_ip(req->ip_addr, &af_family, &ip)) return NULL;
 
-    i2a_lkp.ip_addr = req->ip_addr;
-    dns_cache_set_ip(&i2a_lkp);
-    i2a_lkp.device_mac = req->device_mac;
+    hash = dns_cache_ip2action_hash(req->device_mac, af_family, ip);
+    i2a = mgr->ip2a_buckets[hash & (mgr->ip2a_nbuckets - 1)];
+    for (; i2a != NULL; i2a = i2a->ip2a_hnext)
+    {
+        if (i2a->hash != hash) continue;
+        if (i2a->af_family != af_family) continue;
+        if (memcmp(&i2a->device_mac, req->device_mac, sizeof(os_macaddr_t))) continue;
+        if (memcmp(i2a->ip_tbl, ip, dns_cache_ip_len(af_family))) continue;
+        break;
+    }
+    if (i2a == NULL) return NULL;
 
-    i2a = ds_tree_find(&mgr->ip2a_tree, &i2a_lkp);
-    if (i2a != NULL) return i2a;
+    /* Entry cached before the last invalidation, release it now */
+    if (i2a->generation != mgr->generation)
+    {
+        dns_cache_remove_ip2action(mgr, i2a);
+        return NULL;
+    }
 
-    return NULL;
+    return i2a;
 }
 
 /**
@@ -491,20 +603,23 @@ static struct ip2action *
 dns_cache_alloc_ip2action(struct ip2action_req  *to_add)
 {
     struct ip2action *i2a;
+    int af_family;
     size_t index;
+    uint8_t *ip;
     bool rc;
 
+    if (!dns_cache_get_ip(to_add->ip_addr, &af_family, &ip)) return NULL;
+
     i2a = CALLOC(1, sizeof(struct ip2action));
     if (i2a == NULL)
     {
         LOGE("%s: Couldn't allocate memory for ip2action entry.",__func__);
         return NULL;
     }
-    i2a->device_mac = CALLOC(1, sizeof(os_macaddr_t));
-    memcpy(i2a->device_mac, to_add->device_mac, sizeof(os_macaddr_t));
-
-    i2a->ip_addr = CALLOC(1, sizeof(struct sockaddr_storage));
-    memcpy(i2a->ip_addr, to_add->ip_addr, sizeof(struct sockaddr_storage));
+    memcpy(&i2a->device_mac, to_add->device_mac, sizeof(os_macaddr_t));
+    i2a->af_family = af_family;
+    memcpy(i2a->ip_tbl, ip, dns_cache_ip_len(af_family));
+    i2a->hash = dns_cache_ip2action_hash(&i2a->device_mac, af_family, ip);
 
     i2a->action  = to_add->action;
     i2a->cache_ttl  = to_add->cache_ttl;
@@ -541,12 +656,9 @@ dns_cache_alloc_ip2action(struct ip2action_req  *to_add)
 
     if (!rc) goto err;
 
-    dns_cache_set_ip(i2a);
     return i2a;
 
 err:
-    FREE(i2a->ip_addr);
-    FREE(i2a->device_mac);
     FREE(i2a);
 
     return NULL;
@@ -565,6 +677,7 @@ dns_cache_add_entry(struct ip2action_req *to_add)
 {
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
     struct ip2action     *i2a;
+    size_t               idx;
 
     if (!mgr->initialized || !to_add) return false;
 
@@ -583,8 +696,13 @@ dns_cache_add_entry(struct ip2action_req *to_add)
 
     LOGD("%s: ip2action_cache adding to cache:", __func__);
 
+    i2a->generation = mgr->generation;
     mgr->entries++;
-    ds_tree_insert(&mgr->ip2a_tree, i2a, i2a);
+    dns_cache_grow_hash(mgr);
+    idx = i2a->hash & (mgr->ip2a_nbuckets - 1);
+    i2a->ip2a_hnext = mgr->ip2a_buckets[idx];
+    mgr->ip2a_buckets[idx] = i2a;
+    dns_cache_arm_ip2action(i2a);
 
     return true;
 }
@@ -610,11 +728,7 @@ dns_cache_del_entry(struct ip2action_req *to_del)
     LOGD("%s: ip2action_cache removing entry:", __func__);
 
     /* free ip2action entry  */
-    dns_cache_free_ip2action(i2a);
-    ds_tree_remove(&mgr->ip2a_tree, i2a);
-    FREE(i2a);
-
-    mgr->entries--;
+    dns_cache_remove_ip2action(mgr, i2a);
     return true;
 }
 
@@ -622,38 +736,31 @@ dns_cache_del_entry(struct ip2action_req *to_del)
 /**
  * @brief remove old cache entres.
  *
- * @param ttl
+ * Only the entries hashed to the seconds elapsed since the previous
+ * cleanup are checked.
  */
 bool
 dns_cache_ttl_cleanup(void)
 {
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
-    struct ip2action     *i2a, *next;
-    ds_tree_t            *tree;
+    struct ip2action     *i2a;
     time_t               now;
+    int                  removed;
 
     if (!mgr->initialized) return false;
 
-    LOGD("%s: ip2action_cache removing ttl expired entries", __func__);
     now = time(NULL);
+    removed = 0;
 
-    tree = &mgr->ip2a_tree;
-
-    i2a = ds_tree_head(tree);
-    while (i2a != NULL)
+    while ((i2a = ds_wheel_expire(&mgr->ip2a_wheel, now)) != NULL)
     {
-        if ((now - i2a->cache_ts) < i2a->cache_ttl)
-        {
-            i2a = ds_tree_next(tree, i2a);
-            continue;
-        }
-        next = ds_tree_next(tree, i2a);
-        ds_tree_remove(tree, i2a);
+        dns_cache_unhash_ip2action(mgr, i2a);
         dns_cache_free_ip2action(i2a);
-        FREE(i2a);
         mgr->entries--;
-        i2a = next;
+        removed++;
     }
+
+    LOGD("%s: ip2action_cache removed %d ttl expired entries", __func__, removed);
     return true;
 }
 
@@ -666,17 +773,19 @@ print_dns_cache(void)
 {
     struct dns_cache_mgr *mgr = dns_cache_get_mgr();
     struct ip2action     *i2a;
-    ds_tree_t            *tree;
+    size_t               i;
 
     if (!mgr->initialized) return;
 
-    tree = &mgr->ip2a_tree;
-
     LOGT("%s: dns_cache dump", __func__);
 
-    ds_tree_foreach(tree, i2a)
+    for (i = 0; i < mgr->ip2a_nbuckets; i++)
     {
-        print_dns_cache_entry(i2a);
+        for (i2a = mgr->ip2a_buckets[i]; i2a != NULL; i2a = i2a->ip2a_hnext)
+        {
+            if (i2a->generation != mgr->generation) continue;
+            print_dns_cache_entry(i2a);
+        }
     }
     LOGT("=====END=====");
     return;
@@ -441,6 +441,55 @@ void test_add_dns_cache(void)
     LOGI("\n******************** %s: completed ****************\n", __func__);
 }
 
+void test_invalidate_dns_cache(void)
+{
+    struct ip2action_req *entry = NULL;
+    uint32_t v4udstip = htonl(0x04030201);
+    struct ip2action_req  key;
+    struct sockaddr_storage ip;
+    os_macaddr_t mac;
+    bool rc_lookup;
+    bool rc_add;
+
+    LOGI("\n******************** %s: starting ****************\n", __func__);
+    entry = entry1;
+    entry->service_id = 0;
+    entry->cache_bc.reputation = 3;
+    entry->nelems = 1;
+    entry->cache_bc.confidence_levels[0] = 1;
+
+    rc_add = dns_cache_add_entry(entry);
+    TEST_ASSERT_TRUE(rc_add);
+    TEST_ASSERT_EQUAL_INT(1, dns_cache_get_size());
+
+    memset(&key, 0, sizeof(struct ip2action_req));
+    util_populate_sockaddr(AF_INET, &v4udstip, &ip);
+    key.ip_addr = &ip;
+    memset(mac.addr, 0xaa, sizeof(mac.addr));
+    mac.addr[5] = 0x01;
+    key.device_mac = &mac;
+
+    rc_lookup = dns_cache_ip2action_lookup(&key);
+    TEST_ASSERT_TRUE(rc_lookup);
+
+    /* A policy change makes the entry stale, it is dropped on lookup */
+    dns_cache_invalidate();
+    TEST_ASSERT_EQUAL_INT(1, dns_cache_get_size());
+    rc_lookup = dns_cache_ip2action_lookup(&key);
+    TEST_ASSERT_FALSE(rc_lookup);
+    TEST_ASSERT_EQUAL_INT(0, dns_cache_get_size());
+
+    /* Entries added after the invalidation are served again */
+    rc_add = dns_cache_add_entry(entry);
+    TEST_ASSERT_TRUE(rc_add);
+    rc_lookup = dns_cache_ip2action_lookup(&key);
+    TEST_ASSERT_TRUE(rc_lookup);
+    TEST_ASSERT_EQUAL_INT(FSM_BLOCK, key.action);
+
+    dns_cache_cleanup();
+    LOGI("\n******************** %s: completed ****************\n", __func__);
+}
+
 void test_del_dns_cache(void)
 {
     struct ip2action_req *entry = NULL;
@@ -1574,6 +1623,7 @@ int main(int argc, char *argv[])
 
     RUN_TEST(test_dns_cache_hit_count);
     RUN_TEST(test_add_dns_cache);
+    RUN_TEST(test_invalidate_dns_cache);
     RUN_TEST(test_del_dns_cache);
     RUN_TEST(test_upd_dns_cache);
     RUN_TEST(test_dns_cache_ref_count);
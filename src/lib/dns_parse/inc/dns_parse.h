@@ -95,6 +95,37 @@ typedef struct dns_rr
     struct dns_rr * next;
 } dns_rr;
 
+/* Maximum questions and answers accepted from a DNS message */
+#define DNS_MAX_QUESTIONS 1
+#define DNS_MAX_ANSWERS 40
+
+/*
+ * Compact view of a dns question, as filled by dns_parse_compact().
+ * The name is left in the packet and decoded on demand with
+ * read_rr_name_into().
+ */
+struct dns_question_ref
+{
+    uint32_t name_pos;
+    uint16_t type;
+    uint16_t cls;
+};
+
+/*
+ * Compact view of a dns resource record, as filled by dns_parse_compact().
+ * type_pos is the offset of the fixed record header (type, class, ttl,
+ * rdlength); the rdata starts at type_pos + 10.
+ */
+struct dns_rr_ref
+{
+    uint32_t name_pos;
+    uint32_t type_pos;
+    uint16_t type;
+    uint16_t cls;
+    uint32_t ttl;
+    uint16_t rdlength;
+};
+
 /* Holds general DNS information. */
 typedef struct
 {
@@ -114,14 +145,39 @@ typedef struct
     dns_rr * name_servers;
     uint16_t arcount;
     dns_rr * additional;
+    uint32_t id_pos;
+    uint16_t nqueries;
+    struct dns_question_ref query_refs[DNS_MAX_QUESTIONS];
+    uint16_t nanswers;
+    struct dns_rr_ref answer_refs[DNS_MAX_ANSWERS];
 } dns_info;
 
 
+/*
+ * Openflow tag update staged until the next flush.
+ * The row accumulates the IPs of all the DNS answers matching the tag.
+ */
+struct dns_tag_update
+{
+    char name[MAX_TAG_NAME_LEN];
+    bool local;
+    bool dirty;
+    struct schema_Openflow_Tag *regular_tag;
+    struct schema_Openflow_Local_Tag *local_tag;
+    ds_tree_node_t update_node;
+};
+
+/* Delay applied to Openflow tag updates, in seconds */
+#define DNS_TAG_FLUSH_INTERVAL 0.5
+
 struct dns_cache
 {
     bool initialized;
     ds_tree_t fsm_sessions;
     int req_cache_ttl;
+    struct ev_loop *loop;
+    ds_tree_t tag_updates;
+    ev_timer tag_flush_timer;
     int (*set_forward_context)(struct fsm_session *);
     void (*forward)(struct dns_session *, dns_info *, uint8_t *, int);
     void (*update_tag)(struct fqdn_pending_req *, struct fsm_policy_reply *);
@@ -149,6 +205,19 @@ dns_parse(uint32_t pos, struct pcap_pkthdr *header,
           uint8_t *packet, dns_info * dns,
           struct dns_session *dns_session, uint8_t force);
 
+/*
+ * Allocation free flavor of dns_parse().
+ * The header, questions and answers are decoded into the fixed size
+ * query_refs and answer_refs arrays of 'dns', as offsets into 'packet'.
+ * Names are not decompressed, and the authority and additional sections
+ * are not parsed. The linked lists of 'dns' are left empty, so there is
+ * nothing to free afterwards.
+ * Returns the position past the answers section (0 on error).
+ */
+uint32_t
+dns_parse_compact(uint32_t pos, struct pcap_pkthdr *header,
+                  uint8_t *packet, dns_info *dns);
+
 void
 free_rrs(ip_info * ip, transport_info * trns, dns_info * dns,
          struct pcap_pkthdr * header);
@@ -220,6 +289,15 @@ dns_forward(struct dns_session *dns_session, dns_info *dns,
 void
 dns_update_tag(struct fqdn_pending_req *req, struct fsm_policy_reply *policy_reply);
 
+/**
+ * @brief write the staged Openflow tag updates
+ *
+ * Each tag updated since the last flush is written once, with all the
+ * IPs accumulated from the DNS answers.
+ */
+void
+dns_flush_tag_updates(void);
+
 void
 dns_periodic(struct fsm_session  *session);
 
@@ -7,6 +7,7 @@
 #include <time.h>
 
 #include "os_types.h"
+#include "ds_dlist.h"
 
 
 /*
@@ -106,14 +107,51 @@ typedef struct ip_fragment
     uint32_t id;
     ip_addr src;
     ip_addr dst;
+    uint8_t proto;
     uint32_t start;
     uint32_t end;
     uint8_t * data;
     uint8_t islast;
-    struct ip_fragment * next;
-    struct ip_fragment * child;
 } ip_fragment;
 
+/*
+ * IP reassembly table limits.
+ * Datagrams are reassembled in a pool of IP_FRAG_MAX_DATAGRAMS preallocated
+ * buffers. A datagram is dropped if its payload exceeds IP_FRAG_MAX_LEN
+ * (a 4096 bytes EDNS payload plus the UDP header), if it arrives in more
+ * than IP_FRAG_MAX_RANGES disjoint pieces, or if it is not complete
+ * IP_FRAG_TIMEOUT seconds after its first fragment. When the pool is
+ * exhausted, the oldest datagram is evicted.
+ */
+#define IP_FRAG_HASH_SIZE 64
+#define IP_FRAG_MAX_DATAGRAMS 16
+#define IP_FRAG_MAX_LEN (4096 + 8)
+#define IP_FRAG_MAX_RANGES 8
+#define IP_FRAG_TIMEOUT 30
+
+/* A datagram being reassembled, keyed by (src, dst, id, proto). */
+typedef struct ip_frag_entry
+{
+    uint32_t id;
+    ip_addr src;
+    ip_addr dst;
+    uint8_t proto;
+    time_t expires;
+    /* Payload length, known once the last fragment is received. */
+    uint32_t total;
+    /* Sorted, non overlapping received byte ranges */
+    uint8_t nranges;
+    struct
+    {
+        uint32_t start;
+        uint32_t end;
+    } ranges[IP_FRAG_MAX_RANGES];
+    uint8_t *data;
+    ip_fragment datagram;
+    struct ip_frag_entry *bucket_next;
+    ds_dlist_node_t entry_node;
+} ip_frag_entry;
+
 #define UDP 0x11
 #define TCP 0x06
 
@@ -137,7 +175,14 @@ typedef struct
 
 typedef struct
 {
-    ip_fragment *ip_fragment_head;
+    ip_frag_entry *frag_buckets[IP_FRAG_HASH_SIZE];
+    /* Datagrams in progress, oldest first */
+    ds_dlist_t frag_inuse;
+    ds_dlist_t frag_free;
+    ip_frag_entry *frag_pool;
+    uint8_t *frag_buffers;
+    uint32_t frag_evicted;
+    uint32_t frag_dropped;
 } ip_config;
 
 /*
@@ -211,13 +256,16 @@ ipv6_parse(uint32_t, struct pcap_pkthdr *,
 
 
 /*
- * Add the ip_fragment object to our lists of fragments. If a fragment is
- * complete, returns the completed fragment object.
+ * Copy the ip_fragment data into the reassembly table. The fragment
+ * object and its data remain owned by the caller.
+ * If the fragment completes a datagram, returns the reassembled datagram.
+ * It is owned by the table, and its data remains valid until the next
+ * call to ip_frag_add() or ip_frag_free().
  */
 ip_fragment *
 ip_frag_add(ip_fragment *, ip_config *);
 
-/* Frees all fragment objects. */
+/* Frees the reassembly table. */
 void ip_frag_free(ip_config *);
 
 /*
@@ -2,6 +2,8 @@
 #define STRUTILS_H_INCLUDED
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 /*
  * Encodes the data into plaintext (minus newlines and delimiters).  Escaped
  * characters are in the format \x33 (an ! in this case).  The escaped
@@ -33,6 +35,36 @@ escape_data(const uint8_t *, uint32_t, uint32_t);
 char *
 read_rr_name(const uint8_t *, uint32_t *, uint32_t, uint32_t);
 
+/*
+ * Skip over a reservation record style name without decoding it.
+ * The position argument is moved past the name (a compression pointer
+ * ends the name). Returns false if the name runs past the packet end,
+ * in which case the position argument is left untouched.
+ * Args (packet, pos, len)
+ * packet - The uint8_t array of the whole packet.
+ * pos - the start of the rr name.
+ * len - the length of the whole packet
+ */
+bool
+skip_rr_name(const uint8_t *, uint32_t *, uint32_t);
+
+/*
+ * Allocation free flavor of read_rr_name().
+ * The name starting at pos is decompressed and escaped the same way
+ * read_rr_name() does, into the caller provided buffer.
+ * Returns false if the name is malformed or does not fit the buffer.
+ * Args (packet, pos, id_pos, len, name, name_len)
+ * packet - The uint8_t array of the whole packet.
+ * pos - the start of the rr name.
+ * id_pos - the start of the dns packet (id field)
+ * len - the length of the whole packet
+ * name - the output buffer
+ * name_len - the size of the output buffer
+ */
+bool
+read_rr_name_into(const uint8_t *, uint32_t, uint32_t, uint32_t,
+                  char *, size_t);
+
 char *
 fail_name(const uint8_t *, uint32_t, uint32_t, const char *);
 
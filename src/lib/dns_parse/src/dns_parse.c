@@ -87,6 +87,91 @@ dns_dev_id_cmp(void *a, void *b)
                   sizeof(dev_id_a->addr));
 }
 
+/**
+ * @brief compare staged Openflow tag updates
+ * @param a: staged tag update
+ * @param b: staged tag update
+ *
+ * Compare staged updates based on their tag table and name
+ */
+static int
+dns_tag_update_cmp(void *a, void *b)
+{
+    struct dns_tag_update *u_a = a;
+    struct dns_tag_update *u_b = b;
+
+    if (u_a->local != u_b->local) return (int)u_a->local - (int)u_b->local;
+
+    return strcmp(u_a->name, u_b->name);
+}
+
+
+static void
+dns_free_tag_update(struct dns_tag_update *update)
+{
+    FREE(update->regular_tag);
+    FREE(update->local_tag);
+    FREE(update);
+}
+
+
+void
+dns_flush_tag_updates(void)
+{
+    struct dns_tag_update *update;
+    struct dns_tag_update *next;
+    struct dns_cache *mgr;
+    bool rc;
+
+    mgr = dns_get_mgr();
+    if (!mgr->initialized) return;
+
+    if (mgr->loop != NULL) ev_timer_stop(mgr->loop, &mgr->tag_flush_timer);
+
+    update = ds_tree_head(&mgr->tag_updates);
+    while (update != NULL)
+    {
+        next = ds_tree_next(&mgr->tag_updates, update);
+        ds_tree_remove(&mgr->tag_updates, update);
+
+        if (update->dirty && update->local)
+        {
+            rc = dns_upsert_local_tag(update->local_tag, ovsdb_sync_upsert);
+            if (!rc)
+            {
+                LOGT("%s: Openflow_Local_Tag %s not updated.", __func__,
+                     update->name);
+            }
+        }
+        else if (update->dirty)
+        {
+            rc = dns_upsert_regular_tag(update->regular_tag, ovsdb_sync_upsert);
+            if (!rc)
+            {
+                LOGT("%s: Openflow_Tag %s not updated.", __func__,
+                     update->name);
+            }
+        }
+
+        dns_free_tag_update(update);
+        update = next;
+    }
+}
+
+
+/**
+ * @brief tag flush timer callback
+ */
+static void
+dns_tag_flush_cb(struct ev_loop *loop, ev_timer *watcher, int revents)
+{
+    (void)loop;
+    (void)watcher;
+    (void)revents;
+
+    dns_flush_tag_updates();
+}
+
 
 static void
 dns_parse_update(struct fsm_session *session)
@@ -280,6 +365,7 @@ dns_free_session(struct dns_session *d_session)
         ds_tree_remove(tree, remove);
         dns_free_device(remove);
     }
+    ip_frag_free(&d_session->ip_config);
     FREE(d_session);
 }
 
@@ -318,6 +404,7 @@ dns_plugin_exit(struct fsm_session *session)
     mgr = dns_get_mgr();
     if (!mgr->initialized) return;
 
+    dns_flush_tag_updates();
     dns_cache_cleanup_mgr();
     dns_delete_session(session);
 }
@@ -405,6 +492,9 @@ dns_mgr_init(void)
 
     ds_tree_init(&mgr->fsm_sessions, dns_session_cmp,
                  struct dns_session, session_node);
+    ds_tree_init(&mgr->tag_updates, dns_tag_update_cmp,
+                 struct dns_tag_update, update_node);
+    ev_timer_init(&mgr->tag_flush_timer, dns_tag_flush_cb, 0., 0.);
     mgr->set_forward_context = dns_set_forward_context;
     mgr->forward = dns_forward;
     mgr->update_tag = dns_update_tag;
@@ -457,8 +547,8 @@ dns_plugin_init(struct fsm_session *session)
     dns_session->RECORD_SEP = "";
     dns_session->SEP = '\t';
 
-    dns_session->ip_config.ip_fragment_head = NULL;
     dns_session->fsm_context = session;
+    if (mgr->loop == NULL) mgr->loop = session->loop;
 
     rc = mgr->set_forward_context(session);
     if (rc != 0) goto error;
@@ -639,8 +729,8 @@ process_response_ips(dns_info *dns, uint8_t *packet,
 {
     struct ip2action_req ip_cache_req;
     struct sockaddr_storage ipaddr;
+    struct dns_rr_ref *answer;
     int ip2action_cache_ttl;
-    dns_rr *answer;
     const char *res;
     int qtype = -1;
     size_t index;
@@ -654,16 +744,20 @@ process_response_ips(dns_info *dns, uint8_t *packet,
     if (dns == NULL) return;
     if (req->dns_response.num_replies > 1) return;
 
-    if (dns->queries == NULL) LOGT("%s: no queries", __func__);
+    if (dns->nqueries == 0)
+    {
+        LOGT("%s: no queries", __func__);
+        return;
+    }
 
     ttl = 0;
-    answer = dns->answers;
-    qtype = dns->queries->type;
+    qtype = dns->query_refs[0].type;
     LOGT("%s: query type: %d",
          __func__, qtype);
 
-    for (i = 0; i < dns->ancount && answer != NULL; i++)
+    for (i = 0; i < dns->nanswers; i++)
     {
+        answer = &dns->answer_refs[i];
         LOGT("%s: answer %d type: %d",
              __func__, i, qtype);
         if (answer->type == qtype)
@@ -671,9 +765,9 @@ process_response_ips(dns_info *dns, uint8_t *packet,
             add_entry = false;
             ttl = answer->ttl;
             ip = packet + answer->type_pos + 10;
-            LOGT("%s: type %d answer, addr %s ttl: %d",
-                 __func__, qtype, answer->data, ttl);
-            if (qtype == 1) /* IPv4 redirect */
+            LOGT("%s: type %d answer, rdlength %u ttl: %u",
+                 __func__, qtype, answer->rdlength, ttl);
+            if (qtype == 1 && answer->rdlength == 4) /* IPv4 redirect */
             {
                 char ipv4_addr[INET_ADDRSTRLEN];
 
@@ -691,7 +785,7 @@ process_response_ips(dns_info *dns, uint8_t *packet,
                     process_response_ip(req, ipv4_addr, INET_ADDRSTRLEN);
                 }
             }
-            else if (qtype == 28) /* IPv6 */
+            else if (qtype == 28 && answer->rdlength == 16) /* IPv6 */
             {
                 char ipv6_addr[INET6_ADDRSTRLEN];
 
@@ -763,7 +857,6 @@ process_response_ips(dns_info *dns, uint8_t *packet,
                 }
             }
         }
-        answer = answer->next;
     }
 }
 
@@ -785,187 +878,165 @@ dns_forward(struct dns_session *dns_session, dns_info *dns,
 }
 
 
-static bool
-dns_updatev4_tag(struct fqdn_pending_req *req, struct fsm_policy_reply *policy_reply)
+/**
+ * @brief returns the staged update of a tag, creating it if needed
+ *
+ * @param name the tag name, without its marker
+ * @param local true for an Openflow_Local_Tag, false for an Openflow_Tag
+ * @return the staged update, NULL on allocation failure
+ */
+static struct dns_tag_update *
+dns_get_tag_update(char *name, bool local)
 {
-    struct schema_Openflow_Local_Tag *local_tag;
-    struct schema_Openflow_Tag *regular_tag;
-    size_t max_capacity;
-    size_t value_len;
-    size_t elem_len;
-    int tle_flag;
-    bool result;
-    size_t len;
+    struct dns_tag_update *update;
+    struct dns_tag_update key;
+    struct dns_cache *mgr;
 
-    regular_tag = NULL;
-    local_tag = NULL;
-    max_capacity = 0;
-    result = false;
-    len = 0;
+    mgr = dns_get_mgr();
 
-    if (policy_reply->action != FSM_UPDATE_TAG) return false;
+    memset(&key, 0, sizeof(key));
+    STRSCPY(key.name, name);
+    key.local = local;
+    update = ds_tree_find(&mgr->tag_updates, &key);
+    if (update != NULL) return update;
 
-    tle_flag = om_get_type_of_tag(policy_reply->updatev4_tag);
+    update = CALLOC(1, sizeof(*update));
+    if (update == NULL) return NULL;
 
-    if (tle_flag == OM_TLE_FLAG_DEVICE ||
-        tle_flag == OM_TLE_FLAG_CLOUD)
+    STRSCPY(update->name, name);
+    update->local = local;
+    if (local)
     {
-        regular_tag = CALLOC(1, sizeof(*regular_tag));
-        if (regular_tag == NULL) goto out;
-
-        value_len = sizeof(regular_tag->device_value);
-        elem_len = sizeof(regular_tag->device_value[0]);
-        max_capacity = value_len / elem_len;
-
-        len = strlen(policy_reply->updatev4_tag);
-        os_util_strncpy(regular_tag->name, &policy_reply->updatev4_tag[3], len - 3);
-        regular_tag->name_exists = true;
-        regular_tag->name_present = true;
+        update->local_tag = CALLOC(1, sizeof(*update->local_tag));
+        if (update->local_tag == NULL) goto err;
 
-        result = dns_generate_update_tag(req, policy_reply, regular_tag->device_value,
-                                         &regular_tag->device_value_len,
-                                         max_capacity, 4);
-        if (result)
-        {
-            result = dns_upsert_regular_tag(regular_tag, ovsdb_sync_upsert);
-            if (!result)
-            {
-                LOGT("%s: Openflow_Tag not updated for request.", __func__);
-            }
-        }
-        else
-        {
-            LOGT("%s: Openflow_Tag not updated for request.", __func__);
-        }
+        STRSCPY(update->local_tag->name, name);
+        update->local_tag->name_exists = true;
+        update->local_tag->name_present = true;
     }
-    else if (tle_flag == OM_TLE_FLAG_LOCAL)
+    else
     {
-        local_tag = CALLOC(1, sizeof(*local_tag));
-        if (local_tag == NULL) goto out;
-
-        value_len = sizeof(local_tag->values);
-        elem_len = sizeof(regular_tag->device_value[0]);
-        max_capacity = value_len / elem_len;
+        update->regular_tag = CALLOC(1, sizeof(*update->regular_tag));
+        if (update->regular_tag == NULL) goto err;
 
-        len = strlen(policy_reply->updatev4_tag);
-        os_util_strncpy(local_tag->name, &policy_reply->updatev4_tag[3], len - 3);
-        local_tag->name_exists = true;
-        local_tag->name_present = true;
+        STRSCPY(update->regular_tag->name, name);
+        update->regular_tag->name_exists = true;
+        update->regular_tag->name_present = true;
+    }
+    ds_tree_insert(&mgr->tag_updates, update, update);
 
-        result = dns_generate_update_tag(req, policy_reply, local_tag->values,
-                                         &local_tag->values_len,
-                                         max_capacity, 4);
-        if (result)
-        {
-            result = dns_upsert_local_tag(local_tag, ovsdb_sync_upsert);
-            if (!result)
-            {
-                LOGT("%s: Openflow_Local_Tag not updated for request.", __func__);
-            }
-        }
-        else
-        {
-            LOGT("%s: Openflow_Local_Tag not updated for request.", __func__);
-        }
+    /* Arm the flush timer with the tag's first update */
+    if (mgr->loop != NULL && !ev_is_active(&mgr->tag_flush_timer))
+    {
+        ev_timer_set(&mgr->tag_flush_timer, DNS_TAG_FLUSH_INTERVAL, 0.);
+        ev_timer_start(mgr->loop, &mgr->tag_flush_timer);
     }
 
-out:
-    FREE(regular_tag);
-    FREE(local_tag);
+    return update;
 
-    return result;
+err:
+    dns_free_tag_update(update);
+    return NULL;
 }
 
 
-bool
-dns_updatev6_tag(struct fqdn_pending_req *req, struct fsm_policy_reply *policy_reply)
+/**
+ * @brief stages the resolved IPs of a request in the tag's pending row
+ *
+ * The row is written by dns_flush_tag_updates(), so that all the answers
+ * matching a tag within the flush interval result in a single write.
+ * Without an event loop, the row is written right away.
+ *
+ * @param req the request with the resolved IPs
+ * @param policy_reply the policy reply
+ * @param tag the tag to update, including its marker
+ * @param ip_ver the IP protocol version of the IPs to add
+ * @return true if new IPs were added to the tag
+ */
+static bool
+dns_stage_tag_update(struct fqdn_pending_req *req,
+                     struct fsm_policy_reply *policy_reply,
+                     char *tag, int ip_ver)
 {
-    struct schema_Openflow_Local_Tag *local_tag;
-    struct schema_Openflow_Tag *regular_tag;
+    struct dns_tag_update *update;
+    char name[MAX_TAG_NAME_LEN];
+    struct dns_cache *mgr;
     size_t max_capacity;
-    size_t value_len;
-    size_t elem_len;
     int tle_flag;
     bool result;
+    bool local;
     size_t len;
 
-    regular_tag = NULL;
-    local_tag = NULL;
-    max_capacity = 0;
-    result = false;
-    len = 0;
-
     if (policy_reply->action != FSM_UPDATE_TAG) return false;
 
-    tle_flag = om_get_type_of_tag(policy_reply->updatev6_tag);
-
+    tle_flag = om_get_type_of_tag(tag);
     if (tle_flag == OM_TLE_FLAG_DEVICE ||
         tle_flag == OM_TLE_FLAG_CLOUD)
     {
-        regular_tag = CALLOC(1, sizeof(*regular_tag));
-        if (regular_tag == NULL) goto out;
+        local = false;
+    }
+    else if (tle_flag == OM_TLE_FLAG_LOCAL)
+    {
+        local = true;
+    }
+    else
+    {
+        return false;
+    }
 
-        value_len = sizeof(regular_tag->device_value);
-        elem_len = sizeof(regular_tag->device_value[0]);
-        max_capacity = value_len / elem_len;
+    memset(name, 0, sizeof(name));
+    len = strlen(tag);
+    os_util_strncpy(name, &tag[3], len - 3);
 
-        len = strlen(policy_reply->updatev6_tag);
-        os_util_strncpy(regular_tag->name, &policy_reply->updatev6_tag[3], len - 3);
-        regular_tag->name_exists = true;
-        regular_tag->name_present = true;
+    update = dns_get_tag_update(name, local);
+    if (update == NULL) return false;
 
-        result = dns_generate_update_tag(req, policy_reply, regular_tag->device_value,
-                                         &regular_tag->device_value_len,
-                                         max_capacity, 6);
-        if (result)
-        {
-            result = dns_upsert_regular_tag(regular_tag, ovsdb_sync_upsert);
-            if (!result)
-            {
-                LOGT("%s: Openflow_Tag not updated for request.", __func__);
-            }
-        }
-        else
-        {
-            LOGT("%s: Openflow_Tag not updated for request.", __func__);
-        }
+    if (local)
+    {
+        max_capacity = (sizeof(update->local_tag->values) /
+                        sizeof(update->local_tag->values[0]));
+        result = dns_generate_update_tag(req, policy_reply,
+                                         update->local_tag->values,
+                                         &update->local_tag->values_len,
+                                         max_capacity, ip_ver);
     }
-    else if(tle_flag == OM_TLE_FLAG_LOCAL)
+    else
     {
-        local_tag = CALLOC(1, sizeof(*local_tag));
-        if (local_tag == NULL) goto out;
+        max_capacity = (sizeof(update->regular_tag->device_value) /
+                        sizeof(update->regular_tag->device_value[0]));
+        result = dns_generate_update_tag(req, policy_reply,
+                                         update->regular_tag->device_value,
+                                         &update->regular_tag->device_value_len,
+                                         max_capacity, ip_ver);
+    }
 
-        value_len = sizeof(local_tag->values);
-        elem_len = sizeof(regular_tag->device_value[0]);
-        max_capacity = value_len / elem_len;
+    if (!result)
+    {
+        LOGT("%s: no new IP for tag %s.", __func__, name);
+        return false;
+    }
+    update->dirty = true;
 
-        len = strlen(policy_reply->updatev6_tag);
-        os_util_strncpy(local_tag->name, &policy_reply->updatev6_tag[3], len - 3);
-        local_tag->name_exists = true;
-        local_tag->name_present = true;
+    mgr = dns_get_mgr();
+    if (mgr->loop == NULL) dns_flush_tag_updates();
 
-        result = dns_generate_update_tag(req, policy_reply, local_tag->values,
-                                         &local_tag->values_len,
-                                         max_capacity, 6);
-        if (result)
-        {
-            result = dns_upsert_local_tag(local_tag, ovsdb_sync_upsert);
-            if (!result)
-            {
-                LOGT("%s: Openflow_Local_Tag not updated for request.", __func__);
-            }
-        }
-        else
-        {
-            LOGT("%s: Openflow_Local_Tag not updated for request.", __func__);
-        }
-    }
+    return true;
+}
+
+
+static bool
+dns_updatev4_tag(struct fqdn_pending_req *req, struct fsm_policy_reply *policy_reply)
+{
+    return dns_stage_tag_update(req, policy_reply,
+                                policy_reply->updatev4_tag, 4);
+}
 
-out:
-    FREE(regular_tag);
-    FREE(local_tag);
 
-    return result;
+bool
+dns_updatev6_tag(struct fqdn_pending_req *req, struct fsm_policy_reply *policy_reply)
+{
+    return dns_stage_tag_update(req, policy_reply,
+                                policy_reply->updatev6_tag, 6);
 }
 
 
@@ -1080,15 +1151,15 @@ update_a_rrs(dns_info *dns, uint8_t *packet,
              struct fqdn_pending_req *req,
              struct fsm_policy_reply *policy_reply)
 {
-    dns_rr *answer = dns->answers;
     struct sockaddr_storage ipaddr;
+    struct dns_rr_ref *answer;
     bool updated = false;
     int qtype = -1;
     int i = 0;
     void *ip;
     bool rc;
 
-    if (dns->queries == NULL)
+    if (dns->nqueries == 0)
     {
         LOGT("%s: no queries", __func__);
         return false;
@@ -1096,20 +1167,21 @@ update_a_rrs(dns_info *dns, uint8_t *packet,
 
     if (policy_reply->redirect == false) return false;
 
-    qtype = dns->queries->type;
+    qtype = dns->query_refs[0].type;
     LOGT("%s: query type: %d",
          __func__, qtype);
-    for (i = 0; i < dns->ancount && answer != NULL; i++)
+    for (i = 0; i < dns->nanswers; i++)
     {
+        answer = &dns->answer_refs[i];
         LOGT("%s: answer %d type: %d",
              __func__, i, qtype);
         if (answer->type == qtype)
         {
             uint8_t *p_ttl = packet + answer->type_pos + 4;
 
-            LOGT("%s: type %d answer, addr %s",
-                 __func__, qtype, answer->data);
-            if (qtype == 1)  /* IPv4 redirect */
+            LOGT("%s: type %d answer, rdlength %u",
+                 __func__, qtype, answer->rdlength);
+            if (qtype == 1 && answer->rdlength == 4)  /* IPv4 redirect */
             {
                 char *ipv4_addr = check_redirect(policy_reply->redirects[0],
                                                  IPv4_REDIRECT);
@@ -1138,7 +1210,7 @@ update_a_rrs(dns_info *dns, uint8_t *packet,
                     updated |= true;
                 }
             }
-            else if (qtype == 28)  /* IPv6 */
+            else if (qtype == 28 && answer->rdlength == 16)  /* IPv6 */
             {
                 LOGT("%s: IPv6 record, rdlength == %d",
                      __func__, answer->rdlength);
@@ -1171,7 +1243,6 @@ update_a_rrs(dns_info *dns, uint8_t *packet,
                 }
             }
         }
-        answer = answer->next;
     }
     return updated;
 }
@@ -1203,12 +1274,12 @@ dns_handle_reply(struct dns_session *dns_session, dns_info *dns,
     }
 
     LOGD("dns reply: looking up request %u type %d",
-         dns->id, dns->answers ? dns->answers->type : -1);
+         dns->id, dns->nanswers ? dns->answer_refs[0].type : -1);
     req = ds_tree_find(&ds->fqdn_pending_reqs, &dns->id);
     if (req == NULL)
     {
         LOGD("dns reply: could not retrieve request %u type %d",
-             dns->id, dns->answers ? dns->answers->type : -1);
+             dns->id, dns->nanswers ? dns->answer_refs[0].type : -1);
         goto free_out;
     }
 
@@ -1331,7 +1402,6 @@ dns_handle_reply(struct dns_session *dns_session, dns_info *dns,
     }
 
   free_out:
-    free_rrs(&dns_session->ip, &dns_session->udp, dns, header);
     return;
 }
 
@@ -1386,8 +1456,8 @@ void
 dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
 {
     struct dns_session *dns_session;
+    struct dns_question_ref *query;
     eth_info *eth;
-    dns_question *qnext;
     os_macaddr_t *mac = NULL;
     struct fsm_url_request *req_info = NULL;
     int cnt = 0;
@@ -1398,6 +1468,7 @@ dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
     struct fsm_policy_reply *policy_reply;
     struct pcap_pkthdr header;
     uint8_t * packet;
+    bool rc;
 
     dns_session = (struct dns_session *)session->handler_ctxt;
     eth = &dns_session->eth_hdr;
@@ -1447,11 +1518,10 @@ dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
     if (pos == 0) return;
 
     dns_session->data_offset = pos;
-    pos = dns_parse(pos, &header, packet, &dns, dns_session, !FORCE);
+    pos = dns_parse_compact(pos, &header, packet, &dns);
     if (dns.qdcount == 0)
     {
         LOGD("%s: dropping packet with no question", __func__);
-        free_rrs(&dns_session->ip, &dns_session->udp, &dns, &header);
         return;
     }
 
@@ -1462,7 +1532,6 @@ dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
         return;
     }
 
-    qnext = dns.queries;
     mac = (dns.qr == 0 ? &eth->srcmac : &eth->dstmac);
 
     LOGD("%s: looking up device " PRI_os_macaddr_lower_t,
@@ -1491,7 +1560,6 @@ dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
              __func__, dns.id);
         req->dedup++;
         req->timestamp = time(NULL);
-        free_rrs(&dns_session->ip, &dns_session->udp, &dns, &header);
         return;
     }
 
@@ -1520,12 +1588,19 @@ dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
     req->dev_session = ds;
     set_provider_ops(dns_session, policy_reply);
     req_info = req->req_info;
-    qnext = dns.queries;
-    for (i = 0; i < dns.qdcount; i++)
+    for (i = 0; i < dns.nqueries; i++)
     {
-        if ((qnext->type == 0x1) || (qnext->type == 0x1c))
+        query = &dns.query_refs[i];
+        if ((query->type == 0x1) || (query->type == 0x1c))
         {
-            STRSCPY(req_info->url, qnext->name);
+            rc = read_rr_name_into(packet, query->name_pos, dns.id_pos,
+                                   header.len, req_info->url,
+                                   sizeof(req_info->url));
+            if (!rc)
+            {
+                LOGD("%s: could not read question name", __func__);
+                continue;
+            }
             LOGT("%s: url: %s", __func__, req_info->url);
             memcpy(&req_info->dev_id, &eth->srcmac,
                    sizeof(req_info->dev_id));
@@ -1533,13 +1608,11 @@ dns_handler(struct fsm_session *session, struct net_header_parser *net_header)
             req_info++;
             cnt++;
         }
-        qnext = qnext->next;
     }
 
     dns_session->req = req;
     req->numq = cnt;
     dns_policy_check(ds, req, policy_reply);
-    free_rrs(&dns_session->ip, &dns_session->udp, &dns, &header);
 }
 
 
@@ -1772,22 +1845,13 @@ parse_rr_set(uint32_t pos, uint32_t id_pos,
 
 
 /*
- * Parse the dns protocol in 'packet'.
- * See RFC1035
- * See dns_parse.h for more info.
+ * Parse the fixed dns header of 'packet' at 'pos' into 'dns'.
+ * Return false if the message should be ignored, in which case
+ * all the record counts of 'dns' are zeroed.
  */
-uint32_t
-dns_parse(uint32_t pos, struct pcap_pkthdr *header,
-          uint8_t *packet, dns_info *dns,
-          struct dns_session *dns_session, uint8_t force)
+static bool
+dns_parse_header(uint32_t pos, uint8_t *packet, dns_info *dns)
 {
-    uint32_t id_pos = pos;
-
-    if (header->len - pos < 12)
-    {
-        return 0;
-    }
-
     dns->id = (packet[pos] << 8) + packet[pos+1];
     dns->qr = packet[pos+2] >> 7;
     dns->opcode = (packet[pos+2] & (0x7f)) >> 1;
@@ -1805,11 +1869,7 @@ dns_parse(uint32_t pos, struct pcap_pkthdr *header,
         LOGD("%s: ignoring request with opcode %u Z bit %u rcode %u",
              __func__, dns->opcode, dns->Z, dns->rcode);
         dns->qdcount = dns->ancount = dns->nscount = dns->arcount = 0;
-        dns->queries = NULL;
-        dns->answers = NULL;
-        dns->name_servers = NULL;
-        dns->additional = NULL;
-        return pos + 12;
+        return false;
     }
 
     LOGD("%s: transaction id %d, type %s", __func__,
@@ -1821,11 +1881,38 @@ dns_parse(uint32_t pos, struct pcap_pkthdr *header,
     dns->nscount = (packet[pos+8] << 8) + packet[pos+9];
     dns->arcount = (packet[pos+10] << 8) + packet[pos+11];
 
-    if ((dns->qdcount > 1) || (dns->ancount > 40))
+    if ((dns->qdcount > DNS_MAX_QUESTIONS) ||
+        (dns->ancount > DNS_MAX_ANSWERS))
     {
         LOGD("%s: ignoring request with qdcount %u ancount %u",
              __func__, dns->qdcount, dns->ancount);
         dns->qdcount = dns->ancount = dns->nscount = dns->arcount = 0;
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Parse the dns protocol in 'packet'.
+ * See RFC1035
+ * See dns_parse.h for more info.
+ */
+uint32_t
+dns_parse(uint32_t pos, struct pcap_pkthdr *header,
+          uint8_t *packet, dns_info *dns,
+          struct dns_session *dns_session, uint8_t force)
+{
+    uint32_t id_pos = pos;
+
+    if (header->len - pos < 12)
+    {
+        return 0;
+    }
+
+    if (!dns_parse_header(pos, packet, dns))
+    {
         dns->queries = NULL;
         dns->answers = NULL;
         dns->name_servers = NULL;
@@ -1870,6 +1957,84 @@ dns_parse(uint32_t pos, struct pcap_pkthdr *header,
 }
 
 
+/*
+ * Parse the dns protocol in 'packet' without any allocation.
+ * See dns_parse.h for more info.
+ */
+uint32_t
+dns_parse_compact(uint32_t pos, struct pcap_pkthdr *header,
+                  uint8_t *packet, dns_info *dns)
+{
+    struct dns_question_ref *query;
+    struct dns_rr_ref *rr;
+    uint16_t i;
+    bool rc;
+
+    dns->queries = NULL;
+    dns->answers = NULL;
+    dns->name_servers = NULL;
+    dns->additional = NULL;
+    dns->nqueries = 0;
+    dns->nanswers = 0;
+    dns->id_pos = pos;
+
+    if (header->len - pos < 12)
+    {
+        return 0;
+    }
+
+    if (!dns_parse_header(pos, packet, dns)) return pos + 12;
+
+    pos += 12;
+    for (i = 0; i < dns->qdcount; i++)
+    {
+        query = &dns->query_refs[i];
+        query->name_pos = pos;
+        rc = skip_rr_name(packet, &pos, header->len);
+        if (!rc || (header->len - pos) < 4)
+        {
+            LOGD("%s: bad DNS question", __func__);
+            return 0;
+        }
+
+        query->type = (packet[pos] << 8) + packet[pos+1];
+        query->cls = (packet[pos+2] << 8) + packet[pos+3];
+        dns->nqueries++;
+        pos += 4;
+    }
+
+    dns->answer_pos = pos;
+    for (i = 0; i < dns->ancount; i++)
+    {
+        rr = &dns->answer_refs[i];
+        rr->name_pos = pos;
+        rc = skip_rr_name(packet, &pos, header->len);
+        if (!rc || (header->len - pos) < 10)
+        {
+            LOGD("%s: bad rr name", __func__);
+            return 0;
+        }
+
+        rr->type_pos = pos;
+        rr->type = (packet[pos] << 8) + packet[pos+1];
+        rr->cls = (packet[pos+2] << 8) + packet[pos+3];
+        rr->ttl = ((uint32_t)packet[pos+4] << 24) + (packet[pos+5] << 16) +
+                  (packet[pos+6] << 8) + packet[pos+7];
+        rr->rdlength = (packet[pos+8] << 8) + packet[pos+9];
+        if ((header->len - pos - 10) < rr->rdlength)
+        {
+            LOGD("%s: truncated rr", __func__);
+            return 0;
+        }
+
+        dns->nanswers++;
+        pos += 10 + rr->rdlength;
+    }
+
+    return pos;
+}
+
+
 static void
 dns_send_report(struct fqdn_pending_req *req, struct fsm_policy_reply *policy_reply)
 {
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "network.h"
 #include "log.h"
 #include "memutil.h"
@@ -59,7 +60,8 @@ ipv4_parse(uint32_t pos, struct pcap_pkthdr *header,
 {
 
     uint32_t h_len;
-    ip_fragment * frag = NULL;
+    ip_fragment frag_info;
+    ip_fragment * frag;
     uint8_t frag_mf;
     uint16_t frag_offset;
 
@@ -88,8 +90,14 @@ ipv4_parse(uint32_t pos, struct pcap_pkthdr *header,
 
     if (frag_mf == 1 || frag_offset != 0)
     {
-        frag = MALLOC(sizeof(ip_fragment));
+        if (header->len - pos - 4*h_len < ip->length)
+        {
+            LOGD("Truncated Packet(ipv4 fragment)");
+            *p_packet = NULL;
+            return 0;
+        }
 
+        frag = &frag_info;
         frag->start = frag_offset;
         /*
          * We don't try to deal with endianness here, since it
@@ -99,12 +107,11 @@ ipv4_parse(uint32_t pos, struct pcap_pkthdr *header,
         frag->id = *((uint16_t *)(packet + pos + 4));
         frag->src = ip->src;
         frag->dst = ip->dst;
+        frag->proto = ip->proto;
         frag->end = frag->start + ip->length;
-        frag->data = MALLOC(sizeof(uint8_t) * ip->length);
-        frag->next = frag->child = NULL;
-        memcpy(frag->data, packet + pos + 4*h_len, ip->length);
+        frag->data = packet + pos + 4*h_len;
         /*
-         * Add the fragment to the list.
+         * Add the fragment to the reassembly table.
          * If this completed the packet, it is returned.
          */
         frag = ip_frag_add(frag, conf);
@@ -113,7 +120,6 @@ ipv4_parse(uint32_t pos, struct pcap_pkthdr *header,
             /* Update the IP info on the reassembled data. */
             header->len = ip->length = frag->end - frag->start;
             *p_packet = frag->data;
-            FREE(frag);
 
             return 0;
         }
@@ -141,6 +147,7 @@ ipv6_parse(uint32_t pos, struct pcap_pkthdr *header,
     uint8_t * packet = *p_packet;
 
     /* In case the IP packet is a fragment. */
+    ip_fragment frag_info;
     ip_fragment * frag = NULL;
     uint32_t header_len = 0;
 
@@ -213,7 +220,6 @@ ipv6_parse(uint32_t pos, struct pcap_pkthdr *header,
         case 50: /* ESP Protocol. See RFC4303. */
             /* We don't support ESP. */
             LOGD("Unsupported protocol: IPv6 ESP");
-            if (frag != NULL) FREE(frag);
             *p_packet = NULL; return 0;
         case 135: /* IPv6 Mobility See RFC 6275 */
             if (header->len < (pos + 2))
@@ -232,10 +238,15 @@ ipv6_parse(uint32_t pos, struct pcap_pkthdr *header,
             break;
         case IPPROTO_FRAGMENT:
             /* IP fragment. */
+            if (header->len < (pos + 8))
+            {
+                LOGD("Truncated Packet(ipv6)");
+                *p_packet = NULL; return 0;
+            }
             next_hdr = packet[pos];
-            frag = MALLOC(sizeof(ip_fragment));
+            frag = &frag_info;
             /* Get the offset of the data for this fragment. */
-            frag->start = (packet[pos+2] << 8) + (packet[pos+3] & 0xf4);
+            frag->start = (packet[pos+2] << 8) + (packet[pos+3] & 0xf8);
             frag->islast = !(packet[pos+3] & 0x01);
             /*
              * We don't try to deal with endianness here, since it
@@ -264,14 +275,20 @@ ipv6_parse(uint32_t pos, struct pcap_pkthdr *header,
     /* Handle fragments. */
     if (frag != NULL)
     {
+        if (header->len - pos < ip->length)
+        {
+            LOGD("Truncated Packet(ipv6 fragment)");
+            *p_packet = NULL;
+            return 0;
+        }
+
         frag->src = ip->src;
         frag->dst = ip->dst;
+        frag->proto = ip->proto;
         frag->end = frag->start + ip->length;
-        frag->next = frag->child = NULL;
-        frag->data = MALLOC(sizeof(uint8_t) * ip->length);
-        memcpy(frag->data, packet+pos, ip->length);
+        frag->data = packet + pos;
         /*
-         * Add the fragment to the list.
+         * Add the fragment to the reassembly table.
          * If this completed the packet, it is returned.
          */
         frag = ip_frag_add(frag, conf);
@@ -279,7 +296,6 @@ ipv6_parse(uint32_t pos, struct pcap_pkthdr *header,
         {
             header->len = ip->length = frag->end - frag->start;
             *p_packet = frag->data;
-            FREE(frag);
 
             return 0;
         }
@@ -295,143 +311,304 @@ ipv6_parse(uint32_t pos, struct pcap_pkthdr *header,
 
 }
 
+/* Allocate the reassembly pool. */
+static bool
+ip_frag_init(ip_config *conf)
+{
+    ip_frag_entry *entry;
+    size_t i;
+
+    conf->frag_pool = CALLOC(IP_FRAG_MAX_DATAGRAMS, sizeof(*conf->frag_pool));
+    if (conf->frag_pool == NULL) return false;
+
+    conf->frag_buffers = MALLOC(IP_FRAG_MAX_DATAGRAMS * IP_FRAG_MAX_LEN);
+    if (conf->frag_buffers == NULL)
+    {
+        FREE(conf->frag_pool);
+        conf->frag_pool = NULL;
+        return false;
+    }
+
+    memset(conf->frag_buckets, 0, sizeof(conf->frag_buckets));
+    ds_dlist_init(&conf->frag_inuse, ip_frag_entry, entry_node);
+    ds_dlist_init(&conf->frag_free, ip_frag_entry, entry_node);
+    for (i = 0; i < IP_FRAG_MAX_DATAGRAMS; i++)
+    {
+        entry = &conf->frag_pool[i];
+        entry->data = conf->frag_buffers + i * IP_FRAG_MAX_LEN;
+        ds_dlist_insert_tail(&conf->frag_free, entry);
+    }
+
+    return true;
+}
+
+
+/* Hash a fragment's reassembly key into a bucket index. */
+static uint32_t
+ip_frag_hash(ip_fragment *frag)
+{
+    uint32_t hash;
+    int i;
+
+    hash = frag->id ^ frag->proto;
+    if (frag->src.vers == IPv4)
+    {
+        hash ^= frag->src.addr.v4.s_addr;
+        hash ^= (frag->dst.addr.v4.s_addr << 16) |
+                (frag->dst.addr.v4.s_addr >> 16);
+    }
+    else
+    {
+        for (i = 0; i < 4; i++)
+        {
+            hash ^= frag->src.addr.v6.s6_addr32[i];
+            hash ^= (frag->dst.addr.v6.s6_addr32[i] << 16) |
+                    (frag->dst.addr.v6.s6_addr32[i] >> 16);
+        }
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+
+    return hash & (IP_FRAG_HASH_SIZE - 1);
+}
+
+
+/* Return the datagram the fragment belongs to, NULL if none. */
+static ip_frag_entry *
+ip_frag_lookup(ip_config *conf, ip_fragment *frag, uint32_t bucket)
+{
+    ip_frag_entry *entry;
+
+    for (entry = conf->frag_buckets[bucket];
+         entry != NULL;
+         entry = entry->bucket_next)
+    {
+        if (entry->id == frag->id &&
+            entry->proto == frag->proto &&
+            IP_CMP(entry->src, frag->src) &&
+            IP_CMP(entry->dst, frag->dst))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Return a datagram to the free pool. Its buffer is left untouched. */
+static void
+ip_frag_release(ip_config *conf, ip_frag_entry *entry)
+{
+    ip_frag_entry **link;
+    ip_fragment frag;
+
+    frag.id = entry->id;
+    frag.proto = entry->proto;
+    frag.src = entry->src;
+    frag.dst = entry->dst;
+    link = &conf->frag_buckets[ip_frag_hash(&frag)];
+    while (*link != NULL && *link != entry) link = &(*link)->bucket_next;
+    if (*link != NULL) *link = entry->bucket_next;
+    entry->bucket_next = NULL;
+
+    ds_dlist_remove(&conf->frag_inuse, entry);
+    ds_dlist_insert_tail(&conf->frag_free, entry);
+}
+
+
+/* Drop the datagrams whose reassembly timed out. */
+static void
+ip_frag_expire(ip_config *conf, time_t now)
+{
+    ip_frag_entry *entry;
+
+    /* Datagrams are kept in creation order, so stop at the first live one */
+    while ((entry = ds_dlist_head(&conf->frag_inuse)) != NULL)
+    {
+        if (entry->expires > now) break;
+
+        LOGD("%s: ip fragment id %u from %s timed out", __func__,
+             entry->id, iptostr(&entry->src));
+        conf->frag_dropped++;
+        ip_frag_release(conf, entry);
+    }
+}
+
+
+/*
+ * Record the received byte range [start, end) of a datagram, merging it
+ * with the ranges it overlaps or touches.
+ * Returns false if the datagram is too fragmented.
+ */
+static bool
+ip_frag_add_range(ip_frag_entry *entry, uint32_t start, uint32_t end)
+{
+    uint8_t first;
+    uint8_t last;
+    uint8_t n;
+
+    n = entry->nranges;
+
+    /* Skip the ranges ending before this one */
+    for (first = 0; first < n && entry->ranges[first].end < start; first++);
+
+    /* Absorb the ranges overlapping or touching this one */
+    for (last = first; last < n && entry->ranges[last].start <= end; last++)
+    {
+        if (entry->ranges[last].start < start) start = entry->ranges[last].start;
+        if (entry->ranges[last].end > end) end = entry->ranges[last].end;
+    }
+
+    if (first == last)
+    {
+        /* No overlap: open a new range */
+        if (n == IP_FRAG_MAX_RANGES) return false;
+        memmove(&entry->ranges[first + 1], &entry->ranges[first],
+                (n - first) * sizeof(entry->ranges[0]));
+        entry->nranges++;
+    }
+    else
+    {
+        /* Collapse the absorbed ranges into the first one */
+        memmove(&entry->ranges[first + 1], &entry->ranges[last],
+                (n - last) * sizeof(entry->ranges[0]));
+        entry->nranges -= (last - first - 1);
+    }
+
+    entry->ranges[first].start = start;
+    entry->ranges[first].end = end;
+
+    return true;
+}
+
+
 /*
- * Add this ip fragment to the our list of fragments. If we complete
+ * Add this ip fragment to the reassembly table. If we complete
  * a fragmented packet, return it.
- * Limitations - Duplicate packets may end up in the list of fragments.
- *             - We aren't going to expire fragments, and we aren't going
- *                to save/load them like with TCP streams either. This may
- *                mean lost data.
+ * Fragments are copied at their offset in the datagram's buffer, so
+ * duplicates and overlaps simply overwrite already received data.
  */
 ip_fragment *
 ip_frag_add(ip_fragment * this, ip_config * conf)
 {
-    ip_fragment ** curr = &(conf->ip_fragment_head);
-    ip_fragment ** found = NULL;
+    ip_fragment *datagram;
+    ip_frag_entry *entry;
+    uint32_t bucket;
+    time_t now;
+    bool rc;
 
-    /* Find the matching fragment list. */
-    while (*curr != NULL)
+    if (conf->frag_pool == NULL)
     {
-        if ((*curr)->id == this->id &&
-            IP_CMP((*curr)->src, this->src) &&
-            IP_CMP((*curr)->dst, this->dst))
+        rc = ip_frag_init(conf);
+        if (!rc)
         {
-            found = curr;
-            break;
+            LOGE("%s: could not allocate the ip fragment pool", __func__);
+            return NULL;
         }
-        curr = &(*curr)->next;
     }
 
-    /*
-     * At this point curr will be the head of our matched chain of fragments,
-     * and found will be the same. We'll use found as our pointer into this
-     * chain, and curr to remember where it starts.
-     * 'found' could also be NULL, meaning no match was found.
-     */
+    now = time(NULL);
+    ip_frag_expire(conf, now);
+
+    bucket = ip_frag_hash(this);
+    entry = ip_frag_lookup(conf, this, bucket);
 
-    /* If there wasn't a matching list, then we're done. */
-    if (found == NULL)
+    if (this->end > IP_FRAG_MAX_LEN)
     {
-        this->next = conf->ip_fragment_head;
-        conf->ip_fragment_head = this;
-        return NULL;
+        LOGD("%s: ip fragment id %u from %s exceeds %u bytes", __func__,
+             this->id, iptostr(&this->src), IP_FRAG_MAX_LEN);
+        goto drop;
     }
 
-    while (*found != NULL)
+    /* Empty fragments carry nothing to reassemble */
+    if (this->end <= this->start) return NULL;
+
+    if (entry == NULL)
     {
-        if ((*found)->start >= this->end)
+        entry = ds_dlist_remove_head(&conf->frag_free);
+        if (entry == NULL)
         {
-            /* It goes before, so put it there. */
-            this->child = *found;
-            this->next = (*found)->next;
-            *found = this;
-            break;
+            /* The pool is exhausted: evict the oldest datagram */
+            conf->frag_evicted++;
+            ip_frag_release(conf, ds_dlist_head(&conf->frag_inuse));
+            entry = ds_dlist_remove_head(&conf->frag_free);
         }
-        else if ((*found)->child == NULL &&
-                 (*found)->end <= this->start)
-        {
-            (*found)->child = this;
-            break;
-        }
-        found = &((*found)->child);
+
+        entry->id = this->id;
+        entry->proto = this->proto;
+        entry->src = this->src;
+        entry->dst = this->dst;
+        entry->expires = now + IP_FRAG_TIMEOUT;
+        entry->total = 0;
+        entry->nranges = 0;
+        entry->bucket_next = conf->frag_buckets[bucket];
+        conf->frag_buckets[bucket] = entry;
+        ds_dlist_insert_tail(&conf->frag_inuse, entry);
     }
 
-    /*
-     * We found no place for the fragment, which means it's a duplicate
-     * (or the chain is screwed up...)
-     */
-    if (*found == NULL)
+    /* The last fragment sets the datagram length */
+    if (this->islast)
     {
-        FREE(this);
+        if (entry->total != 0 && entry->total != this->end) goto drop;
+        entry->total = this->end;
+    }
+    if (entry->total != 0 && this->end > entry->total) goto drop;
 
-        return NULL;
+    rc = ip_frag_add_range(entry, this->start, this->end);
+    if (!rc)
+    {
+        LOGD("%s: ip fragment id %u from %s: too many fragments", __func__,
+             this->id, iptostr(&this->src));
+        goto drop;
     }
+    memcpy(entry->data + this->start, this->data, this->end - this->start);
 
-    /* Now we try to collapse the list. */
-    found = curr;
-    while ((*found != NULL) && (*found)->child != NULL)
+    /* Check to see if the datagram is complete. */
+    if (entry->total == 0 || entry->nranges != 1) return NULL;
+    if (entry->ranges[0].start != 0 || entry->ranges[0].end != entry->total)
     {
-        ip_fragment * child = (*found)->child;
-        if ((*found)->end == child->start)
-        {
-            uint32_t child_len = child->end - child->start;
-            uint32_t fnd_len = (*found)->end - (*found)->start;
-            uint8_t * buff = MALLOC(sizeof(uint8_t) * (fnd_len + child_len));
-            memcpy(buff, (*found)->data, fnd_len);
-            memcpy(buff + fnd_len, child->data, child_len);
-            (*found)->end = (*found)->end + child_len;
-            (*found)->islast = child->islast;
-            (*found)->child = child->child;
-            /*
-             * Free the old data and the child, and make the combined buffer
-             * the new data for the merged fragment.
-             */
-            FREE((*found)->data);
-            FREE(child->data);
-            FREE(child);
-            (*found)->data = buff;
-        }
-        else
-        {
-            found = &(*found)->child;
-        }
+        return NULL;
     }
 
+    datagram = &entry->datagram;
+    datagram->id = entry->id;
+    datagram->proto = entry->proto;
+    datagram->src = entry->src;
+    datagram->dst = entry->dst;
+    datagram->start = 0;
+    datagram->end = entry->total;
+    datagram->data = entry->data;
+    datagram->islast = 1;
+
     /*
-     * Check to see if we completely collapsed it.
-     * *curr is the pointer to the first fragment.
+     * The entry goes back to the pool, but its buffer is only reused
+     * by a later call, once the caller is done with the datagram.
      */
-    if ((*curr)->islast != 0)
-    {
-        ip_fragment * ret = *curr;
-        /* Remove this from the fragment list. */
-        *curr = (*curr)->next;
-        return ret;
-    }
+    ip_frag_release(conf, entry);
+
+    return datagram;
+
+drop:
+    conf->frag_dropped++;
+    if (entry != NULL) ip_frag_release(conf, entry);
 
-    /* This is what happens when we don't complete a packet. */
     return NULL;
 }
 
-/* Free the lists of IP fragments. */
+/* Free the IP reassembly table. */
 void
 ip_frag_free(ip_config *conf)
 {
-    ip_fragment * curr;
-    ip_fragment * child;
+    if (conf->frag_pool == NULL) return;
 
-    while (conf->ip_fragment_head != NULL)
-    {
-        curr = conf->ip_fragment_head;
-        conf->ip_fragment_head = curr->next;
-        while (curr != NULL)
-        {
-            child = curr->child;
-            FREE(curr->data);
-            FREE(curr);
-            curr = child;
-        }
-    }
+    FREE(conf->frag_buffers);
+    FREE(conf->frag_pool);
+    conf->frag_buffers = NULL;
+    conf->frag_pool = NULL;
+    memset(conf->frag_buckets, 0, sizeof(conf->frag_buckets));
 }
 
 
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include "memutil.h"
@@ -179,6 +180,109 @@ read_rr_name(const uint8_t * packet, uint32_t * packet_p,
 }
 
 
+bool
+skip_rr_name(const uint8_t * packet, uint32_t * packet_p, uint32_t len)
+{
+    uint32_t pos = *packet_p;
+    uint8_t c;
+
+    while (pos < len)
+    {
+        c = packet[pos];
+
+        /* End of the name */
+        if (c == 0)
+        {
+            *packet_p = pos + 1;
+            return true;
+        }
+
+        /* A compression pointer always terminates the name */
+        if ((c & 0xc0) == 0xc0)
+        {
+            if (pos + 1 >= len) return false;
+            *packet_p = pos + 2;
+            return true;
+        }
+
+        pos += c + 1;
+    }
+
+    return false;
+}
+
+
+bool
+read_rr_name_into(const uint8_t * packet, uint32_t pos, uint32_t id_pos,
+                  uint32_t len, char * name, size_t name_len)
+{
+    uint32_t steps = 0;
+    uint32_t next;
+    size_t i = 0;
+    uint8_t c;
+
+    if (name_len == 0) return false;
+
+    /*
+     * Same walk as read_rr_name(), done in a single pass: the output
+     * buffer bounds the name length, and the steps counter protects
+     * against compression loops.
+     */
+    next = pos;
+    while (pos < len && steps < len*2)
+    {
+        c = packet[pos];
+        steps++;
+        if (pos == next)
+        {
+            if (c == 0)
+            {
+                name[i] = 0;
+                return true;
+            }
+
+            if ((c & 0xc0) == 0xc0)
+            {
+                if (pos + 1 >= len) return false;
+                pos = id_pos + ((c & 0x3f) << 8) + packet[pos+1];
+                next = pos;
+                continue;
+            }
+
+            /* Add a period except for the first time. */
+            if (i != 0)
+            {
+                if (i + 1 >= name_len) return false;
+                name[i++] = '.';
+            }
+            next = pos + c + 1;
+            pos++;
+            continue;
+        }
+
+        if (c >= '!' && c <= '~' && c != '\\')
+        {
+            if (i + 1 >= name_len) return false;
+            name[i++] = c;
+        }
+        else
+        {
+            if (i + 4 >= name_len) return false;
+            name[i] = '\\';
+            name[i+1] = 'x';
+            name[i+2] = c/16 + 0x30;
+            name[i+3] = c%16 + 0x30;
+            if (name[i+2] > 0x39) name[i+2] += 0x27;
+            if (name[i+3] > 0x39) name[i+3] += 0x27;
+            i += 4;
+        }
+        pos++;
+    }
+
+    return false;
+}
+
+
 static const char cb64[]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 char * b64encode(const uint8_t * data, uint32_t pos, uint16_t length) {
@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "dns_parse.h"
+#include "strutils.h"
 #include "fsm_policy.h"
 #include "json_util.h"
 #include "log.h"
@@ -1287,6 +1288,186 @@ test_gk_dns_cache(void)
 }
 
 
+/**
+ * @brief test the coalescing of Openflow tag updates
+ */
+void
+test_deferred_tag_updates(void)
+{
+    struct fsm_policy_reply policy_reply;
+    struct dns_tag_update *update;
+    struct fqdn_pending_req req;
+    char tag_name[64];
+    int i;
+
+    /* Stage the updates until the flush timer fires */
+    g_dns_mgr->loop = EV_DEFAULT;
+
+    memset(&req, 0, sizeof(req));
+    memset(&policy_reply, 0, sizeof(policy_reply));
+    policy_reply.action = FSM_UPDATE_TAG;
+    snprintf(tag_name, sizeof(tag_name), "${@%s}", g_tags[0].name);
+    policy_reply.updatev4_tag = tag_name;
+
+    /* Two answers for the same tag, sharing one IP */
+    req.dns_response.ipv4_cnt = 2;
+    req.dns_response.ipv4_addrs[0] = STRDUP("10.0.0.1");
+    req.dns_response.ipv4_addrs[1] = STRDUP("10.0.0.2");
+    dns_update_tag(&req, &policy_reply);
+    FREE(req.dns_response.ipv4_addrs[0]);
+    FREE(req.dns_response.ipv4_addrs[1]);
+
+    req.dns_response.ipv4_addrs[0] = STRDUP("10.0.0.2");
+    req.dns_response.ipv4_addrs[1] = STRDUP("10.0.0.3");
+    dns_update_tag(&req, &policy_reply);
+
+    /* A single row holds the union of the resolved IPs */
+    update = ds_tree_head(&g_dns_mgr->tag_updates);
+    TEST_ASSERT_NOT_NULL(update);
+    TEST_ASSERT_NULL(ds_tree_next(&g_dns_mgr->tag_updates, update));
+    TEST_ASSERT_TRUE(update->dirty);
+    TEST_ASSERT_FALSE(update->local);
+    TEST_ASSERT_EQUAL_STRING(g_tags[0].name, update->regular_tag->name);
+    TEST_ASSERT_EQUAL_INT(3, update->regular_tag->device_value_len);
+    TEST_ASSERT_TRUE(ev_is_active(&g_dns_mgr->tag_flush_timer));
+
+    dns_flush_tag_updates();
+    TEST_ASSERT_NULL(ds_tree_head(&g_dns_mgr->tag_updates));
+    TEST_ASSERT_FALSE(ev_is_active(&g_dns_mgr->tag_flush_timer));
+
+    for (i = 0; i < req.dns_response.ipv4_cnt; i++)
+    {
+        FREE(req.dns_response.ipv4_addrs[i]);
+    }
+    g_dns_mgr->loop = NULL;
+}
+
+
+/**
+ * @brief test the allocation free parsing of a type A response
+ */
+void
+test_compact_parse(void)
+{
+    struct pcap_pkthdr header;
+    struct dns_rr_ref *answer;
+    uint8_t packet[sizeof(pkt47)];
+    char name[256];
+    dns_info dns;
+    uint32_t pos;
+    size_t i;
+    bool rc;
+
+    /* The dns message starts after the ethernet, IPv4 and UDP headers */
+    memcpy(packet, pkt47, sizeof(pkt47));
+    header.caplen = sizeof(packet);
+    header.len = sizeof(packet);
+
+    pos = dns_parse_compact(42, &header, packet, &dns);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(packet), pos);
+    TEST_ASSERT_EQUAL_INT(1, dns.qr);
+    TEST_ASSERT_EQUAL_UINT16(1, dns.nqueries);
+    TEST_ASSERT_EQUAL_UINT16(8, dns.nanswers);
+    TEST_ASSERT_NULL(dns.queries);
+    TEST_ASSERT_NULL(dns.answers);
+    TEST_ASSERT_EQUAL_UINT16(1, dns.query_refs[0].type);
+
+    rc = read_rr_name_into(packet, dns.query_refs[0].name_pos, dns.id_pos,
+                           header.len, name, sizeof(name));
+    TEST_ASSERT_TRUE(rc);
+    TEST_ASSERT_EQUAL_STRING("receive-lp1.dg.srv.nintendo.net", name);
+
+    for (i = 0; i < dns.nanswers; i++)
+    {
+        answer = &dns.answer_refs[i];
+        TEST_ASSERT_EQUAL_UINT16(1, answer->type);
+        TEST_ASSERT_EQUAL_UINT16(1, answer->cls);
+        TEST_ASSERT_EQUAL_UINT32(57, answer->ttl);
+        TEST_ASSERT_EQUAL_UINT16(4, answer->rdlength);
+
+        /* Answer names are compressed pointers to the question name */
+        rc = read_rr_name_into(packet, answer->name_pos, dns.id_pos,
+                               header.len, name, sizeof(name));
+        TEST_ASSERT_TRUE(rc);
+        TEST_ASSERT_EQUAL_STRING("receive-lp1.dg.srv.nintendo.net", name);
+    }
+    answer = &dns.answer_refs[0];
+    TEST_ASSERT_EQUAL_UINT8(0x22, packet[answer->type_pos + 10]);
+
+    /* The name does not fit */
+    rc = read_rr_name_into(packet, dns.query_refs[0].name_pos, dns.id_pos,
+                           header.len, name, 8);
+    TEST_ASSERT_FALSE(rc);
+
+    /* Truncated message */
+    header.len = sizeof(packet) - 2;
+    pos = dns_parse_compact(42, &header, packet, &dns);
+    TEST_ASSERT_EQUAL_UINT32(0, pos);
+    TEST_ASSERT_EQUAL_UINT16(7, dns.nanswers);
+}
+
+
+/**
+ * @brief test IP fragments reassembly
+ */
+void
+test_ip_frag_reassembly(void)
+{
+    ip_fragment *datagram;
+    uint8_t payload[3000];
+    ip_fragment frags[3];
+    ip_fragment other;
+    ip_config conf;
+    size_t i;
+
+    memset(&conf, 0, sizeof(conf));
+    for (i = 0; i < sizeof(payload); i++) payload[i] = (uint8_t)i;
+
+    memset(frags, 0, sizeof(frags));
+    for (i = 0; i < 3; i++)
+    {
+        frags[i].id = 0x1234;
+        frags[i].proto = UDP;
+        frags[i].src.vers = IPv4;
+        frags[i].src.addr.v4.s_addr = htonl(0x0a010001);
+        frags[i].dst.vers = IPv4;
+        frags[i].dst.addr.v4.s_addr = htonl(0x0a010040);
+        frags[i].start = i * 1480;
+        frags[i].end = (i == 2 ? sizeof(payload) : (i + 1) * 1480);
+        frags[i].data = payload + frags[i].start;
+        frags[i].islast = (i == 2);
+    }
+
+    /* A fragment of another datagram from the same source */
+    other = frags[0];
+    other.id = 0x4321;
+
+    /* Out of order, with a duplicate and an interleaved datagram */
+    TEST_ASSERT_NULL(ip_frag_add(&frags[1], &conf));
+    TEST_ASSERT_NULL(ip_frag_add(&other, &conf));
+    TEST_ASSERT_NULL(ip_frag_add(&frags[2], &conf));
+    TEST_ASSERT_NULL(ip_frag_add(&frags[1], &conf));
+    datagram = ip_frag_add(&frags[0], &conf);
+    TEST_ASSERT_NOT_NULL(datagram);
+    TEST_ASSERT_EQUAL_UINT32(0, datagram->start);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(payload), datagram->end);
+    TEST_ASSERT_EQUAL_MEMORY(payload, datagram->data, sizeof(payload));
+    TEST_ASSERT_EQUAL_UINT32(0, conf.frag_dropped);
+
+    /* Only the interleaved datagram is still pending */
+    TEST_ASSERT_EQUAL_PTR(ds_dlist_head(&conf.frag_inuse),
+                          ds_dlist_tail(&conf.frag_inuse));
+
+    /* Datagrams larger than the reassembly buffers are dropped */
+    other.start = IP_FRAG_MAX_LEN;
+    other.end = IP_FRAG_MAX_LEN + 8;
+    TEST_ASSERT_NULL(ip_frag_add(&other, &conf));
+    TEST_ASSERT_EQUAL_UINT32(1, conf.frag_dropped);
+    TEST_ASSERT_TRUE(ds_dlist_is_empty(&conf.frag_inuse));
+
+    ip_frag_free(&conf);
+}
+
 
 int main(int argc, char *argv[])
 {
@@ -1314,6 +1495,9 @@ int main(int argc, char *argv[])
     RUN_TEST(test_update_v4_tag_generation_ip_expiration);
     RUN_TEST(test_update_v6_tag_generation_ip_expiration);
     RUN_TEST(test_gk_dns_cache);
+    RUN_TEST(test_deferred_tag_updates);
+    RUN_TEST(test_compact_parse);
+    RUN_TEST(test_ip_frag_reassembly);
 
     return UNITY_END();
 }
@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DS_WHEEL_H_INCLUDED
+#define DS_WHEEL_H_INCLUDED
+
+#include <stddef.h>
+#include <time.h>
+
+#include "ds.h"
+#include "ds_dlist.h"
+
+/*
+ * ============================================================
+ *  Hashed timer wheel
+ * ============================================================
+ *
+ * Elements are hashed by their expiry time (in seconds) into
+ * DS_WHEEL_SLOTS slots. Expiring elements only walks the slots of the
+ * seconds elapsed since the previous call; elements expiring more than
+ * one rotation away stay in their slot and are skipped until their
+ * rotation comes.
+ */
+
+#define DS_WHEEL_SLOTS                  512     /**< One-second slots, a rotation is ~8.5 minutes */
+
+/** Run-time initialization */
+#define ds_wheel_init(wheel, type, elem)    __ds_wheel_init(wheel, offsetof(type, elem))
+
+typedef struct ds_wheel             ds_wheel_t;
+typedef struct ds_wheel_node        ds_wheel_node_t;
+
+/**
+ * Wheel node, zero initialized nodes are not armed
+ */
+struct ds_wheel_node
+{
+    ds_dlist_node_t     dwn_lnode;          /**< Slot list node             */
+    ds_dlist_t*         dwn_list;           /**< Holding list, NULL if the
+                                                 node is not armed          */
+    time_t              dwn_expiry;         /**< Expiry time                */
+};
+
+/**
+ * Timer wheel
+ */
+struct ds_wheel
+{
+    size_t              dw_cof;             /**< Container offset           */
+    time_t              dw_tick;            /**< Next second to process     */
+    size_t              dw_count;           /**< Number of armed nodes      */
+    ds_dlist_t          dw_expired;         /**< Expired, not yet returned  */
+    ds_dlist_t          dw_slot[DS_WHEEL_SLOTS];
+};
+
+/*
+ * ===========================================================================
+ *  Public API
+ * ===========================================================================
+ */
+extern void     __ds_wheel_init(ds_wheel_t *wheel, size_t cof);
+
+/**
+ * Arm @p data to expire at @p expiry; an already armed element is re-armed
+ */
+extern void     ds_wheel_insert(ds_wheel_t *wheel, void *data, time_t expiry);
+
+/**
+ * Disarm @p data; no-op if the element is not armed
+ */
+extern void     ds_wheel_remove(ds_wheel_t *wheel, void *data);
+
+/**
+ * Return and disarm the next element which expired at @p now, or NULL
+ * when there are none left. Callers are expected to loop until NULL is
+ * returned; the returned element may be freed right away.
+ */
+extern void    *ds_wheel_expire(ds_wheel_t *wheel, time_t now);
+
+static inline size_t ds_wheel_count(ds_wheel_t *wheel)
+{
+    return wheel->dw_count;
+}
+
+#endif /* DS_WHEEL_H_INCLUDED */
@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "ds_wheel.h"
+
+#define DWN(wheel, data)    ((ds_wheel_node_t *)CONT_TO_NODE(data, (wheel)->dw_cof))
+
+/**
+ * Timer wheel run-time initializer
+ */
+void __ds_wheel_init(ds_wheel_t *wheel, size_t cof)
+{
+    size_t lcof;
+    size_t i;
+
+    /* The slot lists link the containers through the wheel node */
+    lcof = cof + offsetof(ds_wheel_node_t, dwn_lnode);
+
+    wheel->dw_cof   = cof;
+    wheel->dw_tick  = 0;
+    wheel->dw_count = 0;
+
+    __ds_dlist_init(&wheel->dw_expired, lcof);
+    for (i = 0; i < DS_WHEEL_SLOTS; i++)
+    {
+        __ds_dlist_init(&wheel->dw_slot[i], lcof);
+    }
+}
+
+void ds_wheel_insert(ds_wheel_t *wheel, void *data, time_t expiry)
+{
+    ds_wheel_node_t *node = DWN(wheel, data);
+
+    ds_wheel_remove(wheel, data);
+
+    node->dwn_expiry = expiry;
+
+    /* The slot of an already processed second would only be visited in
+     * the next rotation */
+    if (expiry < wheel->dw_tick)
+        node->dwn_list = &wheel->dw_expired;
+    else
+        node->dwn_list = &wheel->dw_slot[expiry % DS_WHEEL_SLOTS];
+
+    ds_dlist_insert_tail(node->dwn_list, data);
+    wheel->dw_count++;
+}
+
+void ds_wheel_remove(ds_wheel_t *wheel, void *data)
+{
+    ds_wheel_node_t *node = DWN(wheel, data);
+
+    if (node->dwn_list == NULL) return;
+
+    ds_dlist_remove(node->dwn_list, data);
+    node->dwn_list = NULL;
+    wheel->dw_count--;
+}
+
+void *ds_wheel_expire(ds_wheel_t *wheel, time_t now)
+{
+    ds_wheel_node_t *node;
+    ds_dlist_t *slot;
+    void *data;
+    void *next;
+
+    /* The clock went backwards, restart from the current time */
+    if (now + 1 < wheel->dw_tick) wheel->dw_tick = now;
+
+    /* Each slot needs to be visited only once per call */
+    if (now - wheel->dw_tick >= DS_WHEEL_SLOTS) wheel->dw_tick = now - DS_WHEEL_SLOTS + 1;
+
+    while (ds_dlist_is_empty(&wheel->dw_expired) && wheel->dw_tick <= now)
+    {
+        slot = &wheel->dw_slot[wheel->dw_tick % DS_WHEEL_SLOTS];
+        for (data = ds_dlist_head(slot); data != NULL; data = next)
+        {
+            next = ds_dlist_next(slot, data);
+
+            /* Expires in a later rotation */
+            node = DWN(wheel, data);
+            if (node->dwn_expiry > now) continue;
+
+            ds_dlist_remove(slot, data);
+            ds_dlist_insert_tail(&wheel->dw_expired, data);
+            node->dwn_list = &wheel->dw_expired;
+        }
+        wheel->dw_tick++;
+    }
+
+    while ((data = ds_dlist_remove_head(&wheel->dw_expired)) != NULL)
+    {
+        node = DWN(wheel, data);
+
+        /* Only possible if the clock went backwards since it was armed */
+        if (node->dwn_expiry > now)
+        {
+            node->dwn_list = &wheel->dw_slot[node->dwn_expiry % DS_WHEEL_SLOTS];
+            ds_dlist_insert_tail(node->dwn_list, data);
+            continue;
+        }
+
+        node->dwn_list = NULL;
+        wheel->dw_count--;
+        return data;
+    }
+
+    return NULL;
+}
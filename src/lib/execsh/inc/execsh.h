@@ -27,11 +27,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef EXECSH_H_INCLUDED
 #define EXECSH_H_INCLUDED
 
+#include <sys/types.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdarg.h>
 
+#include <ev.h>
+
 #include "const.h"
+#include "read_until.h"
 
 #define EXECSH_SHELL_PATH       "/bin/sh"
 
@@ -82,4 +86,60 @@ int execsh_log_a(int severity, const char *script, char *argv[]);
 #define execsh_log(severity, script, ...) \
     execsh_log_a(severity, script, C_VPACK(__VA_ARGS__))
 
+/*
+ * Asynchronous execsh
+ *
+ * The script is started and the function returns immediately; the output is
+ * processed and the completion callback is invoked from the EV_DEFAULT loop
+ * (ev_child watchers work only with the default loop).
+ *
+ * Example:
+ *
+ *      static void done_fn(execsh_async_t *esa, int exit_status) { ... }
+ *
+ *      static execsh_async_t esa;
+ *      execsh_async_init(&esa, done_fn);
+ *      execsh_async_start(&esa, _S(ip link set "$1" up), "eth0");
+ */
+typedef struct execsh_async execsh_async_t;
+
+/*
+ * Completion callback; @p exit_status is the exit code of the script or -1
+ * if the script was terminated by a signal. The callback is invoked after
+ * the script exited and all of its output was processed; it's safe to
+ * restart the object from the callback.
+ */
+typedef void execsh_async_fn_t(execsh_async_t *esa, int exit_status);
+
+struct execsh_async
+{
+    execsh_async_fn_t  *esa_fn;             /* Completion callback */
+    execsh_fn_t        *esa_io_fn;          /* Output callback or NULL to log output */
+    void               *esa_io_ctx;         /* Output callback context */
+    int                 esa_severity;       /* Output log severity if esa_io_fn is NULL */
+    void               *esa_data;           /* User data */
+    pid_t               esa_pid;            /* PID of the running script or -1 */
+    bool                esa_exited;         /* True if the script exited */
+    int                 esa_exit_status;    /* Exit status, valid if esa_exited is true */
+    char               *esa_script;         /* Copy of the script */
+    const char         *esa_pscript;        /* Current script write position */
+    struct ev_loop     *esa_loop;           /* Loop of the I/O watchers */
+    ev_child            esa_child;          /* Child watcher */
+    ev_io               esa_stdin;          /* Script stdin watcher */
+    ev_io               esa_stdout;         /* Script stdout watcher */
+    read_until_t        esa_stdout_ru;
+    char                esa_stdout_buf[EXECSH_PIPE_BUF];
+    ev_io               esa_stderr;         /* Script stderr watcher */
+    read_until_t        esa_stderr_ru;
+    char                esa_stderr_buf[EXECSH_PIPE_BUF];
+};
+
+void execsh_async_init(execsh_async_t *self, execsh_async_fn_t *fn);
+void execsh_async_set_io(execsh_async_t *self, execsh_fn_t *io_fn, void *ctx);
+bool execsh_async_start_a(execsh_async_t *self, const char *script, char *argv[]);
+void execsh_async_stop(execsh_async_t *self);
+
+#define execsh_async_start(self, script, ...) \
+    execsh_async_start_a(self, script, C_VPACK(__VA_ARGS__))
+
 #endif /* EXECSH_H_INCLUDED */
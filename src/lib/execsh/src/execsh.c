@@ -26,12 +26,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 
 #include <ev.h>
 
@@ -41,33 +43,24 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "execsh.h"
 #include "memutil.h"
 
-static void execsh_closefrom(int fd);
+static void execsh_closefrom(int fd, int maxfd);
 static bool execsh_set_nonblock(int fd, bool enable);
 static pid_t execsh_pspawn(const char *path, char *argv[], int fdin, int fdout, int fderr);
+static bool execsh_spawn(execsh_async_t *self, struct ev_loop *loop, char *argv[]);
+static bool execsh_io_active(execsh_async_t *self);
+static void execsh_io_stop(execsh_async_t *self);
+static int execsh_exit_status(int wstat);
+static void execsh_async_complete(execsh_async_t *self);
 static bool __execsh_log(void *ctx, int type, const char *msg);
 
 static void __execsh_fn_std_write(struct ev_loop *loop, ev_io *w, int revent);
 static void __execsh_fn_std_read(struct ev_loop *loop, ev_io *w, int revent);
+static void __execsh_async_child(struct ev_loop *loop, ev_child *w, int revent);
 
 /* pipe() indexes */
 #define P_RD    0       /* Read end */
 #define P_WR    1       /* Write end */
 
-/**
- * execsh_fn() this is the main execsh function -- all other functions are based on this one.
- */
-struct __execsh
-{
-    const char      *pscript;
-    execsh_fn_t     *fn;
-    void            *ctx;
-    int             stdin_fd;
-    int             stdout_fd;
-    read_until_t    stdout_ru;
-    int             stderr_fd;
-    read_until_t    stderr_ru;
-};
-
 int execsh_fn_v(execsh_fn_t *fn, void *ctx, const char *script, va_list __argv)
 {
     int retval = -1;
@@ -107,19 +100,188 @@ exit:
     return retval;
 }
 
-int execsh_fn_a(execsh_fn_t *fn, void *ctx, const char *script, char *__argv[])
+/**
+ * execsh_fn() this is the main synchronous execsh function -- all other
+ * synchronous functions are based on this one.
+ *
+ * The script I/O is processed in a private loop, the function returns after
+ * the script terminates.
+ */
+int execsh_fn_a(execsh_fn_t *fn, void *ctx, const char *script, char *argv[])
 {
-    struct __execsh es;
+    execsh_async_t es;
     int wstat;
 
-    pid_t cpid = -1;
     int retval = -1;
+    struct ev_loop *loop = NULL;
+
+    execsh_async_init(&es, NULL);
+    execsh_async_set_io(&es, fn, ctx);
+    es.esa_pscript = script;
+
+    loop = ev_loop_new(EVFLAG_AUTO);
+    if (loop == NULL)
+    {
+        LOG(ERR, "execsh: Error creating loop, execsh() failed.");
+        goto exit;
+    }
+
+    if (!execsh_spawn(&es, loop, argv))
+    {
+        LOG(ERR, "execsh: Error executing: %s", script);
+        goto exit;
+    }
+
+    /* Loop until all watchers are active */
+    while (ev_run(loop, EVRUN_ONCE))
+    {
+        if (!execsh_io_active(&es)) break;
+    }
+
+    /* Wait for the process to terminate */
+    if (waitpid(es.esa_pid, &wstat, 0) <= 0)
+    {
+        LOG(ERR, "execsh: Error waiting on child.");
+        goto exit;
+    }
+
+    retval = execsh_exit_status(wstat);
+
+exit:
+    execsh_io_stop(&es);
+
+    if (loop != NULL) ev_loop_destroy(loop);
+
+    return retval;
+}
+
+/*
+ * ===========================================================================
+ *  Asynchronous execsh
+ * ===========================================================================
+ */
+void execsh_async_init(execsh_async_t *self, execsh_async_fn_t *fn)
+{
+    memset(self, 0, sizeof(*self));
+
+    self->esa_fn = fn;
+    self->esa_severity = LOG_SEVERITY_INFO;
+    self->esa_pid = -1;
+
+    ev_io_init(&self->esa_stdin, __execsh_fn_std_write, -1, EV_WRITE);
+    ev_io_init(&self->esa_stdout, __execsh_fn_std_read, -1, EV_READ);
+    ev_io_init(&self->esa_stderr, __execsh_fn_std_read, -1, EV_READ);
+}
+
+/**
+ * Set the output callback; if @p io_fn is NULL, the script output is logged
+ */
+void execsh_async_set_io(execsh_async_t *self, execsh_fn_t *io_fn, void *ctx)
+{
+    self->esa_io_fn = io_fn;
+    self->esa_io_ctx = ctx;
+}
+
+bool execsh_async_start_a(execsh_async_t *self, const char *script, char *argv[])
+{
+    if (self->esa_pid > 0)
+    {
+        LOG(ERR, "execsh: Asynchronous script already running (pid %jd).", (intmax_t)self->esa_pid);
+        return false;
+    }
+
+    self->esa_script = STRDUP(script);
+    self->esa_pscript = self->esa_script;
+    self->esa_exited = false;
+    self->esa_exit_status = -1;
+
+    if (!execsh_spawn(self, EV_DEFAULT, argv))
+    {
+        LOG(ERR, "execsh: Error executing: %s", script);
+        FREE(self->esa_script);
+        self->esa_script = NULL;
+        return false;
+    }
+
+    ev_child_init(&self->esa_child, __execsh_async_child, self->esa_pid, 0);
+    self->esa_child.data = self;
+    ev_child_start(EV_DEFAULT, &self->esa_child);
+
+    return true;
+}
+
+/**
+ * Stop watching the script and kill it; the completion callback is not
+ * invoked
+ */
+void execsh_async_stop(execsh_async_t *self)
+{
+    if (self->esa_pid <= 0) return;
+
+    execsh_io_stop(self);
+
+    if (ev_is_active(&self->esa_child))
+    {
+        ev_child_stop(EV_DEFAULT, &self->esa_child);
+        /* The zombie is reaped by the libev SIGCHLD handler */
+        kill(self->esa_pid, SIGKILL);
+    }
+
+    FREE(self->esa_script);
+    self->esa_script = NULL;
+    self->esa_pid = -1;
+}
+
+void __execsh_async_child(struct ev_loop *loop, ev_child *w, int revent)
+{
+    (void)revent;
+
+    execsh_async_t *self = w->data;
+
+    ev_child_stop(loop, w);
+
+    self->esa_exited = true;
+    self->esa_exit_status = execsh_exit_status(w->rstatus);
+
+    execsh_async_complete(self);
+}
+
+/*
+ * Invoke the completion callback once the script exited and all of its output
+ * was processed
+ */
+void execsh_async_complete(execsh_async_t *self)
+{
+    if (self->esa_fn == NULL) return;
+    if (!self->esa_exited || execsh_io_active(self)) return;
+
+    /* Stdin may be still open if the script exited before reading all input */
+    execsh_io_stop(self);
+
+    FREE(self->esa_script);
+    self->esa_script = NULL;
+    self->esa_pid = -1;
+
+    self->esa_fn(self, self->esa_exit_status);
+}
+
+/*
+ * ===========================================================================
+ *  Common functions
+ * ===========================================================================
+ */
 
-    int pin[2] = { -1 };
-    int pout[2] = { -1 };
-    int perr[2] = { -1 };
+/*
+ * Spawn the shell and start the I/O watchers
+ */
+bool execsh_spawn(execsh_async_t *self, struct ev_loop *loop, char *__argv[])
+{
+    int pin[2] = { -1, -1 };
+    int pout[2] = { -1, -1 };
+    int perr[2] = { -1, -1 };
     char **argv = NULL;
-    struct ev_loop *loop = NULL;
+    bool retval = false;
+    int ii;
 
     /**
      * Create STDIN/STDOUT/STDERR: common pipes
@@ -173,10 +335,9 @@ int execsh_fn_a(execsh_fn_t *fn, void *ctx, const char *script, char *__argv[])
     argv[argc] = NULL;
 
     /* Run the child */
-    cpid = execsh_pspawn(EXECSH_SHELL_PATH, argv, pin[P_RD],  pout[P_WR], perr[P_WR]);
-    if (cpid < 0)
+    self->esa_pid = execsh_pspawn(EXECSH_SHELL_PATH, argv, pin[P_RD],  pout[P_WR], perr[P_WR]);
+    if (self->esa_pid < 0)
     {
-        LOG(ERR, "execsh: Error executing: %s", script);
         goto exit;
     }
 
@@ -185,72 +346,83 @@ int execsh_fn_a(execsh_fn_t *fn, void *ctx, const char *script, char *__argv[])
     close(pout[P_WR]); pout[P_WR] = -1;
     close(perr[P_WR]); perr[P_WR] = -1;
 
-    /* Callback context */
-    char outbuf[EXECSH_PIPE_BUF];
-    char errbuf[EXECSH_PIPE_BUF];
-
-    es.fn = fn;
-    es.ctx = ctx;
-    es.pscript = script;
-    es.stdin_fd = pin[P_WR];
-    es.stdout_fd = pout[P_RD];
-    es.stderr_fd = perr[P_RD];
-
-    read_until_init(&es.stdout_ru, outbuf, sizeof(outbuf));
-    read_until_init(&es.stderr_ru, errbuf, sizeof(errbuf));
+    read_until_init(&self->esa_stdout_ru, self->esa_stdout_buf, sizeof(self->esa_stdout_buf));
+    read_until_init(&self->esa_stderr_ru, self->esa_stderr_buf, sizeof(self->esa_stderr_buf));
 
     /*
      * Initialize and start watchers
      */
-    ev_io win;
-    ev_io wout;
-    ev_io werr;
+    self->esa_loop = loop;
 
-    loop = ev_loop_new(EVFLAG_AUTO);
-    if (loop == NULL)
-    {
-        LOG(ERR, "execsh: Error creating loop, execsh() failed.");
-        goto exit;
-    }
-
-    ev_io_init(&win, __execsh_fn_std_write, pin[P_WR], EV_WRITE);
-    win.data = &es;
+    ev_io_init(&self->esa_stdin, __execsh_fn_std_write, pin[P_WR], EV_WRITE);
+    self->esa_stdin.data = self;
     execsh_set_nonblock(pin[P_WR], true);
-    ev_io_start(loop, &win);
+    ev_io_start(loop, &self->esa_stdin);
+    pin[P_WR] = -1;
 
-    ev_io_init(&wout, __execsh_fn_std_read, pout[P_RD], EV_READ);
-    wout.data = &es;
+    ev_io_init(&self->esa_stdout, __execsh_fn_std_read, pout[P_RD], EV_READ);
+    self->esa_stdout.data = self;
     execsh_set_nonblock(pout[P_RD], true);
-    ev_io_start(loop, &wout);
+    ev_io_start(loop, &self->esa_stdout);
+    pout[P_RD] = -1;
 
-    ev_io_init(&werr, __execsh_fn_std_read, perr[P_RD], EV_READ);
-    werr.data = &es;
+    ev_io_init(&self->esa_stderr, __execsh_fn_std_read, perr[P_RD], EV_READ);
+    self->esa_stderr.data = self;
     execsh_set_nonblock(perr[P_RD], true);
-    ev_io_start(loop, &werr);
+    ev_io_start(loop, &self->esa_stderr);
+    perr[P_RD] = -1;
 
-    /* Loop until all watchers are active */
-    while (ev_run(loop, EVRUN_ONCE))
-    {
-        bool do_loop = false;
+    retval = true;
 
-        do_loop |= ev_is_active(&win);
-        do_loop |= ev_is_active(&wout);
-        do_loop |= ev_is_active(&werr);
+exit:
+    if (argv != NULL) FREE(argv);
 
-        if (!do_loop) break;
+    for (ii = 0; ii < 2; ii++)
+    {
+        if (pin[ii] >= 0) close(pin[ii]);
+        if (pout[ii] >= 0) close(pout[ii]);
+        if (perr[ii] >= 0) close(perr[ii]);
     }
 
-    /* Wait for the process to terminate */
-    if (waitpid(cpid, &wstat, 0) <= 0)
+    return retval;
+}
+
+/*
+ * Return true if the stdout/stderr watchers are still active
+ */
+bool execsh_io_active(execsh_async_t *self)
+{
+    bool active = false;
+
+    active |= ev_is_active(&self->esa_stdout);
+    active |= ev_is_active(&self->esa_stderr);
+
+    return active;
+}
+
+/*
+ * Stop all I/O watchers and close the pipes
+ */
+void execsh_io_stop(execsh_async_t *self)
+{
+    ev_io *w[] = { &self->esa_stdin, &self->esa_stdout, &self->esa_stderr };
+    int ii;
+
+    for (ii = 0; ii < ARRAY_LEN(w); ii++)
     {
-        LOG(ERR, "execsh: Error waiting on child.");
-        goto exit;
+        if (!ev_is_active(w[ii])) continue;
+
+        ev_io_stop(self->esa_loop, w[ii]);
+        close(w[ii]->fd);
     }
+}
 
+int execsh_exit_status(int wstat)
+{
     if (WIFSIGNALED(wstat))
     {
         LOG(ERR, "execsh: Process terminated by signal %d.", WTERMSIG(wstat));
-        goto exit;
+        return -1;
     }
 
     if (!WIFEXITED(wstat))
@@ -259,41 +431,26 @@ int execsh_fn_a(execsh_fn_t *fn, void *ctx, const char *script, char *__argv[])
          * Process was not terminated by signal and did not exit
          */
         LOG(ERR, "execsh: Unable to retrieve process status.");
-        goto exit;
-    }
-
-    retval = WEXITSTATUS(wstat);
-
-exit:
-    if (loop != NULL) ev_loop_destroy(loop);
-
-    if (argv != NULL) FREE(argv);
-
-    int ii;
-    for (ii = 0; ii < 2; ii++)
-    {
-        if (pin[ii] >= 0) close(pin[ii]);
-        if (pout[ii] >= 0) close(pout[ii]);
-        if (perr[ii] >= 0) close(perr[ii]);
+        return -1;
     }
 
-    return retval;
+    return WEXITSTATUS(wstat);
 }
 
 void __execsh_fn_std_write(struct ev_loop *loop, ev_io *w, int revent)
 {
-    struct __execsh *pes = w->data;
+    execsh_async_t *pes = w->data;
 
     if (!(revent & EV_WRITE)) return;
 
     ssize_t nwr;
 
-    while ((nwr = write(w->fd, pes->pscript, strlen(pes->pscript))) > 0)
+    while ((nwr = write(w->fd, pes->esa_pscript, strlen(pes->esa_pscript))) > 0)
     {
-        pes->pscript += nwr;
+        pes->esa_pscript += nwr;
 
         /* Did we reach the end of the string? */
-        if (pes->pscript[0] == '\0')
+        if (pes->esa_pscript[0] == '\0')
         {
             break;
         }
@@ -308,22 +465,22 @@ void __execsh_fn_std_write(struct ev_loop *loop, ev_io *w, int revent)
 
 void __execsh_fn_std_read(struct ev_loop *loop, ev_io *w, int revent)
 {
-    struct __execsh *pes = w->data;
+    execsh_async_t *pes = w->data;
 
     int type = 0;
     read_until_t *ru = NULL;
 
     if (!(revent & EV_READ)) return;
 
-    if (w->fd == pes->stdout_fd)
+    if (w == &pes->esa_stdout)
     {
         type = EXECSH_PIPE_STDOUT;
-        ru = &pes->stdout_ru;
+        ru = &pes->esa_stdout_ru;
     }
-    else if (w->fd == pes->stderr_fd)
+    else if (w == &pes->esa_stderr)
     {
         type = EXECSH_PIPE_STDERR;
-        ru = &pes->stderr_ru;
+        ru = &pes->esa_stderr_ru;
     }
 
     if (type == 0 || ru == NULL) return;
@@ -334,20 +491,32 @@ void __execsh_fn_std_read(struct ev_loop *loop, ev_io *w, int revent)
     while ((nrd = read_until(ru, &line, w->fd, "\n")) > 0)
     {
         /* Close the pipe if the callback returns false */
-        if (!pes->fn(pes->ctx, type, line)) break;
+        if (pes->esa_io_fn != NULL)
+        {
+            if (!pes->esa_io_fn(pes->esa_io_ctx, type, line)) break;
+        }
+        else
+        {
+            (void)__execsh_log(&pes->esa_severity, type, line);
+        }
     }
 
     if (nrd == -1 && errno == EAGAIN) return;
 
     ev_io_stop(loop, w);
     close(w->fd);
+
+    execsh_async_complete(pes);
 }
 
-void execsh_closefrom(int fd)
+void execsh_closefrom(int fd, int maxfd)
 {
     int ii;
 
-    int maxfd = sysconf(_SC_OPEN_MAX);
+#if defined(SYS_close_range)
+    /* Single system call on kernels that support it (5.9+) */
+    if (syscall(SYS_close_range, fd, ~0U, 0) == 0) return;
+#endif
 
     for (ii = fd; ii < maxfd; ii++) close(ii);
 }
@@ -359,6 +528,11 @@ void execsh_closefrom(int fd)
  *  - fstdin, fstdout, fstderr: file descriptors that will be used for I/O
  *    redirection or -1 if /dev/null shall be used instead
  *  - argv: null-terminated variable list of char *
+ *
+ * The process is created with vfork() -- the child borrows the address space
+ * of the parent until execv(), so the cost of spawning doesn't depend on the
+ * size of the calling process. The child may only perform system calls and
+ * must not return from this function.
  */
 pid_t execsh_pspawn(
         const char *path,
@@ -367,29 +541,59 @@ pid_t execsh_pspawn(
         int fdout,
         int fderr)
 {
+    struct sigaction sa;
+    sigset_t sigall;
+    sigset_t sigold;
     int fdevnull;
     pid_t child;
+    int maxfd;
     int flog;
     int fdi;
+    int sig;
     int rc;
 
     /* Remap fdin, fdout and fderr arguments to an array for convenience */
     int fdio[3] = { fdin, fdout, fderr };
 
-    child = fork();
-    if (child > 0)
+    maxfd = sysconf(_SC_OPEN_MAX);
+
+    /*
+     * Block all signals so that no signal handler runs in the child while it
+     * shares the address space with the parent
+     */
+    sigfillset(&sigall);
+    sigprocmask(SIG_BLOCK, &sigall, &sigold);
+
+    child = vfork();
+    if (child != 0)
     {
+        sigprocmask(SIG_SETMASK, &sigold, NULL);
+
+        if (child < 0)
+        {
+            LOG(DEBUG, "execsh: Fork failed.");
+            return -1;
+        }
+
         return child;
     }
-    else if (child < 0)
-    {
-        LOG(DEBUG, "execsh: Fork failed.");
-        return -1;
-    }
 
     // Point of no return -- below this point print messages to stderr
     flog = (fderr >= 0) ? fderr : 2;
 
+    /* Reset signal handlers to default before unblocking signals */
+    for (sig = 1; sig < NSIG; sig++)
+    {
+        if (sigaction(sig, NULL, &sa) != 0) continue;
+        if (sa.sa_handler == SIG_IGN || sa.sa_handler == SIG_DFL) continue;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = SIG_DFL;
+        sigaction(sig, &sa, NULL);
+    }
+
+    sigprocmask(SIG_SETMASK, &sigold, NULL);
+
     /*
      * In case there's a gap between file descriptors 0..2, fill it with
      * references to /dev/null
@@ -446,7 +650,7 @@ pid_t execsh_pspawn(
     }
 
     // Close all other file descriptors
-    execsh_closefrom(3);
+    execsh_closefrom(3, maxfd);
 
     execv(path, argv);
 
@@ -489,4 +693,3 @@ int execsh_log_a(int severity, const char *script, char *argv[])
 {
     return execsh_fn_a(__execsh_log, &severity, script, argv);
 }
-
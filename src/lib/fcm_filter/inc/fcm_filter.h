@@ -33,6 +33,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ds_dlist.h"
 #include "network_metadata.h"
 #include "network_metadata_report.h"
+#include "os_types.h"
+#include "policy_tags.h"
 #include "schema.h"
 
 enum {
@@ -86,6 +88,76 @@ struct ip_port
     uint16_t port_max;  /* if it set to 0 then no range */
 };
 
+#define FCM_FILTER_IP_BIN_SIZE 16
+
+/**
+ * @brief ip address or prefix compiled from a filter rule value
+ */
+struct fcm_filter_ip_prefix
+{
+    uint8_t family;     /* AF_INET or AF_INET6 */
+    uint8_t prefix_len; /* full length for host entries */
+    uint8_t addr[FCM_FILTER_IP_BIN_SIZE];
+};
+
+/**
+ * @brief mac set compiled from a filter rule
+ *
+ * Literal macs are stored in binary form, sorted for a binary search.
+ * Tag references are resolved to interned tag handles. Values which could
+ * not be parsed as macs are kept as strings, pointing into the rule's
+ * original str_set.
+ */
+struct fcm_filter_mac_set
+{
+    os_macaddr_t *macs;
+    size_t nmacs;
+    om_tag_handle_t **tags;
+    size_t ntags;
+    char **strs;
+    size_t nstrs;
+};
+
+/**
+ * @brief ip set compiled from a filter rule
+ *
+ * Host entries are sorted for a binary search, CIDR entries are
+ * matched against each prefix. Tag references are resolved to interned
+ * tag handles. Unparsed values are kept as strings, pointing into the
+ * rule's original str_set.
+ */
+struct fcm_filter_ip_set
+{
+    struct fcm_filter_ip_prefix *hosts;
+    size_t nhosts;
+    struct fcm_filter_ip_prefix *prefixes;
+    size_t nprefixes;
+    om_tag_handle_t **tags;
+    size_t ntags;
+    char **strs;
+    size_t nstrs;
+};
+
+#define FCM_FILTER_PORT_MAP_SIZE (65536 / 8)
+#define FCM_FILTER_VLAN_MAP_SIZE (4096 / 8)
+#define FCM_FILTER_PROTO_MAP_SIZE (256 / 8)
+
+/**
+ * @brief filter rule compiled into binary predicates at config time
+ */
+struct fcm_filter_compiled
+{
+    struct fcm_filter_mac_set smac;
+    struct fcm_filter_mac_set dmac;
+    uint8_t *vlanid_map;
+    struct fcm_filter_ip_set src_ip;
+    struct fcm_filter_ip_set dst_ip;
+    uint8_t *src_port_map;
+    uint8_t *dst_port_map;
+    uint8_t proto_map[FCM_FILTER_PROTO_MAP_SIZE];
+    bool has_tags;
+};
+
 struct fcm_filter_rule
 {
     char *name;
@@ -127,6 +199,7 @@ struct fcm_filter_rule
     struct str_set *app_tags;
     ds_tree_t *other_config;
     int action;
+    struct fcm_filter_compiled compiled;
 };
 
 struct fcm_filter
@@ -149,12 +222,56 @@ struct fcm_filter_mgr
 #define FCM_MAX_FILTERS 60
 #define FILTER_NAME_SIZE 32
 
+/* Number of entries of the per table results cache. Must be a power of 2 */
+#define FCM_FILTER_CACHE_SIZE 256
+
+/**
+ * @brief key of the filter results cache
+ *
+ * The key gathers the flow fields the compiled rules evaluate.
+ * It is zeroed before being filled so it can be hashed and compared
+ * as a whole.
+ */
+struct fcm_filter_cache_key
+{
+    os_macaddr_t smac;
+    os_macaddr_t dmac;
+    uint8_t src_ip[FCM_FILTER_IP_BIN_SIZE];
+    uint8_t dst_ip[FCM_FILTER_IP_BIN_SIZE];
+    uint16_t sport;
+    uint16_t dport;
+    uint16_t vlan_id;
+    uint8_t l4_proto;
+    uint8_t ip_type;
+    uint8_t flags;
+};
+
+/**
+ * @brief filter results cache entry
+ *
+ * match_map holds one bit per rule index, set when the rule's l2/l3
+ * predicates matched the key. The entry is valid as long as both the
+ * table and the tags generations are unchanged.
+ */
+struct fcm_filter_cache_entry
+{
+    struct fcm_filter_cache_key key;
+    uint64_t match_map;
+    uint32_t table_gen;
+    uint32_t tag_gen;
+    bool valid;
+};
+
 struct filter_table
 {
     char name[FILTER_NAME_SIZE];
     ds_tree_t filters;
     ds_dlist_t filter_rules;
     struct fcm_filter *lookup_array[FCM_MAX_FILTERS];
+    uint32_t generation;
+    struct fcm_filter_cache_entry *cache;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
     ds_tree_node_t table_node;
 };
 
@@ -170,10 +287,19 @@ struct fcm_filter_client
 
 #define FCM_FILTER_IP_SIZE 128
 
+/*
+ * Callers holding binary addresses should fill src_ip_bin and dst_ip_bin
+ * (network order, sized per ip_type) and set ip_bin_set, leaving the
+ * string representations empty. The strings are then only built when a
+ * rule references a tag.
+ */
 typedef struct fcm_filter_l3_info
 {
     char        src_ip[FCM_FILTER_IP_SIZE];
     char        dst_ip[FCM_FILTER_IP_SIZE];
+    uint8_t     src_ip_bin[FCM_FILTER_IP_BIN_SIZE];
+    uint8_t     dst_ip_bin[FCM_FILTER_IP_BIN_SIZE];
+    bool        ip_bin_set;
     uint16_t    sport;
     uint16_t    dport;
     uint8_t     l4_proto;
@@ -187,10 +313,17 @@ typedef struct fcm_filter_l3_info
 
 #define FCM_FILTER_MAC_SIZE 18
 
+/*
+ * Callers holding binary macs should fill smac_bin and dmac_bin and set
+ * mac_bin_set, leaving the string representations empty.
+ */
 typedef struct fcm_filter_l2_info
 {
     char            src_mac[FCM_FILTER_MAC_SIZE];
     char            dst_mac[FCM_FILTER_MAC_SIZE];
+    os_macaddr_t    smac_bin;
+    os_macaddr_t    dmac_bin;
+    bool            mac_bin_set;
     unsigned int    vlan_id;
     unsigned int    eth_type;
     bool        smac_op_exists;
@@ -233,5 +366,12 @@ void fcm_filter_client_init(void);
 void fcm_filter_register_client(struct fcm_filter_client *client);
 void fcm_filter_deregister_client(struct fcm_filter_client *client);
 void fcm_filter_update_clients(struct filter_table *table);
+int fcm_filter_compile_rule(struct fcm_filter_rule *rule);
+void fcm_filter_free_compiled(struct fcm_filter_rule *rule);
+bool fcm_filter_mac_set_match(struct fcm_filter_mac_set *set,
+                              os_macaddr_t *mac);
+bool fcm_filter_ip_set_match(struct fcm_filter_ip_set *set, int family,
+                             uint8_t *addr);
+void fcm_filter_table_invalidate(struct filter_table *table);
 
 #endif /* FCM_FILTER_H_INCLUDED */
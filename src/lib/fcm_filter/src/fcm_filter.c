@@ -26,6 +26,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <arpa/inet.h>
+#include "os_nif.h"
 #include "util.h"
 #include "ovsdb.h"
 #include "ovsdb_table.h"
@@ -201,34 +203,35 @@ bool fcm_app_name_in_set(struct fcm_filter_rule *app, struct flow_key *fkey)
     return false;
 }
 
+#define FCM_FILTER_MAP_TEST(map, bit) ((map)[(bit) >> 3] & (1 << ((bit) & 7)))
+
+#define FCM_FILTER_CACHE_L2 (1 << 0)
+#define FCM_FILTER_CACHE_L3 (1 << 1)
+
 /**
- * fcm_src_ip_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
+ * @brief binary view of the flow fields evaluated by the compiled rules
  *
- * Checking the dst ip address are present set of the rule
- * Returns true if found, false otherwise.
+ * String representations are only built when a rule holds tags or values
+ * which could not be compiled.
  */
-
-static
-bool fcm_src_ip_in_set(struct fcm_filter_rule *rule, fcm_filter_l3_info_t *l3_info)
-{
-    char ipaddr[128] = { 0 };
-    size_t i = 0;
-    bool rc;
-
-    snprintf(ipaddr, sizeof(ipaddr), "%s", l3_info->src_ip);
-
-    for (i = 0; i < rule->src_ip->nelems; i++)
-    {
-        rc = fcm_find_ip_addr_in_tag(ipaddr, rule->src_ip->array[i]);
-        if (rc) return FCM_DEFAULT_TRUE;
-    }
-    return false;
-}
-
-static
-int fcm_check_option(int option, bool present)
+struct fcm_filter_flow
+{
+    fcm_filter_l2_info_t *l2_info;
+    fcm_filter_l3_info_t *l3_info;
+    struct fcm_filter_cache_key key;
+    bool smac_valid;
+    bool dmac_valid;
+    bool src_ip_valid;
+    bool dst_ip_valid;
+    bool cacheable;
+    char smac_s[FCM_FILTER_MAC_SIZE];
+    char dmac_s[FCM_FILTER_MAC_SIZE];
+    char src_ip_s[FCM_FILTER_IP_SIZE];
+    char dst_ip_s[FCM_FILTER_IP_SIZE];
+};
+
+static int
+fcm_check_option(int option, bool present)
 {
     /* No operation. Consider the rule successful. */
     if (option == FCM_OP_NONE) return FCM_DEFAULT_TRUE;
@@ -247,329 +250,463 @@ int fcm_check_app_option(int option, bool present)
     return FCM_RULED_TRUE;
 }
 
-/**
- * fcm_src_ip_filter: looks up a rule that matches unique index
- * @mgr: fcm_filter_mgr pointer to context manager
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the src ip option like in / out in the rule.
- *
- * Returns true if found ip is in set and op set to "in", false otherwise.
- */
-static
-int fcm_src_ip_filter(struct fcm_filter_mgr *mgr,
-                      struct fcm_filter_rule *rule,
-                      fcm_filter_l3_info_t *l3_info)
+static bool
+fcm_filter_ip_from_str(char *ip_s, int *family, uint8_t *addr)
 {
-    bool rc = false;
+    int rc;
+
+    rc = inet_pton(AF_INET, ip_s, addr);
+    if (rc == 1)
+    {
+        *family = AF_INET;
+        return true;
+    }
 
-    if (!rule->src_ip_rule_present) return FCM_DEFAULT_TRUE;
+    rc = inet_pton(AF_INET6, ip_s, addr);
+    if (rc == 1)
+    {
+        *family = AF_INET6;
+        return true;
+    }
 
-    rc = fcm_src_ip_in_set(rule, l3_info);
-    return fcm_check_option(rule->src_ip_op, rc);
+    return false;
 }
 
 /**
- * fcm_dst_ip_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
+ * @brief fills the binary view of the flow from the filter request
  *
- * Checking the dst ip address are present set of the rule
- * Returns true if found, false otherwise.
+ * Binary fields provided by the caller are used as is. Legacy callers
+ * providing strings only get their values parsed once per request.
  */
-
-static
-int fcm_dst_ip_in_set(struct fcm_filter_rule *rule, fcm_filter_l3_info_t *l3_info)
+static void
+fcm_filter_flow_init(struct fcm_filter_flow *flow, struct fcm_filter_req *req)
 {
-    char ipaddr[128] = { 0 };
-    size_t i = 0;
-    bool rc;
+    struct fcm_filter_cache_key *key;
+    fcm_filter_l2_info_t *l2_info;
+    fcm_filter_l3_info_t *l3_info;
+    int family;
 
-    snprintf(ipaddr, sizeof(ipaddr), "%s", l3_info->dst_ip);
+    memset(flow, 0, sizeof(*flow));
+    key = &flow->key;
 
-    for (i = 0; i < rule->dst_ip->nelems; i++)
+    l2_info = req->l2_info;
+    flow->l2_info = l2_info;
+    if (l2_info != NULL)
     {
-        rc = fcm_find_ip_addr_in_tag(ipaddr,rule->dst_ip->array[i]);
-        if (rc) return FCM_DEFAULT_TRUE;
+        key->flags |= FCM_FILTER_CACHE_L2;
+        key->vlan_id = l2_info->vlan_id;
+        if (l2_info->mac_bin_set)
+        {
+            key->smac = l2_info->smac_bin;
+            key->dmac = l2_info->dmac_bin;
+            flow->smac_valid = true;
+            flow->dmac_valid = true;
+        }
+        else
+        {
+            flow->smac_valid = os_nif_macaddr_from_str(&key->smac,
+                                                       l2_info->src_mac);
+            flow->dmac_valid = os_nif_macaddr_from_str(&key->dmac,
+                                                       l2_info->dst_mac);
+        }
     }
-    return FCM_DEFAULT_FALSE;
-}
 
-/**
- * fcm_dst_ip_filter: looks up a rule that matches unique index
- * @mgr: fcm_filter_mgr pointer to context manager
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the dst ip option like in / out in the rule.
- *
- * Returns true if found ip is in set and op set to "in", false otherwise.
- */
+    l3_info = req->l3_info;
+    flow->l3_info = l3_info;
+    if (l3_info != NULL)
+    {
+        key->flags |= FCM_FILTER_CACHE_L3;
+        key->sport = l3_info->sport;
+        key->dport = l3_info->dport;
+        key->l4_proto = l3_info->l4_proto;
+        if (l3_info->ip_bin_set)
+        {
+            key->ip_type = l3_info->ip_type;
+            memcpy(key->src_ip, l3_info->src_ip_bin, sizeof(key->src_ip));
+            memcpy(key->dst_ip, l3_info->dst_ip_bin, sizeof(key->dst_ip));
+            flow->src_ip_valid = true;
+            flow->dst_ip_valid = true;
+        }
+        else
+        {
+            family = 0;
+            flow->src_ip_valid = fcm_filter_ip_from_str(l3_info->src_ip,
+                                                        &family,
+                                                        key->src_ip);
+            key->ip_type = family;
+            flow->dst_ip_valid = fcm_filter_ip_from_str(l3_info->dst_ip,
+                                                        &family,
+                                                        key->dst_ip);
+            if (key->ip_type == 0) key->ip_type = family;
+        }
+    }
 
-static
-int fcm_dst_ip_filter(struct fcm_filter_mgr *mgr,
-                      struct fcm_filter_rule *rule,
-                      fcm_filter_l3_info_t *l3_info)
-{
-    bool rc = false;
+    /* Flows with unparsed fields can't be told apart by their binary key */
+    flow->cacheable = true;
+    if (l2_info != NULL)
+    {
+        flow->cacheable &= (flow->smac_valid && flow->dmac_valid);
+    }
+    if (l3_info != NULL)
+    {
+        flow->cacheable &= (flow->src_ip_valid && flow->dst_ip_valid);
+    }
+}
 
-    if (!rule->dst_ip_rule_present) return FCM_DEFAULT_TRUE;
+static char *
+fcm_filter_flow_mac_str(struct fcm_filter_flow *flow, bool src)
+{
+    os_macaddr_t *mac;
+    char *legacy;
+    char *mac_s;
+    bool valid;
 
-    rc = fcm_dst_ip_in_set(rule, l3_info);
-    return fcm_check_option(rule->dst_ip_op, rc);
-}
+    legacy = (src ? flow->l2_info->src_mac : flow->l2_info->dst_mac);
+    if (legacy[0] != '\0') return legacy;
 
-/**
- * fcm_sport_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
- *
- * Checking the sport are present set of the rule
- * Returns true if found, false otherwise.
- */
+    mac_s = (src ? flow->smac_s : flow->dmac_s);
+    if (mac_s[0] != '\0') return mac_s;
 
-static
-int fcm_sport_in_set(struct fcm_filter_rule *rule, fcm_filter_l3_info_t *l3_info)
-{
-    int i = 0;
+    valid = (src ? flow->smac_valid : flow->dmac_valid);
+    if (!valid) return mac_s;
 
-    for (i = 0; i < rule->src_port_len; i++)
-    {
-        if ((rule->src_port[i].port_max != 0) &&
-            (rule->src_port[i].port_min <= l3_info->sport
-            && l3_info->sport <= rule->src_port[i].port_max ))
-        {
-            return FCM_DEFAULT_TRUE;
-        }
-        else if (rule->src_port[i].port_min == l3_info->sport) return FCM_DEFAULT_TRUE;
-    }
+    mac = (src ? &flow->key.smac : &flow->key.dmac);
+    snprintf(mac_s, FCM_FILTER_MAC_SIZE, PRI_os_macaddr_lower_t,
+             FMT_os_macaddr_pt(mac));
 
-    return FCM_DEFAULT_FALSE;
+    return mac_s;
 }
 
-static
-int fcm_sport_filter(struct fcm_filter_mgr *mgr,
-                     struct fcm_filter_rule *rule,
-                     fcm_filter_l3_info_t *l3_info)
+static char *
+fcm_filter_flow_ip_str(struct fcm_filter_flow *flow, bool src)
 {
-    bool rc = false;
+    uint8_t *addr;
+    char *legacy;
+    char *ip_s;
+    bool valid;
+
+    legacy = (src ? flow->l3_info->src_ip : flow->l3_info->dst_ip);
+    if (legacy[0] != '\0') return legacy;
+
+    ip_s = (src ? flow->src_ip_s : flow->dst_ip_s);
+    if (ip_s[0] != '\0') return ip_s;
 
-    /* No dmacs operation. Consider the rule successful. */
-    if (!rule->src_port_rule_present) return FCM_DEFAULT_TRUE;
+    valid = (src ? flow->src_ip_valid : flow->dst_ip_valid);
+    if (!valid) return ip_s;
 
-    rc = fcm_sport_in_set(rule, l3_info);
-    return fcm_check_option(rule->src_port_op, rc);
+    addr = (src ? flow->key.src_ip : flow->key.dst_ip);
+    inet_ntop(flow->key.ip_type, addr, ip_s, FCM_FILTER_IP_SIZE);
+
+    return ip_s;
 }
 
 /**
- * fcm_dport_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
+ * fcm_mac_in_set: checks a flow mac against a rule's mac set
+ * @set: the compiled rule set
+ * @flow: the flow
+ * @src: true to check the source mac, false for the destination mac
  *
- * Checking the dst port are present set of the rule
+ * Literal macs are looked up in binary form, as well as tag values when
+ * the flow mac is valid. Uncompiled values of the set are checked against
+ * the mac string representation.
  * Returns true if found, false otherwise.
  */
-
-static
-int fcm_dport_in_set(struct fcm_filter_rule *rule, fcm_filter_l3_info_t *l3_info)
+static bool
+fcm_mac_in_set(struct fcm_filter_mac_set *set, struct fcm_filter_flow *flow,
+               bool src)
 {
-    int i = 0;
+    os_macaddr_t *mac;
+    char *mac_s;
+    bool valid;
+    size_t i;
+    bool rc;
 
-    for (i = 0; i < rule->dst_port_len; i++)
+    valid = (src ? flow->smac_valid : flow->dmac_valid);
+    mac = (src ? &flow->key.smac : &flow->key.dmac);
+    if (valid && fcm_filter_mac_set_match(set, mac)) return true;
+
+    for (i = 0; i < set->ntags; i++)
     {
-        if ((rule->dst_port[i].port_max != 0) &&
-            (rule->dst_port[i].port_min <= l3_info->dport
-            && l3_info->dport <= rule->dst_port[i].port_max ))
-        {
-            return FCM_DEFAULT_TRUE;
-        }
-        else if (rule->dst_port[i].port_min == l3_info->dport) return FCM_DEFAULT_TRUE;
+        if (valid) rc = om_tag_handle_in_mac(set->tags[i], mac);
+        else rc = om_tag_handle_in(set->tags[i],
+                                   fcm_filter_flow_mac_str(flow, src));
+        if (rc) return true;
     }
-    return FCM_DEFAULT_TRUE;
-}
 
-static
-int fcm_dport_filter(struct fcm_filter_mgr *mgr,
-                     struct fcm_filter_rule *rule,
-                     fcm_filter_l3_info_t *l3_info)
-{
-    bool rc = false;
+    if (set->nstrs == 0) return false;
 
-    /* No dmacs operation. Consider the rule successful. */
-    if (!rule->dst_port_rule_present) return FCM_DEFAULT_TRUE;
+    mac_s = fcm_filter_flow_mac_str(flow, src);
+    for (i = 0; i < set->nstrs; i++)
+    {
+        rc = fcm_find_device_in_tag(mac_s, set->strs[i]);
+        if (rc) return true;
+    }
 
-    rc = fcm_dport_in_set(rule, l3_info);
-    return fcm_check_option(rule->dst_port_op, rc);
+    return false;
 }
 
 /**
- * fcm_dport_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l3_info: l3_info, that need to be verified against rule
+ * fcm_ip_in_set: checks a flow ip against a rule's ip set
+ * @set: the compiled rule set
+ * @flow: the flow
+ * @src: true to check the source ip, false for the destination ip
  *
- * Checking the l4 protocol are present set of the rule
+ * Literal hosts and prefixes are matched in binary form, as well as tag
+ * values when the flow ip is valid. Uncompiled values of the set are
+ * checked against the ip string representation.
  * Returns true if found, false otherwise.
  */
-static
-int fcm_proto_in_set(struct fcm_filter_rule *rule, fcm_filter_l3_info_t *l3_info)
+static bool
+fcm_ip_in_set(struct fcm_filter_ip_set *set, struct fcm_filter_flow *flow,
+              bool src)
 {
-    size_t i = 0;
+    uint8_t *addr;
+    char *ip_s;
+    bool valid;
+    size_t i;
+    bool rc;
 
-    for (i = 0; i < rule->proto->nelems; i++)
+    valid = (src ? flow->src_ip_valid : flow->dst_ip_valid);
+    addr = (src ? flow->key.src_ip : flow->key.dst_ip);
+    if (valid && fcm_filter_ip_set_match(set, flow->key.ip_type, addr))
     {
-        if (rule->proto->array[i] == l3_info->l4_proto) return FCM_DEFAULT_TRUE;
+        return true;
     }
 
-    return FCM_DEFAULT_TRUE;
-}
+    for (i = 0; i < set->ntags; i++)
+    {
+        if (valid) rc = om_tag_handle_in_ip(set->tags[i], flow->key.ip_type,
+                                             addr);
+        else rc = om_tag_handle_in(set->tags[i],
+                                   fcm_filter_flow_ip_str(flow, src));
+        if (rc) return true;
+    }
 
-static
-int fcm_l4_proto_filter(struct fcm_filter_mgr *mgr,
-                        struct fcm_filter_rule *rule,
-                        fcm_filter_l3_info_t *l3_info)
-{
-    bool rc = false;
+    if (set->nstrs == 0) return false;
 
-    /* No dmacs operation. Consider the rule successful. */
-    if (!rule->proto_rule_present) return FCM_DEFAULT_TRUE;
+    ip_s = fcm_filter_flow_ip_str(flow, src);
+    for (i = 0; i < set->nstrs; i++)
+    {
+        rc = fcm_find_ip_addr_in_tag(ip_s, set->strs[i]);
+        if (rc) return true;
+    }
 
-    rc = fcm_proto_in_set(rule, l3_info);
-    return fcm_check_option(rule->proto_op, rc);
+    return false;
 }
 
 /**
- * fcm_smac_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
+ * fcm_l3_filter: checks the compiled l3/l4 predicates of a rule
+ * @rule: the filter rule
+ * @flow: the flow
  *
- * Checking the src mac address are present set of the rule
- * Returns true if found, false otherwise.
+ * Returns false if a predicate ruled the flow out, true otherwise.
  */
-
-static
-int fcm_smac_in_set(struct fcm_filter_rule *rule, fcm_filter_l2_info_t *l2_info)
+static bool
+fcm_l3_filter(struct fcm_filter_rule *rule, struct fcm_filter_flow *flow)
 {
-    char mac_s[32] = { 0 };
-    size_t i = 0;
-    bool rc;
+    struct fcm_filter_compiled *compiled;
+    struct fcm_filter_cache_key *key;
+    bool in_set;
+    int ret;
+
+    compiled = &rule->compiled;
+    key = &flow->key;
 
-    snprintf(mac_s, sizeof(mac_s), "%s",l2_info->src_mac);
-    for (i = 0; i < rule->smac->nelems; i++)
+    if (rule->src_ip_rule_present)
     {
-        rc = fcm_find_device_in_tag(mac_s, rule->smac->array[i]);
-        if (rc) return FCM_DEFAULT_TRUE;
+        in_set = fcm_ip_in_set(&compiled->src_ip, flow, true);
+        ret = fcm_check_option(rule->src_ip_op, in_set);
+        if (ret == FCM_RULED_FALSE) return false;
     }
-    return FCM_DEFAULT_FALSE;
-}
 
-/**
- * fcm_dmac_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
- *
- * Checking the dst mac address are present set of the rule
- * Returns true if found, false otherwise.
- */
+    if (rule->dst_ip_rule_present)
+    {
+        in_set = fcm_ip_in_set(&compiled->dst_ip, flow, false);
+        ret = fcm_check_option(rule->dst_ip_op, in_set);
+        if (ret == FCM_RULED_FALSE) return false;
+    }
 
-static
-int fcm_dmac_in_set(struct fcm_filter_rule *rule, fcm_filter_l2_info_t *l2_info)
-{
-    char mac_s[32] = { 0 };
-    size_t i = 0;
-    bool rc;
+    if (rule->src_port_rule_present)
+    {
+        in_set = FCM_FILTER_MAP_TEST(compiled->src_port_map, key->sport);
+        ret = fcm_check_option(rule->src_port_op, in_set);
+        if (ret == FCM_RULED_FALSE) return false;
+    }
 
-    snprintf(mac_s, sizeof(mac_s), "%s", l2_info->dst_mac);
+    if (rule->dst_port_rule_present)
+    {
+        in_set = FCM_FILTER_MAP_TEST(compiled->dst_port_map, key->dport);
+        ret = fcm_check_option(rule->dst_port_op, in_set);
+        if (ret == FCM_RULED_FALSE) return false;
+    }
 
-    for (i = 0; i < rule->dmac->nelems; i++)
+    if (rule->proto_rule_present)
     {
-        rc = fcm_find_device_in_tag(mac_s, rule->dmac->array[i]);
-        if (rc) return FCM_DEFAULT_TRUE;
+        in_set = FCM_FILTER_MAP_TEST(compiled->proto_map, key->l4_proto);
+        ret = fcm_check_option(rule->proto_op, in_set);
+        if (ret == FCM_RULED_FALSE) return false;
     }
-    return FCM_DEFAULT_FALSE;
+
+    return true;
 }
 
 /**
- * fcm_vlanid_in_set: looks up a rule that matches unique index
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
+ * fcm_l2_filter: checks the compiled l2 predicates of a rule
+ * @rule: the filter rule
+ * @flow: the flow
  *
- * Checking the vlan_ids are present set of the rule
- * Returns true if found, false otherwise.
+ * Returns false if a predicate ruled the flow out, true otherwise.
  */
-static
-int fcm_vlanid_in_set(struct fcm_filter_rule *rule, fcm_filter_l2_info_t *l2_info)
+static bool
+fcm_l2_filter(struct fcm_filter_rule *rule, struct fcm_filter_flow *flow)
 {
-    size_t i = 0;
+    struct fcm_filter_compiled *compiled;
+    bool in_set;
+    int ret;
+
+    compiled = &rule->compiled;
 
-    for (i = 0; i < rule->vlanid->nelems; i++)
+    if (rule->smac_rule_present)
     {
-        if (rule->vlanid->array[i] == (int)l2_info->vlan_id) return FCM_DEFAULT_TRUE;
+        in_set = fcm_mac_in_set(&compiled->smac, flow, true);
+        ret = fcm_check_option(rule->smac_op, in_set);
+        if (ret == FCM_RULED_FALSE) return false;
     }
-    return FCM_DEFAULT_FALSE;
+
+    if (rule->dmac_rule_present)
+    {
+        in_set = fcm_mac_in_set(&compiled->dmac, flow, false);
+        ret = fcm_check_option(rule->dmac_op, in_set);
+        if (ret == FCM_RULED_FALSE) return false;
+    }
+
+    if (rule->vlanid_rule_present)
+    {
+        in_set = false;
+        if (flow->key.vlan_id < 4096)
+        {
+            in_set = FCM_FILTER_MAP_TEST(compiled->vlanid_map,
+                                         flow->key.vlan_id);
+        }
+        ret = fcm_check_option(rule->vlanid_op, in_set);
+        if (ret == FCM_RULED_FALSE) return false;
+    }
+
+    return true;
 }
 
 /**
- * fcm_smacs_filter: looks up a rule that matches unique index
- * @mgr: fcm_filter_mgr pointer to context manager
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
- *
- * Checking the src mac option like in / out in the rule.
+ * fcm_filter_match_map: evaluates the l2/l3 predicates of all rules
+ * @table: the filter table
+ * @flow: the flow
  *
- * Returns true if found mac is in set and op set to "in", false otherwise.
+ * Returns a bitmap of the rule indexes whose predicates matched.
  */
+static uint64_t
+fcm_filter_match_map(struct filter_table *table, struct fcm_filter_flow *flow)
+{
+    struct fcm_filter_rule *rule;
+    uint64_t match_map;
+    bool allow;
+    int i;
 
-static
-int fcm_smacs_filter(struct fcm_filter_mgr *mgr,
-                     struct fcm_filter_rule *rule,
-                     fcm_filter_l2_info_t *l2_info)
+    match_map = 0;
+    for (i = 0; i < FCM_MAX_FILTERS; i++)
+    {
+        if (table->lookup_array[i] == NULL) continue;
+
+        rule = &table->lookup_array[i]->filter_rule;
+        allow = true;
+        if (flow->l3_info != NULL) allow = fcm_l3_filter(rule, flow);
+        if (allow && flow->l2_info != NULL) allow = fcm_l2_filter(rule, flow);
+
+        if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
+        {
+            LOGT("%s: rule index %d --> l2/l3 allow %d", __func__,
+                 rule->index, allow);
+        }
+
+        if (allow) match_map |= ((uint64_t)1 << i);
+    }
+
+    return match_map;
+}
+
+static uint32_t
+fcm_filter_cache_hash(struct fcm_filter_cache_key *key)
 {
-    bool rc = false;
+    uint8_t *p = (uint8_t *)key;
+    uint32_t hash = 2166136261u;
+    size_t i;
 
-    /* No smac operation. Consider the rule successful. */
-    if (!rule->smac_rule_present) return FCM_DEFAULT_TRUE;
+    for (i = 0; i < sizeof(*key); i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
 
-    rc = fcm_smac_in_set(rule, l2_info);
-    return fcm_check_option(rule->smac_op, rc);
+    return hash;
 }
 
 /**
- * fcm_dmacs_filter: looks up a rule that matches unique index
- * @mgr: fcm_filter_mgr pointer to context manager
- * @rule: schema_FCM_Filter rule
- * @l2_info: l2_info, that need to be verified against rule
- *
- * Checking the dst mac option like in / out in the rule.
+ * fcm_filter_cached_match_map: returns the rules matching the flow
+ * @table: the filter table
+ * @flow: the flow
  *
- * Returns true if found mac is in set and op set to "in", false otherwise.
+ * Looks up the table's direct mapped cache before evaluating the rules.
+ * Entries are stale once the table or any tag changed.
  */
-static
-int fcm_dmacs_filter(struct fcm_filter_mgr *mgr,
-                     struct fcm_filter_rule *rule,
-                     fcm_filter_l2_info_t *l2_info)
+static uint64_t
+fcm_filter_cached_match_map(struct filter_table *table,
+                            struct fcm_filter_flow *flow)
 {
-    bool rc = false;
+    struct fcm_filter_cache_entry *entry;
+    uint32_t tag_gen;
+    uint32_t idx;
+    int cmp;
+
+    if (table->cache == NULL)
+    {
+        table->cache = CALLOC(FCM_FILTER_CACHE_SIZE, sizeof(*table->cache));
+    }
+
+    tag_gen = om_tag_get_generation();
+    idx = fcm_filter_cache_hash(&flow->key) & (FCM_FILTER_CACHE_SIZE - 1);
+    entry = &table->cache[idx];
 
-    /* No dmacs operation. Consider the rule successful. */
-    if (!rule->dmac_rule_present) return FCM_DEFAULT_TRUE;
+    if (entry->valid && entry->table_gen == table->generation &&
+        entry->tag_gen == tag_gen)
+    {
+        cmp = memcmp(&entry->key, &flow->key, sizeof(entry->key));
+        if (cmp == 0)
+        {
+            table->cache_hits++;
+            return entry->match_map;
+        }
+    }
 
-    rc = fcm_dmac_in_set(rule, l2_info);
-    return fcm_check_option(rule->dmac_op, rc);
+    table->cache_misses++;
+    entry->key = flow->key;
+    entry->match_map = fcm_filter_match_map(table, flow);
+    entry->table_gen = table->generation;
+    entry->tag_gen = tag_gen;
+    entry->valid = true;
+
+    return entry->match_map;
 }
 
-static
-int fcm_vlanid_filter(struct fcm_filter_mgr *mgr,
-                      struct fcm_filter_rule *rule,
-                      fcm_filter_l2_info_t *l2_info)
+/**
+ * fcm_filter_table_invalidate: drops the cached results of a table
+ * @table: the filter table
+ *
+ * To be called whenever a rule of the table is added or removed.
+ */
+void
+fcm_filter_table_invalidate(struct filter_table *table)
 {
-    bool rc = false;
+    if (table == NULL) return;
 
-    /* No valid operation. Consider the rule successful. */
-    if (!rule->vlanid_rule_present) return FCM_DEFAULT_TRUE;
-
-    rc = fcm_vlanid_in_set(rule, l2_info);
-    return fcm_check_option(rule->vlanid_op, rc);
+    table->generation++;
 }
 
 static
@@ -659,15 +796,14 @@ void fcm_filter_app_print(struct fcm_filter_rule *app)
 
 void fcm_apply_filter(struct fcm_session *session, struct fcm_filter_req *req)
 {
-    int sport_allow, dport_allow, proto_allow;
-    int vlanid_allow, pktcnt_allow;
-    int src_ip_allow, dst_ip_allow;
-    int smac_allow, dmac_allow;
+    struct fcm_filter_flow flow;
     struct filter_table *table;
     struct fcm_filter_mgr *mgr;
     struct fcm_filter *rule;
+    uint64_t match_map;
     bool action_op = true;
     bool allow = true;
+    int pktcnt_allow;
     int name_allow;
     int i;
 
@@ -680,65 +816,24 @@ void fcm_apply_filter(struct fcm_session *session, struct fcm_filter_req *req)
 
     mgr = get_filter_mgr();
 
+    /* Evaluate the l2/l3 predicates of all the rules at once */
+    fcm_filter_flow_init(&flow, req);
+    if (flow.cacheable)
+    {
+        match_map = fcm_filter_cached_match_map(table, &flow);
+    }
+    else
+    {
+        match_map = fcm_filter_match_map(table, &flow);
+    }
+
     for (i = 0; i < FCM_MAX_FILTERS; i++)
     {
-        allow = true;
         rule = table->lookup_array[i];
         if (rule == NULL) continue;
 
-        /* check if it matches l3 filter */
-        if (req->l3_info)
-        {
-            src_ip_allow = fcm_src_ip_filter(mgr, &rule->filter_rule, req->l3_info);
-            allow &= (src_ip_allow == FCM_RULED_FALSE? false: true);
-
-            dst_ip_allow = fcm_dst_ip_filter(mgr, &rule->filter_rule, req->l3_info);
-            allow &= (dst_ip_allow == FCM_RULED_FALSE? false: true);
-
-            sport_allow = fcm_sport_filter(mgr, &rule->filter_rule, req->l3_info);
-            allow &= (sport_allow == FCM_RULED_FALSE? false: true);
-
-            dport_allow = fcm_dport_filter(mgr, &rule->filter_rule, req->l3_info);
-            allow &= (dport_allow == FCM_RULED_FALSE? false: true);
-
-            proto_allow = fcm_l4_proto_filter(mgr, &rule->filter_rule, req->l3_info);
-            allow &= (proto_allow == FCM_RULED_FALSE? false: true);
-
-            if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
-            {
-                LOGT("%s: rule index %d --> src_ip_allow %d dst_ip_allow %d "
-                     "sport_allow %d dport_allow %d proto_allow %d", __func__,
-                     rule->filter_rule.index,
-                     src_ip_allow,
-                     dst_ip_allow,
-                     sport_allow,
-                     dport_allow,
-                     proto_allow );
-            }
-        }
-
-        /* check if it matches l2 filter */
-        if (req->l2_info)
-        {
-            smac_allow = fcm_smacs_filter(mgr, &rule->filter_rule , req->l2_info);
-            allow &= (smac_allow == FCM_RULED_FALSE? false: true);
-
-            dmac_allow = fcm_dmacs_filter(mgr, &rule->filter_rule, req->l2_info);
-            allow &= (dmac_allow == FCM_RULED_FALSE? false: true);
-
-            vlanid_allow = fcm_vlanid_filter(mgr, &rule->filter_rule, req->l2_info);
-            allow &= (vlanid_allow == FCM_RULED_FALSE? false: true);
-
-            if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
-            {
-                LOGT("%s: rule index %d --> smac_allow %d dmac_allow %d"
-                     "vlanid_allow %d ", __func__,
-                     rule->filter_rule.index,
-                     smac_allow,
-                     dmac_allow,
-                     vlanid_allow);
-            }
-        }
+        allow = ((match_map & ((uint64_t)1 << i)) != 0);
+        if (!allow) continue;
 
         /* Check if it matches app filter */
         if (req->fkey)
@@ -775,7 +870,6 @@ void fcm_apply_filter(struct fcm_session *session, struct fcm_filter_req *req)
             }
         }
 
-        if (LOG_SEVERITY_ENABLED(LOG_SEVERITY_TRACE))
         action_op = fcm_action_filter(&rule->filter_rule);
 
         if (allow) goto tuple_out;
@@ -798,10 +892,12 @@ void fcm_free_filter(struct fcm_filter *ffilter)
     idx = ffilter->filter_rule.index;
     table = ffilter->table;
     ds_dlist_remove(&table->filter_rules, ffilter);
+    fcm_filter_free_compiled(&ffilter->filter_rule);
     free_schema_struct(&ffilter->filter_rule);
     free_filter_app(&ffilter->filter_rule);
     FREE(ffilter);
     table->lookup_array[idx] = NULL;
+    fcm_filter_table_invalidate(table);
 }
 
 void fcm_filter_cleanup(void)
@@ -842,6 +938,7 @@ void fcm_filter_cleanup(void)
         while (!ds_dlist_is_empty(&table->filter_rules))
         {
             rule = ds_dlist_head(&table->filter_rules);
+            fcm_filter_free_compiled(&rule->filter_rule);
             free_schema_struct(&rule->filter_rule);
             free_filter_app(&rule->filter_rule);
             ds_dlist_remove(&table->filter_rules, rule);
@@ -849,6 +946,7 @@ void fcm_filter_cleanup(void)
         }
         table = ds_tree_next(tables_tree, table);
         ds_tree_remove(tables_tree, t_to_remove);
+        FREE(t_to_remove->cache);
         FREE(t_to_remove);
     }
 
@@ -0,0 +1,464 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "os_nif.h"
+#include "log.h"
+#include "policy_tags.h"
+#include "fcm_filter.h"
+#include "ovsdb_utils.h"
+#include "memutil.h"
+
+#define FCM_FILTER_MAP_SET(map, bit) ((map)[(bit) >> 3] |= (1 << ((bit) & 7)))
+
+static int
+fcm_filter_mac_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(os_macaddr_t));
+}
+
+static int
+fcm_filter_ip_cmp(const void *a, const void *b)
+{
+    const struct fcm_filter_ip_prefix *ip_a = a;
+    const struct fcm_filter_ip_prefix *ip_b = b;
+
+    if (ip_a->family != ip_b->family) return ip_a->family - ip_b->family;
+
+    return memcmp(ip_a->addr, ip_b->addr, sizeof(ip_a->addr));
+}
+
+static size_t
+fcm_filter_ip_len(int family)
+{
+    return (family == AF_INET6 ? 16 : 4);
+}
+
+/**
+ * @brief parses an ip address, optionally followed by a prefix length
+ *
+ * @param str the string to parse, as "ip" or "ip/len"
+ * @param prefix the binary output
+ * @return true if the string was parsed, false otherwise
+ */
+static bool
+fcm_filter_parse_ip(const char *str, struct fcm_filter_ip_prefix *prefix)
+{
+    char ip[INET6_ADDRSTRLEN + 4];
+    size_t max_len;
+    char *len_s;
+    char *end;
+    long len;
+    int rc;
+
+    memset(prefix, 0, sizeof(*prefix));
+    STRSCPY(ip, str);
+
+    len_s = strchr(ip, '/');
+    if (len_s != NULL) *len_s++ = '\0';
+
+    rc = inet_pton(AF_INET, ip, prefix->addr);
+    if (rc == 1)
+    {
+        prefix->family = AF_INET;
+    }
+    else
+    {
+        rc = inet_pton(AF_INET6, ip, prefix->addr);
+        if (rc != 1) return false;
+        prefix->family = AF_INET6;
+    }
+
+    max_len = fcm_filter_ip_len(prefix->family) * 8;
+    prefix->prefix_len = max_len;
+    if (len_s == NULL) return true;
+
+    len = strtol(len_s, &end, 10);
+    if (*len_s == '\0' || *end != '\0') return false;
+    if (len < 0 || len > (long)max_len) return false;
+
+    prefix->prefix_len = len;
+
+    return true;
+}
+
+static bool
+fcm_filter_prefix_match(struct fcm_filter_ip_prefix *prefix, uint8_t *addr)
+{
+    size_t bytes;
+    size_t bits;
+    uint8_t mask;
+
+    bytes = prefix->prefix_len / 8;
+    bits = prefix->prefix_len % 8;
+
+    if (memcmp(prefix->addr, addr, bytes) != 0) return false;
+    if (bits == 0) return true;
+
+    mask = (uint8_t)(0xff << (8 - bits));
+    return ((prefix->addr[bytes] & mask) == (addr[bytes] & mask));
+}
+
+/**
+ * @brief compiles a mac str_set in a binary mac set
+ *
+ * @param values the rule values
+ * @param set the compiled set
+ * @param has_tags set to true if a value is a tag
+ */
+static void
+fcm_filter_compile_mac_set(struct str_set *values,
+                           struct fcm_filter_mac_set *set,
+                           bool *has_tags)
+{
+    om_tag_handle_t *handle;
+    os_macaddr_t mac;
+    size_t i;
+    bool rc;
+
+    memset(set, 0, sizeof(*set));
+    if (values == NULL) return;
+    if (values->nelems == 0) return;
+
+    set->macs = CALLOC(values->nelems, sizeof(*set->macs));
+    set->tags = CALLOC(values->nelems, sizeof(*set->tags));
+    set->strs = CALLOC(values->nelems, sizeof(*set->strs));
+
+    for (i = 0; i < values->nelems; i++)
+    {
+        handle = om_tag_handle_get(values->array[i]);
+        if (handle != NULL)
+        {
+            *has_tags = true;
+            set->tags[set->ntags++] = handle;
+            continue;
+        }
+
+        rc = os_nif_macaddr_from_str(&mac, values->array[i]);
+        if (rc)
+        {
+            set->macs[set->nmacs++] = mac;
+            continue;
+        }
+
+        *has_tags = true;
+        set->strs[set->nstrs++] = values->array[i];
+    }
+
+    qsort(set->macs, set->nmacs, sizeof(*set->macs), fcm_filter_mac_cmp);
+}
+
+/**
+ * @brief compiles an ip str_set in binary host and prefix sets
+ *
+ * @param values the rule values
+ * @param set the compiled set
+ * @param has_tags set to true if a value is a tag
+ */
+static void
+fcm_filter_compile_ip_set(struct str_set *values,
+                          struct fcm_filter_ip_set *set,
+                          bool *has_tags)
+{
+    struct fcm_filter_ip_prefix prefix;
+    om_tag_handle_t *handle;
+    size_t i;
+    bool rc;
+
+    memset(set, 0, sizeof(*set));
+    if (values == NULL) return;
+    if (values->nelems == 0) return;
+
+    set->hosts = CALLOC(values->nelems, sizeof(*set->hosts));
+    set->prefixes = CALLOC(values->nelems, sizeof(*set->prefixes));
+    set->tags = CALLOC(values->nelems, sizeof(*set->tags));
+    set->strs = CALLOC(values->nelems, sizeof(*set->strs));
+
+    for (i = 0; i < values->nelems; i++)
+    {
+        handle = om_tag_handle_get(values->array[i]);
+        if (handle != NULL)
+        {
+            *has_tags = true;
+            set->tags[set->ntags++] = handle;
+            continue;
+        }
+
+        rc = fcm_filter_parse_ip(values->array[i], &prefix);
+        if (!rc)
+        {
+            *has_tags = true;
+            set->strs[set->nstrs++] = values->array[i];
+            continue;
+        }
+
+        if (prefix.prefix_len == fcm_filter_ip_len(prefix.family) * 8)
+        {
+            set->hosts[set->nhosts++] = prefix;
+        }
+        else
+        {
+            set->prefixes[set->nprefixes++] = prefix;
+        }
+    }
+
+    qsort(set->hosts, set->nhosts, sizeof(*set->hosts), fcm_filter_ip_cmp);
+}
+
+static uint8_t *
+fcm_filter_compile_ports(struct ip_port *ports, int len)
+{
+    uint8_t *map;
+    int port_max;
+    int port;
+    int i;
+
+    map = CALLOC(1, FCM_FILTER_PORT_MAP_SIZE);
+    if (ports == NULL) return map;
+
+    for (i = 0; i < len; i++)
+    {
+        port_max = ports[i].port_max;
+        if (port_max == 0) port_max = ports[i].port_min;
+
+        for (port = ports[i].port_min; port <= port_max; port++)
+        {
+            FCM_FILTER_MAP_SET(map, port);
+        }
+    }
+
+    return map;
+}
+
+static uint8_t *
+fcm_filter_compile_vlans(struct int_set *vlans)
+{
+    uint8_t *map;
+    size_t i;
+    int vlan;
+
+    map = CALLOC(1, FCM_FILTER_VLAN_MAP_SIZE);
+    if (vlans == NULL) return map;
+
+    for (i = 0; i < vlans->nelems; i++)
+    {
+        vlan = vlans->array[i];
+        if (vlan < 0 || vlan >= 4096) continue;
+
+        FCM_FILTER_MAP_SET(map, vlan);
+    }
+
+    return map;
+}
+
+static void
+fcm_filter_free_mac_set(struct fcm_filter_mac_set *set)
+{
+    size_t i;
+
+    for (i = 0; i < set->ntags; i++) om_tag_handle_put(set->tags[i]);
+
+    FREE(set->macs);
+    FREE(set->tags);
+    FREE(set->strs);
+    memset(set, 0, sizeof(*set));
+}
+
+static void
+fcm_filter_free_ip_set(struct fcm_filter_ip_set *set)
+{
+    size_t i;
+
+    for (i = 0; i < set->ntags; i++) om_tag_handle_put(set->tags[i]);
+
+    FREE(set->hosts);
+    FREE(set->prefixes);
+    FREE(set->tags);
+    FREE(set->strs);
+    memset(set, 0, sizeof(*set));
+}
+
+/**
+ * @brief releases the binary predicates of a rule
+ *
+ * @param rule the filter rule
+ */
+void
+fcm_filter_free_compiled(struct fcm_filter_rule *rule)
+{
+    struct fcm_filter_compiled *compiled;
+
+    if (rule == NULL) return;
+
+    compiled = &rule->compiled;
+    fcm_filter_free_mac_set(&compiled->smac);
+    fcm_filter_free_mac_set(&compiled->dmac);
+    fcm_filter_free_ip_set(&compiled->src_ip);
+    fcm_filter_free_ip_set(&compiled->dst_ip);
+    FREE(compiled->vlanid_map);
+    FREE(compiled->src_port_map);
+    FREE(compiled->dst_port_map);
+    memset(compiled, 0, sizeof(*compiled));
+}
+
+/**
+ * @brief compiles the rule's string sets into binary predicates
+ *
+ * Called once when the rule is configured, so that the per flow
+ * evaluation does not have to parse or compare strings.
+ *
+ * @param rule the filter rule, its string sets already populated
+ * @return 0 on success
+ */
+int
+fcm_filter_compile_rule(struct fcm_filter_rule *rule)
+{
+    struct fcm_filter_compiled *compiled;
+    size_t i;
+    int proto;
+
+    if (rule == NULL) return -1;
+
+    compiled = &rule->compiled;
+    memset(compiled, 0, sizeof(*compiled));
+
+    if (rule->smac_rule_present)
+    {
+        fcm_filter_compile_mac_set(rule->smac, &compiled->smac,
+                                   &compiled->has_tags);
+    }
+
+    if (rule->dmac_rule_present)
+    {
+        fcm_filter_compile_mac_set(rule->dmac, &compiled->dmac,
+                                   &compiled->has_tags);
+    }
+
+    if (rule->vlanid_rule_present)
+    {
+        compiled->vlanid_map = fcm_filter_compile_vlans(rule->vlanid);
+    }
+
+    if (rule->src_ip_rule_present)
+    {
+        fcm_filter_compile_ip_set(rule->src_ip, &compiled->src_ip,
+                                  &compiled->has_tags);
+    }
+
+    if (rule->dst_ip_rule_present)
+    {
+        fcm_filter_compile_ip_set(rule->dst_ip, &compiled->dst_ip,
+                                  &compiled->has_tags);
+    }
+
+    if (rule->src_port_rule_present)
+    {
+        compiled->src_port_map = fcm_filter_compile_ports(rule->src_port,
+                                                          rule->src_port_len);
+    }
+
+    if (rule->dst_port_rule_present)
+    {
+        compiled->dst_port_map = fcm_filter_compile_ports(rule->dst_port,
+                                                          rule->dst_port_len);
+    }
+
+    if (rule->proto_rule_present && rule->proto != NULL)
+    {
+        for (i = 0; i < rule->proto->nelems; i++)
+        {
+            proto = rule->proto->array[i];
+            if (proto < 0 || proto > 255) continue;
+
+            FCM_FILTER_MAP_SET(compiled->proto_map, proto);
+        }
+    }
+
+    LOGD("%s: rule %s index %d compiled, tags: %s", __func__,
+         rule->name, rule->index, compiled->has_tags ? "yes" : "no");
+
+    return 0;
+}
+
+/**
+ * @brief checks if a binary mac is part of the compiled literal macs
+ *
+ * @param set the compiled mac set
+ * @param mac the mac to look up
+ * @return true if found
+ */
+bool
+fcm_filter_mac_set_match(struct fcm_filter_mac_set *set, os_macaddr_t *mac)
+{
+    void *found;
+
+    if (set->nmacs == 0) return false;
+
+    found = bsearch(mac, set->macs, set->nmacs, sizeof(*set->macs),
+                    fcm_filter_mac_cmp);
+
+    return (found != NULL);
+}
+
+/**
+ * @brief checks if a binary ip is part of the compiled hosts or prefixes
+ *
+ * @param set the compiled ip set
+ * @param family the address family, AF_INET or AF_INET6
+ * @param addr the address in network order
+ * @return true if found
+ */
+bool
+fcm_filter_ip_set_match(struct fcm_filter_ip_set *set, int family,
+                        uint8_t *addr)
+{
+    struct fcm_filter_ip_prefix key;
+    struct fcm_filter_ip_prefix *prefix;
+    void *found;
+    size_t i;
+
+    if (set->nhosts != 0)
+    {
+        memset(&key, 0, sizeof(key));
+        key.family = family;
+        memcpy(key.addr, addr, fcm_filter_ip_len(family));
+        found = bsearch(&key, set->hosts, set->nhosts, sizeof(*set->hosts),
+                        fcm_filter_ip_cmp);
+        if (found != NULL) return true;
+    }
+
+    for (i = 0; i < set->nprefixes; i++)
+    {
+        prefix = &set->prefixes[i];
+        if (prefix->family != family) continue;
+        if (fcm_filter_prefix_match(prefix, addr)) return true;
+    }
+
+    return false;
+}
@@ -320,9 +320,14 @@ fcm_filter_insert_schema(struct filter_table *table,
         goto free_rule;
     }
 
+    /* Compile the rule sets in binary predicates */
+    ret = fcm_filter_compile_rule(&ffilter->filter_rule);
+    if (ret < 0) goto free_rule;
+
     ffilter->table = table;
     table->lookup_array[idx] = ffilter;
     ds_dlist_insert_tail(&table->filter_rules, ffilter);
+    fcm_filter_table_invalidate(table);
 
     return ffilter;
 
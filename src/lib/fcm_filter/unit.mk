@@ -33,6 +33,7 @@ UNIT_TYPE := LIB
 UNIT_DIR := lib
 UNIT_SRC := src/fcm_filter.c
 UNIT_SRC += src/fcm_filter_ovsdb.c
+UNIT_SRC += src/fcm_filter_compile.c
 UNIT_SRC += src/fcm_filter_client.c
 UNIT_SRC += src/fcm_report_filter.c
 
@@ -1229,6 +1229,225 @@ void test_fcm_filter_app_update(void)
     FREE(req);
 }
 
+void test_fcm_filter_binary_apply(void)
+{
+    struct fcm_filter_l3_info l3_info;
+    struct fcm_filter_l2_info l2_info;
+    struct fcm_filter_req req;
+    struct filter_table *table;
+    uint64_t misses;
+    uint64_t hits;
+
+    struct schema_FCM_Filter cidr_filter = {
+        .name = "fcm_filter_bin",
+        .index = 10,
+        .src_ip_op_exists = true,
+        .src_ip_len = 2,
+        .src_ip[0] = "192.168.40.0/24",
+        .src_ip[1] = "2001:db8::1",
+        .src_ip_op = "in",
+        .dst_port_op_exists = true,
+        .dst_port_len = 2,
+        .dst_port[0] = "443",
+        .dst_port[1] = "8000-8080",
+        .dst_port_op = "in",
+        .proto_op_exists = true,
+        .proto_len = 1,
+        .proto[0] = 6,
+        .proto_op = "in",
+        .smac_op_exists = true,
+        .smac_len = 1,
+        .smac[0] = "A6:55:44:33:22:1A",
+        .smac_op = "out",
+        .action = "include",
+    };
+
+    g_mon.mon_type = OVSDB_UPDATE_NEW;
+    callback_FCM_Filter(&g_mon, NULL, &cidr_filter);
+    table = ds_tree_find(&get_filter_mgr()->fcm_filters, cidr_filter.name);
+    TEST_ASSERT_NOT_NULL(table);
+
+    memset(&l2_info, 0, sizeof(l2_info));
+    l2_info.mac_bin_set = true;
+    l2_info.smac_bin.addr[0] = 0x11;
+    l2_info.dmac_bin.addr[0] = 0x22;
+
+    memset(&l3_info, 0, sizeof(l3_info));
+    l3_info.ip_bin_set = true;
+    l3_info.ip_type = AF_INET;
+    inet_pton(AF_INET, "192.168.40.77", l3_info.src_ip_bin);
+    inet_pton(AF_INET, "8.8.8.8", l3_info.dst_ip_bin);
+    l3_info.sport = 50000;
+    l3_info.dport = 8042;
+    l3_info.l4_proto = 6;
+
+    memset(&req, 0, sizeof(req));
+    req.l2_info = &l2_info;
+    req.l3_info = &l3_info;
+    req.table = table;
+
+    /* Prefix, port range and protocol match */
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_TRUE(req.action);
+
+    /* The same flow is served from the cache */
+    hits = table->cache_hits;
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_TRUE(req.action);
+    TEST_ASSERT_EQUAL_UINT64(hits + 1, table->cache_hits);
+
+    /* Out of range port */
+    l3_info.dport = 8081;
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_FALSE(req.action);
+
+    /* Out of prefix address */
+    l3_info.dport = 443;
+    inet_pton(AF_INET, "192.168.41.1", l3_info.src_ip_bin);
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_FALSE(req.action);
+
+    /* IPv6 host entry */
+    l3_info.ip_type = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8::1", l3_info.src_ip_bin);
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_TRUE(req.action);
+
+    /* Excluded source mac, matched regardless of the configured case */
+    l2_info.smac_bin.addr[0] = 0xa6;
+    l2_info.smac_bin.addr[1] = 0x55;
+    l2_info.smac_bin.addr[2] = 0x44;
+    l2_info.smac_bin.addr[3] = 0x33;
+    l2_info.smac_bin.addr[4] = 0x22;
+    l2_info.smac_bin.addr[5] = 0x1a;
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_FALSE(req.action);
+
+    /* Removing the rule invalidates the cached results */
+    misses = table->cache_misses;
+    g_mon.mon_type = OVSDB_UPDATE_DEL;
+    callback_FCM_Filter(&g_mon, &cidr_filter, NULL);
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_FALSE(req.action);
+    TEST_ASSERT_EQUAL_UINT64(misses + 1, table->cache_misses);
+}
+
+void test_fcm_filter_exclude_action(void)
+{
+    struct fcm_filter_l3_info l3_info;
+    struct fcm_filter_req req;
+    struct filter_table *table;
+
+    struct schema_FCM_Filter exclude_filter = {
+        .name = "fcm_filter_excl",
+        .index = 11,
+        .dst_port_op_exists = true,
+        .dst_port_len = 1,
+        .dst_port[0] = "53",
+        .dst_port_op = "in",
+        .action = "exclude",
+    };
+
+    g_mon.mon_type = OVSDB_UPDATE_NEW;
+    callback_FCM_Filter(&g_mon, NULL, &exclude_filter);
+    table = ds_tree_find(&get_filter_mgr()->fcm_filters, exclude_filter.name);
+    TEST_ASSERT_NOT_NULL(table);
+
+    memset(&l3_info, 0, sizeof(l3_info));
+    STRSCPY(l3_info.src_ip, "192.168.40.12");
+    STRSCPY(l3_info.dst_ip, "10.2.20.121");
+    l3_info.dport = 53;
+
+    memset(&req, 0, sizeof(req));
+    req.l3_info = &l3_info;
+    req.table = table;
+
+    /* A matching exclude rule drops the flow */
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_FALSE(req.action);
+
+    g_mon.mon_type = OVSDB_UPDATE_DEL;
+    callback_FCM_Filter(&g_mon, &exclude_filter, NULL);
+}
+
+void test_fcm_filter_tag_apply(void)
+{
+    struct schema_Openflow_Tag stag;
+    struct fcm_filter_l3_info l3_info;
+    struct fcm_filter_l2_info l2_info;
+    struct fcm_filter_req req;
+    struct filter_table *table;
+
+    struct schema_FCM_Filter tag_filter = {
+        .name = "fcm_filter_tag",
+        .index = 12,
+        .smac_op_exists = true,
+        .smac_len = 1,
+        .smac[0] = "${@fcm_tag}",
+        .smac_op = "in",
+        .dst_ip_op_exists = true,
+        .dst_ip_len = 1,
+        .dst_ip[0] = "${fcm_tag}",
+        .dst_ip_op = "in",
+        .action = "include",
+    };
+
+    memset(&stag, 0, sizeof(stag));
+    stag.name_exists = true;
+    STRSCPY(stag.name, "fcm_tag");
+    stag.device_value_len = 2;
+    STRSCPY(stag.device_value[0], "A6:55:44:33:22:1A");
+    STRSCPY(stag.device_value[1], "10.2.20.121");
+    TEST_ASSERT_TRUE(om_tag_add_from_schema(&stag));
+
+    g_mon.mon_type = OVSDB_UPDATE_NEW;
+    callback_FCM_Filter(&g_mon, NULL, &tag_filter);
+    table = ds_tree_find(&get_filter_mgr()->fcm_filters, tag_filter.name);
+    TEST_ASSERT_NOT_NULL(table);
+
+    memset(&l2_info, 0, sizeof(l2_info));
+    l2_info.mac_bin_set = true;
+    l2_info.smac_bin.addr[0] = 0xa6;
+    l2_info.smac_bin.addr[1] = 0x55;
+    l2_info.smac_bin.addr[2] = 0x44;
+    l2_info.smac_bin.addr[3] = 0x33;
+    l2_info.smac_bin.addr[4] = 0x22;
+    l2_info.smac_bin.addr[5] = 0x1a;
+
+    memset(&l3_info, 0, sizeof(l3_info));
+    l3_info.ip_bin_set = true;
+    l3_info.ip_type = AF_INET;
+    inet_pton(AF_INET, "192.168.40.77", l3_info.src_ip_bin);
+    inet_pton(AF_INET, "10.2.20.121", l3_info.dst_ip_bin);
+
+    memset(&req, 0, sizeof(req));
+    req.l2_info = &l2_info;
+    req.l3_info = &l3_info;
+    req.table = table;
+
+    /* The binary mac and ip are looked up in the tag */
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_TRUE(req.action);
+
+    /* A tag update is seen by the rule, cached results are dropped */
+    STRSCPY(stag.device_value[1], "10.2.20.122");
+    TEST_ASSERT_TRUE(om_tag_update_from_schema(&stag));
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_FALSE(req.action);
+
+    inet_pton(AF_INET, "10.2.20.122", l3_info.dst_ip_bin);
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_TRUE(req.action);
+
+    /* Rules referencing a removed tag no longer match */
+    TEST_ASSERT_TRUE(om_tag_remove_from_schema(&stag));
+    fcm_apply_filter(session, &req);
+    TEST_ASSERT_FALSE(req.action);
+
+    g_mon.mon_type = OVSDB_UPDATE_DEL;
+    callback_FCM_Filter(&g_mon, &tag_filter, NULL);
+}
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -1256,6 +1475,9 @@ int main(int argc, char *argv[])
     // Test fcm_apply_filter
     RUN_TEST(test_fcm_apply_filter_check_7tuple_apply);
     RUN_TEST(test_fcm_apply_filter_check_l2_apply);
+    RUN_TEST(test_fcm_filter_binary_apply);
+    RUN_TEST(test_fcm_filter_exclude_action);
+    RUN_TEST(test_fcm_filter_tag_apply);
 
     return UNITY_END();
 }
@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ds_list.h"
 #include "ovsdb_utils.h"
 #include "os_types.h"
+#include "policy_tags.h"
 #include "schema.h"
 
 enum {
@@ -318,6 +319,58 @@ struct fsm_policy_req
  *   move on to the next check.
  * - Else the rule has failed.
  */
+/**
+ * @brief path compressed binary trie node of an ip prefix set
+ *
+ * Children are indexes in the trie node array, 0 meaning no child.
+ * A node branches on bit 'depth' of the address. Terminal nodes are
+ * leaves, standing for the prefix made of the first 'depth' bits of key.
+ */
+struct fsm_ip_trie_node
+{
+    uint32_t child[2];
+    uint8_t key[16];
+    uint8_t depth;
+    bool terminal;
+};
+
+
+/**
+ * @brief ip prefix set compiled from a policy's ipaddr rule
+ *
+ * IPv4 and IPv6 hosts and CIDR entries, literal or expanded from tags,
+ * are stored in a path compressed binary trie. Node 0 is the IPv4 root,
+ * node 1 the IPv6 root. Entries which are neither an ip address nor a tag
+ * are kept as strings, pointing into the rule's str_set.
+ */
+struct fsm_ip_trie
+{
+    struct fsm_ip_trie_node *nodes;
+    size_t nnodes;
+    size_t size;
+    size_t nprefixes;
+    char **strs;
+    size_t nstrs;
+    bool has_tags;
+};
+
+
+/**
+ * @brief tag change, as passed to the tag update callback
+ *
+ * The callback runs before the tag values change: the new values are
+ * the current ones minus the removed and updated entries, plus the added
+ * and updated entries. On removal, all the values are in removed.
+ */
+struct fsm_policy_tag_update
+{
+    om_tag_t *tag;
+    ds_tree_t *removed;
+    ds_tree_t *added;
+    ds_tree_t *updated;
+};
+
+
 struct fsm_policy_rules
 {
     bool mac_rule_present;
@@ -339,6 +392,7 @@ struct fsm_policy_rules
     bool ip_rule_present;
     int ip_op;
     struct str_set *ipaddrs;
+    struct fsm_ip_trie *ip_trie;
 
     bool app_rule_present;
     int app_op;
@@ -396,12 +450,47 @@ struct fsm_url_report_stats {
     uint32_t cache_size;
 };
 
+#define FSM_POLICY_CACHE_SIZE 256
+#define FSM_POLICY_CACHE_TARGET_LEN 256
+
+#if FSM_MAX_POLICIES > 64
+#error "the policy decision cache bitmaps hold up to 64 policies"
+#endif
+
+/**
+ * @brief policy decision cache entry
+ *
+ * Caches, for a (device, request type, target) key, the outcome of the
+ * mac, fqdn and ip checks of the table's policies. These only depend on
+ * the key, the policies and the tags. The table generation moves when a
+ * policy or a tag referenced by a policy changes. The categories and risk checks
+ * still run on each request. Bit i of the bitmaps stands for the policy
+ * at index i.
+ */
+struct fsm_policy_cache_entry
+{
+    bool valid;
+    uint32_t table_gen;
+    os_macaddr_t mac;
+    int req_type;
+    int ip_version;
+    int family;
+    uint8_t addr[16];
+    char target[FSM_POLICY_CACHE_TARGET_LEN];
+    uint64_t evaluated;   /* policies whose checks are cached */
+    uint64_t passed;      /* policies whose checks passed */
+};
+
 #define POLICY_NAME_SIZE 32
 struct policy_table
 {
     char name[POLICY_NAME_SIZE];
     ds_tree_t policies;
     struct fsm_policy *lookup_array[FSM_MAX_POLICIES];
+    uint32_t generation;    /* bumped on policy and referenced tag changes */
+    struct fsm_policy_cache_entry *cache;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
     ds_tree_node_t table_node;
 };
 
@@ -457,7 +546,18 @@ void fsm_policy_register_client(struct fsm_policy_client *client);
 void fsm_policy_deregister_client(struct fsm_policy_client *client);
 void fsm_policy_update_clients(struct policy_table *table);
 bool find_mac_in_set(os_macaddr_t *mac, struct str_set *macs_set);
+struct fsm_ip_trie *fsm_ip_trie_build(struct str_set *ips,
+                                      struct fsm_policy_tag_update *update);
+void fsm_ip_trie_free(struct fsm_ip_trie *trie);
+bool fsm_ip_trie_lookup(struct fsm_ip_trie *trie, int family,
+                        const uint8_t *addr);
+void fsm_policy_tag_update(om_tag_t *tag, ds_tree_t *removed,
+                           ds_tree_t *added, ds_tree_t *updated);
+bool fsm_ip_in_rules(struct fsm_policy_rules *rules, int family,
+                     const uint8_t *addr, const char *ip_s);
 void fsm_free_url_reply(struct fsm_url_reply *reply);
+void fsm_policy_cache_free(struct policy_table *table);
+void fsm_policy_log_cache_stats(const char *caller);
 int fsm_policy_get_req_type(struct fsm_policy_req *req);
 void fsm_walk_clients_tree(const char *caller);
 void fsm_policy_flush_cache(struct fsm_policy *policy);
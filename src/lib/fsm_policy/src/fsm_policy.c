@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <jansson.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -39,6 +40,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <fnmatch.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 
 #include "os.h"
 #include "util.h"
@@ -463,26 +465,25 @@ fsm_fqdncats_in_set(struct fsm_policy_req *req,
 
 
 /**
- * @brief looks up a fqdn in a policy's fqdns values set.
+ * @brief looks up the request's ip in a policy's ipaddrs values set.
  * @param req the policy request
  * @param p the policy
  * @param op the lookup operation
  *
- * Checks if the request's ip is either an exact match, start from right
- * or start form left superset of an entry in the policy's fqdn set entry.
+ * The binary address of the request, when provided, is otherwise parsed
+ * from the request's url. It is looked up in the policy's compiled
+ * prefix trie, covering host, CIDR and tag entries.
  */
 static bool fsm_ip_in_set(struct fsm_policy_req *req, struct fsm_policy *p,
                           int op)
 {
     struct net_md_stats_accumulator *acc;
+    struct sockaddr_storage *ss;
     struct net_md_flow_key *key;
-    struct str_set *ips_set;
-    size_t ip_str_len;
-    size_t nelems;
+    uint8_t addr[16];
+    uint8_t *ip;
     int af_family;
-    size_t len;
-    size_t i;
-    int rc;
+    int family;
 
     acc = req->acc;
     key = acc->key;
@@ -491,23 +492,29 @@ static bool fsm_ip_in_set(struct fsm_policy_req *req, struct fsm_policy *p,
     if (key->ip_version == 6) af_family = AF_INET6;
     if (af_family == 0) return false;
 
-    ips_set = p->rules.ipaddrs;
-    if (ips_set == NULL) return false;
+    if (p->rules.ipaddrs == NULL) return false;
 
-    ip_str_len = strlen(req->url);
-    nelems = ips_set->nelems;
-    for (i = 0; i < nelems; i++)
+    family = 0;
+    ip = NULL;
+    ss = req->ip_addr;
+    if (ss != NULL && ss->ss_family == AF_INET)
     {
-        char *entry_set;
-
-        entry_set = ips_set->array[i];
-        len = strlen(entry_set);
-        if (len != ip_str_len) continue;
-        rc = strncmp(req->url, entry_set, len);
-        if (!rc) return true;
-
+        family = AF_INET;
+        ip = (uint8_t *)&((struct sockaddr_in *)ss)->sin_addr;
     }
-    return false;
+    else if (ss != NULL && ss->ss_family == AF_INET6)
+    {
+        family = AF_INET6;
+        ip = (uint8_t *)&((struct sockaddr_in6 *)ss)->sin6_addr;
+    }
+    else if (req->url != NULL)
+    {
+        ip = addr;
+        if (inet_pton(AF_INET, req->url, addr) == 1) family = AF_INET;
+        else if (inet_pton(AF_INET6, req->url, addr) == 1) family = AF_INET6;
+    }
+
+    return fsm_ip_in_rules(&p->rules, family, ip, req->url);
 }
 
 
@@ -1231,13 +1238,222 @@ fsm_gk_check_required(struct fsm_policy *policy,
  * Walks through the policies table looking for a match,
  * combines the action and report to apply
  */
+/**
+ * @brief fills a decision cache key from a request
+ *
+ * @param req the policy request
+ * @param key the key to fill
+ * @return true if the request can be cached, false otherwise
+ */
+static bool
+fsm_policy_cache_key(struct fsm_policy_req *req,
+                     struct fsm_policy_cache_entry *key)
+{
+    struct net_md_flow_key *fkey;
+    struct sockaddr_storage *ss;
+    size_t len;
+
+    if (req->device_id == NULL) return false;
+    if (req->url == NULL) return false;
+
+    len = strlen(req->url);
+    if (len >= sizeof(key->target)) return false;
+
+    memset(key, 0, sizeof(*key));
+    key->mac = *req->device_id;
+    key->req_type = req->req_type;
+    memcpy(key->target, req->url, len);
+
+    if (req->acc != NULL && req->acc->key != NULL)
+    {
+        fkey = req->acc->key;
+        key->ip_version = fkey->ip_version;
+    }
+
+    ss = req->ip_addr;
+    if (ss != NULL && ss->ss_family == AF_INET)
+    {
+        key->family = AF_INET;
+        memcpy(key->addr, &((struct sockaddr_in *)ss)->sin_addr, 4);
+    }
+    else if (ss != NULL && ss->ss_family == AF_INET6)
+    {
+        key->family = AF_INET6;
+        memcpy(key->addr, &((struct sockaddr_in6 *)ss)->sin6_addr, 16);
+    }
+
+    return true;
+}
+
+
+static uint32_t
+fsm_policy_cache_hash(struct fsm_policy_cache_entry *key)
+{
+    const uint8_t *p;
+    uint32_t hash;
+    size_t i;
+
+    /* FNV-1a */
+    hash = 2166136261u;
+
+    p = key->mac.addr;
+    for (i = 0; i < sizeof(key->mac.addr); i++) hash = (hash ^ p[i]) * 16777619u;
+
+    hash = (hash ^ (uint8_t)key->req_type) * 16777619u;
+    hash = (hash ^ (uint8_t)key->ip_version) * 16777619u;
+    hash = (hash ^ (uint8_t)key->family) * 16777619u;
+
+    p = key->addr;
+    for (i = 0; i < sizeof(key->addr); i++) hash = (hash ^ p[i]) * 16777619u;
+
+    for (p = (uint8_t *)key->target; *p != '\0'; p++) hash = (hash ^ *p) * 16777619u;
+
+    return hash;
+}
+
+
+static bool
+fsm_policy_cache_key_equal(struct fsm_policy_cache_entry *a,
+                           struct fsm_policy_cache_entry *b)
+{
+    if (memcmp(&a->mac, &b->mac, sizeof(a->mac))) return false;
+    if (a->req_type != b->req_type) return false;
+    if (a->ip_version != b->ip_version) return false;
+    if (a->family != b->family) return false;
+    if (memcmp(a->addr, b->addr, sizeof(a->addr))) return false;
+
+    return (strcmp(a->target, b->target) == 0);
+}
+
+
+/**
+ * @brief looks up the cached check results of a request
+ *
+ * @param table the policy table
+ * @param key the request key, its bitmaps set from the cache on a hit
+ * @return true on a hit
+ */
+static bool
+fsm_policy_cache_lookup(struct policy_table *table,
+                        struct fsm_policy_cache_entry *key)
+{
+    struct fsm_policy_cache_entry *entry;
+    uint32_t idx;
+
+    if (table->cache == NULL) return false;
+
+    idx = fsm_policy_cache_hash(key) % FSM_POLICY_CACHE_SIZE;
+    entry = &table->cache[idx];
+
+    if (!entry->valid) return false;
+    if (entry->table_gen != key->table_gen) return false;
+    if (!fsm_policy_cache_key_equal(entry, key)) return false;
+
+    key->evaluated = entry->evaluated;
+    key->passed = entry->passed;
+
+    return true;
+}
+
+
+/**
+ * @brief stores the check results of a request
+ *
+ * @param table the policy table
+ * @param key the request key and its bitmaps
+ */
+static void
+fsm_policy_cache_store(struct policy_table *table,
+                       struct fsm_policy_cache_entry *key)
+{
+    uint32_t idx;
+
+    if (table->cache == NULL)
+    {
+        table->cache = CALLOC(FSM_POLICY_CACHE_SIZE, sizeof(*table->cache));
+    }
+
+    idx = fsm_policy_cache_hash(key) % FSM_POLICY_CACHE_SIZE;
+    table->cache[idx] = *key;
+    table->cache[idx].valid = true;
+}
+
+
+/**
+ * @brief releases the decision cache of a policy table
+ *
+ * @param table the policy table
+ */
+void
+fsm_policy_cache_free(struct policy_table *table)
+{
+    if (table == NULL) return;
+
+    if (table->cache != NULL) FREE(table->cache);
+    table->cache = NULL;
+}
+
+
+/**
+ * @brief logs the decision cache counters of the policy tables
+ *
+ * @param caller the caller, logged along the counters
+ */
+void
+fsm_policy_log_cache_stats(const char *caller)
+{
+    struct fsm_policy_session *mgr;
+    struct policy_table *table;
+
+    mgr = fsm_policy_get_mgr();
+    if (!mgr->initialized) return;
+
+    ds_tree_foreach(&mgr->policy_tables, table)
+    {
+        if (table->cache_hits == 0 && table->cache_misses == 0) continue;
+
+        LOGI("%s: policy table %s decision cache hits: %" PRIu64
+             ", misses: %" PRIu64, caller, table->name,
+             table->cache_hits, table->cache_misses);
+    }
+}
+
+
+/**
+ * @brief checks the request against the policy's mac, fqdn and ip rules
+ *
+ * These checks only depend on the request key, the policy and the tags,
+ * and are subject to the decision cache.
+ */
+static bool
+fsm_policy_static_check(struct fsm_policy_req *req, struct fsm_policy *p)
+{
+    bool rc;
+
+    /* Check if the device matches the policy's macs rule */
+    rc = fsm_mac_check(req, p);
+    if (!rc) return false;
+
+    /* MAC rule passed. Check FQDN */
+    rc = fsm_fqdn_check(req, p);
+    if (!rc) return false;
+
+    /* FQDN rule passed. Check IP */
+    return fsm_ip_check(req, p);
+}
+
+
 int fsm_apply_policies(struct fsm_policy_req *req,
                        struct fsm_policy_reply *policy_reply)
 {
+    struct fsm_policy_cache_entry key;
     struct fsm_policy *last_match_policy;
     struct policy_table *table;
     int action = FSM_NO_MATCH;
     struct fsm_policy *p;
+    uint64_t bit;
+    bool cacheable;
+    bool cached;
     int req_type;
     bool report;
     bool gk_req;
@@ -1264,21 +1480,33 @@ int fsm_apply_policies(struct fsm_policy_req *req,
     last_match_policy = NULL;
     req->report = false;
 
+    cached = false;
+    cacheable = fsm_policy_cache_key(req, &key);
+    if (cacheable)
+    {
+        key.table_gen = table->generation;
+        cached = fsm_policy_cache_lookup(table, &key);
+        if (cached) table->cache_hits++;
+        else table->cache_misses++;
+    }
+
     for (i = 0; i < FSM_MAX_POLICIES; i++)
     {
         p = table->lookup_array[i];
         if (p == NULL) continue;
 
-        /* Check if the device matches the policy's macs rule */
-        rc = fsm_mac_check(req, p);
-        if (!rc) continue;
-
-        /* MAC rule passed. Check FQDN */
-        rc = fsm_fqdn_check(req, p);
-        if (!rc) continue;
-
-        /* IP rule passed. Check IP */
-        rc = fsm_ip_check(req, p);
+        /* Check the mac, fqdn and ip rules, unless already known */
+        bit = (1ULL << i);
+        if (cacheable && (key.evaluated & bit))
+        {
+            rc = ((key.passed & bit) != 0);
+        }
+        else
+        {
+            rc = fsm_policy_static_check(req, p);
+            key.evaluated |= bit;
+            if (rc) key.passed |= bit;
+        }
         if (!rc) continue;
 
         /* fqdn rule passed. Check categories */
@@ -1316,6 +1544,9 @@ int fsm_apply_policies(struct fsm_policy_req *req,
         if (p->action != FSM_ACTION_NONE) break;
     }
 
+    /* Record the checks evaluated by this request */
+    if (cacheable) fsm_policy_cache_store(table, &key);
+
     if (matched)
     {
         p = last_match_policy;
@@ -0,0 +1,484 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm_policy.h"
+#include "policy_tags.h"
+#include "log.h"
+#include "memutil.h"
+
+#define FSM_IP_TRIE_ROOT4 0
+#define FSM_IP_TRIE_ROOT6 1
+#define FSM_IP_TRIE_MIN_SIZE 64
+
+/**
+ * @brief parses an ip address, optionally followed by a prefix length
+ *
+ * @param str the string to parse, as "ip" or "ip/len"
+ * @param family the parsed family
+ * @param addr the parsed address, 16 bytes long
+ * @param prefix_len the parsed prefix length
+ * @return true if the string was parsed, false otherwise
+ */
+static bool
+fsm_ip_parse_prefix(const char *str, int *family, uint8_t *addr,
+                    int *prefix_len)
+{
+    char ip[INET6_ADDRSTRLEN + 4];
+    char *len_s;
+    char *end;
+    long len;
+    int max;
+
+    STRSCPY(ip, str);
+    len_s = strchr(ip, '/');
+    if (len_s != NULL) *len_s++ = '\0';
+
+    if (inet_pton(AF_INET, ip, addr) == 1)
+    {
+        *family = AF_INET;
+        max = 32;
+    }
+    else if (inet_pton(AF_INET6, ip, addr) == 1)
+    {
+        *family = AF_INET6;
+        max = 128;
+    }
+    else
+    {
+        return false;
+    }
+
+    *prefix_len = max;
+    if (len_s == NULL) return true;
+
+    len = strtol(len_s, &end, 10);
+    if (*len_s == '\0' || *end != '\0') return false;
+    if (len < 0 || len > max) return false;
+
+    *prefix_len = len;
+
+    return true;
+}
+
+static uint32_t
+fsm_ip_trie_new_node(struct fsm_ip_trie *trie)
+{
+    size_t size;
+
+    if (trie->nnodes == trie->size)
+    {
+        size = trie->size * 2;
+        trie->nodes = REALLOC(trie->nodes, size * sizeof(*trie->nodes));
+        memset(&trie->nodes[trie->size], 0,
+               (size - trie->size) * sizeof(*trie->nodes));
+        trie->size = size;
+    }
+
+    return trie->nnodes++;
+}
+
+static struct fsm_ip_trie *
+fsm_ip_trie_alloc(void)
+{
+    struct fsm_ip_trie *trie;
+
+    trie = CALLOC(1, sizeof(*trie));
+    trie->size = FSM_IP_TRIE_MIN_SIZE;
+    trie->nodes = CALLOC(trie->size, sizeof(*trie->nodes));
+    trie->nnodes = 2; /* IPv4 and IPv6 roots */
+
+    return trie;
+}
+
+static int
+fsm_ip_bit(const uint8_t *addr, int bit)
+{
+    return (addr[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+static void
+fsm_ip_set_bit(uint8_t *addr, int bit, int val)
+{
+    uint8_t mask;
+
+    mask = 0x80 >> (bit & 7);
+    if (val) addr[bit >> 3] |= mask;
+    else addr[bit >> 3] &= ~mask;
+}
+
+/**
+ * @brief checks that the first len bits of an address match a key
+ */
+static bool
+fsm_ip_prefix_match(const uint8_t *addr, const uint8_t *key, int len)
+{
+    uint8_t mask;
+    int bytes;
+    int bits;
+
+    bytes = len >> 3;
+    bits = len & 7;
+    if (memcmp(addr, key, bytes) != 0) return false;
+    if (bits == 0) return true;
+
+    mask = 0xff << (8 - bits);
+
+    return ((addr[bytes] ^ key[bytes]) & mask) == 0;
+}
+
+/**
+ * @brief adds a prefix to a one bit per level build trie
+ *
+ * @param trie the build trie
+ * @param family AF_INET or AF_INET6
+ * @param addr the prefix address, in network order
+ * @param prefix_len the prefix length
+ */
+static void
+fsm_ip_trie_insert(struct fsm_ip_trie *trie, int family, const uint8_t *addr,
+                   int prefix_len)
+{
+    uint32_t node;
+    uint32_t next;
+    int bit;
+    int b;
+
+    if (family == AF_INET) node = FSM_IP_TRIE_ROOT4;
+    else if (family == AF_INET6) node = FSM_IP_TRIE_ROOT6;
+    else return;
+
+    for (bit = 0; bit < prefix_len; bit++)
+    {
+        /* A shorter prefix already covers this one */
+        if (trie->nodes[node].terminal) return;
+
+        b = fsm_ip_bit(addr, bit);
+        next = trie->nodes[node].child[b];
+        if (next == 0)
+        {
+            /* The node array may move */
+            next = fsm_ip_trie_new_node(trie);
+            trie->nodes[node].child[b] = next;
+        }
+        node = next;
+    }
+
+    if (trie->nodes[node].terminal) return;
+
+    trie->nodes[node].terminal = true;
+    trie->nprefixes++;
+}
+
+/**
+ * @brief copies a build trie subtree in its path compressed form
+ *
+ * Chains of non terminal nodes with a single child are skipped: the
+ * copied node records the depth of the next branch or prefix, and the
+ * key leading to it. Terminal nodes cover their whole subtree and become
+ * leaves.
+ * @param dst the compressed trie
+ * @param idx the dst node to fill
+ * @param src the build trie
+ * @param node the src subtree root
+ * @param depth the depth of the src subtree root
+ * @param key the bits leading to the src subtree root
+ */
+static void
+fsm_ip_trie_compress(struct fsm_ip_trie *dst, uint32_t idx,
+                     struct fsm_ip_trie *src, uint32_t node, int depth,
+                     uint8_t *key)
+{
+    struct fsm_ip_trie_node *n;
+    uint32_t child;
+    int b;
+
+    n = &src->nodes[node];
+    while (!n->terminal && ((n->child[0] == 0) != (n->child[1] == 0)))
+    {
+        b = (n->child[1] != 0);
+        fsm_ip_set_bit(key, depth, b);
+        n = &src->nodes[n->child[b]];
+        depth++;
+    }
+
+    dst->nodes[idx].depth = depth;
+    dst->nodes[idx].terminal = n->terminal;
+    memcpy(dst->nodes[idx].key, key, sizeof(dst->nodes[idx].key));
+    if (n->terminal) return;
+
+    for (b = 0; b < 2; b++)
+    {
+        if (n->child[b] == 0) continue;
+
+        /* The dst node array may move */
+        child = fsm_ip_trie_new_node(dst);
+        dst->nodes[idx].child[b] = child;
+        fsm_ip_set_bit(key, depth, b);
+        fsm_ip_trie_compress(dst, child, src, n->child[b], depth + 1, key);
+    }
+}
+
+/**
+ * @brief checks if an address is covered by a prefix of the trie
+ *
+ * Branches are taken on the address bits without checking the skipped
+ * ones. The first terminal node reached is the only candidate prefix,
+ * its key is then compared to the address.
+ * @param trie the trie
+ * @param family AF_INET or AF_INET6
+ * @param addr the address, in network order
+ * @return true if a prefix covers the address
+ */
+bool
+fsm_ip_trie_lookup(struct fsm_ip_trie *trie, int family, const uint8_t *addr)
+{
+    struct fsm_ip_trie_node *n;
+    uint32_t node;
+    int nbits;
+
+    if (trie == NULL) return false;
+
+    if (family == AF_INET)
+    {
+        node = FSM_IP_TRIE_ROOT4;
+        nbits = 32;
+    }
+    else if (family == AF_INET6)
+    {
+        node = FSM_IP_TRIE_ROOT6;
+        nbits = 128;
+    }
+    else
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        n = &trie->nodes[node];
+        if (n->terminal) return fsm_ip_prefix_match(addr, n->key, n->depth);
+        if (n->depth >= nbits) return false;
+
+        node = n->child[fsm_ip_bit(addr, n->depth)];
+        if (node == 0) return false;
+    }
+}
+
+/**
+ * @brief adds the ip values of a tag value tree to the trie
+ *
+ * @param trie the build trie
+ * @param values the tag values
+ * @param match_flags the source flags of the tag reference
+ * @param skip values to leave out, may be NULL
+ * @param skip2 more values to leave out, may be NULL
+ */
+static void
+fsm_ip_trie_add_values(struct fsm_ip_trie *trie, ds_tree_t *values,
+                       uint8_t match_flags, ds_tree_t *skip, ds_tree_t *skip2)
+{
+    om_tag_list_entry_t *tle;
+    uint8_t addr[16];
+    int prefix_len;
+    int family;
+    bool rc;
+
+    if (values == NULL) return;
+
+    ds_tree_foreach(values, tle)
+    {
+        if (match_flags && !(tle->flags & match_flags)) continue;
+
+        if (skip != NULL &&
+            om_tag_list_entry_find_by_value(skip, tle->value) != NULL)
+        {
+            continue;
+        }
+
+        if (skip2 != NULL &&
+            om_tag_list_entry_find_by_value(skip2, tle->value) != NULL)
+        {
+            continue;
+        }
+
+        rc = fsm_ip_parse_prefix(tle->value, &family, addr, &prefix_len);
+        if (!rc) continue;
+
+        fsm_ip_trie_insert(trie, family, addr, prefix_len);
+    }
+}
+
+/**
+ * @brief adds the ip values of a tag to the trie
+ *
+ * The tag update callback runs before the tag values change. The values
+ * of the updated tag are then its current ones, minus the removed and
+ * updated entries, plus the added and updated entries.
+ * @param trie the build trie
+ * @param tag_ref the tag reference
+ * @param update the tag update in progress, NULL if none
+ */
+static void
+fsm_ip_trie_add_tag(struct fsm_ip_trie *trie, char *tag_ref,
+                    struct fsm_policy_tag_update *update)
+{
+    uint8_t match_flags;
+    om_tag_t *tag;
+    bool rc;
+
+    if (update != NULL)
+    {
+        rc = om_tag_ref_matches(tag_ref, update->tag, &match_flags);
+        if (rc)
+        {
+            tag = update->tag;
+            fsm_ip_trie_add_values(trie, &tag->values, match_flags,
+                                   update->removed, update->updated);
+            fsm_ip_trie_add_values(trie, update->added, match_flags,
+                                   NULL, NULL);
+            fsm_ip_trie_add_values(trie, update->updated, match_flags,
+                                   NULL, NULL);
+            return;
+        }
+    }
+
+    tag = om_tag_ref_lookup(tag_ref, &match_flags);
+    if (tag == NULL) return;
+
+    fsm_ip_trie_add_values(trie, &tag->values, match_flags, NULL, NULL);
+}
+
+/**
+ * @brief compiles a policy's ip set in a path compressed prefix trie
+ *
+ * Tags are expanded with their current values, or with the values they
+ * are being updated to.
+ * @param ips the policy's ip set
+ * @param update the tag update in progress, NULL if none
+ * @return the trie
+ */
+struct fsm_ip_trie *
+fsm_ip_trie_build(struct str_set *ips, struct fsm_policy_tag_update *update)
+{
+    struct fsm_ip_trie *build;
+    struct fsm_ip_trie *trie;
+    uint8_t addr[16];
+    int prefix_len;
+    int family;
+    size_t i;
+    bool rc;
+
+    trie = fsm_ip_trie_alloc();
+    if (ips == NULL) return trie;
+
+    build = fsm_ip_trie_alloc();
+    trie->strs = CALLOC(ips->nelems + 1, sizeof(*trie->strs));
+    for (i = 0; i < ips->nelems; i++)
+    {
+        if (om_tag_get_type(ips->array[i]) != NOT_A_OPENSYNC_TAG)
+        {
+            trie->has_tags = true;
+            fsm_ip_trie_add_tag(build, ips->array[i], update);
+            continue;
+        }
+
+        rc = fsm_ip_parse_prefix(ips->array[i], &family, addr, &prefix_len);
+        if (rc)
+        {
+            fsm_ip_trie_insert(build, family, addr, prefix_len);
+            continue;
+        }
+
+        trie->strs[trie->nstrs++] = ips->array[i];
+    }
+
+    memset(addr, 0, sizeof(addr));
+    fsm_ip_trie_compress(trie, FSM_IP_TRIE_ROOT4, build, FSM_IP_TRIE_ROOT4,
+                         0, addr);
+    memset(addr, 0, sizeof(addr));
+    fsm_ip_trie_compress(trie, FSM_IP_TRIE_ROOT6, build, FSM_IP_TRIE_ROOT6,
+                         0, addr);
+    trie->nprefixes = build->nprefixes;
+
+    LOGD("%s: %zu prefixes, %zu nodes (%zu uncompressed), %zu unparsed entries",
+         __func__, trie->nprefixes, trie->nnodes, build->nnodes, trie->nstrs);
+
+    fsm_ip_trie_free(build);
+
+    return trie;
+}
+
+/**
+ * @brief releases a prefix trie
+ */
+void
+fsm_ip_trie_free(struct fsm_ip_trie *trie)
+{
+    if (trie == NULL) return;
+
+    FREE(trie->nodes);
+    FREE(trie->strs);
+    FREE(trie);
+}
+
+/**
+ * @brief checks an address against a policy's ip rule values
+ *
+ * The trie is compiled when the policy is configured, and recompiled from
+ * the tag update callback when one of its tags changes.
+ * @param rules the policy rules
+ * @param family the address family, 0 if the address is not available
+ * @param addr the binary address, in network order
+ * @param ip_s the address string, checked against the unparsed entries
+ * @return true if the address is part of the rule values
+ */
+bool
+fsm_ip_in_rules(struct fsm_policy_rules *rules, int family,
+                const uint8_t *addr, const char *ip_s)
+{
+    struct fsm_ip_trie *trie;
+    size_t i;
+
+    if (rules->ipaddrs == NULL) return false;
+
+    trie = rules->ip_trie;
+    if (trie == NULL) return false;
+
+    if (family != 0 && fsm_ip_trie_lookup(trie, family, addr)) return true;
+
+    if (ip_s == NULL) return false;
+
+    for (i = 0; i < trie->nstrs; i++)
+    {
+        if (strcmp(ip_s, trie->strs[i]) == 0) return true;
+    }
+
+    return false;
+}
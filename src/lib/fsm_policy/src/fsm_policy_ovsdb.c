@@ -239,6 +239,9 @@ fsm_free_rules(struct fsm_policy_rules *rules)
     rules->ip_rule_present = false;
     rules->ip_op = -1;
     free_str_set(rules->ipaddrs);
+    fsm_ip_trie_free(rules->ip_trie);
+    rules->ipaddrs = NULL;
+    rules->ip_trie = NULL;
 }
 
 
@@ -423,7 +426,11 @@ fsm_set_ip_rules(struct fsm_policy_rules *rules,
                                     spolicy->ipaddrs_len,
                                     spolicy->ipaddrs);
     check = fsm_check_conversion(rules->ipaddrs, spolicy->ipaddrs_len);
-    return check;
+    if (!check) return false;
+
+    rules->ip_trie = fsm_ip_trie_build(rules->ipaddrs, NULL);
+
+    return true;
 }
 
 
@@ -639,6 +646,9 @@ struct fsm_policy *fsm_policy_insert_schema_p(struct policy_table *table,
     /* Insert policy in the table's policy tree */
     ds_tree_insert(&table->policies, fpolicy, &fpolicy->idx);
 
+    /* Invalidate the table's cached decisions */
+    table->generation++;
+
     LOGN("%s: loaded policy %s into table %s", __func__,
         fpolicy->rule_name, fpolicy->table_name);
 
@@ -866,6 +876,10 @@ void fsm_free_policy(struct fsm_policy *fpolicy)
     idx = fpolicy->idx;
     table->lookup_array[idx] = NULL;
     FREE(fpolicy);
+
+    /* Invalidate the table's cached decisions */
+    table->generation++;
+    if (ds_tree_is_empty(&table->policies)) fsm_policy_cache_free(table);
 }
 
 
@@ -926,7 +940,7 @@ void callback_FSM_Policy(ovsdb_update_monitor_t *mon,
         fsm_update_policy(spolicy);
     }
 
-    dns_cache_cleanup();
+    dns_cache_invalidate();
 }
 
 struct policy_table * fsm_policy_find_table(char *name)
@@ -945,6 +959,83 @@ struct policy_table * fsm_policy_find_table(char *name)
 }
 
 
+/**
+ * @brief checks if a policy rule set references a tag
+ *
+ * @param set the rule values
+ * @param tag the tag
+ * @return true if one of the values designates the tag
+ */
+static bool fsm_policy_set_has_tag(struct str_set *set, om_tag_t *tag)
+{
+    size_t i;
+
+    if (set == NULL) return false;
+
+    for (i = 0; i < set->nelems; i++)
+    {
+        if (om_tag_ref_matches(set->array[i], tag, NULL)) return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * @brief refreshes the policies referencing an updated tag
+ *
+ * Called from the tag update callback. The ip tries of the policies
+ * referencing the tag are recompiled, and the decision cache of their
+ * tables invalidated. Other tables are left untouched.
+ * @param tag the tag being added, updated or removed
+ * @param removed the removed values
+ * @param added the added values
+ * @param updated the values with updated flags
+ */
+void fsm_policy_tag_update(om_tag_t *tag, ds_tree_t *removed,
+                           ds_tree_t *added, ds_tree_t *updated)
+{
+    struct fsm_policy_tag_update update;
+    struct fsm_policy_session *mgr;
+    struct fsm_policy_rules *rules;
+    struct policy_table *table;
+    struct fsm_policy *fpolicy;
+    bool referenced;
+
+    mgr = fsm_policy_get_mgr();
+    if (!mgr->initialized) return;
+
+    update.tag = tag;
+    update.removed = removed;
+    update.added = added;
+    update.updated = updated;
+
+    ds_tree_foreach(&mgr->policy_tables, table)
+    {
+        referenced = false;
+        ds_tree_foreach(&table->policies, fpolicy)
+        {
+            rules = &fpolicy->rules;
+            referenced |= fsm_policy_set_has_tag(rules->macs, tag);
+            referenced |= fsm_policy_set_has_tag(rules->fqdns, tag);
+
+            if (!fsm_policy_set_has_tag(rules->ipaddrs, tag)) continue;
+
+            referenced = true;
+            if (rules->ip_trie == NULL) continue;
+
+            LOGD("%s: recompiling %s:%s ip set for tag %s", __func__,
+                 table->name, fpolicy->rule_name, tag->name);
+
+            fsm_ip_trie_free(rules->ip_trie);
+            rules->ip_trie = fsm_ip_trie_build(rules->ipaddrs, &update);
+        }
+
+        if (referenced) table->generation++;
+    }
+}
+
+
 int table_name_cmp(void *a, void *b)
 {
     char *name_a = (char *)a;
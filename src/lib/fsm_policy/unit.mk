@@ -34,6 +34,7 @@ UNIT_TYPE := LIB
 UNIT_SRC := src/fsm_policy.c
 UNIT_SRC += src/fsm_policy_ovsdb.c
 UNIT_SRC += src/fsm_policy_client.c
+UNIT_SRC += src/fsm_policy_ip.c
 
 UNIT_CFLAGS := -I$(UNIT_PATH)/inc
 UNIT_CFLAGS += -Isrc/fsm/inc
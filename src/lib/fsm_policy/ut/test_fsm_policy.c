@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 
 #include "fsm.h"
 #include "log.h"
@@ -43,6 +44,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "schema.h"
 #include "policy_tags.h"
 #include "memutil.h"
+#include "ovsdb_utils.h"
 
 const char *test_name = "fsm_policy_tests";
 
@@ -1386,6 +1388,268 @@ test_fsm_policy_flush(void)
 }
 
 
+static bool
+test_tag_update_cb(om_tag_t *tag, ds_tree_t *removed, ds_tree_t *added,
+                   ds_tree_t *updated)
+{
+    fsm_policy_tag_update(tag, removed, added, updated);
+    return true;
+}
+
+
+/**
+ * @brief test the compiled ip prefix trie of a policy's ipaddr rule
+ */
+void test_ip_trie(void)
+{
+    struct fsm_policy_rules rules;
+    struct schema_Openflow_Tag stag;
+    uint8_t addr[16];
+    bool rc;
+
+    char ips[][64] =
+    {
+        "10.0.0.0/8",
+        "192.168.1.1",
+        "2001:db8::/32",
+        "${@ip_tag}",
+        "not_an_ip",
+    };
+
+    memset(&stag, 0, sizeof(stag));
+    stag.name_exists = true;
+    STRSCPY(stag.name, "ip_tag");
+    stag.device_value_len = 2;
+    STRSCPY(stag.device_value[0], "172.16.0.0/12");
+    STRSCPY(stag.device_value[1], "fe80::1");
+    stag.cloud_value_len = 1;
+    STRSCPY(stag.cloud_value[0], "8.8.8.8");
+    rc = om_tag_add_from_schema(&stag);
+    TEST_ASSERT_TRUE(rc);
+
+    memset(&rules, 0, sizeof(rules));
+    rules.ipaddrs = schema2str_set(sizeof(ips[0]), 5, ips);
+    TEST_ASSERT_NOT_NULL(rules.ipaddrs);
+    rules.ip_trie = fsm_ip_trie_build(rules.ipaddrs, NULL);
+    TEST_ASSERT_NOT_NULL(rules.ip_trie);
+
+    /* CIDR and host entries */
+    inet_pton(AF_INET, "10.200.3.4", addr);
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(&rules, AF_INET, addr, NULL));
+    inet_pton(AF_INET, "11.0.0.1", addr);
+    TEST_ASSERT_FALSE(fsm_ip_in_rules(&rules, AF_INET, addr, NULL));
+    inet_pton(AF_INET, "192.168.1.1", addr);
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(&rules, AF_INET, addr, NULL));
+    inet_pton(AF_INET, "192.168.1.2", addr);
+    TEST_ASSERT_FALSE(fsm_ip_in_rules(&rules, AF_INET, addr, NULL));
+    inet_pton(AF_INET6, "2001:db8:1::5", addr);
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(&rules, AF_INET6, addr, NULL));
+    inet_pton(AF_INET6, "2001:db9::5", addr);
+    TEST_ASSERT_FALSE(fsm_ip_in_rules(&rules, AF_INET6, addr, NULL));
+
+    /* Tag entries, filtered by source */
+    inet_pton(AF_INET, "172.31.255.1", addr);
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(&rules, AF_INET, addr, NULL));
+    inet_pton(AF_INET6, "fe80::1", addr);
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(&rules, AF_INET6, addr, NULL));
+    inet_pton(AF_INET, "8.8.8.8", addr);
+    TEST_ASSERT_FALSE(fsm_ip_in_rules(&rules, AF_INET, addr, NULL));
+
+    /* Unparsed entries are compared as strings */
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(&rules, 0, NULL, "not_an_ip"));
+
+    /* The trie is path compressed: single child chains are skipped */
+    TEST_ASSERT_TRUE(rules.ip_trie->nnodes < 32);
+
+    rc = om_tag_remove_from_schema(&stag);
+    TEST_ASSERT_TRUE(rc);
+
+    free_str_set(rules.ipaddrs);
+    fsm_ip_trie_free(rules.ip_trie);
+}
+
+
+/**
+ * @brief test the recompilation of a policy's ip trie on tag updates
+ */
+void test_ip_trie_tag_update(void)
+{
+    struct schema_FSM_Policy spolicy;
+    struct schema_Openflow_Tag stag;
+    struct fsm_policy_rules *rules;
+    struct fsm_ip_trie *other_trie;
+    struct fsm_policy *fpolicy;
+    struct tag_mgr tag_mgr;
+    uint8_t addr[16];
+    bool rc;
+
+    memset(&tag_mgr, 0, sizeof(tag_mgr));
+    tag_mgr.service_tag_update = test_tag_update_cb;
+    om_tag_init(&tag_mgr);
+
+    /* A policy referencing the tag, and one which does not */
+    spolicy = spolicies[8];
+    STRSCPY(spolicy.policy, "ip_trie_table");
+    STRSCPY(spolicy.ipaddrs[0], "${@ip_tag}");
+    fsm_add_policy(&spolicy);
+    fpolicy = fsm_policy_lookup(&spolicy);
+    TEST_ASSERT_NOT_NULL(fpolicy);
+    rules = &fpolicy->rules;
+
+    fsm_add_policy(&spolicies[4]);
+    fpolicy = fsm_policy_lookup(&spolicies[4]);
+    TEST_ASSERT_NOT_NULL(fpolicy);
+    other_trie = fpolicy->rules.ip_trie;
+
+    inet_pton(AF_INET, "172.16.0.1", addr);
+    TEST_ASSERT_FALSE(fsm_ip_in_rules(rules, AF_INET, addr, NULL));
+
+    /* The tag addition is compiled in the referencing policy */
+    memset(&stag, 0, sizeof(stag));
+    stag.name_exists = true;
+    STRSCPY(stag.name, "ip_tag");
+    stag.device_value_len = 2;
+    STRSCPY(stag.device_value[0], "172.16.0.0/12");
+    STRSCPY(stag.device_value[1], "fe80::1");
+    rc = om_tag_add_from_schema(&stag);
+    TEST_ASSERT_TRUE(rc);
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(rules, AF_INET, addr, NULL));
+
+    /* Updates are compiled with the new values */
+    STRSCPY(stag.device_value[1], "8.8.8.8");
+    rc = om_tag_update_from_schema(&stag);
+    TEST_ASSERT_TRUE(rc);
+    inet_pton(AF_INET, "8.8.8.8", addr);
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(rules, AF_INET, addr, NULL));
+    inet_pton(AF_INET6, "fe80::1", addr);
+    TEST_ASSERT_FALSE(fsm_ip_in_rules(rules, AF_INET6, addr, NULL));
+    inet_pton(AF_INET6, "::1", addr);
+    TEST_ASSERT_TRUE(fsm_ip_in_rules(rules, AF_INET6, addr, NULL));
+
+    /* The removal drops the tag values */
+    rc = om_tag_remove_from_schema(&stag);
+    TEST_ASSERT_TRUE(rc);
+    inet_pton(AF_INET, "172.16.0.1", addr);
+    TEST_ASSERT_FALSE(fsm_ip_in_rules(rules, AF_INET, addr, NULL));
+
+    /* The policy not referencing the tag kept its trie */
+    TEST_ASSERT_TRUE(other_trie == fpolicy->rules.ip_trie);
+
+    memset(&tag_mgr, 0, sizeof(tag_mgr));
+    om_tag_init(&tag_mgr);
+}
+
+
+/**
+ * @brief test the decision cache of the static policy checks
+ */
+void test_policy_cache(void)
+{
+    struct schema_Openflow_Tag stag;
+    struct schema_FSM_Policy *spolicy;
+    struct fqdn_pending_req fqdn_req;
+    struct fsm_url_request req_info;
+    struct fsm_policy_session *mgr;
+    struct fsm_policy_reply *policy_reply;
+    struct fsm_session session;
+    struct policy_table *table;
+    struct fsm_policy_req req;
+    struct tag_mgr tag_mgr;
+    os_macaddr_t mac;
+    size_t i;
+    bool rc;
+
+    struct cache_expected
+    {
+        uint64_t hits;
+        uint64_t misses;
+    } expected[] =
+    {
+        { .hits = 0, .misses = 1 }, /* First lookup */
+        { .hits = 1, .misses = 1 }, /* Same request */
+        { .hits = 2, .misses = 1 }, /* After an unreferenced tag update */
+        { .hits = 2, .misses = 2 }, /* After a referenced tag update */
+        { .hits = 2, .misses = 3 }, /* After a policy update */
+    };
+
+    memset(&tag_mgr, 0, sizeof(tag_mgr));
+    tag_mgr.service_tag_update = test_tag_update_cb;
+    om_tag_init(&tag_mgr);
+
+    /* Insert the mac match policy */
+    spolicy = &spolicies[6];
+    fsm_add_policy(spolicy);
+
+    mgr = fsm_policy_get_mgr();
+    table = ds_tree_find(&mgr->policy_tables, spolicy->policy);
+    TEST_ASSERT_NOT_NULL(table);
+
+    /* In tag_1's device values */
+    memset(&mac, 0x11, sizeof(mac));
+
+    for (i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        if (i == 2)
+        {
+            memcpy(&stag, &g_tags[1], sizeof(stag));
+            STRSCPY(stag.device_value[0], "16:16:16:16:16:16");
+            rc = om_tag_update_from_schema(&stag);
+            TEST_ASSERT_TRUE(rc);
+        }
+        else if (i == 3)
+        {
+            memcpy(&stag, &g_tags[0], sizeof(stag));
+            STRSCPY(stag.cloud_value[0], "16:16:16:16:16:16");
+            rc = om_tag_update_from_schema(&stag);
+            TEST_ASSERT_TRUE(rc);
+        }
+        else if (i == 4)
+        {
+            fsm_update_policy(spolicy);
+        }
+
+        memset(&fqdn_req, 0, sizeof(fqdn_req));
+        memset(&req_info, 0, sizeof(req_info));
+        memset(&req, 0, sizeof(req));
+        memset(&session, 0, sizeof(session));
+
+        STRSCPY(req_info.url, "www.playboy.com");
+        fqdn_req.req_info = &req_info;
+        fqdn_req.numq = 1;
+        req.fqdn_req = &fqdn_req;
+        req.session = &session;
+        req.device_id = &mac;
+        req.url = req_info.url;
+
+        policy_reply = fsm_policy_initialize_reply(&session);
+        TEST_ASSERT_NOT_NULL(policy_reply);
+
+        policy_reply->policy_table = table;
+        policy_reply->categories_check = test_cat_check;
+        policy_reply->risk_level_check = test_risk_level;
+
+        fsm_apply_policies(&req, policy_reply);
+
+        /* Cached or not, the decision is the same */
+        TEST_ASSERT_EQUAL_INT(FSM_BLOCK, policy_reply->action);
+        TEST_ASSERT_EQUAL_UINT64(expected[i].hits, table->cache_hits);
+        TEST_ASSERT_EQUAL_UINT64(expected[i].misses, table->cache_misses);
+
+        fsm_policy_free_reply(policy_reply);
+        fsm_free_url_reply(fqdn_req.req_info->reply);
+    }
+
+    /* Restore tag_1 and tag_2 */
+    rc = om_tag_update_from_schema(&g_tags[0]);
+    TEST_ASSERT_TRUE(rc);
+    rc = om_tag_update_from_schema(&g_tags[1]);
+    TEST_ASSERT_TRUE(rc);
+
+    memset(&tag_mgr, 0, sizeof(tag_mgr));
+    om_tag_init(&tag_mgr);
+}
+
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -1410,6 +1674,9 @@ int main(int argc, char *argv[])
     RUN_TEST(test_apply_wildcard_policy_match_in);
     RUN_TEST(test_apply_wildcard_policy_no_match);
     RUN_TEST(test_ip_threat_blacklist);
+    RUN_TEST(test_ip_trie);
+    RUN_TEST(test_ip_trie_tag_update);
+    RUN_TEST(test_policy_cache);
     RUN_TEST(test_fsm_policy_flush);
 
     return UNITY_END();
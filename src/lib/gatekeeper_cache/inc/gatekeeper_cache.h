@@ -37,6 +37,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "os_types.h"
 #include "fsm_policy.h"
 #include "ds_tree.h"
+#include "ds_wheel.h"
 #include "util.h"
 #include "os.h"
 #include "network_metadata_report.h"
@@ -101,20 +102,6 @@ enum gkc_flow_direction
     GKC_FLOW_DIRECTION_LAN2LAN     = NET_MD_ACC_LAN2LAN_DIR,
 };
 
-/**
- * @brief structure to store parameters
- * required for checking and deleting
- * entries with expired TTL values.
- */
-struct gkc_del_info_s
-{
-    enum gk_cache_request_type attr_type;
-    struct per_device_cache *pdevice;
-    uint64_t attr_del_count;
-    uint64_t flow_del_count;
-    ds_tree_t *tree;
-};
-
 /**
  * @brief structure to store fqdn
  * redirect entries
@@ -143,7 +130,11 @@ struct attr_cache
     struct fqdn_redirect_s *fqdn_redirect;
     uint8_t                 direction;        /* inbound or outbound */
     uint64_t                key;              /* used to differentiate entries */
+    struct per_device_cache *pdevice;         /* device owning the entry */
+    ds_tree_t              *tree;             /* attribute tree holding the entry */
+    enum gk_cache_request_type tree_type;     /* attribute type of the tree */
     ds_tree_node_t          attr_tnode;
+    ds_wheel_node_t         attr_wnode;       /* TTL expiry */
 };
 
 /**
@@ -166,7 +157,10 @@ struct ip_flow_cache
     uint32_t confidence_level;  /* risk/confidence level */
     time_t cache_ts;            /* time when the entry was added */
     struct counter_s hit_count; /* number of times lookup is performed */
+    struct per_device_cache *pdevice; /* device owning the flow */
+    ds_tree_t *tree;            /* flow tree holding the flow */
     ds_tree_node_t ipflow_tnode;
+    ds_wheel_node_t ipflow_wnode; /* TTL expiry */
 };
 
 /**
@@ -212,6 +206,8 @@ struct gk_cache_mgr
     bool initialized;
     uint64_t total_entry_count;
     ds_tree_t per_device_tree; /* per_device_cache */
+    ds_wheel_t attr_wheel;     /* attr_cache by expiry time */
+    ds_wheel_t flow_wheel;     /* ip_flow_cache by expiry time */
 };
 
 /**
@@ -323,15 +319,14 @@ void
 gk_cache_cleanup(void);
 
 /**
- * @brief check ttl value for the given attribue
- *        or flow tree
+ * @brief deletes the attributes whose TTL expired
  *
- * @params: attribute or flow tree
+ * @params: now current time
  *
- * @return void.
+ * @return the number of deleted attributes
  */
-void
-gk_cache_check_ttl_device_tree(ds_tree_t *tree);
+uint64_t
+gkc_expire_attributes(time_t now);
 
 /**
  * @brief get the count of devices having allowed action
@@ -514,13 +509,14 @@ bool
 gkc_is_flow_valid(struct gkc_ip_flow_interface *req);
 
 /**
- * @brief delete the given flow from the flow
- *        tree if TTL is expired
+ * @brief deletes the flows whose TTL expired
  *
- * @params: gk_del_info cache delete info structure
+ * @params: now current time
+ *
+ * @return the number of deleted flows
  */
-void
-gkc_cleanup_ttl_flow_tree(struct gkc_del_info_s *gk_del_info);
+uint64_t
+gkc_expire_flows(time_t now);
 
 /**
  * @brief Get the number of entries cached by gatekeeper
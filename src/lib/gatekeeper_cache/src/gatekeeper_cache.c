@@ -245,6 +245,8 @@ gk_cache_init_mgr(struct gk_cache_mgr *mgr)
 
     /* initialize per device tree */
     ds_tree_init(&mgr->per_device_tree, gkc_mac_addr_cmp, struct per_device_cache, perdevice_tnode);
+    ds_wheel_init(&mgr->attr_wheel, struct attr_cache, attr_wnode);
+    ds_wheel_init(&mgr->flow_wheel, struct ip_flow_cache, ipflow_wnode);
 
     mgr->initialized = true;
 
@@ -385,6 +387,30 @@ cleanup_new_attr:
     return NULL;
 }
 
+/**
+ * @brief links a new attribute to its device tree and arms its TTL expiry
+ *
+ * @params: pdevice_cache: device owning the attribute
+ * @params: cache: tree structure for the attribute type
+ * @params: tree_type: attribute type of the tree
+ * @params: new_attr_cache: the attribute
+ */
+static void
+gkc_link_attr_entry(struct per_device_cache *pdevice_cache, ds_tree_t *cache,
+                    enum gk_cache_request_type tree_type, struct attr_cache *new_attr_cache)
+{
+    struct gk_cache_mgr *mgr;
+
+    mgr = gk_cache_get_mgr();
+
+    new_attr_cache->pdevice = pdevice_cache;
+    new_attr_cache->tree = cache;
+    new_attr_cache->tree_type = tree_type;
+    ds_tree_insert(cache, new_attr_cache, &new_attr_cache->key);
+    ds_wheel_insert(&mgr->attr_wheel, new_attr_cache,
+                    new_attr_cache->cache_ts + new_attr_cache->cache_ttl);
+}
+
 /**
  * @brief effectively add the attribute to the per device 'host_name' tree.
  *        We have ensured that the manager is initialized.
@@ -396,8 +422,9 @@ cleanup_new_attr:
  *         false otherwise (we updated the cache)
  */
 static bool
-gkc_insert_host_name(ds_tree_t *cache, struct gk_attr_cache_interface *entry)
+gkc_insert_host_name(struct per_device_cache *pdevice_cache, struct gk_attr_cache_interface *entry)
 {
+    struct gk_cache_mgr *mgr;
     struct attr_cache *cached_attr_entry;
     struct attr_cache *new_attr_cache;
     struct attr_hostname_s *attr;
@@ -441,6 +468,10 @@ gkc_insert_host_name(ds_tree_t *cache, struct gk_attr_cache_interface *entry)
         now = time(NULL);
         cached_attr_entry->cache_ts = now;
 
+        mgr = gk_cache_get_mgr();
+        ds_wheel_insert(&mgr->attr_wheel, cached_attr_entry,
+                        cached_attr_entry->cache_ts + cached_attr_entry->cache_ttl);
+
         return false;
     }
 
@@ -448,7 +479,8 @@ gkc_insert_host_name(ds_tree_t *cache, struct gk_attr_cache_interface *entry)
     new_attr_cache = gkc_new_attr_entry(entry);
     if (new_attr_cache == NULL) return false;
 
-    ds_tree_insert(cache, new_attr_cache, &new_attr_cache->key);
+    gkc_link_attr_entry(pdevice_cache, &pdevice_cache->hostname_tree,
+                        GK_CACHE_INTERNAL_TYPE_HOSTNAME, new_attr_cache);
 
     return true;
 }
@@ -463,7 +495,8 @@ gkc_insert_host_name(ds_tree_t *cache, struct gk_attr_cache_interface *entry)
  *         false otherwise (we updated the cache)
  */
 static bool
-gkc_insert_generic(ds_tree_t *cache, struct gk_attr_cache_interface *entry)
+gkc_insert_generic(struct per_device_cache *pdevice_cache, ds_tree_t *cache,
+                   struct gk_attr_cache_interface *entry)
 {
     struct attr_cache *new_attr_cache;
     bool was_inserted;
@@ -482,7 +515,7 @@ gkc_insert_generic(ds_tree_t *cache, struct gk_attr_cache_interface *entry)
     new_attr_cache = gkc_new_attr_entry(entry);
     if (new_attr_cache == NULL) return false;
 
-    ds_tree_insert(cache, new_attr_cache, &new_attr_cache->key);
+    gkc_link_attr_entry(pdevice_cache, cache, entry->attribute_type, new_attr_cache);
 
     return true;
 }
@@ -505,23 +538,23 @@ gkc_add_attr_tree(struct per_device_cache *pdevice_cache, struct gk_attr_cache_i
         case GK_CACHE_REQ_TYPE_FQDN:
         case GK_CACHE_REQ_TYPE_HOST:
         case GK_CACHE_REQ_TYPE_SNI:
-            was_inserted = gkc_insert_host_name(&pdevice_cache->hostname_tree, entry);
+            was_inserted = gkc_insert_host_name(pdevice_cache, entry);
             break;
 
         case GK_CACHE_REQ_TYPE_URL:
-            was_inserted = gkc_insert_generic(&pdevice_cache->url_tree, entry);
+            was_inserted = gkc_insert_generic(pdevice_cache, &pdevice_cache->url_tree, entry);
             break;
 
         case GK_CACHE_REQ_TYPE_IPV4:
-            was_inserted = gkc_insert_generic(&pdevice_cache->ipv4_tree, entry);
+            was_inserted = gkc_insert_generic(pdevice_cache, &pdevice_cache->ipv4_tree, entry);
             break;
 
         case GK_CACHE_REQ_TYPE_IPV6:
-            was_inserted = gkc_insert_generic(&pdevice_cache->ipv6_tree, entry);
+            was_inserted = gkc_insert_generic(pdevice_cache, &pdevice_cache->ipv6_tree, entry);
             break;
 
         case GK_CACHE_REQ_TYPE_APP:
-            was_inserted = gkc_insert_generic(&pdevice_cache->app_tree, entry);
+            was_inserted = gkc_insert_generic(pdevice_cache, &pdevice_cache->app_tree, entry);
             break;
 
         default:
@@ -1039,19 +1072,26 @@ gkc_del_attribute(struct gk_attr_cache_interface *req)
 /**
  * @brief remove old cache entres.
  *
- * @param ttl the cache entry time to live
+ * Entries are indexed by expiry time, only the ones due are visited.
  */
 void
 gkc_ttl_cleanup(void)
 {
     struct gk_cache_mgr *mgr;
-    ds_tree_t *tree;
+    uint64_t attr_count;
+    uint64_t flow_count;
+    time_t now;
 
     mgr = gk_cache_get_mgr();
     if (!mgr->initialized) return;
 
-    tree = &mgr->per_device_tree;
-    gk_cache_check_ttl_device_tree(tree);
+    now = time(NULL);
+    attr_count = gkc_expire_attributes(now);
+    flow_count = gkc_expire_flows(now);
+
+    LOGT("%s(): number of expired TTL entries: attribute type: %" PRIu64
+         ", flow type %" PRIu64 ", remaining entries: %" PRIu64,
+         __func__, attr_count, flow_count, mgr->total_entry_count);
 }
 
 /**
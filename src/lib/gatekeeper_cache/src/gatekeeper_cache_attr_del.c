@@ -38,6 +38,10 @@ void
 gkc_free_attr_entry(struct attr_cache *attr_entry, enum gk_cache_request_type attr_type)
 {
     union attribute_type *attr;
+    struct gk_cache_mgr *mgr;
+
+    mgr = gk_cache_get_mgr();
+    ds_wheel_remove(&mgr->attr_wheel, attr_entry);
 
     attr = &attr_entry->attr;
     switch (attr_type)
@@ -112,6 +116,11 @@ gk_clean_attribute_tree(ds_tree_t *tree, enum gk_cache_request_type attr_type)
 static void
 free_flow_entry_members(struct ip_flow_cache *flow_entry)
 {
+    struct gk_cache_mgr *mgr;
+
+    mgr = gk_cache_get_mgr();
+    ds_wheel_remove(&mgr->flow_wheel, flow_entry);
+
     FREE(flow_entry->src_ip_addr);
     FREE(flow_entry->dst_ip_addr);
     FREE(flow_entry->gk_policy);
@@ -208,26 +217,6 @@ gk_cache_cleanup(void)
     mgr->total_entry_count = 0;
 }
 
-/**
- * @brief check if the TTL is expired for the given
- *        attribute
- * @params: attr_entry pointer to attribute tree
- * @return true on success, false on failure
- */
-static bool
-gkc_attr_ttl_expired(struct attr_cache *attr_entry)
-{
-    time_t now;
-    now = time(NULL);
-
-    /* check if TTL is expired */
-    if ((now - attr_entry->cache_ts) < attr_entry->cache_ttl)
-    {
-        return false;
-    }
-    return true;
-}
-
 static const char *
 gk_get_attribute_value(struct attr_cache *attr_entry, enum gk_cache_request_type attr_type)
 {
@@ -302,117 +291,41 @@ gk_get_attribute_tree(struct per_device_cache *pdevice, int attr_type)
 }
 
 /**
- * @brief delete the given attribute from the attr
- *        tree if TTL is expired
+ * @brief deletes the attributes whose TTL expired
  *
- * @params: gk_del_info cache delete info structure
+ * Only the attributes hashed to the seconds elapsed since the previous
+ * call are checked.
+ * @params: now current time
+ * @return the number of deleted attributes
  */
-
-static void
-gkc_cleanup_ttl_attribute_tree(struct gkc_del_info_s *gk_del_info)
+uint64_t
+gkc_expire_attributes(time_t now)
 {
-    struct attr_cache *attr_entry, *remove;
+    struct attr_cache *remove;
     struct gk_cache_mgr *mgr;
-    bool ttl_expired;
+    uint64_t count;
 
     mgr = gk_cache_get_mgr();
-    if (!mgr->initialized) return;
+    if (!mgr->initialized) return 0;
 
-    attr_entry = ds_tree_head(gk_del_info->tree);
-    while (attr_entry != NULL)
+    count = 0;
+    while ((remove = ds_wheel_expire(&mgr->attr_wheel, now)) != NULL)
     {
-        remove = attr_entry;
-        attr_entry = ds_tree_next(gk_del_info->tree, attr_entry);
-        ttl_expired = gkc_attr_ttl_expired(remove);
-        if (ttl_expired == false) continue;
-
         LOGT("%s(): Removing attribute '%s', for device " PRI_os_macaddr_lower_t " due to expired TTL",
              __func__,
-             gk_get_attribute_value(remove, gk_del_info->attr_type),
-             FMT_os_macaddr_pt(gk_del_info->pdevice->device_mac));
-
-        gkc_free_attr_entry(remove, gk_del_info->attr_type);
+             gk_get_attribute_value(remove, remove->tree_type),
+             FMT_os_macaddr_pt(remove->pdevice->device_mac));
 
-        gk_del_info->attr_del_count++;
+        gkc_free_attr_entry(remove, remove->tree_type);
 
         /* decrement the cache entries counter */
         mgr->total_entry_count--;
-        ds_tree_remove(gk_del_info->tree, remove);
+        ds_tree_remove(remove->tree, remove);
         FREE(remove);
+        count++;
     }
-}
-
-/**
- * @brief deletes attributes with expired TTL value
- *
- * @params: pdevice pointer to device structure
- */
-static void
-gk_cache_check_ttl_per_device(struct per_device_cache *pdevice)
-{
-    struct gkc_del_info_s *gk_del_info;
-    int attr_types[] = { GK_CACHE_INTERNAL_TYPE_HOSTNAME, GK_CACHE_REQ_TYPE_URL,
-                         GK_CACHE_REQ_TYPE_IPV4, GK_CACHE_REQ_TYPE_IPV6,
-                         GK_CACHE_REQ_TYPE_APP };
-    size_t i;
-
-    gk_del_info = CALLOC(1, sizeof(*gk_del_info));
-    if (gk_del_info == NULL) return;
-
-    gk_del_info->pdevice = pdevice;
-
-    /* loop through all the attributes and check for TTL expiry */
-    /* Note: HOST, FQDN and SNI are wrapped in one single tree */
-    for (i = 0; i < sizeof(attr_types) / sizeof(attr_types[0]); i++)
-    {
-        gk_del_info->attr_type = attr_types[i];
-        /* get the tree for this attribute type */
-        gk_del_info->tree = gk_get_attribute_tree(pdevice, attr_types[i]);
-        gkc_cleanup_ttl_attribute_tree(gk_del_info);
-    }
-
-    /* check the flow inbound tree */
-    gk_del_info->attr_type = GK_CACHE_REQ_TYPE_INBOUND;
-    gk_del_info->tree = &pdevice->inbound_tree;
-    gkc_cleanup_ttl_flow_tree(gk_del_info);
 
-    /* check the flow outbound tree */
-    gk_del_info->attr_type = GK_CACHE_REQ_TYPE_OUTBOUND;
-    gk_del_info->tree = &pdevice->outbound_tree;
-    gkc_cleanup_ttl_flow_tree(gk_del_info);
-
-    LOGT("%s(): number of expired TTL entries for device: " PRI_os_macaddr_lower_t " attribute type: %" PRIu64
-         ", flow type %" PRIu64,
-         __func__,
-         FMT_os_macaddr_pt(pdevice->device_mac),
-         gk_del_info->attr_del_count,
-         gk_del_info->flow_del_count);
-
-    FREE(gk_del_info);
-}
-
-/**
- * @brief deletes all the flows and attributes with
- *        expired TTL
- *
- * @params: tree device tree structure check and
- *          and delete entries.
- */
-void
-gk_cache_check_ttl_device_tree(ds_tree_t *tree)
-{
-    struct per_device_cache *pdevice, *current;
-
-    LOGT("%s(): cache entries before flushing expired TTL entries: %lu", __func__, gk_get_cache_count());
-
-    pdevice = ds_tree_head(tree);
-    while (pdevice != NULL)
-    {
-        current = pdevice;
-        pdevice = ds_tree_next(tree, pdevice);
-        gk_cache_check_ttl_per_device(current);
-    }
-    LOGT("%s(): cache entries after flushing expired TTL entries: %lu", __func__, gk_get_cache_count());
+    return count;
 }
 
 static bool
@@ -139,12 +139,17 @@ gkc_add_flow_tree(struct per_device_cache *pdevice,
 
     if (req->direction == GKC_FLOW_DIRECTION_INBOUND)
     {
-        ds_tree_insert(&pdevice->inbound_tree, flow_entry, flow_entry);
+        flow_entry->tree = &pdevice->inbound_tree;
     }
-    else if (req->direction == GKC_FLOW_DIRECTION_OUTBOUND)
+    else
     {
-        ds_tree_insert(&pdevice->outbound_tree, flow_entry, flow_entry);
+        flow_entry->tree = &pdevice->outbound_tree;
     }
 
+    flow_entry->pdevice = pdevice;
+    ds_tree_insert(flow_entry->tree, flow_entry, flow_entry);
+    ds_wheel_insert(&mgr->flow_wheel, flow_entry,
+                    flow_entry->cache_ts + flow_entry->cache_ttl);
+
     return true;
 }
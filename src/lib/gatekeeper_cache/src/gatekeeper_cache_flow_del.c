@@ -70,6 +70,11 @@ gkc_is_flow_present(struct ip_flow_cache *cur_flow_entry,
 void
 gkc_free_flow_members(struct ip_flow_cache *flow_entry)
 {
+    struct gk_cache_mgr *mgr;
+
+    mgr = gk_cache_get_mgr();
+    ds_wheel_remove(&mgr->flow_wheel, flow_entry);
+
     FREE(flow_entry->gk_policy);
     FREE(flow_entry->dst_ip_addr);
     FREE(flow_entry->src_ip_addr);
@@ -150,51 +155,31 @@ gkc_del_flow_from_dev(struct per_device_cache *pdevice,
     return ret;
 }
 
-static bool
-gkc_flow_ttl_expired(struct ip_flow_cache *flow_entry)
-{
-    time_t now;
-    now = time(NULL);
-
-    /* check if TTL is expired */
-    if ((now - flow_entry->cache_ts) < flow_entry->cache_ttl) return false;
-
-    return true;
-}
-
 /**
- * @brief delete the given flow from the flow
- *        tree if TTL is expired
+ * @brief deletes the flows whose TTL expired
  *
- * @params: gk_del_info cache delete info structure
+ * Only the flows hashed to the seconds elapsed since the previous
+ * call are checked.
+ * @params: now current time
+ * @return the number of deleted flows
  */
-void
-gkc_cleanup_ttl_flow_tree(struct gkc_del_info_s *gk_del_info)
+uint64_t
+gkc_expire_flows(time_t now)
 {
-    struct ip_flow_cache *flow_entry, *remove;
+    struct ip_flow_cache *remove;
     struct gk_cache_mgr *mgr;
-    bool ttl_expired;
+    uint64_t count;
 
     mgr = gk_cache_get_mgr();
-    if (!mgr->initialized) return;
+    if (!mgr->initialized) return 0;
 
-    /* loop through all flows in the tree */
-    flow_entry = ds_tree_head(gk_del_info->tree);
-    while (flow_entry != NULL)
+    count = 0;
+    while ((remove = ds_wheel_expire(&mgr->flow_wheel, now)) != NULL)
     {
-        remove     = flow_entry;
-        flow_entry = ds_tree_next(gk_del_info->tree, flow_entry);
-
-        /* check if the TTL value is expired for this flow */
-        ttl_expired = gkc_flow_ttl_expired(remove);
-        if (ttl_expired == false) continue;
-
         LOGT("%s(): deleting flow for device " PRI_os_macaddr_lower_t
              " with expired TTL",
              __func__,
-             FMT_os_macaddr_pt(gk_del_info->pdevice->device_mac));
-
-        gk_del_info->flow_del_count++;
+             FMT_os_macaddr_pt(remove->pdevice->device_mac));
 
         /* decrement the cache count */
         mgr->total_entry_count--;
@@ -202,8 +187,11 @@ gkc_cleanup_ttl_flow_tree(struct gkc_del_info_s *gk_del_info)
         /* found the flow. Free memory used by the flow structure. */
         gkc_free_flow_members(remove);
         /* remove it from the tree */
-        ds_tree_remove(gk_del_info->tree, remove);
+        ds_tree_remove(remove->tree, remove);
         /* free the entry */
         FREE(remove);
+        count++;
     }
+
+    return count;
 }
@@ -34,11 +34,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "fsm.h"
 #include "ds_tree.h"
+#include "ds_dlist.h"
 #include "wc_telemetry.h"
 
 #define GK_PERIODIC_INTERVAL 120
 #define GK_UNCATEGORIZED_ID 15
 #define GK_CURL_TIMEOUT      (2*60)
+#define GK_MCURL_BATCH_WINDOW_MS 5      /* default multi curl accumulation window */
+#define GK_MCURL_BATCH_MAX   32         /* queued requests forcing an early flush */
 #define MAX_PATH_LEN 256
 
 enum gk_response_code
@@ -88,6 +91,31 @@ struct gk_curl_multi_info
     struct ev_loop *loop;
     CURLM *mcurl_handle;
     int still_running;
+    struct ev_timer batch_timer;        /* flushes the queued requests */
+    ds_dlist_t batch_queue;             /* gk_mcurl_data waiting to be sent */
+    size_t batch_len;
+    long batch_window;                  /* accumulation window in ms, 0 sends at once */
+};
+
+/**
+ * @brief requests sent together after an accumulation window
+ */
+struct gk_mcurl_batch
+{
+    struct timespec start;              /* time the batch was sent */
+    size_t size;                        /* requests sent */
+    size_t outstanding;                 /* requests not completed yet */
+    size_t completed;                   /* requests answered by the gatekeeper */
+};
+
+/**
+ * @brief requester attached to an in-flight multi curl lookup
+ */
+struct gk_mcurl_waiter
+{
+    struct fsm_policy_req *policy_req;
+    struct fsm_policy_reply *policy_reply;
+    ds_dlist_node_t waiter_node;
 };
 
 struct gk_mcurl_data
@@ -96,7 +124,27 @@ struct gk_mcurl_data
     int req_id;
     time_t timestamp;
     struct fsm_gk_verdict *gk_verdict;
+    char *target;                       /* looked up attribute */
+    bool pending;                       /* in flight, present in mcurl_pending_tree */
+    ds_dlist_t waiters;                 /* coalesced requests (gk_mcurl_waiter) */
+    size_t num_waiters;
+    bool queued;                        /* waiting in the batch queue */
+    struct gk_mcurl_batch *batch;       /* batch the request was sent with */
     ds_tree_node_t mcurl_req_node;
+    ds_tree_node_t mcurl_pending_node;
+    ds_dlist_node_t batch_node;
+};
+
+/**
+ * @brief multi curl request coalescing counters
+ */
+struct gk_mcurl_stats
+{
+    uint32_t requests;                  /* cloud requests sent */
+    uint32_t coalesced;                 /* requests attached to an in-flight lookup */
+    uint32_t max_waiters;               /* largest number of requests attached to a lookup */
+    uint32_t batches;                   /* batches sent */
+    uint32_t max_batch;                 /* largest batch sent */
 };
 
 /**
@@ -154,6 +202,8 @@ struct fsm_gk_session
     int32_t remote_lookup_retries;
     ds_tree_node_t session_node;
     ds_tree_t mcurl_data_tree;          /* tree for storing gk_mcurl_data */
+    ds_tree_t mcurl_pending_tree;       /* in-flight gk_mcurl_data, by type and target */
+    struct gk_mcurl_stats mcurl_stats;
     long health_stats_report_interval;
     char *health_stats_report_topic;
     struct fsm_url_stats health_stats;
@@ -299,9 +349,27 @@ gatekeeper_report_compute_health_stats(struct fsm_gk_session *fsm_gk_session,
 bool
 gk_process_using_multi_curl(struct fsm_policy_req *req, struct fsm_policy_reply *policy_reply);
 
+/**
+ * @brief compute the latency indicators for a lookup or a batch of lookups
+ *
+ * @param gk_session the session holding the latency indicators
+ * @param start the time the request(s) were sent
+ * @param end the time the last reply was received
+ * @param count the number of lookups the latency applies to
+ * @return the latency in milliseconds
+ */
+long
+fsm_gk_update_latencies(struct fsm_gk_session *gk_session,
+                        struct timespec *start, struct timespec *end,
+                        size_t count);
+
 void
 free_mcurl_data(struct gk_mcurl_data *mcurl_request);
 
+void
+gk_mcurl_pending_remove(struct fsm_gk_session *fsm_gk_session,
+                        struct gk_mcurl_data *mcurl_data);
+
 bool
 gk_process_using_multi_curl(struct fsm_policy_req *policy_req,
                             struct fsm_policy_reply *policy_reply);
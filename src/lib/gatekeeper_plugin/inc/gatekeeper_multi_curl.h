@@ -79,6 +79,44 @@ bool
 gk_send_mcurl_request(struct fsm_gk_session *fsm_gk_session, struct gk_mcurl_data *mcurl_data);
 
 
+/**
+ * @brief queues a request until the batch window expires
+ * @param fsm_gk_session pointer to gatekeeper session
+ * @param mcurl_data the request to send
+ */
+void
+gk_mcurl_queue_request(struct fsm_gk_session *fsm_gk_session,
+                       struct gk_mcurl_data *mcurl_data);
+
+
+/**
+ * @brief sends the queued requests
+ * @param fsm_gk_session pointer to gatekeeper session
+ */
+void
+gk_mcurl_batch_flush(struct fsm_gk_session *fsm_gk_session);
+
+
+/**
+ * @brief drops the queued requests, which remain owned by the mcurl data tree
+ * @param fsm_gk_session pointer to gatekeeper session
+ */
+void
+gk_mcurl_batch_cancel(struct fsm_gk_session *fsm_gk_session);
+
+
+/**
+ * @brief drops a request's reference to the batch it was sent with
+ * @param gk_session pointer to gatekeeper session, NULL to skip the accounting
+ * @param mcurl_data the request
+ * @param answered true if the gatekeeper replied to the request
+ */
+void
+gk_mcurl_batch_release(struct fsm_gk_session *gk_session,
+                       struct gk_mcurl_data *mcurl_data,
+                       bool answered);
+
+
 /**
  * @brief cleans up curl library.
  *
@@ -95,6 +95,16 @@ gatekeeper_log_health_stats(struct fsm_gk_session *fsm_gk_session,
     LOGI("%s: total lookups: %u", __func__, hs->total_lookups);
     LOGI("%s: total cache hits: %u", __func__, hs->cache_hits);
     LOGI("%s: total remote lookups: %u", __func__, hs->remote_lookups);
+    if (fsm_gk_session->enable_multi_curl)
+    {
+        LOGI("%s: multi curl requests: %u, coalesced: %u, max coalesced: %u", __func__,
+             fsm_gk_session->mcurl_stats.requests,
+             fsm_gk_session->mcurl_stats.coalesced,
+             fsm_gk_session->mcurl_stats.max_waiters);
+        LOGI("%s: multi curl batches: %u, max batch size: %u", __func__,
+             fsm_gk_session->mcurl_stats.batches,
+             fsm_gk_session->mcurl_stats.max_batch);
+    }
     LOGI("%s: connectivity failures: %u", __func__, hs->connectivity_failures);
     LOGI("%s: cloud uncategorized responses: %u", __func__,
          hs->uncategorized);
@@ -108,6 +118,7 @@ gatekeeper_log_health_stats(struct fsm_gk_session *fsm_gk_session,
          hs->avg_latency);
     LOGI("%s: dns cache hit count: %u", __func__,
          fsm_gk_session->dns_cache_hit_count);
+    fsm_policy_log_cache_stats(__func__);
 }
 
 /**
@@ -686,15 +697,19 @@ gk_add_policy_to_cache(struct fsm_policy_req *req, struct fsm_policy_reply *poli
 }
 
 /**
- * @brief compute the latency indicators for a given request
+ * @brief compute the latency indicators for a lookup or a batch of lookups
  *
+ * A batch accounts for as many lookups as it carried, keeping the
+ * average a per lookup value.
  * @param gk_session the session holding the latency indicators
  * @param start the clock_t value before the categorization API call
- * @param end the clock_t value before the categorization API call
+ * @param end the clock_t value after the (last) categorization reply
+ * @param count the number of lookups the latency applies to
  */
-static long
+long
 fsm_gk_update_latencies(struct fsm_gk_session *gk_session,
-                        struct timespec *start, struct timespec *end)
+                        struct timespec *start, struct timespec *end,
+                        size_t count)
 {
     struct fsm_url_stats *stats;
     long nanoseconds;
@@ -712,7 +727,7 @@ fsm_gk_update_latencies(struct fsm_gk_session *gk_session,
     /* Translate in milliseconds */
     latency /= 1000000L;
 
-    stats->avg_lookup_latency += latency;
+    stats->avg_lookup_latency += latency * (long)count;
 
     if (latency < stats->min_lookup_latency)
     {
@@ -744,8 +759,8 @@ gk_purge_mcurl_data(struct fsm_gk_session* gk_session)
         /* get the time difference */
         cmp = difftime(now, mcurl_data->timestamp);
 
-        /* continue if current request is not yet timed out */
-        if (cmp < GK_MULTI_CURL_REQ_TIMEOUT)
+        /* continue if current request is not yet timed out or not sent */
+        if (cmp < GK_MULTI_CURL_REQ_TIMEOUT || mcurl_data->queued)
         {
             mcurl_data = ds_tree_next(&gk_session->mcurl_data_tree, mcurl_data);
             continue;
@@ -760,7 +775,8 @@ gk_purge_mcurl_data(struct fsm_gk_session* gk_session)
         to_remove = mcurl_data;
         mcurl_data = ds_tree_next(&gk_session->mcurl_data_tree, mcurl_data);
 
-        /* remove current node from the tree */
+        /* remove current node from the trees */
+        gk_mcurl_pending_remove(gk_session, to_remove);
         ds_tree_remove(&gk_session->mcurl_data_tree, to_remove);
         /* free up the memory */
         free_mcurl_data(to_remove);
@@ -805,6 +821,7 @@ gk_add_mcurl_data(struct fsm_session *session,
     mcurl_data->timestamp = time(NULL);
     mcurl_data->req_type   = policy_req->req_type;
     mcurl_data->gk_verdict = gk_verdict;
+    ds_dlist_init(&mcurl_data->waiters, struct gk_mcurl_waiter, waiter_node);
     LOGN("%s(): added curl data for request type: %d, with id %d, gk_verdict: %p, policy_req: %p, policy reply:%p",
          __func__,
          mcurl_data->req_type,
@@ -814,6 +831,15 @@ gk_add_mcurl_data(struct fsm_session *session,
          gk_verdict->policy_reply);
 
     ds_tree_insert(&fsm_gk_session->mcurl_data_tree, mcurl_data, mcurl_data);
+
+    /* make the lookup visible to identical requests until it completes */
+    if (policy_req->url != NULL) mcurl_data->target = STRDUP(policy_req->url);
+    if (mcurl_data->target != NULL)
+    {
+        mcurl_data->pending = true;
+        ds_tree_insert(&fsm_gk_session->mcurl_pending_tree, mcurl_data, mcurl_data);
+    }
+
     return mcurl_data;
 
 error:
@@ -822,6 +848,81 @@ error:
     return NULL;
 }
 
+/**
+ * @brief removes a completed lookup from the in-flight requests tree
+ *
+ * @param fsm_gk_session the gatekeeper session
+ * @param mcurl_data the lookup
+ */
+void
+gk_mcurl_pending_remove(struct fsm_gk_session *fsm_gk_session,
+                        struct gk_mcurl_data *mcurl_data)
+{
+    if (!mcurl_data->pending) return;
+
+    ds_tree_remove(&fsm_gk_session->mcurl_pending_tree, mcurl_data);
+    mcurl_data->pending = false;
+}
+
+/**
+ * @brief looks up an in-flight lookup of the same type and target
+ *
+ * @param fsm_gk_session the gatekeeper session
+ * @param policy_req the request
+ * @return the in-flight lookup if found, NULL otherwise
+ */
+static struct gk_mcurl_data *
+gk_find_pending_mcurl_data(struct fsm_gk_session *fsm_gk_session,
+                           struct fsm_policy_req *policy_req)
+{
+    struct gk_mcurl_data key;
+
+    if (policy_req->url == NULL) return NULL;
+
+    memset(&key, 0, sizeof(key));
+    key.req_type = policy_req->req_type;
+    key.target = policy_req->url;
+
+    return ds_tree_find(&fsm_gk_session->mcurl_pending_tree, &key);
+}
+
+/**
+ * @brief attaches a request to an in-flight lookup
+ *
+ * The verdict of the lookup is applied to the request when the
+ * gatekeeper response is processed.
+ */
+static bool
+gk_mcurl_add_waiter(struct fsm_gk_session *fsm_gk_session,
+                    struct gk_mcurl_data *mcurl_data,
+                    struct fsm_policy_req *policy_req,
+                    struct fsm_policy_reply *policy_reply)
+{
+    struct gk_mcurl_stats *stats;
+    struct gk_mcurl_waiter *waiter;
+
+    waiter = CALLOC(1, sizeof(*waiter));
+    if (waiter == NULL) return false;
+
+    waiter->policy_req = policy_req;
+    waiter->policy_reply = policy_reply;
+    ds_dlist_insert_tail(&mcurl_data->waiters, waiter);
+    mcurl_data->num_waiters++;
+
+    stats = &fsm_gk_session->mcurl_stats;
+    stats->coalesced++;
+    if (mcurl_data->num_waiters > stats->max_waiters)
+    {
+        stats->max_waiters = mcurl_data->num_waiters;
+    }
+
+    LOGT("%s(): request %s (type %d) attached to in-flight request id %d, %zu waiting",
+         __func__, mcurl_data->target, mcurl_data->req_type, mcurl_data->req_id,
+         mcurl_data->num_waiters);
+
+    return true;
+}
+
 bool
 gk_process_using_multi_curl(struct fsm_policy_req *policy_req,
                             struct fsm_policy_reply *policy_reply)
@@ -835,10 +936,18 @@ gk_process_using_multi_curl(struct fsm_policy_req *policy_req,
     fsm_gk_session = gatekeeper_lookup_session(session->service);
     if (fsm_gk_session == NULL) return false;
 
+    /* the same target is already being looked up, wait for its verdict */
+    mcurl_data = gk_find_pending_mcurl_data(fsm_gk_session, policy_req);
+    if (mcurl_data != NULL)
+    {
+        return gk_mcurl_add_waiter(fsm_gk_session, mcurl_data, policy_req, policy_reply);
+    }
+
     mcurl_data = gk_add_mcurl_data(session, policy_req, policy_reply);
     if (mcurl_data == NULL) return false;
 
-    gk_send_mcurl_request(fsm_gk_session, mcurl_data);
+    /* sent with the requests gathered during the batch window */
+    gk_mcurl_queue_request(fsm_gk_session, mcurl_data);
     return true;
 }
 
@@ -1004,7 +1113,7 @@ gatekeeper_get_verdict(struct fsm_policy_req *req,
         clock_gettime(CLOCK_REALTIME, &end);
 
         /* update stats for processing the request */
-        lookup_latency = fsm_gk_update_latencies(fsm_gk_session, &start, &end);
+        lookup_latency = fsm_gk_update_latencies(fsm_gk_session, &start, &end, 1);
         LOGT("%s(): cloud lookup latency for '%s' is %ld ms", __func__, req->url, lookup_latency);
     }
 
@@ -1050,6 +1159,18 @@ gk_mcurl_cmp(void *a, void *b)
     return cmp;
 }
 
+static int
+gk_mcurl_pending_cmp(void *a, void *b)
+{
+    struct gk_mcurl_data *ta = a;
+    struct gk_mcurl_data *tb = b;
+
+    int cmp = ta->req_type - tb->req_type;
+    if (cmp) return cmp;
+
+    return strcmp(ta->target, tb->target);
+}
+
 /**
  * @brief initializes gate keeper plugin
  *
@@ -1111,6 +1232,10 @@ gatekeeper_init_curl(struct fsm_session *session)
                      gk_mcurl_cmp,
                      struct gk_mcurl_data,
                      mcurl_req_node);
+        ds_tree_init(&fsm_gk_session->mcurl_pending_tree,
+                     gk_mcurl_pending_cmp,
+                     struct gk_mcurl_data,
+                     mcurl_pending_node);
     }
     else
     {
@@ -1417,6 +1542,7 @@ gatekeeper_periodic(struct fsm_session *session)
         stats = &fsm_gk_session->health_stats;
         memset(stats, 0, sizeof(*stats));
         stats->min_lookup_latency = LONG_MAX;
+        memset(&fsm_gk_session->mcurl_stats, 0, sizeof(fsm_gk_session->mcurl_stats));
     }
 
     /* Proceed to other periodic tasks */
@@ -1442,6 +1568,7 @@ gatekeeper_update(struct fsm_session *session)
     char *hs_report_interval;
     char *hs_report_topic;
     char *mcurl_config;
+    char *batch_window;
     long interval;
     int val;
 
@@ -1482,6 +1609,14 @@ gatekeeper_update(struct fsm_session *session)
 
     server_info->server_url = session->ops.get_config(session, "gk_url");
 
+    fsm_gk_session->mcurl.batch_window = GK_MCURL_BATCH_WINDOW_MS;
+    batch_window = session->ops.get_config(session, "mcurl_batch_window_ms");
+    if (batch_window != NULL)
+    {
+        fsm_gk_session->mcurl.batch_window = strtol(batch_window, NULL, 10);
+        if (fsm_gk_session->mcurl.batch_window < 0) fsm_gk_session->mcurl.batch_window = 0;
+    }
+
     fsm_gk_session->health_stats_report_interval = (long)GATEKEEPER_REPORT_HEALTH_STATS_INTERVAL;
     hs_report_interval = session->ops.get_config(session,
                                                  "wc_health_stats_interval_secs");
@@ -1509,6 +1644,7 @@ gatekeeper_update(struct fsm_session *session)
 void
 free_mcurl_data(struct gk_mcurl_data *mcurl_request)
 {
+    struct gk_mcurl_waiter *waiter;
     struct fsm_gk_verdict *gk_verdict;
 
     if (mcurl_request == NULL) return;
@@ -1522,6 +1658,18 @@ free_mcurl_data(struct gk_mcurl_data *mcurl_request)
         FREE(gk_verdict);
     }
 
+    gk_mcurl_batch_release(NULL, mcurl_request, false);
+
+    /* requests still waiting for the verdict are dropped, as the lookup itself */
+    waiter = ds_dlist_head(&mcurl_request->waiters);
+    while (waiter != NULL)
+    {
+        ds_dlist_remove(&mcurl_request->waiters, waiter);
+        FREE(waiter);
+        waiter = ds_dlist_head(&mcurl_request->waiters);
+    }
+
+    FREE(mcurl_request->target);
     FREE(mcurl_request);
 }
 
@@ -1612,6 +1760,7 @@ gatekeeper_delete_session(struct fsm_session *session)
 
     LOGD("%s: removing session %s", __func__, session->name);
     ds_tree_remove(sessions, gk_session);
+    if (gk_session->enable_multi_curl) gk_mcurl_batch_cancel(gk_session);
     gk_clean_mcurl_tree(&gk_session->mcurl_data_tree);
     gatekeeper_free_session(gk_session);
 
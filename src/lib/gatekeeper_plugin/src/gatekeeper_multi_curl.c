@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <curl/curl.h>
 #include <ev.h>
+#include <string.h>
 #include <time.h>
 #include <mxml.h>
 
@@ -290,6 +291,56 @@ gk_lookup_curl_data(struct fsm_gk_session *gk_session,
     return mcurl_data;
 }
 
+/**
+ * @brief applies the outcome of a lookup to the requests coalesced on it
+ *
+ * @param gk_session the gatekeeper session
+ * @param mcurl_data the completed lookup
+ * @param response the unpacked gatekeeper reply, NULL if the lookup failed
+ */
+static void
+gk_mcurl_reply_waiters(struct fsm_gk_session *gk_session,
+                       struct gk_mcurl_data *mcurl_data,
+                       Gatekeeper__Southbound__V1__GatekeeperReply *response)
+{
+    struct fsm_policy_reply *policy_reply;
+    struct gk_mcurl_waiter *waiter;
+    struct fsm_gk_verdict verdict;
+    bool ret;
+
+    gk_mcurl_pending_remove(gk_session, mcurl_data);
+
+    waiter = ds_dlist_head(&mcurl_data->waiters);
+    while (waiter != NULL)
+    {
+        ds_dlist_remove(&mcurl_data->waiters, waiter);
+        mcurl_data->num_waiters--;
+
+        policy_reply = waiter->policy_reply;
+        ret = (response != NULL);
+        if (ret)
+        {
+            memset(&verdict, 0, sizeof(verdict));
+            verdict.policy_req = waiter->policy_req;
+            verdict.policy_reply = policy_reply;
+            ret = gk_set_policy(response, &verdict);
+        }
+
+        if (ret && policy_reply->gatekeeper_response != NULL)
+        {
+            gk_add_policy_to_cache(waiter->policy_req, policy_reply);
+            policy_reply->gatekeeper_response(waiter->policy_req, policy_reply);
+        }
+        else if (policy_reply->policy_response != NULL)
+        {
+            policy_reply->policy_response(waiter->policy_req, policy_reply);
+        }
+
+        FREE(waiter);
+        waiter = ds_dlist_head(&mcurl_data->waiters);
+    }
+}
+
 void
 gk_process_fail_response(struct gk_conn_info *conn)
 {
@@ -327,10 +378,13 @@ gk_process_fail_response(struct gk_conn_info *conn)
     if (policy_reply->policy_response == NULL)
     {
         LOGD("%s(): policy response is NULL", __func__);
-        return;
     }
-    policy_reply->policy_response(mcurl_data->gk_verdict->policy_req, policy_reply);
+    else
+    {
+        policy_reply->policy_response(mcurl_data->gk_verdict->policy_req, policy_reply);
+    }
 
+    gk_mcurl_reply_waiters(gk_session, mcurl_data, NULL);
 }
 
 /**
@@ -412,11 +466,42 @@ gk_process_response(struct gk_conn_info *conn)
     policy_reply->gatekeeper_response(mcurl_data->gk_verdict->policy_req, policy_reply);
 
 error:
+    /* requests for the same target share this reply */
+    if (mcurl_data != NULL) gk_mcurl_reply_waiters(gk_session, mcurl_data, unpacked_data);
+
     gatekeeper__southbound__v1__gatekeeper_reply__free_unpacked(unpacked_data, NULL);
 
     return ret;
 }
 
+/**
+ * @brief releases the state still attached to a completed transfer
+ *
+ * Accounts the transfer in its batch, and covers replies that could not
+ * be matched or decoded: the lookup is no longer in flight, so its
+ * waiters get the failure path.
+ * @param conn the completed connection
+ * @param answered true if the gatekeeper replied
+ */
+static void
+gk_mcurl_complete(struct gk_conn_info *conn, bool answered)
+{
+    struct fsm_gk_session *gk_session;
+    struct gk_mcurl_data *mcurl_data;
+
+    gk_session = conn->context;
+    mcurl_data = gk_find_curl_data(&gk_session->mcurl_data_tree,
+                                   conn->req_key.req_type,
+                                   conn->req_key.req_id);
+    if (mcurl_data == NULL) return;
+
+    gk_mcurl_batch_release(gk_session, mcurl_data, answered);
+
+    if (!mcurl_data->pending) return;
+
+    gk_mcurl_reply_waiters(gk_session, mcurl_data, NULL);
+}
+
 /**
  * @brief Check for completed transfers, and remove
  *        their easy handles.
@@ -455,6 +540,7 @@ check_multi_info(struct gk_curl_multi_info *mcurl_info)
         {
             gk_process_fail_response(conn);
         }
+        gk_mcurl_complete(conn, (res == CURLE_OK));
         gk_free_conn(conn, mcurl_info);
     }
 }
@@ -757,6 +843,180 @@ err_free_conn:
 }
 
 
+/**
+ * @brief drops a request's reference to its batch
+ *
+ * The batch latency is accounted once its last request completes.
+ * @param gk_session the gatekeeper session, NULL to skip the accounting
+ * @param mcurl_data the request
+ * @param answered true if the gatekeeper replied to the request
+ */
+void
+gk_mcurl_batch_release(struct fsm_gk_session *gk_session,
+                       struct gk_mcurl_data *mcurl_data,
+                       bool answered)
+{
+    struct gk_mcurl_batch *batch;
+    struct timespec end;
+    long latency;
+
+    batch = mcurl_data->batch;
+    if (batch == NULL) return;
+
+    mcurl_data->batch = NULL;
+    if (answered) batch->completed++;
+
+    batch->outstanding--;
+    if (batch->outstanding != 0) return;
+
+    if (gk_session != NULL && batch->completed != 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &end);
+        latency = fsm_gk_update_latencies(gk_session, &batch->start, &end,
+                                          batch->completed);
+        LOGT("http2: batch of %zu requests (%zu answered) completed in %ld ms",
+             batch->size, batch->completed, latency);
+    }
+
+    FREE(batch);
+}
+
+/**
+ * @brief sends the queued requests
+ *
+ * All the handles are added to the multi handle before curl gets to run,
+ * so the requests go out multiplexed on the gatekeeper connection within
+ * a single socket action pass.
+ * @param fsm_gk_session the gatekeeper session
+ */
+void
+gk_mcurl_batch_flush(struct fsm_gk_session *fsm_gk_session)
+{
+    struct gk_curl_multi_info *mcurl_info;
+    struct gk_mcurl_data *mcurl_data;
+    struct gk_mcurl_stats *stats;
+    struct gk_mcurl_batch *batch;
+    bool ret;
+
+    mcurl_info = &fsm_gk_session->mcurl;
+    ev_timer_stop(mcurl_info->loop, &mcurl_info->batch_timer);
+
+    if (mcurl_info->batch_len == 0) return;
+
+    batch = CALLOC(1, sizeof(*batch));
+    if (batch != NULL) clock_gettime(CLOCK_REALTIME, &batch->start);
+
+    stats = &fsm_gk_session->mcurl_stats;
+    mcurl_data = ds_dlist_head(&mcurl_info->batch_queue);
+    while (mcurl_data != NULL)
+    {
+        ds_dlist_remove(&mcurl_info->batch_queue, mcurl_data);
+        mcurl_info->batch_len--;
+        mcurl_data->queued = false;
+
+        /* transfers only progress from the event loop, after the flush */
+        ret = gk_send_mcurl_request(fsm_gk_session, mcurl_data);
+        if (ret)
+        {
+            fsm_gk_session->health_stats.cloud_lookups++;
+            stats->requests++;
+            if (batch != NULL)
+            {
+                mcurl_data->batch = batch;
+                batch->outstanding++;
+                batch->size++;
+            }
+        }
+        else
+        {
+            gk_mcurl_reply_waiters(fsm_gk_session, mcurl_data, NULL);
+        }
+
+        mcurl_data = ds_dlist_head(&mcurl_info->batch_queue);
+    }
+
+    if (batch == NULL) return;
+
+    LOGT("http2: sent batch of %zu requests", batch->size);
+    if (batch->size != 0)
+    {
+        stats->batches++;
+        if (batch->size > stats->max_batch) stats->max_batch = batch->size;
+    }
+
+    /* every request failed to be sent */
+    if (batch->outstanding == 0) FREE(batch);
+}
+
+/**
+ * @brief flushes the requests gathered during the batch window
+ */
+static void
+gk_mcurl_batch_timer_cb(EV_P_ struct ev_timer *w, int revents)
+{
+    struct fsm_gk_session *fsm_gk_session;
+
+    fsm_gk_session = w->data;
+    gk_mcurl_batch_flush(fsm_gk_session);
+}
+
+/**
+ * @brief queues a request until the batch window expires
+ *
+ * The request is sent at once when batching is disabled, and the queue
+ * is flushed early when it reaches GK_MCURL_BATCH_MAX requests.
+ * @param fsm_gk_session the gatekeeper session
+ * @param mcurl_data the request
+ */
+void
+gk_mcurl_queue_request(struct fsm_gk_session *fsm_gk_session,
+                       struct gk_mcurl_data *mcurl_data)
+{
+    struct gk_curl_multi_info *mcurl_info;
+
+    mcurl_info = &fsm_gk_session->mcurl;
+
+    ds_dlist_insert_tail(&mcurl_info->batch_queue, mcurl_data);
+    mcurl_info->batch_len++;
+    mcurl_data->queued = true;
+
+    if (mcurl_info->batch_window == 0 || mcurl_info->batch_len >= GK_MCURL_BATCH_MAX)
+    {
+        gk_mcurl_batch_flush(fsm_gk_session);
+        return;
+    }
+
+    if (ev_is_active(&mcurl_info->batch_timer)) return;
+
+    ev_timer_set(&mcurl_info->batch_timer, mcurl_info->batch_window / 1000.0, 0.0);
+    ev_timer_start(mcurl_info->loop, &mcurl_info->batch_timer);
+}
+
+/**
+ * @brief drops the queued requests
+ *
+ * The requests remain in the mcurl data tree, which owns them.
+ * @param fsm_gk_session the gatekeeper session
+ */
+void
+gk_mcurl_batch_cancel(struct fsm_gk_session *fsm_gk_session)
+{
+    struct gk_curl_multi_info *mcurl_info;
+    struct gk_mcurl_data *mcurl_data;
+
+    mcurl_info = &fsm_gk_session->mcurl;
+    if (mcurl_info->loop != NULL) ev_timer_stop(mcurl_info->loop, &mcurl_info->batch_timer);
+
+    mcurl_data = ds_dlist_head(&mcurl_info->batch_queue);
+    while (mcurl_data != NULL)
+    {
+        ds_dlist_remove(&mcurl_info->batch_queue, mcurl_data);
+        mcurl_data->queued = false;
+        mcurl_data = ds_dlist_head(&mcurl_info->batch_queue);
+    }
+    mcurl_info->batch_len = 0;
+}
+
 /**
  * @brief initialize curl library
  * @param loop pointer to ev_loop structure
@@ -787,6 +1047,12 @@ gk_multi_curl_init(struct fsm_gk_session *fsm_gk_session, struct ev_loop *loop)
     ev_timer_init(&mcurl_info->timer_event, timer_cb, 0.0, 0.0);
     mcurl_info->timer_event.data = mcurl_info;
 
+    /* initialize the request batching */
+    ds_dlist_init(&mcurl_info->batch_queue, struct gk_mcurl_data, batch_node);
+    mcurl_info->batch_len = 0;
+    ev_timer_init(&mcurl_info->batch_timer, gk_mcurl_batch_timer_cb, 0.0, 0.0);
+    mcurl_info->batch_timer.data = fsm_gk_session;
+
     /* initialize socket callback */
     cmret = curl_multi_setopt(mcurl_info->mcurl_handle, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
     if (cmret != CURLM_OK)
@@ -815,6 +1081,13 @@ gk_multi_curl_init(struct fsm_gk_session *fsm_gk_session, struct ev_loop *loop)
         goto err;
     }
 
+    /* batched requests share the gatekeeper connection */
+    cmret = curl_multi_setopt(mcurl_info->mcurl_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (cmret != CURLM_OK)
+    {
+        LOGN("http2: failed to enable multiplexing");
+    }
+
     LOGN("http2: curl initialization successful");
 
     return true;
@@ -8,62 +8,74 @@
 #include "http_parser.h"
 #include "fsm.h"
 #include "ds_tree.h"
+#include "ds_dlist.h"
 #include "net_header_parse.h"
 
 #define MAX_UA_SIZE 256
 
-#define MAX_HEADERS 13
 #define MAX_ELEMENT_SIZE 2048
-#define MAX_CHUNKS 16
 
-struct message
+/* Number of http flows tracked concurrently per session */
+#define HTTP_FLOW_POOL_SIZE 32
+
+/* Request header bytes inspected per flow before giving up */
+#define HTTP_FLOW_MAX_HEADERS_LEN 4096
+
+/* Seconds of inactivity after which a flow's parsing state is recycled */
+#define HTTP_FLOW_IDLE_TIMEOUT 60
+
+/* Longest header name kept while parsing. Only User-Agent is of interest */
+#define HTTP_FLOW_FIELD_SIZE 16
+
+struct http_flow_key
+{
+    int ip_version;
+    uint8_t src_ip[16];
+    uint8_t dst_ip[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+};
+
+
+/**
+ * @brief parsing state of a http request spanning several tcp segments
+ *
+ * The http parser resumes where the previous segment left off. Header
+ * names and the user agent value are accumulated in bounded buffers as
+ * the parser may deliver them in several pieces.
+ */
+struct http_flow
 {
-    const char *name;
-    const char *raw;
-    enum http_parser_type type;
-    enum http_method method;
-    int status_code;
-    char response_status[MAX_ELEMENT_SIZE];
-    char request_path[MAX_ELEMENT_SIZE];
-    char request_url[MAX_ELEMENT_SIZE];
-    char fragment[MAX_ELEMENT_SIZE];
-    char query_string[MAX_ELEMENT_SIZE];
-    char body[MAX_ELEMENT_SIZE];
-    size_t body_size;
-    const char *host;
-    const char *userinfo;
-    uint16_t port;
-    int num_headers;
-    enum { NONE=0, FIELD, VALUE } last_header_element;
-    char headers [MAX_HEADERS][2][MAX_ELEMENT_SIZE];
-    int should_keep_alive;
-
-    int num_chunks;
-    int num_chunks_complete;
-    int chunk_lengths[MAX_CHUNKS];
-
-    const char *upgrade; // upgraded body
-
-    unsigned short http_major;
-    unsigned short http_minor;
-
-    int message_begin_cb_called;
-    int headers_complete_cb_called;
-    int message_complete_cb_called;
-    int status_cb_called;
-    int message_complete_on_eof;
-    int body_is_final;
+    struct http_flow_key key;
+    struct http_parser parser;
+    uint32_t next_seq;              /* next expected tcp sequence number */
+    size_t inspected;               /* request bytes fed to the parser */
+    char field[HTTP_FLOW_FIELD_SIZE];
+    size_t field_len;
+    char user_agent[MAX_UA_SIZE];
+    size_t ua_len;
+    bool in_field;                  /* last callback was a header name */
+    bool in_user_agent;             /* current header is User-Agent */
+    bool ua_complete;
+    bool reported;
+    bool done;                      /* headers complete or not http */
+    time_t last_seen;
+    ds_tree_node_t flow_node;
+    ds_dlist_node_t lru_node;
 };
 
 
 struct fsm_http_parser
 {
     struct net_header_parser *net_parser; /* network header parser */
-    struct http_parser parser;
-    struct message message;
     size_t http_len;
     uint8_t *data;
     size_t parsed;
+    struct http_flow *flow;         /* flow of the current packet */
+    struct http_flow *flow_pool;
+    ds_tree_t flows;                /* flows being parsed, by 5-tuple */
+    ds_dlist_t lru_flows;           /* flows being parsed, oldest first */
+    ds_dlist_t free_flows;
 };
 
 
@@ -120,6 +132,21 @@ process_report(struct http_session *h_session, char *user_agent);
 size_t
 http_parse_content(struct fsm_http_parser *parser);
 
+struct http_flow *
+http_get_flow(struct fsm_http_parser *parser);
+
+void
+http_release_flow(struct fsm_http_parser *parser, struct http_flow *flow);
+
+void
+http_flows_init(struct fsm_http_parser *parser);
+
+void
+http_flows_expire(struct fsm_http_parser *parser, time_t now);
+
+void
+http_flows_free(struct fsm_http_parser *parser);
+
 size_t
 http_parse_message(struct fsm_http_parser *parser);
 
@@ -141,7 +168,7 @@ struct http_device *
 http_get_device(struct http_session *http_session);
 
 void
-parser_init(struct fsm_http_parser *parser);
+parser_init(struct http_flow *flow);
 
 struct http_cache *
 http_get_mgr(void);
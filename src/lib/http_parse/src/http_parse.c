@@ -2,6 +2,7 @@
 #include <stddef.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
 
 #include "const.h"
 #include "log.h"
@@ -101,49 +102,80 @@ strlcpy(char *dst, const char *src, size_t len)
 }
 
 
+/**
+ * @brief accumulates a header name, possibly delivered in several pieces
+ */
 static int
-request_url_cb(http_parser *p, const char *buf, size_t len)
+header_field_cb(http_parser *p, const char *buf, size_t len)
 {
-    struct message *m = p->data;
+    struct http_flow *flow = p->data;
+    size_t ncpy;
 
-    strlncpy(m->request_url, sizeof(m->request_url), buf, len);
+    if (!flow->in_field)
+    {
+        /* A new header starts, the previous one is complete */
+        if (flow->in_user_agent) flow->ua_complete = true;
+        flow->in_user_agent = false;
+        flow->field_len = 0;
+    }
+
+    /* Names longer than the buffer are only counted, they cannot match */
+    if (flow->field_len < sizeof(flow->field))
+    {
+        ncpy = sizeof(flow->field) - flow->field_len;
+        if (len < ncpy) ncpy = len;
+        memcpy(flow->field + flow->field_len, buf, ncpy);
+    }
+    flow->field_len += len;
+    flow->in_field = true;
 
     return 0;
 }
 
 
+/**
+ * @brief accumulates the user agent value, truncated to MAX_UA_SIZE
+ */
 static int
-header_field_cb(http_parser *p, const char *buf, size_t len)
+header_value_cb(http_parser *p, const char *buf, size_t len)
 {
-    struct message *m = p->data;
+    static const char user_agent[] = "User-Agent";
+    struct http_flow *flow = p->data;
+    size_t ncpy;
 
-    if (m->num_headers == MAX_HEADERS)
+    if (flow->in_field)
     {
-        LOGD("%s: max headers %d reached", __func__, MAX_HEADERS);
-        return 1;
+        flow->in_field = false;
+        flow->in_user_agent = ((flow->field_len == sizeof(user_agent) - 1) &&
+                               !strncasecmp(flow->field, user_agent,
+                                            sizeof(user_agent) - 1));
     }
+    if (!flow->in_user_agent) return 0;
 
-    if (m->last_header_element != FIELD) m->num_headers++;
-
-    strlncpy(m->headers[m->num_headers-1][0],
-             sizeof(m->headers[m->num_headers-1][0]),
-             buf, len);
-
-    m->last_header_element = FIELD;
+    ncpy = sizeof(flow->user_agent) - 1 - flow->ua_len;
+    if (len < ncpy) ncpy = len;
+    memcpy(flow->user_agent + flow->ua_len, buf, ncpy);
+    flow->ua_len += ncpy;
+    flow->user_agent[flow->ua_len] = '\0';
 
     return 0;
 }
 
 
+/**
+ * @brief stops the inspection of the flow once the headers are parsed
+ */
 static int
-header_value_cb (http_parser *p, const char *buf, size_t len)
+headers_complete_cb(http_parser *p)
 {
-    struct message *m = p->data;
+    struct http_flow *flow = p->data;
 
-    strlncpy(m->headers[m->num_headers-1][1],
-             sizeof(m->headers[m->num_headers-1][1]),
-             buf, len);
-    m->last_header_element = VALUE;
+    if (flow->in_user_agent) flow->ua_complete = true;
+    flow->in_user_agent = false;
+    flow->done = true;
+
+    /* No need to go through the body */
+    http_parser_pause(p, 1);
 
     return 0;
 }
@@ -153,10 +185,10 @@ static http_parser_settings parser_callbacks =
     .on_message_begin = 0,
     .on_header_field = header_field_cb,
     .on_header_value = header_value_cb,
-    .on_url = request_url_cb,
+    .on_url = 0,
     .on_status = 0,
     .on_body = 0,
-    .on_headers_complete = 0,
+    .on_headers_complete = headers_complete_cb,
     .on_message_complete = 0,
     .on_chunk_header = 0,
     .on_chunk_complete = 0,
@@ -214,24 +246,245 @@ http_ua_cmp(void *a, void *b) {
 }
 
 
-void parser_init(struct fsm_http_parser *parser)
+/**
+ * @brief compare http flows
+ *
+ * @param a flow key
+ * @param b flow key
+ * @return 0 if the flows match, an integer otherwise
+ */
+static int
+http_flow_cmp(void *a, void *b)
+{
+    return memcmp(a, b, sizeof(struct http_flow_key));
+}
+
+
+void parser_init(struct http_flow *flow)
 {
-    struct http_parser *http_parser = &parser->parser;
+    struct http_parser *http_parser = &flow->parser;
 
     http_parser_init(http_parser, HTTP_REQUEST);
-    http_parser->data = &parser->message;
+    http_parser->data = flow;
 }
 
 
+/**
+ * @brief sets up the flow pool of a parser
+ *
+ * @param parser the http parser
+ */
+void
+http_flows_init(struct fsm_http_parser *parser)
+{
+    ds_tree_init(&parser->flows, http_flow_cmp, struct http_flow, flow_node);
+    ds_dlist_init(&parser->lru_flows, struct http_flow, lru_node);
+    ds_dlist_init(&parser->free_flows, struct http_flow, lru_node);
+    parser->flow_pool = NULL;
+    parser->flow = NULL;
+}
 
+
+/**
+ * @brief returns a flow to the pool
+ *
+ * @param parser the http parser
+ * @param flow the flow to release
+ */
+void
+http_release_flow(struct fsm_http_parser *parser, struct http_flow *flow)
+{
+    if (flow == NULL) return;
+
+    ds_tree_remove(&parser->flows, flow);
+    ds_dlist_remove(&parser->lru_flows, flow);
+    ds_dlist_insert_tail(&parser->free_flows, flow);
+    if (parser->flow == flow) parser->flow = NULL;
+}
+
+
+/**
+ * @brief recycles the flows idle for more than HTTP_FLOW_IDLE_TIMEOUT
+ *
+ * @param parser the http parser
+ * @param now the current time
+ */
+void
+http_flows_expire(struct fsm_http_parser *parser, time_t now)
+{
+    struct http_flow *flow;
+
+    while ((flow = ds_dlist_head(&parser->lru_flows)) != NULL)
+    {
+        if ((now - flow->last_seen) < HTTP_FLOW_IDLE_TIMEOUT) break;
+        http_release_flow(parser, flow);
+    }
+}
+
+
+/**
+ * @brief frees the flow pool of a parser
+ *
+ * @param parser the http parser
+ */
+void
+http_flows_free(struct fsm_http_parser *parser)
+{
+    struct http_flow *flow;
+
+    while ((flow = ds_dlist_head(&parser->lru_flows)) != NULL)
+    {
+        http_release_flow(parser, flow);
+    }
+    while (ds_dlist_remove_head(&parser->free_flows) != NULL);
+
+    FREE(parser->flow_pool);
+    parser->flow_pool = NULL;
+}
+
+
+/**
+ * @brief fills the flow key of the current packet
+ *
+ * @param net_parser the network header parser
+ * @param key the key to fill
+ * @return true if the packet is a tcp packet, false otherwise
+ */
+static bool
+http_fill_flow_key(struct net_header_parser *net_parser,
+                   struct http_flow_key *key)
+{
+    struct tcphdr *tcphdr;
+
+    if (net_parser->ip_protocol != IPPROTO_TCP) return false;
+
+    memset(key, 0, sizeof(*key));
+    key->ip_version = net_parser->ip_version;
+    if (key->ip_version == 4)
+    {
+        struct iphdr *iphdr;
+
+        iphdr = net_header_get_ipv4_hdr(net_parser);
+        memcpy(key->src_ip, &iphdr->saddr, sizeof(iphdr->saddr));
+        memcpy(key->dst_ip, &iphdr->daddr, sizeof(iphdr->daddr));
+    }
+    else if (key->ip_version == 6)
+    {
+        struct ip6_hdr *ip6hdr;
+
+        ip6hdr = net_header_get_ipv6_hdr(net_parser);
+        memcpy(key->src_ip, &ip6hdr->ip6_src, sizeof(ip6hdr->ip6_src));
+        memcpy(key->dst_ip, &ip6hdr->ip6_dst, sizeof(ip6hdr->ip6_dst));
+    }
+    else return false;
+
+    tcphdr = net_parser->ip_pld.tcphdr;
+    key->src_port = tcphdr->source;
+    key->dst_port = tcphdr->dest;
+
+    return true;
+}
+
+
+/**
+ * @brief looks up or allocates the parsing state of the current packet's flow
+ *
+ * When all the flows of the pool are in use, the least recently seen one
+ * is recycled.
+ *
+ * @param parser the http parser
+ * @return the flow, NULL if the packet is not a tcp packet
+ */
+struct http_flow *
+http_get_flow(struct fsm_http_parser *parser)
+{
+    struct net_header_parser *net_parser;
+    struct http_flow_key key;
+    struct http_flow *flow;
+    size_t i;
+
+    net_parser = parser->net_parser;
+    if (!http_fill_flow_key(net_parser, &key)) return NULL;
+
+    flow = ds_tree_find(&parser->flows, &key);
+    if (flow != NULL)
+    {
+        /* Keep the lru list ordered */
+        ds_dlist_remove(&parser->lru_flows, flow);
+        ds_dlist_insert_tail(&parser->lru_flows, flow);
+        flow->last_seen = time(NULL);
+        return flow;
+    }
+
+    if (parser->flow_pool == NULL)
+    {
+        parser->flow_pool = CALLOC(HTTP_FLOW_POOL_SIZE,
+                                   sizeof(*parser->flow_pool));
+        for (i = 0; i < HTTP_FLOW_POOL_SIZE; i++)
+        {
+            ds_dlist_insert_tail(&parser->free_flows, &parser->flow_pool[i]);
+        }
+    }
+
+    flow = ds_dlist_remove_head(&parser->free_flows);
+    if (flow == NULL)
+    {
+        flow = ds_dlist_head(&parser->lru_flows);
+        http_release_flow(parser, flow);
+        flow = ds_dlist_remove_head(&parser->free_flows);
+    }
+
+    memset(flow, 0, sizeof(*flow));
+    memcpy(&flow->key, &key, sizeof(key));
+    flow->next_seq = ntohl(net_parser->ip_pld.tcphdr->seq);
+    flow->last_seen = time(NULL);
+    parser_init(flow);
+    ds_tree_insert(&parser->flows, flow, &flow->key);
+    ds_dlist_insert_tail(&parser->lru_flows, flow);
+
+    return flow;
+}
+
+
+/**
+ * @brief feeds the current tcp segment to its flow's parser
+ *
+ * Segments are expected in order. Retransmitted segments are skipped,
+ * a gap in the sequence ends the inspection of the flow.
+ *
+ * @param parser the parsed data container
+ * @return the number of bytes parsed
+ */
 size_t http_parse_content(struct fsm_http_parser *parser)
 {
-    struct http_parser *http_parser = &parser->parser;
+    struct http_flow *flow = parser->flow;
+    enum http_errno err;
+    uint32_t seq;
     size_t parsed;
+    size_t len;
+
+    seq = ntohl(parser->net_parser->ip_pld.tcphdr->seq);
+    if ((int32_t)(seq - flow->next_seq) < 0) return 0;
+    if (seq != flow->next_seq)
+    {
+        flow->done = true;
+        return 0;
+    }
 
-    parser_init(parser);
-    parsed = http_parser_execute(http_parser, &parser_callbacks,
-                                 (char *)parser->data, parser->http_len);
+    len = parser->http_len;
+    if (len > HTTP_FLOW_MAX_HEADERS_LEN - flow->inspected)
+    {
+        len = HTTP_FLOW_MAX_HEADERS_LEN - flow->inspected;
+    }
+
+    flow->next_seq += parser->http_len;
+    flow->inspected += len;
+    parsed = http_parser_execute(&flow->parser, &parser_callbacks,
+                                 (char *)parser->data, len);
+
+    err = HTTP_PARSER_ERRNO(&flow->parser);
+    if (err != HPE_OK && err != HPE_PAUSED) flow->done = true;
+    if (flow->inspected >= HTTP_FLOW_MAX_HEADERS_LEN) flow->done = true;
 
     return parsed;
 }
@@ -240,6 +493,9 @@ size_t http_parse_content(struct fsm_http_parser *parser)
 /**
  * @brief parses a http message
  *
+ * Resumes the parsing of the packet's flow. Flows whose request headers
+ * were already parsed are not inspected further.
+ *
  * @param parser the parsed data container
  * @return the size of the parsed message, or 0 on parsing error.
  */
@@ -247,21 +503,28 @@ size_t
 http_parse_message(struct fsm_http_parser *parser)
 {
     struct net_header_parser *net_parser;
+    struct http_flow *flow;
     size_t len;
-    int ip_protocol;
 
     if (parser == NULL) return 0;
 
     net_parser = parser->net_parser;
+    parser->flow = NULL;
 
     /* Some basic validation */
-    ip_protocol = net_parser->ip_protocol;
-    if (ip_protocol != IPPROTO_TCP) return 0;
+    if (net_parser->ip_protocol != IPPROTO_TCP) return 0;
 
-    /* Parse the http content */
     parser->parsed = net_parser->parsed;
     parser->data = net_parser->data;
     parser->http_len = net_parser->packet_len - net_parser->parsed;
+    if (parser->http_len == 0) return 0;
+
+    flow = http_get_flow(parser);
+    if (flow == NULL) return 0;
+    if (flow->done) return 0;
+
+    /* Parse the http content */
+    parser->flow = flow;
     len = http_parse_content(parser);
 
     return len;
@@ -272,29 +535,18 @@ void
 http_process_message(struct http_session *h_session)
 {
     struct fsm_http_parser *parser;
-    char user_agent[] = "User-Agent";
-    char *header_user_agent = NULL;
-    struct message *m;
-    int i, cmp = 0;
+    struct http_flow *flow;
 
     parser = &h_session->parser;
-    m = &parser->message;
+    flow = parser->flow;
+    if (flow == NULL) return;
 
-    /* Fetch user agent */
-    for (i = 0; i < m->num_headers; i++)
+    /* Report user agent once its value is fully parsed */
+    if (flow->ua_complete && !flow->reported)
     {
-        cmp = strcmp(m->headers[i][0], user_agent);
-        if (cmp == 0)
-        {
-            header_user_agent = m->headers[i][1];
-            break;
-        }
+        process_report(h_session, flow->user_agent);
+        flow->reported = true;
     }
-
-    /* Report user agent */
-    process_report(h_session, header_user_agent);
-
-    m->num_headers = 0;
 }
 
 
@@ -423,7 +675,7 @@ http_get_report(struct http_device *hdev,
     tree = &hdev->reports;
     report = CALLOC(1, sizeof(struct http_parse_report));
 
-    memcpy(report->user_agent, user_agent, MAX_ELEMENT_SIZE);
+    STRSCPY(report->user_agent, user_agent);
     memcpy(&report->src_mac, &hdev->device_mac, sizeof(os_macaddr_t));
     ds_tree_insert(tree, report, report->user_agent);
     hdev->cached_entries++;
@@ -494,8 +746,14 @@ process_report(struct http_session *h_session, char *user_agent)
 void http_periodic(struct fsm_session *session)
 {
     struct http_cache *mgr = http_get_mgr();
+    struct http_session *h_session;
 
     if (!mgr->initialized) return;
+
+    h_session = (struct http_session *)session->handler_ctxt;
+    if (h_session == NULL) return;
+
+    http_flows_expire(&h_session->parser, time(NULL));
 }
 
 
@@ -574,6 +832,7 @@ http_free_session(struct http_session *h_session)
         http_free_device(remove);
     }
 
+    http_flows_free(&h_session->parser);
     FREE(h_session);
 }
 
@@ -671,6 +930,7 @@ http_plugin_init(struct fsm_session *session)
     http_session->session = session;
     ds_tree_init(&http_session->session_devices, http_dev_id_cmp,
                  struct http_device, device_node);
+    http_flows_init(&http_session->parser);
     http_session->initialized = true;
     LOGD("%s: added session %s", __func__, session->name);
 
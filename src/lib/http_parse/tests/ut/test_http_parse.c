@@ -267,6 +267,93 @@ void test_http_get_user_agent(void)
 }
 
 
+/**
+ * @brief splits pkt372's request in two tcp segments
+ *
+ * The first segment ends in the middle of the User-Agent header name.
+ * The user agent is reported once the second segment is parsed.
+ */
+void test_http_incremental_parsing(void)
+{
+    struct fsm_session *session;
+    struct http_session *h_session;
+    struct fsm_http_parser *parser;
+    struct net_header_parser *net_parser;
+    struct http_device *hdev;
+    struct http_parse_report *http_report;
+    char *expected_user_agent = "test_fsm_1";
+    uint8_t seg1[sizeof(pkt372)];
+    uint8_t seg2[sizeof(pkt372)];
+    size_t hdr_len = 66; /* ethernet, ipv4 and tcp with options */
+    size_t split = 44;   /* "GET ... User-A" */
+    uint16_t tot_len;
+    uint32_t seq;
+    size_t len;
+
+    session = &g_sessions[0];
+    h_session = http_lookup_session(session);
+    TEST_ASSERT_NOT_NULL(h_session);
+
+    /* First segment: headers and the first split bytes of the request */
+    memcpy(seg1, pkt372, hdr_len + split);
+    tot_len = htons(20 + 32 + split);
+    memcpy(&seg1[16], &tot_len, sizeof(tot_len));
+
+    /* Second segment: headers and the rest of the request */
+    memcpy(seg2, pkt372, hdr_len);
+    memcpy(&seg2[hdr_len], &pkt372[hdr_len + split],
+           sizeof(pkt372) - hdr_len - split);
+    tot_len = htons(20 + 32 + sizeof(pkt372) - hdr_len - split);
+    memcpy(&seg2[16], &tot_len, sizeof(tot_len));
+    memcpy(&seq, &seg2[38], sizeof(seq));
+    seq = htonl(ntohl(seq) + split);
+    memcpy(&seg2[38], &seq, sizeof(seq));
+
+    parser = &h_session->parser;
+    net_parser = CALLOC(1, sizeof(*net_parser));
+    parser->net_parser = net_parser;
+
+    net_parser->packet_len = hdr_len + split;
+    net_parser->data = seg1;
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    len = http_parse_message(parser);
+    TEST_ASSERT_EQUAL_UINT(split, len);
+    http_process_message(h_session);
+    TEST_ASSERT_NULL(http_lookup_device(h_session));
+    TEST_ASSERT_NOT_NULL(parser->flow);
+    TEST_ASSERT_FALSE(parser->flow->done);
+
+    memset(net_parser, 0, sizeof(*net_parser));
+    parser->net_parser = net_parser;
+    net_parser->packet_len = sizeof(pkt372) - split;
+    net_parser->data = seg2;
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    len = http_parse_message(parser);
+    TEST_ASSERT_TRUE(len != 0);
+    http_process_message(h_session);
+    TEST_ASSERT_TRUE(parser->flow->done);
+
+    hdev = http_lookup_device(h_session);
+    TEST_ASSERT_NOT_NULL(hdev);
+    http_report = http_lookup_report(hdev, expected_user_agent);
+    TEST_ASSERT_NOT_NULL(http_report);
+    TEST_ASSERT_EQUAL_INT(1, http_report->counter);
+
+    /* The headers are complete, further segments are not inspected */
+    memset(net_parser, 0, sizeof(*net_parser));
+    parser->net_parser = net_parser;
+    net_parser->packet_len = sizeof(pkt372) - split;
+    net_parser->data = seg2;
+    len = net_header_parse(net_parser);
+    TEST_ASSERT_TRUE(len != 0);
+    len = http_parse_message(parser);
+    TEST_ASSERT_EQUAL_UINT(0, len);
+    FREE(net_parser);
+}
+
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -281,6 +368,7 @@ int main(int argc, char *argv[])
 
     RUN_TEST(test_load_unload_plugin);
     RUN_TEST(test_http_get_user_agent);
+    RUN_TEST(test_http_incremental_parsing);
 
     global_test_exit();
 
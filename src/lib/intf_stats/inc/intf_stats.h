@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "ds.h"
 #include "ds_dlist.h"
+#include "ds_tree.h"
 #include "interface_stats.pb-c.h"
 #include "memutil.h"
 
@@ -52,7 +53,10 @@ typedef struct
     uint64_t            tx_packets;
     uint64_t            rx_packets;
 
+    int                 ifindex;    /* Resolved kernel ifindex, 0 if unknown */
+
     ds_dlist_node_t     node;
+    ds_tree_node_t      idx_node;   /* Node in the ifindex table of tracked interfaces */
 } intf_stats_t;
 
 /**
@@ -38,6 +38,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <netdb.h>
 #include <unistd.h>
 #include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <libmnl/libmnl.h>
 #include <errno.h>
 
 #include "os_types.h"
@@ -54,10 +56,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "intf_stats.h"
 #include "util.h"
 
+/*
+ * Maximum number of RTM_GETLINK requests sent in a single batch; each reply
+ * carries the full link attributes, so keep a batch of replies well below the
+ * socket receive buffer size
+ */
+#define INTF_STATS_NL_BATCH      32
+
 static  ds_dlist_t               cloud_intf_list;
+static  ds_tree_t                cloud_intf_idx;    /* Tracked interfaces by ifindex */
 static  intf_stats_report_data_t report;
 static  int                      report_type;
 
+static  struct mnl_socket       *intf_stats_nl_sock = NULL;
+static  unsigned int             intf_stats_nl_seq;
+
 static  ovsdb_update_monitor_t   intf_stats_inet_config_ovsdb_update;
 
 /******************************************************************************
@@ -82,6 +95,51 @@ intf_stats_remove_all_intfs(ds_dlist_t *list)
     return;
 }
 
+/*
+ * Remove the interface from the ifindex table; its ifindex is resolved again
+ * by name on the next fetch
+ */
+static void
+intf_stats_untrack(intf_stats_t *intf)
+{
+    if (intf->ifindex == 0) return;
+
+    if (ds_tree_find(&cloud_intf_idx, &intf->ifindex) == intf)
+    {
+        ds_tree_remove(&cloud_intf_idx, intf);
+    }
+    intf->ifindex = 0;
+
+    return;
+}
+
+static void
+intf_stats_track(intf_stats_t *intf, int ifindex)
+{
+    if (intf->ifindex == ifindex) return;
+
+    intf_stats_untrack(intf);
+
+    /* The same interface may be listed twice, only index the first entry */
+    if (ds_tree_find(&cloud_intf_idx, &ifindex) != NULL) return;
+
+    intf->ifindex = ifindex;
+    ds_tree_insert(&cloud_intf_idx, intf, &intf->ifindex);
+    LOGT("Interface '%s' has ifindex %d", intf->ifname, ifindex);
+
+    return;
+}
+
+static void
+intf_stats_remove_cloud_intf(intf_stats_t *intf)
+{
+    intf_stats_untrack(intf);
+    ds_dlist_remove(&cloud_intf_list, intf);
+    intf_stats_intf_free(intf);
+
+    return;
+}
+
 void
 intf_stats_reset_report(intf_stats_report_data_t *report)
 {
@@ -433,8 +491,7 @@ intf_stats_inet_config_ovsdb_update_cb(ovsdb_update_monitor_t *self)
                     if(!inet.collect_stats)
                     {
                         /* The cloud does not want stats to be reported on this interface anymore */
-                        ds_dlist_remove(&cloud_intf_list, intf);
-                        intf_stats_intf_free(intf);
+                        intf_stats_remove_cloud_intf(intf);
                         window_entry->num_intfs--;
                         break;
                     }
@@ -462,8 +519,7 @@ intf_stats_inet_config_ovsdb_update_cb(ovsdb_update_monitor_t *self)
             intf = intf_stats_find_by_ifname(&cloud_intf_list, inet.if_name);
             if (intf)
             {
-                ds_dlist_remove(&cloud_intf_list, intf);
-                intf_stats_intf_free(intf);
+                intf_stats_remove_cloud_intf(intf);
                 window_entry->num_intfs--;
                 break;
             }
@@ -492,7 +548,7 @@ intf_stats_get_node_info(fcm_collect_plugin_t *collector)
 /******************************************************************************/
 
 static void
-intf_stats_calculate_stats(intf_stats_t *stats_old, struct rtnl_link_stats *stats_new)
+intf_stats_calculate_stats(intf_stats_t *stats_old, struct rtnl_link_stats64 *stats_new)
 {
     intf_stats_window_t *window_entry     = NULL;
     intf_stats_t        *intf_entry       = NULL;
@@ -545,7 +601,36 @@ intf_stats_calculate_stats(intf_stats_t *stats_old, struct rtnl_link_stats *stat
 }
 
 static void
-intf_stats_fetch_stats(bool set_baseline)
+intf_stats_update_stats(intf_stats_t *stats_old, struct rtnl_link_stats64 *stats_new, bool set_baseline)
+{
+    LOGT("------Stats retreived for '%s'-------", stats_old->ifname);
+    LOGT("tx_packets = %10" PRIu64 "; rx_packets = %10" PRIu64 "",
+                                (uint64_t)stats_new->tx_packets, (uint64_t)stats_new->rx_packets);
+    LOGT("tx_bytes   = %10" PRIu64 "; rx_bytes   = %10" PRIu64 "",
+                                (uint64_t)stats_new->tx_bytes, (uint64_t)stats_new->rx_bytes);
+    LOGT("----------------------------------------------");
+
+    /* Calculate the deltas */
+    if (!set_baseline)
+    {
+        intf_stats_calculate_stats(stats_old, stats_new);
+    }
+
+    /* Replace the old stats */
+    stats_old->tx_bytes   = stats_new->tx_bytes;
+    stats_old->rx_bytes   = stats_new->rx_bytes;
+    stats_old->tx_packets = stats_new->tx_packets;
+    stats_old->rx_packets = stats_new->rx_packets;
+
+    return;
+}
+
+/*
+ * Fallback used when the rtnetlink socket is not available: getifaddrs()
+ * dumps all links and addresses of the system
+ */
+static void
+intf_stats_fetch_stats_ifaddrs(bool set_baseline)
 {
     intf_stats_t     *stats_old = NULL;
     struct  ifaddrs  *ifaddr, *ifa;
@@ -594,31 +679,278 @@ intf_stats_fetch_stats(bool set_baseline)
         } 
         else if (family == AF_PACKET && ifa->ifa_data != NULL)
         {
-            struct rtnl_link_stats *stats_new = ifa->ifa_data;
+            struct rtnl_link_stats   *stats = ifa->ifa_data;
+            struct rtnl_link_stats64  stats_new;
+
+            memset(&stats_new, 0, sizeof(stats_new));
+            stats_new.tx_bytes   = stats->tx_bytes;
+            stats_new.rx_bytes   = stats->rx_bytes;
+            stats_new.tx_packets = stats->tx_packets;
+            stats_new.rx_packets = stats->rx_packets;
 
-            LOGT("------Stats retreived from getifaddrs()-------");
-            LOGT("tx_packets = %10u; rx_packets = %10u\n",
-                                        stats_new->tx_packets, stats_new->rx_packets);
-            LOGT("tx_bytes   = %10u; rx_bytes   = %10u\n",
-                                        stats_new->tx_bytes, stats_new->rx_bytes);
-            LOGT("----------------------------------------------");
+            intf_stats_update_stats(stats_old, &stats_new, set_baseline);
+        }
+    }
 
-            /* Calculate the deltas */
-            if (!set_baseline)
+exit:
+    freeifaddrs(ifaddr);
+
+    return;
+}
+
+/******************************************************************************
+ *  rtnetlink link stats
+ ******************************************************************************/
+
+/*
+ * State of a batch of RTM_GETLINK requests, the interface of each request
+ * is found from its sequence number
+ */
+struct intf_stats_nl_batch
+{
+    char                buf[MNL_SOCKET_BUFFER_SIZE];
+    size_t              len;
+    unsigned int        seq;
+    int                 count;
+    intf_stats_t       *intfs[INTF_STATS_NL_BATCH];
+};
+
+static bool
+intf_stats_nl_open(void)
+{
+    int opt = 1;
+
+    if (intf_stats_nl_sock != NULL) return true;
+
+    intf_stats_nl_sock = mnl_socket_open(NETLINK_ROUTE);
+    if (intf_stats_nl_sock == NULL)
+    {
+        LOGE("Unable to open rtnetlink socket, errno = '%d'", errno);
+        return false;
+    }
+
+    if (mnl_socket_bind(intf_stats_nl_sock, 0, MNL_SOCKET_AUTOPID) < 0)
+    {
+        LOGE("Unable to bind rtnetlink socket, errno = '%d'", errno);
+        mnl_socket_close(intf_stats_nl_sock);
+        intf_stats_nl_sock = NULL;
+        return false;
+    }
+
+    /* Do not echo the requests back in the acknowledgements */
+    (void)mnl_socket_setsockopt(intf_stats_nl_sock, NETLINK_CAP_ACK, &opt, sizeof(opt));
+
+    return true;
+}
+
+static void
+intf_stats_nl_close(void)
+{
+    if (intf_stats_nl_sock == NULL) return;
+
+    mnl_socket_close(intf_stats_nl_sock);
+    intf_stats_nl_sock = NULL;
+
+    return;
+}
+
+/*
+ * Append a RTM_GETLINK request for @p intf; the link is looked up by ifindex
+ * once resolved, by name otherwise
+ */
+static void
+intf_stats_nl_batch_add(struct intf_stats_nl_batch *nb, intf_stats_t *intf)
+{
+    struct nlmsghdr  *nlh;
+    struct ifinfomsg *ifm;
+
+    nlh = mnl_nlmsg_put_header(nb->buf + nb->len);
+    nlh->nlmsg_type  = RTM_GETLINK;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    nlh->nlmsg_seq   = nb->seq + nb->count;
+
+    ifm = mnl_nlmsg_put_extra_header(nlh, sizeof(*ifm));
+    ifm->ifi_family = AF_UNSPEC;
+    ifm->ifi_index  = intf->ifindex;
+    if (intf->ifindex == 0) mnl_attr_put_strz(nlh, IFLA_IFNAME, intf->ifname);
+
+    nb->intfs[nb->count++] = intf;
+    nb->len += nlh->nlmsg_len;
+
+    return;
+}
+
+static intf_stats_t *
+intf_stats_nl_batch_intf(struct intf_stats_nl_batch *nb, const struct nlmsghdr *nlh)
+{
+    unsigned int idx;
+
+    idx = nlh->nlmsg_seq - nb->seq;
+    if (idx >= (unsigned int)nb->count) return NULL;
+
+    return nb->intfs[idx];
+}
+
+static int
+intf_stats_nl_attr_cb(const struct nlattr *attr, void *data)
+{
+    const struct nlattr **tb = data;
+    int type;
+
+    type = mnl_attr_get_type(attr);
+    if (mnl_attr_type_valid(attr, IFLA_MAX) < 0) return MNL_CB_OK;
+
+    tb[type] = attr;
+    return MNL_CB_OK;
+}
+
+static void
+intf_stats_nl_link(struct intf_stats_nl_batch *nb, const struct nlmsghdr *nlh, bool set_baseline)
+{
+    const struct nlattr      *tb[IFLA_MAX + 1];
+    struct rtnl_link_stats64  stats_new;
+    struct ifinfomsg         *ifm;
+    intf_stats_t             *intf;
+    const char               *ifname;
+
+    intf = intf_stats_nl_batch_intf(nb, nlh);
+    if (intf == NULL) return;
+
+    ifm = mnl_nlmsg_get_payload(nlh);
+
+    memset(tb, 0, sizeof(tb));
+    mnl_attr_parse(nlh, sizeof(*ifm), intf_stats_nl_attr_cb, tb);
+    if (tb[IFLA_IFNAME] == NULL || tb[IFLA_STATS64] == NULL) return;
+
+    /* The ifindex was reused by another interface */
+    ifname = mnl_attr_get_str(tb[IFLA_IFNAME]);
+    if (strcmp(ifname, intf->ifname) != 0)
+    {
+        intf_stats_untrack(intf);
+        return;
+    }
+
+    intf_stats_track(intf, ifm->ifi_index);
+
+    if (mnl_attr_get_payload_len(tb[IFLA_STATS64]) < sizeof(stats_new)) return;
+    memcpy(&stats_new, mnl_attr_get_payload(tb[IFLA_STATS64]), sizeof(stats_new));
+
+    intf_stats_update_stats(intf, &stats_new, set_baseline);
+
+    return;
+}
+
+/*
+ * Send the batch with a single write and process the replies; each request
+ * is answered by a RTM_NEWLINK message, if the link exists, followed by an
+ * acknowledgement
+ */
+static bool
+intf_stats_nl_batch_flush(struct intf_stats_nl_batch *nb, bool set_baseline)
+{
+    char              buf[MNL_SOCKET_BUFFER_SIZE];
+    struct nlmsghdr  *nlh;
+    struct nlmsgerr  *err;
+    intf_stats_t     *intf;
+    ssize_t           rc;
+    int               acks;
+    int               len;
+
+    if (nb->count == 0) return true;
+
+    if (mnl_socket_sendto(intf_stats_nl_sock, nb->buf, nb->len) < 0)
+    {
+        LOGE("Unable to send RTM_GETLINK requests, errno = '%d'", errno);
+        return false;
+    }
+
+    for (acks = 0; acks < nb->count;)
+    {
+        rc = mnl_socket_recvfrom(intf_stats_nl_sock, buf, sizeof(buf));
+        if (rc <= 0)
+        {
+            LOGE("Unable to receive RTM_GETLINK replies, errno = '%d'", errno);
+            return false;
+        }
+
+        for (nlh = (void *)buf, len = rc; mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len))
+        {
+            if (nlh->nlmsg_type == RTM_NEWLINK)
             {
-                intf_stats_calculate_stats(stats_old, stats_new);
+                intf_stats_nl_link(nb, nlh, set_baseline);
+                continue;
             }
 
-            /* Replace the old stats */
-            stats_old->tx_bytes   = stats_new->tx_bytes;
-            stats_old->rx_bytes   = stats_new->rx_bytes;
-            stats_old->tx_packets = stats_new->tx_packets;
-            stats_old->rx_packets = stats_new->rx_packets;
+            if (nlh->nlmsg_type != NLMSG_ERROR) continue;
+
+            acks++;
+            err = mnl_nlmsg_get_payload(nlh);
+            if (err->error == 0) continue;
+
+            intf = intf_stats_nl_batch_intf(nb, &err->msg);
+            if (intf == NULL) continue;
+
+            LOGT("Interface '%s' not found: %s", intf->ifname, strerror(-err->error));
+
+            /* The link is gone, look it up by name next time */
+            intf_stats_untrack(intf);
         }
     }
 
-exit:
-    freeifaddrs(ifaddr);
+    return true;
+}
+
+static bool
+intf_stats_fetch_stats_nl(bool set_baseline)
+{
+    struct intf_stats_nl_batch *nb;
+    intf_stats_t               *intf;
+    ds_dlist_iter_t             intf_iter;
+    bool                        rc = true;
+
+    if (!intf_stats_nl_open()) return false;
+
+    nb = MALLOC(sizeof(*nb));
+
+    nb->len   = 0;
+    nb->count = 0;
+    nb->seq   = intf_stats_nl_seq;
+
+    for ( intf = ds_dlist_ifirst(&intf_iter, &cloud_intf_list);
+          intf != NULL && rc;
+          intf = ds_dlist_inext(&intf_iter))
+    {
+        intf_stats_nl_batch_add(nb, intf);
+        if (nb->count < INTF_STATS_NL_BATCH) continue;
+
+        rc = intf_stats_nl_batch_flush(nb, set_baseline);
+        nb->seq  += nb->count;
+        nb->len   = 0;
+        nb->count = 0;
+    }
+
+    if (rc) rc = intf_stats_nl_batch_flush(nb, set_baseline);
+    intf_stats_nl_seq = nb->seq + nb->count;
+
+    FREE(nb);
+
+    /* Start over with a fresh socket, stale replies may be queued */
+    if (!rc) intf_stats_nl_close();
+
+    return rc;
+}
+
+/*
+ * Fetch the counters of the tracked interfaces only. The links are queried
+ * by ifindex with a batch of RTM_GETLINK requests, instead of dumping all
+ * the links and addresses of the system.
+ */
+static void
+intf_stats_fetch_stats(bool set_baseline)
+{
+    if (intf_stats_fetch_stats_nl(set_baseline)) return;
+
+    intf_stats_fetch_stats_ifaddrs(set_baseline);
 
     return;
 }
@@ -697,6 +1029,8 @@ void
 intf_stats_plugin_close_cb(fcm_collect_plugin_t *collector)
 {
     LOGN("Interface Stats plugin shutting down");
+    intf_stats_nl_close();
+    ds_tree_init(&cloud_intf_idx, ds_int_cmp, intf_stats_t, idx_node);
     intf_stats_remove_all_intfs(&cloud_intf_list);
     intf_stats_reset_report(&report);
 
@@ -728,6 +1062,7 @@ int intf_stats_plugin_init(fcm_collect_plugin_t *collector)
 
     /* Initialize the list to hold the interfaces provided by the cloud */
     ds_dlist_init(&cloud_intf_list, intf_stats_t, node);
+    ds_tree_init(&cloud_intf_idx, ds_int_cmp, intf_stats_t, idx_node);
     intf_stats_get_intf_names(collector);
 
     /* Initialize the report list */
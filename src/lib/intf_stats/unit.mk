@@ -47,6 +47,7 @@ UNIT_CFLAGS += -Isrc/fcm/inc
 UNIT_CFLAGS += -I3rdparty/plume/src/lib/fcm_filter/inc
 UNIT_EXPORT_CFLAGS := $(UNIT_CFLAGS)
 UNIT_LDFLAGS := -lprotobuf-c
+UNIT_LDFLAGS += -lmnl
 
 UNIT_DEPS := src/lib/const
 UNIT_DEPS += src/lib/log
@@ -86,6 +86,20 @@ typedef struct dp_ctl_stats_
     ds_tree_node_t  dp_tnode;
 } dp_ctl_stats_t;
 
+/*
+ * Per-UFID flow state, used to skip datapath flows whose counters did not
+ * change since they were last sampled in the current report window
+ */
+typedef struct lan_stats_flow_
+{
+    ovs_u128_       ufid;
+    unsigned long   pkts;
+    unsigned long   bytes;
+    uint32_t        window;     /* report window the flow was last sampled in */
+    uint32_t        dump;       /* last collection the flow was seen in */
+    ds_tree_node_t  flow_tnode;
+} lan_stats_flow_t;
+
 typedef struct lan_stats_instance
 {
     fcm_collect_plugin_t *collector;
@@ -99,6 +113,10 @@ typedef struct lan_stats_instance
     struct fcm_session *session;
     struct fcm_filter_client *c_client;
     struct fcm_filter_client *r_client;
+    ds_tree_t       flows;          /* lan_stats_flow_t, keyed by UFID */
+    uint32_t        flows_window;   /* current report window */
+    uint32_t        flows_dump;     /* current collection */
+    size_t          flows_skipped;  /* unchanged flows skipped in the last collection */
 } lan_stats_instance_t;
 
 typedef struct lan_stats_mgr_
@@ -138,4 +156,10 @@ lan_stats_flows_filter(lan_stats_instance_t *lan_stats_instance);
 
 void lan_stats_collect_flows(lan_stats_instance_t *lan_stats_instance);
 
+bool
+lan_stats_flow_changed(lan_stats_instance_t *lan_stats_instance);
+
+void
+lan_stats_flows_purge(lan_stats_instance_t *lan_stats_instance, bool all);
+
 #endif /* LAN_STATS_H_INCLUDED */
@@ -0,0 +1,363 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * LAN flow collection over the Open vSwitch datapath generic netlink
+ * interface (ovs_flow family). The datapath flows are dumped in binary
+ * form and converted directly into dp_ctl_stats_t records, without going
+ * through the text format of "ovs-dpctl dump-flows".
+ */
+
+#include <errno.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include <linux/genetlink.h>
+#include <linux/openvswitch.h>
+
+#include "log.h"
+#include "memutil.h"
+#include "lan_stats.h"
+
+#define LAN_NL_DP_IFNAME    "ovs-system"    /* Kernel datapath, "system@ovs-system" */
+#define LAN_NL_BUF_SIZE     (32 * 1024)     /* Large enough for a full dump batch */
+
+static struct mnl_socket *lan_nl_sock = NULL;
+static uint16_t lan_nl_flow_family = 0;
+static unsigned int lan_nl_seq = 0;
+
+struct lan_nl_attrs
+{
+    const struct nlattr **tb;
+    int max;
+};
+
+
+/**
+ * @brief mnl attribute callback, stores the attributes in a table
+ */
+static int
+lan_nl_attr_cb(const struct nlattr *attr, void *data)
+{
+    struct lan_nl_attrs *attrs = data;
+    int type;
+
+    type = mnl_attr_get_type(attr);
+    if (type > attrs->max) return MNL_CB_OK;
+
+    attrs->tb[type] = attr;
+    return MNL_CB_OK;
+}
+
+
+/**
+ * @brief parse nested attributes into @p tb
+ */
+static void
+lan_nl_parse_nested(const struct nlattr *nest, const struct nlattr **tb, int max)
+{
+    struct lan_nl_attrs attrs;
+
+    memset(tb, 0, (max + 1) * sizeof(*tb));
+    if (nest == NULL) return;
+
+    attrs.tb = tb;
+    attrs.max = max;
+    mnl_attr_parse_nested(nest, lan_nl_attr_cb, &attrs);
+}
+
+
+/**
+ * @brief mnl callback processing the CTRL_CMD_GETFAMILY reply
+ */
+static int
+lan_nl_family_cb(const struct nlmsghdr *nlh, void *data)
+{
+    const struct nlattr *tb[CTRL_ATTR_MAX + 1];
+    struct lan_nl_attrs attrs;
+    uint16_t *family = data;
+
+    memset(tb, 0, sizeof(tb));
+    attrs.tb = tb;
+    attrs.max = CTRL_ATTR_MAX;
+    mnl_attr_parse(nlh, sizeof(struct genlmsghdr), lan_nl_attr_cb, &attrs);
+
+    if (tb[CTRL_ATTR_FAMILY_ID] == NULL) return MNL_CB_ERROR;
+
+    *family = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+    return MNL_CB_OK;
+}
+
+
+/**
+ * @brief initialize a generic netlink request
+ */
+static struct nlmsghdr *
+lan_nl_put_request(void *buf, uint16_t type, uint16_t flags, uint8_t cmd,
+                   uint8_t version)
+{
+    struct genlmsghdr *genl;
+    struct nlmsghdr *nlh;
+
+    nlh = mnl_nlmsg_put_header(buf);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    nlh->nlmsg_seq = ++lan_nl_seq;
+
+    genl = mnl_nlmsg_put_extra_header(nlh, sizeof(*genl));
+    genl->cmd = cmd;
+    genl->version = version;
+
+    return nlh;
+}
+
+
+/**
+ * @brief send a request and process the replies until the request completes
+ */
+static bool
+lan_nl_request(struct nlmsghdr *nlh, mnl_cb_t cb, void *data)
+{
+    static char buf[LAN_NL_BUF_SIZE];
+    unsigned int portid;
+    unsigned int seq;
+    int ret;
+
+    seq = nlh->nlmsg_seq;
+    portid = mnl_socket_get_portid(lan_nl_sock);
+
+    if (mnl_socket_sendto(lan_nl_sock, nlh, nlh->nlmsg_len) < 0)
+    {
+        LOGE("%s: mnl_socket_sendto failed: %s", __func__, strerror(errno));
+        return false;
+    }
+
+    do
+    {
+        ret = mnl_socket_recvfrom(lan_nl_sock, buf, sizeof(buf));
+        if (ret <= 0) break;
+
+        ret = mnl_cb_run(buf, ret, seq, portid, cb, data);
+    } while (ret > MNL_CB_STOP);
+
+    if (ret < 0)
+    {
+        LOGE("%s: netlink request failed: %s", __func__, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief close the generic netlink socket
+ */
+static void
+lan_nl_close(void)
+{
+    if (lan_nl_sock == NULL) return;
+
+    mnl_socket_close(lan_nl_sock);
+    lan_nl_sock = NULL;
+    lan_nl_flow_family = 0;
+}
+
+
+/**
+ * @brief open the generic netlink socket and resolve the ovs_flow family
+ */
+static bool
+lan_nl_open(void)
+{
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    struct nlmsghdr *nlh;
+    bool rc;
+
+    if (lan_nl_sock != NULL) return true;
+
+    lan_nl_sock = mnl_socket_open(NETLINK_GENERIC);
+    if (lan_nl_sock == NULL)
+    {
+        LOGE("%s: mnl_socket_open failed: %s", __func__, strerror(errno));
+        return false;
+    }
+
+    if (mnl_socket_bind(lan_nl_sock, 0, MNL_SOCKET_AUTOPID) < 0)
+    {
+        LOGE("%s: mnl_socket_bind failed: %s", __func__, strerror(errno));
+        lan_nl_close();
+        return false;
+    }
+
+    nlh = lan_nl_put_request(buf, GENL_ID_CTRL, NLM_F_ACK, CTRL_CMD_GETFAMILY, 1);
+    mnl_attr_put_strz(nlh, CTRL_ATTR_FAMILY_NAME, OVS_FLOW_FAMILY);
+
+    rc = lan_nl_request(nlh, lan_nl_family_cb, &lan_nl_flow_family);
+    if (!rc || lan_nl_flow_family == 0)
+    {
+        LOGE("%s: %s generic netlink family not available", __func__,
+             OVS_FLOW_FAMILY);
+        lan_nl_close();
+        return false;
+    }
+
+    LOGI("%s: %s generic netlink family id: %u", __func__, OVS_FLOW_FAMILY,
+         lan_nl_flow_family);
+
+    return true;
+}
+
+
+/**
+ * @brief convert a single datapath flow to a dp_ctl_stats_t record
+ *
+ * Mirrors the fields extracted from the "ovs-dpctl dump-flows -m" output:
+ * ufid, eth(src,dst), eth_type, vlan(vid), encap(eth_type), packets, bytes.
+ */
+static int
+lan_nl_flow_cb(const struct nlmsghdr *nlh, void *data)
+{
+    const struct nlattr *encap[OVS_KEY_ATTR_MAX + 1];
+    const struct nlattr *key[OVS_KEY_ATTR_MAX + 1];
+    const struct nlattr *tb[OVS_FLOW_ATTR_MAX + 1];
+    lan_stats_instance_t *lan_stats_instance;
+    const struct ovs_key_ethernet *eth;
+    const struct ovs_flow_stats *fstats;
+    struct lan_nl_attrs attrs;
+    dp_ctl_stats_t *stats;
+    uint16_t tci;
+    size_t len;
+
+    lan_stats_instance = data;
+    stats = &lan_stats_instance->stats;
+
+    memset(tb, 0, sizeof(tb));
+    attrs.tb = tb;
+    attrs.max = OVS_FLOW_ATTR_MAX;
+    mnl_attr_parse(nlh, sizeof(struct genlmsghdr) + sizeof(struct ovs_header),
+                   lan_nl_attr_cb, &attrs);
+
+    if (tb[OVS_FLOW_ATTR_KEY] == NULL) return MNL_CB_OK;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (tb[OVS_FLOW_ATTR_UFID] != NULL)
+    {
+        len = mnl_attr_get_payload_len(tb[OVS_FLOW_ATTR_UFID]);
+        if (len > sizeof(stats->ufid)) len = sizeof(stats->ufid);
+        memcpy(&stats->ufid, mnl_attr_get_payload(tb[OVS_FLOW_ATTR_UFID]), len);
+    }
+
+    if (tb[OVS_FLOW_ATTR_STATS] != NULL &&
+        mnl_attr_get_payload_len(tb[OVS_FLOW_ATTR_STATS]) >= sizeof(*fstats))
+    {
+        fstats = mnl_attr_get_payload(tb[OVS_FLOW_ATTR_STATS]);
+        stats->pkts = fstats->n_packets;
+        stats->bytes = fstats->n_bytes;
+    }
+
+    lan_nl_parse_nested(tb[OVS_FLOW_ATTR_KEY], key, OVS_KEY_ATTR_MAX);
+
+    if (key[OVS_KEY_ATTR_ETHERNET] != NULL &&
+        mnl_attr_get_payload_len(key[OVS_KEY_ATTR_ETHERNET]) >= sizeof(*eth))
+    {
+        eth = mnl_attr_get_payload(key[OVS_KEY_ATTR_ETHERNET]);
+        memcpy(stats->smac_key.addr, eth->eth_src, sizeof(stats->smac_key.addr));
+        memcpy(stats->dmac_key.addr, eth->eth_dst, sizeof(stats->dmac_key.addr));
+        snprintf(stats->smac_addr, sizeof(stats->smac_addr),
+                 PRI_os_macaddr_lower_t, FMT_os_macaddr_t(stats->smac_key));
+        snprintf(stats->dmac_addr, sizeof(stats->dmac_addr),
+                 PRI_os_macaddr_lower_t, FMT_os_macaddr_t(stats->dmac_key));
+    }
+
+    if (key[OVS_KEY_ATTR_ETHERTYPE] != NULL)
+    {
+        stats->eth_val = ntohs(mnl_attr_get_u16(key[OVS_KEY_ATTR_ETHERTYPE]));
+        snprintf(stats->eth_type, sizeof(stats->eth_type), "0x%04x", stats->eth_val);
+    }
+
+    if (key[OVS_KEY_ATTR_VLAN] != NULL)
+    {
+        tci = ntohs(mnl_attr_get_u16(key[OVS_KEY_ATTR_VLAN]));
+        stats->vlan_id = tci & 0x0fff;
+    }
+
+    if (key[OVS_KEY_ATTR_ENCAP] != NULL)
+    {
+        lan_nl_parse_nested(key[OVS_KEY_ATTR_ENCAP], encap, OVS_KEY_ATTR_MAX);
+        if (encap[OVS_KEY_ATTR_ETHERTYPE] != NULL)
+        {
+            stats->vlan_eth_val = ntohs(mnl_attr_get_u16(encap[OVS_KEY_ATTR_ETHERTYPE]));
+            snprintf(stats->vlan_eth_type, sizeof(stats->vlan_eth_type), "0x%04x",
+                     stats->vlan_eth_val);
+        }
+    }
+
+    stats->stime = time(NULL);
+
+    lan_stats_flows_filter(lan_stats_instance);
+
+    return MNL_CB_OK;
+}
+
+
+void
+lan_stats_collect_flows(lan_stats_instance_t *lan_stats_instance)
+{
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    struct ovs_header *ovs_hdr;
+    struct nlmsghdr *nlh;
+    int dp_ifindex;
+    bool rc;
+
+    if (lan_stats_instance == NULL) return;
+
+    if (!lan_nl_open()) return;
+
+    dp_ifindex = if_nametoindex(LAN_NL_DP_IFNAME);
+    if (dp_ifindex == 0)
+    {
+        LOGD("%s: datapath %s not found", __func__, LAN_NL_DP_IFNAME);
+        return;
+    }
+
+    nlh = lan_nl_put_request(buf, lan_nl_flow_family, NLM_F_DUMP,
+                             OVS_FLOW_CMD_GET, OVS_FLOW_VERSION);
+    ovs_hdr = mnl_nlmsg_put_extra_header(nlh, sizeof(*ovs_hdr));
+    ovs_hdr->dp_ifindex = dp_ifindex;
+
+    rc = lan_nl_request(nlh, lan_nl_flow_cb, lan_stats_instance);
+    if (!rc)
+    {
+        LOGE("%s: Failed to dump flows from datapath", __func__);
+        /* Start over with a fresh socket on the next collection */
+        lan_nl_close();
+    }
+}
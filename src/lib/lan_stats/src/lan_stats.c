@@ -519,8 +519,10 @@ set_filter_info(fcm_filter_l2_info_t *l2_filter_info,
                 fcm_filter_stats_t *l2_filter_pkts,
                 dp_ctl_stats_t *stats)
 {
-    STRSCPY(l2_filter_info->src_mac, stats->smac_addr);
-    STRSCPY(l2_filter_info->dst_mac, stats->dmac_addr);
+    memset(l2_filter_info, 0, sizeof(*l2_filter_info));
+    l2_filter_info->smac_bin = stats->smac_key;
+    l2_filter_info->dmac_bin = stats->dmac_key;
+    l2_filter_info->mac_bin_set = true;
     l2_filter_info->vlan_id = stats->vlan_id;
     l2_filter_info->eth_type = stats->eth_val;
 
@@ -601,6 +603,92 @@ lan_stats_send_report_cb(fcm_collect_plugin_t *collector)
     lan_stats_close_window(collector);
     lan_stats_send_aggr_report(lan_stats_instance);
     lan_stats_activate_window(collector);
+
+    /* All flows need to be sampled again in the new window */
+    lan_stats_instance->flows_window++;
+}
+
+/**
+ * @brief compare flow UFIDs
+ */
+static int
+lan_stats_ufid_cmp(void *a, void *b)
+{
+    return memcmp(a, b, sizeof(ovs_u128_));
+}
+
+/**
+ * @brief check if the flow in the instance stats needs to be processed
+ *
+ * A flow is processed the first time it is seen in a report window, and
+ * then only when its counters change. Skipping unchanged flows within a
+ * window does not alter the reports: the aggregator already holds the
+ * same counters for the flow.
+ *
+ * @param lan_stats_instance the lan stats instance
+ * @return true if the flow should be processed
+ */
+bool
+lan_stats_flow_changed(lan_stats_instance_t *lan_stats_instance)
+{
+    lan_stats_flow_t *flow;
+    dp_ctl_stats_t *stats;
+    ovs_u128_ zero;
+
+    stats = &lan_stats_instance->stats;
+
+    /* Flows without a UFID cannot be tracked */
+    memset(&zero, 0, sizeof(zero));
+    if (memcmp(&stats->ufid, &zero, sizeof(zero)) == 0) return true;
+
+    flow = ds_tree_find(&lan_stats_instance->flows, &stats->ufid);
+    if (flow == NULL)
+    {
+        flow = CALLOC(1, sizeof(*flow));
+        if (flow == NULL) return true;
+
+        flow->ufid = stats->ufid;
+        ds_tree_insert(&lan_stats_instance->flows, flow, &flow->ufid);
+    }
+    else if (flow->window == lan_stats_instance->flows_window &&
+             flow->pkts == stats->pkts &&
+             flow->bytes == stats->bytes)
+    {
+        flow->dump = lan_stats_instance->flows_dump;
+        lan_stats_instance->flows_skipped++;
+        return false;
+    }
+
+    flow->pkts = stats->pkts;
+    flow->bytes = stats->bytes;
+    flow->window = lan_stats_instance->flows_window;
+    flow->dump = lan_stats_instance->flows_dump;
+
+    return true;
+}
+
+/**
+ * @brief remove the state of flows no longer present in the datapath
+ *
+ * @param lan_stats_instance the lan stats instance
+ * @param all remove all the flows
+ */
+void
+lan_stats_flows_purge(lan_stats_instance_t *lan_stats_instance, bool all)
+{
+    lan_stats_flow_t *flow;
+    ds_tree_iter_t iter;
+
+    flow = ds_tree_ifirst(&iter, &lan_stats_instance->flows);
+    while (flow != NULL)
+    {
+        if (all || flow->dump != lan_stats_instance->flows_dump)
+        {
+            ds_tree_iremove(&iter);
+            FREE(flow);
+        }
+        flow = ds_tree_inext(&iter);
+    }
 }
 
 void
@@ -611,7 +699,7 @@ lan_stats_flows_filter(lan_stats_instance_t *lan_stats_instance)
     struct fcm_filter_client *client;
     fcm_collect_plugin_t *collector;
     struct fcm_session *session;
-    struct fcm_filter_req *req;
+    struct fcm_filter_req req;
     dp_ctl_stats_t *stats;
     bool allow;
 
@@ -624,22 +712,22 @@ lan_stats_flows_filter(lan_stats_instance_t *lan_stats_instance)
     session = lan_stats_instance->session;
     if (session == NULL) return;
 
+    if (!lan_stats_flow_changed(lan_stats_instance)) return;
+
     set_filter_info(&l2_filter_info, &l2_filter_pkts, stats);
 
     client = lan_stats_instance->c_client;
     if (client == NULL) return;
 
-    req = CALLOC(1, sizeof(struct fcm_filter));
-    if (req == NULL) return;
-
-    req->pkts =  &l2_filter_pkts;
-    req->l2_info = &l2_filter_info;
-    req->table = client->table;
+    memset(&req, 0, sizeof(req));
+    req.pkts =  &l2_filter_pkts;
+    req.l2_info = &l2_filter_info;
+    req.table = client->table;
 
     if (collector->filters.collect != NULL)
     {
-        fcm_apply_filter(session, req);
-        allow = req->action;
+        fcm_apply_filter(session, &req);
+        allow = req.action;
 
         if (allow)
         {
@@ -668,7 +756,6 @@ lan_stats_flows_filter(lan_stats_instance_t *lan_stats_instance)
         LOGD("%s: aggr add sample", __func__);
         lan_stats_aggr_add_sample(collector, stats);
     }
-    FREE(req);
 }
 
 void
@@ -685,7 +772,15 @@ lan_stats_collect_cb(fcm_collect_plugin_t *collector)
     /* collect stats only for active instance. */
     if (lan_stats_instance != mgr->active) return;
 
+    lan_stats_instance->flows_dump++;
+    lan_stats_instance->flows_skipped = 0;
+
     lan_stats_instance->collect_flows(lan_stats_instance);
+
+    LOGD("%s: %s: unchanged flows skipped: %zu", __func__,
+         collector->name, lan_stats_instance->flows_skipped);
+
+    lan_stats_flows_purge(lan_stats_instance, false);
 }
 
 
@@ -711,6 +806,9 @@ void lan_stats_plugin_exit(fcm_collect_plugin_t *collector)
     /* free the parent tag */
     FREE(lan_stats_instance->parent_tag);
 
+    /* free the flows state */
+    lan_stats_flows_purge(lan_stats_instance, true);
+
     /* free the aggregator */
     aggr = lan_stats_instance->aggr;
     if (aggr == NULL)
@@ -773,6 +871,8 @@ int lan_stats_plugin_init(fcm_collect_plugin_t *collector)
 
     if (lan_stats_instance->initialized) return 0;
     lan_stats_instance->collector = collector;
+    ds_tree_init(&lan_stats_instance->flows, lan_stats_ufid_cmp,
+                 lan_stats_flow_t, flow_tnode);
     lan_stats_instance->name = collector->name;
 
     lan_stats_instance->session = collector->session;
@@ -42,6 +42,8 @@ endif
 UNIT_SRC := src/lan_stats.c
 ifeq ($(CONFIG_FCM_OVS_CMD),y)
 UNIT_SRC += src/lan_cmd_flows.c
+else ifeq ($(CONFIG_FCM_OVS_NETLINK),y)
+UNIT_SRC += src/lan_nl_flows.c
 else
 UNIT_SRC += src/lan_dpctl.c
 endif
@@ -55,7 +57,10 @@ UNIT_CFLAGS += -I$(OVS_INTERNAL_PATH)/include
 
 UNIT_CFLAGS += --std=gnu99 -Wno-sign-compare
 
-ifneq ($(CONFIG_FCM_OVS_CMD),y)
+ifeq ($(CONFIG_FCM_OVS_CMD),y)
+else ifeq ($(CONFIG_FCM_OVS_NETLINK),y)
+UNIT_LDFLAGS += -lmnl
+else
 UNIT_LDFLAGS += -lopenvswitch
 endif
 
@@ -512,6 +512,74 @@ test_data_collection(void)
 }
 
 
+#ifdef ARCH_X86
+/**
+ * @brief validates that flows with unchanged counters are only processed
+ *        once per report window
+ */
+void
+test_unchanged_flows(void)
+{
+    lan_stats_instance_t *lan_stats_instance;
+    fcm_collect_plugin_t *collector;
+    struct net_md_aggregator *aggr;
+    size_t skipped;
+    int rc;
+
+    collector = &g_collector_tbl[0];
+
+    rc = lan_stats_plugin_init(collector);
+    TEST_ASSERT_EQUAL_INT(0, rc);
+
+    lan_stats_instance = lan_stats_get_active_instance();
+    TEST_ASSERT_NOT_NULL(lan_stats_instance);
+
+    session = calloc(1, sizeof(*session));
+    TEST_ASSERT_NOT_NULL(session);
+
+    c_client = calloc(1, sizeof(*c_client));
+    TEST_ASSERT_NOT_NULL(c_client);
+
+    r_client = calloc(1, sizeof(*r_client));
+    TEST_ASSERT_NOT_NULL(r_client);
+    session->handler_ctxt = r_client;
+
+    lan_stats_instance->session = session;
+    lan_stats_instance->r_client = r_client;
+    lan_stats_instance->c_client = c_client;
+    lan_stats_instance->collect_flows = test_lan_stats_collect_flows;
+
+    aggr = lan_stats_instance->aggr;
+    TEST_ASSERT_NOT_NULL(aggr);
+    aggr->send_report = test_emit_report;
+
+    g_test_mgr.dpctl_file = g_default_dpctl_f[0];
+
+    /*
+     * First sample of the window: all flows are processed. The trailing
+     * empty line of the dump replays the last flow, which is skipped.
+     */
+    collector->collect_periodic(collector);
+    skipped = lan_stats_instance->flows_skipped;
+    TEST_ASSERT_TRUE(skipped <= 1);
+
+    /* Same counters in the same window: all 6 flows are skipped */
+    collector->collect_periodic(collector);
+    TEST_ASSERT_EQUAL_UINT(skipped + 6, lan_stats_instance->flows_skipped);
+
+    /* New window: all flows are sampled again */
+    collector->send_report(collector);
+    collector->collect_periodic(collector);
+    TEST_ASSERT_EQUAL_UINT(skipped, lan_stats_instance->flows_skipped);
+    collector->send_report(collector);
+
+    FREE(session);
+    FREE(c_client);
+    FREE(r_client);
+}
+#endif
+
+
 void
 add_flow_stats_cb(EV_P_ ev_timer *w, int revents)
 {
@@ -852,6 +920,7 @@ main(int argc, char *argv[])
     RUN_TEST(test_max_session);
     RUN_TEST(test_data_collection);
 #ifdef ARCH_X86
+    RUN_TEST(test_unchanged_flows);
     RUN_TEST(test_events);
 #endif
     RUN_TEST(test_parent_group_tag);
@@ -31,7 +31,10 @@ UNIT_SRC := test_lan_stats.c
 
 UNIT_CFLAGS := -Isrc/fcm/inc
 
-ifneq ($(CONFIG_FCM_OVS_CMD),y)
+ifeq ($(CONFIG_FCM_OVS_CMD),y)
+else ifeq ($(CONFIG_FCM_OVS_NETLINK),y)
+UNIT_LDFLAGS := -lmnl
+else
 UNIT_LDFLAGS := -lopenvswitch
 endif
 UNIT_EXPORT_LDFLAGS := $(UNIT_LDFLAGS)
@@ -87,6 +87,8 @@ struct net_md_stats_accumulator
     void (*free_plugins)(struct net_md_stats_accumulator *);
     ds_tree_t *dpi_plugins;
     int dpi_done;                          /* All dpi engines are done */
+    bool dpi_marked;                       /* dpi_done set in conntrack */
+    int dpi_mark_attempts;                 /* conntrack mark requests sent */
     int refcnt;                            /* # of entities accessing the acc */
     bool report;                           /* send a report */
     uint16_t direction;                    /* flow direction */
@@ -54,17 +54,41 @@ struct lnx_ip_route_gw_node
 static bool lnx_ip_addr_flush(lnx_ip_t *self);
 static bool lnx_ip_route_flush(lnx_ip_t *self);
 static void lnx_ip_status_poll(lnx_ip_t *self);
+static execsh_async_fn_t lnx_ip_apply_done;
 
 /* execsh commands */
-static char lnx_ip_addr_add_cmd[] = _S(ip address add "$2/$3" broadcast "+" dev "$1");
 static char lnx_ip_addr_flush_cmd[] = _S([ ! -e "/sys/class/net/$1" ] || ip -4 address flush dev "$1");
 
-static char lnx_ip_route_gw_add_cmd[] = _S(route add "$2" gw "$3" dev "$1");
-
 /* Scope global doesn't flush "local" or "link" routes */
 static char lnx_ip_route_gw_flush_cmd[] = _S([ ! -e "/sys/class/net/$1" ] || ip -4 route flush dev "$1" scope global);
 
+/*
+ * Flush the interface and apply the configuration; arguments following the
+ * interface name are "addr ADDRESS PREFIX" and "route SOURCE GATEWAY"
+ * triplets. Failed commands do not abort the script, the exit status is
+ * non-zero if any of them failed.
+ */
+static char lnx_ip_apply_cmd[] = _S(
+        ifname="$1";
+        shift;
+        rc=0;
+        if [ -e "/sys/class/net/$ifname" ];
+        then
+            ip -4 address flush dev "$ifname" || rc=1;
+            ip -4 route flush dev "$ifname" scope global || rc=1;
+        fi;
+        while [ $# -ge 3 ];
+        do
+            case "$1" in
+                (addr) ip address add "$2/$3" broadcast "+" dev "$ifname" || rc=1;;
+                (route) route add "$2" gw "$3" dev "$ifname" || rc=1;;
+            esac;
+            shift 3;
+        done;
+        exit "$rc");
+
 static lnx_netlink_fn_t lnx_ip_nl_fn;
+static lnx_netlink_addr_fn_t lnx_ip_addr_cache_fn;
 static execsh_fn_t lnx_ip_addr_parse;
 
 /*
@@ -104,6 +128,10 @@ bool lnx_ip_init(lnx_ip_t *self, const char *ifname)
     lnx_netlink_set_events(&self->ip_nl, LNX_NETLINK_IP4ADDR);
     lnx_netlink_set_ifname(&self->ip_nl, self->ip_ifname);
 
+    execsh_async_init(&self->ip_apply_esa, lnx_ip_apply_done);
+    self->ip_apply_esa.esa_severity = LOG_SEVERITY_DEBUG;
+    self->ip_apply_esa.esa_data = self;
+
     return true;
 }
 
@@ -125,6 +153,10 @@ bool lnx_ip_fini(lnx_ip_t *self)
         retval = false;
     }
 
+    /* Abort any configuration still in progress */
+    execsh_async_stop(&self->ip_apply_esa);
+    self->ip_apply_pending = false;
+
     /* Flush routes */
     lnx_ip_route_flush(self);
 
@@ -194,6 +226,9 @@ bool lnx_ip_addr_flush(lnx_ip_t *self)
 
 /*
  * Apply configuration to system
+ *
+ * The flush and all address and route updates are executed by a single
+ * asynchronous script; failures are reported by lnx_ip_apply_done().
  */
 bool lnx_ip_apply(lnx_ip_t *self)
 {
@@ -203,11 +238,26 @@ bool lnx_ip_apply(lnx_ip_t *self)
     char saddr[OSN_IP_ADDR_LEN];
     char sgw[OSN_IP_ADDR_LEN];
     char spref[C_INT32_LEN];
-    int rc;
+    char **argv = NULL;
+    char **parg;
+    int argc = 0;
+    int argm;
+    bool rc;
 
-    /* Start by issuing a flush */
-    lnx_ip_addr_flush(self);
-    lnx_ip_route_flush(self);
+    if (self->ip_apply_esa.esa_pid > 0)
+    {
+        /* Re-apply the configuration as soon as the current script completes */
+        self->ip_apply_pending = true;
+        return true;
+    }
+
+    /* Interface name, a triplet per address and route and the terminating NULL */
+    argm = 2;
+    ds_tree_foreach(&self->ip_addr_list, node) argm += 3;
+    ds_tree_foreach(&self->ip_route_gw_list, rnode) argm += 3;
+
+    argv = CALLOC(argm, sizeof(char *));
+    argv[argc++] = STRDUP(self->ip_ifname);
 
     /* First apply IPv4 addresses */
     ds_tree_foreach(&self->ip_addr_list, node)
@@ -220,14 +270,9 @@ bool lnx_ip_apply(lnx_ip_t *self)
 
         snprintf(spref, sizeof(spref), "%d", node->addr.ia_prefix);
 
-        rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_ip_addr_add_cmd, self->ip_ifname, saddr, spref);
-        if (rc != 0)
-        {
-            LOG(WARN, "ip: %s: Unable to add IPv4 address: "PRI_osn_ip_addr,
-                    self->ip_ifname,
-                    FMT_osn_ip_addr(node->addr));
-            continue;
-        }
+        argv[argc++] = STRDUP("addr");
+        argv[argc++] = STRDUP(saddr);
+        argv[argc++] = STRDUP(spref);
     }
 
     /* Apply IPv4 routes */
@@ -249,18 +294,43 @@ bool lnx_ip_apply(lnx_ip_t *self)
             continue;
         }
 
-        rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_ip_route_gw_add_cmd, self->ip_ifname, saddr, sgw);
-        if (rc != 0)
-        {
-            LOG(WARN, "ip: %s: Unable to add IPv4 gateway route: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr,
-                    self->ip_ifname,
-                    FMT_osn_ip_addr(rnode->src),
-                    FMT_osn_ip_addr(rnode->gw));
-            continue;
-        }
+        argv[argc++] = STRDUP("route");
+        argv[argc++] = STRDUP(saddr);
+        argv[argc++] = STRDUP(sgw);
     }
 
-    return true;
+    argv[argc] = NULL;
+
+    rc = execsh_async_start_a(&self->ip_apply_esa, lnx_ip_apply_cmd, argv);
+    if (!rc)
+    {
+        LOG(ERR, "ip: %s: Unable to apply IPv4 configuration.", self->ip_ifname);
+    }
+
+    for (parg = argv; *parg != NULL; parg++)
+    {
+        FREE(*parg);
+    }
+    FREE(argv);
+
+    return rc;
+}
+
+void lnx_ip_apply_done(execsh_async_t *esa, int exit_status)
+{
+    lnx_ip_t *self = esa->esa_data;
+
+    if (exit_status != 0)
+    {
+        LOG(WARN, "ip: %s: Error applying IPv4 configuration, exit status %d.",
+                self->ip_ifname, exit_status);
+    }
+
+    if (self->ip_apply_pending)
+    {
+        self->ip_apply_pending = false;
+        lnx_ip_apply(self);
+    }
 }
 
 bool lnx_ip_addr_add(lnx_ip_t *self, const osn_ip_addr_t *addr)
@@ -404,15 +474,22 @@ void lnx_ip_status_poll(lnx_ip_t *self)
     self->ip_status.is_addr_len = 0;
 
     /*
-     * Execute the "ip -4 -o addr show IFNAME" command.
-     * The -o switch yields a more compact and easier to parse format.
+     * Use the netlink address cache; fall back to polling if the cache is not
+     * available.
      */
-    rc = execsh_fn(lnx_ip_addr_parse, self, _S(ip -4 -o addr show dev "$1"), self->ip_ifname);
-    if (rc != 0)
+    if (!lnx_netlink_addr_foreach(self->ip_ifname, AF_INET, lnx_ip_addr_cache_fn, self))
     {
-        LOG(DEBUG, "ip: %s: Unable to acquire interface IPv4 address list. Exit code: %d",
-                self->ip_ifname,
-                rc);
+        /*
+         * Execute the "ip -4 -o addr show IFNAME" command.
+         * The -o switch yields a more compact and easier to parse format.
+         */
+        rc = execsh_fn(lnx_ip_addr_parse, self, _S(ip -4 -o addr show dev "$1"), self->ip_ifname);
+        if (rc != 0)
+        {
+            LOG(DEBUG, "ip: %s: Unable to acquire interface IPv4 address list. Exit code: %d",
+                    self->ip_ifname,
+                    rc);
+        }
     }
 
     LOG(DEBUG, "ip: %s: Found %zu IPv4 address(es).", self->ip_ifname, self->ip_status.is_addr_len);
@@ -423,6 +500,27 @@ void lnx_ip_status_poll(lnx_ip_t *self)
     }
 }
 
+/**
+ * Append a single address from the netlink address cache to the status
+ */
+void lnx_ip_addr_cache_fn(void *ctx, const struct lnx_netlink_addr *na)
+{
+    lnx_ip_t *self = ctx;
+    struct osn_ip_status *is = &self->ip_status;
+
+    if ((is->is_addr_len % LNX_IP_REALLOC_GROW) == 0)
+    {
+        is->is_addr = REALLOC(
+                is->is_addr,
+                (is->is_addr_len + LNX_IP_REALLOC_GROW) * sizeof(is->is_addr[0]));
+    }
+
+    is->is_addr[is->is_addr_len] = OSN_IP_ADDR_INIT;
+    is->is_addr[is->is_addr_len].ia_addr = na->na_addr.ip4;
+    is->is_addr[is->is_addr_len].ia_prefix = na->na_prefix;
+    is->is_addr_len++;
+}
+
 /**
  * Parse a single line of a "ip -o -4 addr show dev IF" output.
  */
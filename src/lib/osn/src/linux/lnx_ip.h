@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "osn_inet.h"
 #include "ds_tree.h"
 #include "const.h"
+#include "execsh.h"
 #include "lnx_netlink.h"
 
 /*
@@ -53,6 +54,8 @@ struct lnx_ip
     lnx_netlink_t           ip_nl;                          /* Netlink object */
     struct osn_ip_status    ip_status;
     lnx_ip_status_fn_t     *ip_status_fn;                   /* Status update callback */
+    execsh_async_t          ip_apply_esa;                   /* Configuration script */
+    bool                    ip_apply_pending;               /* Re-apply when the script completes */
 };
 
 bool lnx_ip_init(lnx_ip_t *, const char *ifname);
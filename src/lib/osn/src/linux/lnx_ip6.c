@@ -44,7 +44,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /*
  * This value specifies the minimum time interval between calls to
- * `ip -6 neigh show` and `ip -6 addr show`
+ * `ip -6 neigh show` and `ip -6 addr show`; these commands are used only
+ * if the netlink address and neighbor cache is not available
  */
 #define LNX_IP6_POLL_TIME 0.5
 
@@ -80,7 +81,10 @@ static bool lnx_ip6_ipaddr_parse(void *_self, int type, const char *line);
 static void lnx_ip6_status_ipaddr_update(lnx_ip6_t *self);
 static bool lnx_ip6_neigh_parse(void *_self, int type, const char *line);
 static void lnx_ip6_status_neigh_update(lnx_ip6_t *self);
+static int lnx_ip6_lft(uint32_t lft, double tstamp);
 static lnx_netlink_fn_t lnx_ip6_nl_fn;
+static lnx_netlink_addr_fn_t lnx_ip6_addr_cache_fn;
+static lnx_netlink_neigh_fn_t lnx_ip6_neigh_cache_fn;
 
 static struct lnx_ip6_neigh *lnx_ip6_neigh_table = NULL;
 static struct lnx_ip6_neigh *lnx_ip6_neigh_table_e = NULL;
@@ -478,6 +482,14 @@ void lnx_ip6_status_ipaddr_update(lnx_ip6_t *self)
 
     FREE(self->ip6_status.is6_addr);
     self->ip6_status.is6_addr = NULL;
+    self->ip6_status.is6_addr_len = 0;
+
+    /* Use the netlink address cache, poll `ip -6 addr show` if it's not available */
+    if (lnx_netlink_addr_foreach(self->ip6_ifname, AF_INET6, lnx_ip6_addr_cache_fn, self))
+    {
+        LOG(DEBUG, "ip6: %s: Found %zu IPv6 address(es).", self->ip6_ifname, self->ip6_status.is6_addr_len);
+        return;
+    }
 
     lnx_ip6_addr_table_update();
     for (pa = lnx_ip6_addr_table; pa < lnx_ip6_addr_table_e; pa++)
@@ -606,6 +618,14 @@ void lnx_ip6_status_neigh_update(lnx_ip6_t *self)
 
     FREE(self->ip6_status.is6_neigh);
     self->ip6_status.is6_neigh = NULL;
+    self->ip6_status.is6_neigh_len = 0;
+
+    /* Use the netlink neighbor cache, poll `ip -6 neigh show` if it's not available */
+    if (lnx_netlink_neigh_foreach(self->ip6_ifname, AF_INET6, lnx_ip6_neigh_cache_fn, self))
+    {
+        LOG(DEBUG, "ip6: %s: Found %zu neighbor(s).", self->ip6_ifname, self->ip6_status.is6_neigh_len);
+        return;
+    }
 
     lnx_ip6_neigh_table_update();
     for (np = lnx_ip6_neigh_table; np < lnx_ip6_neigh_table_e; np++)
@@ -622,6 +642,63 @@ void lnx_ip6_status_neigh_update(lnx_ip6_t *self)
     LOG(DEBUG, "ip6: %s: Found %zu neighbor(s).", self->ip6_ifname, self->ip6_status.is6_neigh_len);
 }
 
+/*
+ * Convert a netlink lifetime, reported at time @p tstamp, to the remaining
+ * lifetime in seconds. Infinite and expired lifetimes are reported as not set
+ * (INT_MIN), same as when parsing the "forever" and "0sec" values from
+ * `ip -6 addr show`.
+ */
+int lnx_ip6_lft(uint32_t lft, double tstamp)
+{
+    double elapsed;
+
+    if (lft == UINT32_MAX) return INT_MIN;
+
+    elapsed = clock_mono_double() - tstamp;
+    if (elapsed >= (double)lft) return INT_MIN;
+
+    return lft - (uint32_t)elapsed;
+}
+
+void lnx_ip6_addr_cache_fn(void *ctx, const struct lnx_netlink_addr *na)
+{
+    lnx_ip6_t *self = ctx;
+    struct osn_ip6_status *is6 = &self->ip6_status;
+
+    if ((is6->is6_addr_len % LNX_IP6_REALLOC_GROW) == 0)
+    {
+        is6->is6_addr = REALLOC(
+                is6->is6_addr,
+                (is6->is6_addr_len + LNX_IP6_REALLOC_GROW) * sizeof(is6->is6_addr[0]));
+    }
+
+    is6->is6_addr[is6->is6_addr_len] = OSN_IP6_ADDR_INIT;
+    is6->is6_addr[is6->is6_addr_len].ia6_addr = na->na_addr.ip6;
+    is6->is6_addr[is6->is6_addr_len].ia6_prefix = na->na_prefix;
+    is6->is6_addr[is6->is6_addr_len].ia6_valid_lft = lnx_ip6_lft(na->na_valid_lft, na->na_tstamp);
+    is6->is6_addr[is6->is6_addr_len].ia6_pref_lft = lnx_ip6_lft(na->na_pref_lft, na->na_tstamp);
+    is6->is6_addr_len++;
+}
+
+void lnx_ip6_neigh_cache_fn(void *ctx, const struct lnx_netlink_neigh *nn)
+{
+    lnx_ip6_t *self = ctx;
+    struct osn_ip6_status *is6 = &self->ip6_status;
+
+    if ((is6->is6_neigh_len % LNX_IP6_REALLOC_GROW) == 0)
+    {
+        is6->is6_neigh = REALLOC(
+                is6->is6_neigh,
+                (is6->is6_neigh_len + LNX_IP6_REALLOC_GROW) * sizeof(is6->is6_neigh[0]));
+    }
+
+    is6->is6_neigh[is6->is6_neigh_len].i6n_ipaddr = OSN_IP6_ADDR_INIT;
+    is6->is6_neigh[is6->is6_neigh_len].i6n_ipaddr.ia6_addr = nn->nn_addr.ip6;
+    memcpy(is6->is6_neigh[is6->is6_neigh_len].i6n_hwaddr.ma_addr, nn->nn_lladdr,
+            sizeof(is6->is6_neigh[0].i6n_hwaddr.ma_addr));
+    is6->is6_neigh_len++;
+}
+
 /**
  * Netlink event callback. This function is subscribed to the following events:
  *      - LNX_NETLINK_IP6ADDR
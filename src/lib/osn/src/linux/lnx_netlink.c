@@ -43,6 +43,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "log.h"
 #include "evx.h"
 #include "kconfig.h"
+#include "memutil.h"
+#include "os_time.h"
 #include "util.h"
 
 #include "lnx_netlink.h"
@@ -61,6 +63,49 @@ static ev_io lnx_netlink_sock_ev;
 /* Delayed dispatching of events */
 static ev_debounce lnx_netlink_dispatch_ev;
 
+/*
+ * Address, neighbor and route cache synchronization state; the caches are
+ * valid only in the LNX_NETLINK_SYNC_DONE state
+ */
+enum lnx_netlink_sync
+{
+    LNX_NETLINK_SYNC_NONE,              /* Cache not available */
+    LNX_NETLINK_SYNC_ADDR,              /* RTM_GETADDR dump in progress */
+    LNX_NETLINK_SYNC_NEIGH,             /* RTM_GETNEIGH dump in progress */
+    LNX_NETLINK_SYNC_ROUTE,             /* RTM_GETROUTE dump in progress */
+    LNX_NETLINK_SYNC_DONE               /* Cache synchronized */
+};
+
+static enum lnx_netlink_sync lnx_netlink_sync_state = LNX_NETLINK_SYNC_NONE;
+/* Events were lost during a dump, re-sync when done */
+static bool lnx_netlink_sync_again = false;
+/* Sequence number of the current dump request */
+static uint32_t lnx_netlink_sync_seq = 0;
+/* Netlink socket port id */
+static uint32_t lnx_netlink_portid = 0;
+
+static ds_key_cmp_t lnx_netlink_addr_cmp;
+static ds_key_cmp_t lnx_netlink_neigh_cmp;
+static ds_key_cmp_t lnx_netlink_route_cmp;
+
+/* Cache of interface addresses, struct lnx_netlink_addr */
+static ds_tree_t lnx_netlink_addr_cache = DS_TREE_INIT(
+        lnx_netlink_addr_cmp,
+        struct lnx_netlink_addr,
+        na_tnode);
+
+/* Cache of neighbors, struct lnx_netlink_neigh */
+static ds_tree_t lnx_netlink_neigh_cache = DS_TREE_INIT(
+        lnx_netlink_neigh_cmp,
+        struct lnx_netlink_neigh,
+        nn_tnode);
+
+/* Cache of routes, struct lnx_netlink_route */
+static ds_tree_t lnx_netlink_route_cache = DS_TREE_INIT(
+        lnx_netlink_route_cmp,
+        struct lnx_netlink_route,
+        nr_tnode);
+
 static bool lnx_netlink_global_init(void);
 static bool lnx_netlink_sock_open(void);
 static void lnx_netlink_sock_close(void);
@@ -72,6 +117,18 @@ static bool lnx_netlink_dispatch(uint64_t nl_event, const char *ifname);
 static void lnx_netlink_dispatch_fn(struct ev_loop *loop, ev_debounce *ev, int revent);
 /* Filter out unwanted netlink messages as they cause too many  updates */
 static bool lnx_netlink_weed_out(struct nlmsghdr *nh);
+/* Address, neighbor and route caches */
+static bool lnx_netlink_sync_start(void);
+static void lnx_netlink_sync_request(void);
+static void lnx_netlink_sync_next(struct nlmsghdr *nh);
+static bool lnx_netlink_dump_request(int type);
+static void lnx_netlink_cache_flush(int ifindex, const char *ifname);
+static void lnx_netlink_route_flush(int ifindex, int family);
+static void lnx_netlink_addr_update(struct nlmsghdr *nh);
+static void lnx_netlink_neigh_update(struct nlmsghdr *nh);
+static void lnx_netlink_route_update(struct nlmsghdr *nh);
+static void lnx_netlink_neigh_notify(struct lnx_netlink_neigh *nn, const char *ifname, bool remove);
+static void lnx_netlink_route_notify(struct lnx_netlink_route *nr, const char *ifname, bool remove);
 
 bool lnx_netlink_init(lnx_netlink_t *self, lnx_netlink_fn_t *fn)
 {
@@ -131,6 +188,16 @@ void lnx_netlink_set_ifname(lnx_netlink_t *self, const char *ifname)
     STRSCPY(self->nl_ifname, ifname);
 }
 
+void lnx_netlink_set_route_fn(lnx_netlink_t *self, lnx_netlink_route_update_fn_t *fn)
+{
+    self->nl_route_fn = fn;
+}
+
+void lnx_netlink_set_neigh_fn(lnx_netlink_t *self, lnx_netlink_neigh_update_fn_t *fn)
+{
+    self->nl_neigh_fn = fn;
+}
+
 /*
  * Global initialization
  */
@@ -172,6 +239,7 @@ bool lnx_netlink_global_init(void)
 bool lnx_netlink_sock_open(void)
 {
      struct sockaddr_nl nladdr;
+     socklen_t nladdr_len;
 
      if (lnx_netlink_sock >= 0) return true;
 
@@ -211,6 +279,20 @@ bool lnx_netlink_sock_open(void)
          goto error;
      }
 
+     nladdr_len = sizeof(nladdr);
+     if (getsockname(lnx_netlink_sock, (struct sockaddr *)&nladdr, &nladdr_len) != 0)
+     {
+         LOGE("netlink: Error retrieving NETLINK socket port id");
+         goto error;
+     }
+     lnx_netlink_portid = nladdr.nl_pid;
+
+     /* Populate the address, neighbor and route caches */
+     if (!lnx_netlink_sync_start())
+     {
+         LOG(WARN, "netlink: Error requesting address dump; netlink caches disabled.");
+     }
+
      /*
       * Initialize an start an I/O watcher
       */
@@ -247,6 +329,10 @@ void lnx_netlink_sock_close(void)
     LOG(NOTICE, "netlink: NETLINK socket closed.");
 
     lnx_netlink_sock = -1;
+
+    /* Without the socket the caches cannot be kept up-to-date */
+    lnx_netlink_sync_state = LNX_NETLINK_SYNC_NONE;
+    lnx_netlink_cache_flush(-1, NULL);
 }
 
 void lnx_netlink_sock_fn(struct ev_loop *loop, ev_io *w, int revent)
@@ -278,9 +364,10 @@ void lnx_netlink_sock_fn(struct ev_loop *loop, ev_io *w, int revent)
         /* The ENOBUFS error should be cleared by the next call to recv() */
         LOG(INFO, "netlink: ENOBUFS received. Netlink sockets may be under stress.");
         /*
-         * We lost an event, make sure to sync the state -- dispatch a global
-         * update event
+         * We lost an event, make sure to sync the state -- re-populate the
+         * caches and dispatch a global update event
          */
+        lnx_netlink_sync_request();
         lnx_netlink_dispatch(LNX_NETLINK_ALL, NULL);
         return;
     }
@@ -305,18 +392,51 @@ void lnx_netlink_sock_fn(struct ev_loop *loop, ev_io *w, int revent)
 
         switch (nl_msg->nlmsg_type)
         {
+            case NLMSG_DONE:
+            case NLMSG_ERROR:
+                lnx_netlink_sync_next(nl_msg);
+                break;
+
             case RTM_NEWLINK:
             case RTM_DELLINK:
             {
                 struct ifinfomsg *ifm = NLMSG_DATA(nl_msg);
+                struct rtattr *rta;
+                unsigned int rtalen;
 
                 pifname = if_indextoname(ifm->ifi_index, ifname);
+                if (pifname == NULL)
+                {
+                    /* The interface is already gone on RTM_DELLINK, use the name from the message */
+                    rtalen = IFLA_PAYLOAD(nl_msg);
+                    for (rta = IFLA_RTA(ifm); RTA_OK(rta, rtalen); rta = RTA_NEXT(rta, rtalen))
+                    {
+                        if (rta->rta_type != IFLA_IFNAME) continue;
+                        if (strscpy(ifname, RTA_DATA(rta), sizeof(ifname)) >= 0) pifname = ifname;
+                        break;
+                    }
+                }
+
                 if (pifname == NULL)
                 {
                     LOG(DEBUG, "netlink: Unable to resolve interface index %d (RTM_NEWLINK or RTM_DELLINK).",
                             ifm->ifi_index);
                 }
 
+                if (nl_msg->nlmsg_type == RTM_DELLINK)
+                {
+                    /* Addresses, neighbors and routes of a removed interface are gone as well */
+                    lnx_netlink_cache_flush(ifm->ifi_index, pifname);
+                }
+                else if (!(ifm->ifi_flags & IFF_UP))
+                {
+                    /*
+                     * The kernel silently removes IPv4 routes of an interface
+                     * that goes down -- no RTM_DELROUTE is sent
+                     */
+                    lnx_netlink_route_flush(ifm->ifi_index, AF_INET);
+                }
+
                 LOG(DEBUG, "netlink: LNX_NETLINK_LINK event on interface: %s", pifname == NULL ? "(null)" : pifname);
                 lnx_netlink_dispatch(LNX_NETLINK_LINK, pifname);
                 break;
@@ -327,6 +447,17 @@ void lnx_netlink_sock_fn(struct ev_loop *loop, ev_io *w, int revent)
             {
                 struct ifaddrmsg *ifa = NLMSG_DATA(nl_msg);
 
+                lnx_netlink_addr_update(nl_msg);
+
+                /*
+                 * Removing an IPv4 address may silently remove routes that
+                 * use it as the preferred source address; re-sync the caches
+                 */
+                if (nl_msg->nlmsg_type == RTM_DELADDR && ifa->ifa_family == AF_INET)
+                {
+                    lnx_netlink_sync_request();
+                }
+
                 pifname = if_indextoname(ifa->ifa_index, ifname);
                 if (pifname == NULL)
                 {
@@ -366,6 +497,8 @@ void lnx_netlink_sock_fn(struct ev_loop *loop, ev_io *w, int revent)
             {
                 struct ndmsg *ndm = NLMSG_DATA(nl_msg);
 
+                lnx_netlink_neigh_update(nl_msg);
+
                 pifname = if_indextoname(ndm->ndm_ifindex, ifname);
                 if (pifname == NULL)
                 {
@@ -405,6 +538,8 @@ void lnx_netlink_sock_fn(struct ev_loop *loop, ev_io *w, int revent)
             {
                 struct rtmsg *rtm = NLMSG_DATA(nl_msg);
 
+                lnx_netlink_route_update(nl_msg);
+
                 switch (rtm->rtm_family)
                 {
                     case AF_INET:
@@ -530,3 +665,717 @@ void lnx_netlink_dispatch_fn(struct ev_loop *loop, ev_debounce *ev, int revent)
 
     return;
 }
+
+/*
+ * ===========================================================================
+ *  Address, neighbor and route cache
+ * ===========================================================================
+ */
+
+/*
+ * Flush the caches and request a full dump of addresses, neighbors and
+ * routes; the dump replies are processed by lnx_netlink_sock_fn() as regular
+ * events
+ */
+bool lnx_netlink_sync_start(void)
+{
+    /* Listeners are not notified of the flush, they receive LNX_NETLINK_SYNC when done */
+    lnx_netlink_sync_state = LNX_NETLINK_SYNC_NONE;
+    lnx_netlink_sync_again = false;
+    lnx_netlink_cache_flush(-1, NULL);
+
+    if (!lnx_netlink_dump_request(RTM_GETADDR))
+    {
+        lnx_netlink_sync_state = LNX_NETLINK_SYNC_NONE;
+        return false;
+    }
+
+    lnx_netlink_sync_state = LNX_NETLINK_SYNC_ADDR;
+    return true;
+}
+
+/*
+ * Re-synchronize the caches; if a dump is already in progress, restart it
+ * when it completes
+ */
+void lnx_netlink_sync_request(void)
+{
+    switch (lnx_netlink_sync_state)
+    {
+        case LNX_NETLINK_SYNC_ADDR:
+        case LNX_NETLINK_SYNC_NEIGH:
+        case LNX_NETLINK_SYNC_ROUTE:
+            lnx_netlink_sync_again = true;
+            return;
+
+        default:
+            break;
+    }
+
+    if (lnx_netlink_sock < 0) return;
+
+    if (!lnx_netlink_sync_start())
+    {
+        LOG(WARN, "netlink: Error re-synchronizing netlink caches.");
+        lnx_netlink_dispatch(LNX_NETLINK_SYNC, NULL);
+    }
+}
+
+/*
+ * Handle the end of a dump (NLMSG_DONE or NLMSG_ERROR); only one dump can be
+ * in progress on a socket so the dumps are requested one after another:
+ * addresses, neighbors and routes
+ */
+void lnx_netlink_sync_next(struct nlmsghdr *nh)
+{
+    if (nh->nlmsg_seq != lnx_netlink_sync_seq || nh->nlmsg_pid != lnx_netlink_portid) return;
+
+    if (nh->nlmsg_type == NLMSG_ERROR)
+    {
+        struct nlmsgerr *err = NLMSG_DATA(nh);
+
+        LOG(WARN, "netlink: Dump request failed: %s (%d); netlink caches disabled.",
+                strerror(-err->error), -err->error);
+        lnx_netlink_sync_state = LNX_NETLINK_SYNC_NONE;
+        lnx_netlink_cache_flush(-1, NULL);
+        lnx_netlink_dispatch(LNX_NETLINK_SYNC, NULL);
+        return;
+    }
+
+    switch (lnx_netlink_sync_state)
+    {
+        case LNX_NETLINK_SYNC_ADDR:
+            if (!lnx_netlink_dump_request(RTM_GETNEIGH))
+            {
+                LOG(WARN, "netlink: Error requesting neighbor dump; netlink caches disabled.");
+                break;
+            }
+            lnx_netlink_sync_state = LNX_NETLINK_SYNC_NEIGH;
+            return;
+
+        case LNX_NETLINK_SYNC_NEIGH:
+            if (!lnx_netlink_dump_request(RTM_GETROUTE))
+            {
+                LOG(WARN, "netlink: Error requesting route dump; netlink caches disabled.");
+                break;
+            }
+            lnx_netlink_sync_state = LNX_NETLINK_SYNC_ROUTE;
+            return;
+
+        case LNX_NETLINK_SYNC_ROUTE:
+            if (lnx_netlink_sync_again)
+            {
+                if (lnx_netlink_sync_start()) return;
+                LOG(WARN, "netlink: Error re-synchronizing netlink caches.");
+                break;
+            }
+
+            LOG(INFO, "netlink: Address, neighbor and route cache synchronized.");
+
+            lnx_netlink_sync_state = LNX_NETLINK_SYNC_DONE;
+            /* Listeners may have used polling until now -- notify everyone */
+            lnx_netlink_dispatch(
+                    LNX_NETLINK_IP4ADDR | LNX_NETLINK_IP6ADDR |
+                    LNX_NETLINK_IP4NEIGH | LNX_NETLINK_IP6NEIGH |
+                    LNX_NETLINK_IP4ROUTE | LNX_NETLINK_IP6ROUTE |
+                    LNX_NETLINK_SYNC,
+                    NULL);
+            return;
+
+        default:
+            return;
+    }
+
+    lnx_netlink_sync_state = LNX_NETLINK_SYNC_NONE;
+    lnx_netlink_cache_flush(-1, NULL);
+    lnx_netlink_dispatch(LNX_NETLINK_SYNC, NULL);
+}
+
+bool lnx_netlink_dump_request(int type)
+{
+    struct
+    {
+        struct nlmsghdr     nh;
+        union
+        {
+            struct ifaddrmsg    ifa;
+            struct ndmsg        ndm;
+            struct rtmsg        rtm;
+        };
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_type = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++lnx_netlink_sync_seq;
+    /* AF_UNSPEC: dump both IPv4 and IPv6 */
+    switch (type)
+    {
+        case RTM_GETADDR:
+            req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+            req.ifa.ifa_family = AF_UNSPEC;
+            break;
+
+        case RTM_GETNEIGH:
+            req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ndm));
+            req.ndm.ndm_family = AF_UNSPEC;
+            break;
+
+        default:
+            req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.rtm));
+            req.rtm.rtm_family = AF_UNSPEC;
+            break;
+    }
+
+    if (send(lnx_netlink_sock, &req, req.nh.nlmsg_len, 0) < 0)
+    {
+        LOG(ERR, "netlink: Error sending dump request %d: %s", type, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Remove entries of interface @p ifindex from the caches, or all entries if
+ * @p ifindex is -1; @p ifname is used for notifications
+ */
+void lnx_netlink_cache_flush(int ifindex, const char *ifname)
+{
+    struct lnx_netlink_route *nr;
+    struct lnx_netlink_neigh *nn;
+    struct lnx_netlink_addr *na;
+    ds_tree_iter_t iter;
+
+    ds_tree_foreach_iter(&lnx_netlink_addr_cache, na, &iter)
+    {
+        if (ifindex >= 0 && na->na_ifindex != ifindex) continue;
+        ds_tree_iremove(&iter);
+        FREE(na);
+    }
+
+    ds_tree_foreach_iter(&lnx_netlink_neigh_cache, nn, &iter)
+    {
+        if (ifindex >= 0 && nn->nn_ifindex != ifindex) continue;
+        ds_tree_iremove(&iter);
+        lnx_netlink_neigh_notify(nn, ifname, true);
+        FREE(nn);
+    }
+
+    ds_tree_foreach_iter(&lnx_netlink_route_cache, nr, &iter)
+    {
+        if (ifindex >= 0 && nr->nr_ifindex != ifindex) continue;
+        ds_tree_iremove(&iter);
+        lnx_netlink_route_notify(nr, ifname, true);
+        FREE(nr);
+    }
+}
+
+/*
+ * Remove routes of family @p family on interface @p ifindex from the cache
+ */
+void lnx_netlink_route_flush(int ifindex, int family)
+{
+    struct lnx_netlink_route *nr;
+    ds_tree_iter_t iter;
+
+    ds_tree_foreach_iter(&lnx_netlink_route_cache, nr, &iter)
+    {
+        if (nr->nr_ifindex != ifindex || nr->nr_family != family) continue;
+        ds_tree_iremove(&iter);
+        lnx_netlink_route_notify(nr, NULL, true);
+        FREE(nr);
+    }
+}
+
+int lnx_netlink_addr_cmp(void *_a, void *_b)
+{
+    struct lnx_netlink_addr *a = _a;
+    struct lnx_netlink_addr *b = _b;
+    int rc;
+
+    if (a->na_ifindex != b->na_ifindex) return a->na_ifindex < b->na_ifindex ? -1 : 1;
+    if (a->na_family != b->na_family) return a->na_family < b->na_family ? -1 : 1;
+
+    rc = memcmp(&a->na_addr, &b->na_addr, sizeof(a->na_addr));
+    if (rc != 0) return rc;
+
+    return a->na_prefix - b->na_prefix;
+}
+
+int lnx_netlink_neigh_cmp(void *_a, void *_b)
+{
+    struct lnx_netlink_neigh *a = _a;
+    struct lnx_netlink_neigh *b = _b;
+
+    if (a->nn_ifindex != b->nn_ifindex) return a->nn_ifindex < b->nn_ifindex ? -1 : 1;
+    if (a->nn_family != b->nn_family) return a->nn_family < b->nn_family ? -1 : 1;
+
+    return memcmp(&a->nn_addr, &b->nn_addr, sizeof(a->nn_addr));
+}
+
+/*
+ * Routes are indexed by the attributes that identify a route in the kernel
+ * (table, destination, TOS and metric) and by the next-hop
+ */
+int lnx_netlink_route_cmp(void *_a, void *_b)
+{
+    struct lnx_netlink_route *a = _a;
+    struct lnx_netlink_route *b = _b;
+    int rc;
+
+    if (a->nr_family != b->nr_family) return a->nr_family < b->nr_family ? -1 : 1;
+    if (a->nr_table != b->nr_table) return a->nr_table < b->nr_table ? -1 : 1;
+
+    rc = memcmp(&a->nr_dst, &b->nr_dst, sizeof(a->nr_dst));
+    if (rc != 0) return rc;
+
+    if (a->nr_dst_len != b->nr_dst_len) return a->nr_dst_len < b->nr_dst_len ? -1 : 1;
+    if (a->nr_tos != b->nr_tos) return a->nr_tos < b->nr_tos ? -1 : 1;
+    if (a->nr_metric != b->nr_metric) return a->nr_metric < b->nr_metric ? -1 : 1;
+    if (a->nr_ifindex != b->nr_ifindex) return a->nr_ifindex < b->nr_ifindex ? -1 : 1;
+    if (a->nr_gw_valid != b->nr_gw_valid) return a->nr_gw_valid ? 1 : -1;
+
+    return memcmp(&a->nr_gw, &b->nr_gw, sizeof(a->nr_gw));
+}
+
+/*
+ * Returns true if listener @p nl should receive incremental updates for
+ * @p event on interface @p ifname
+ */
+static bool lnx_netlink_listener_match(lnx_netlink_t *nl, uint64_t event, const char *ifname)
+{
+    if ((nl->nl_events & event) == 0) return false;
+    if (nl->nl_ifname[0] == '\0') return true;
+
+    return ifname != NULL && strcmp(ifname, nl->nl_ifname) == 0;
+}
+
+/*
+ * Notify listeners of a neighbor cache change; listeners are notified only
+ * if the cache is synchronized
+ */
+void lnx_netlink_neigh_notify(struct lnx_netlink_neigh *nn, const char *ifname, bool remove)
+{
+    char buf[IF_NAMESIZE];
+    lnx_netlink_t *nl;
+    uint64_t event;
+
+    if (lnx_netlink_sync_state != LNX_NETLINK_SYNC_DONE) return;
+
+    event = (nn->nn_family == AF_INET) ? LNX_NETLINK_IP4NEIGH : LNX_NETLINK_IP6NEIGH;
+    if (ifname == NULL) ifname = if_indextoname(nn->nn_ifindex, buf);
+
+    ds_dlist_foreach(&lnx_netlink_list, nl)
+    {
+        if (nl->nl_neigh_fn == NULL) continue;
+        if (!lnx_netlink_listener_match(nl, event, ifname)) continue;
+        nl->nl_neigh_fn(nl, nn, remove);
+    }
+}
+
+/*
+ * Notify listeners of a route cache change
+ */
+void lnx_netlink_route_notify(struct lnx_netlink_route *nr, const char *ifname, bool remove)
+{
+    char buf[IF_NAMESIZE];
+    lnx_netlink_t *nl;
+    uint64_t event;
+
+    if (lnx_netlink_sync_state != LNX_NETLINK_SYNC_DONE) return;
+
+    event = (nr->nr_family == AF_INET) ? LNX_NETLINK_IP4ROUTE : LNX_NETLINK_IP6ROUTE;
+    if (ifname == NULL) ifname = if_indextoname(nr->nr_ifindex, buf);
+
+    ds_dlist_foreach(&lnx_netlink_list, nl)
+    {
+        if (nl->nl_route_fn == NULL) continue;
+        if (!lnx_netlink_listener_match(nl, event, ifname)) continue;
+        nl->nl_route_fn(nl, nr, remove);
+    }
+}
+
+/*
+ * Process a RTM_NEWADDR or RTM_DELADDR message
+ */
+void lnx_netlink_addr_update(struct nlmsghdr *nh)
+{
+    struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+    struct ifa_cacheinfo *ci = NULL;
+    struct lnx_netlink_addr key;
+    struct lnx_netlink_addr *na;
+    struct rtattr *rta_address = NULL;
+    struct rtattr *rta_local = NULL;
+    struct rtattr *rta;
+    unsigned int rtalen;
+    size_t alen;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa))) return;
+
+    switch (ifa->ifa_family)
+    {
+        case AF_INET:
+            alen = sizeof(key.na_addr.ip4);
+            break;
+
+        case AF_INET6:
+            alen = sizeof(key.na_addr.ip6);
+            break;
+
+        default:
+            return;
+    }
+
+    rtalen = IFA_PAYLOAD(nh);
+    for (rta = IFA_RTA(ifa); RTA_OK(rta, rtalen); rta = RTA_NEXT(rta, rtalen))
+    {
+        switch (rta->rta_type)
+        {
+            case IFA_ADDRESS:
+                rta_address = rta;
+                break;
+
+            case IFA_LOCAL:
+                rta_local = rta;
+                break;
+
+            case IFA_CACHEINFO:
+                if (RTA_PAYLOAD(rta) >= sizeof(*ci)) ci = RTA_DATA(rta);
+                break;
+        }
+    }
+
+    /* IFA_ADDRESS is the peer address on point-to-point links; prefer IFA_LOCAL */
+    if (rta_local != NULL) rta_address = rta_local;
+    if (rta_address == NULL || RTA_PAYLOAD(rta_address) < alen) return;
+
+    memset(&key, 0, sizeof(key));
+    key.na_ifindex = ifa->ifa_index;
+    key.na_family = ifa->ifa_family;
+    memcpy(&key.na_addr, RTA_DATA(rta_address), alen);
+    key.na_prefix = ifa->ifa_prefixlen;
+
+    na = ds_tree_find(&lnx_netlink_addr_cache, &key);
+    if (nh->nlmsg_type == RTM_DELADDR)
+    {
+        if (na == NULL) return;
+        ds_tree_remove(&lnx_netlink_addr_cache, na);
+        FREE(na);
+        return;
+    }
+
+    if (na == NULL)
+    {
+        na = MALLOC(sizeof(*na));
+        *na = key;
+        ds_tree_insert(&lnx_netlink_addr_cache, na, na);
+    }
+
+    na->na_valid_lft = (ci != NULL) ? ci->ifa_valid : UINT32_MAX;
+    na->na_pref_lft = (ci != NULL) ? ci->ifa_prefered : UINT32_MAX;
+    na->na_tstamp = clock_mono_double();
+}
+
+/*
+ * Process a RTM_NEWNEIGH or RTM_DELNEIGH message
+ */
+void lnx_netlink_neigh_update(struct nlmsghdr *nh)
+{
+    struct ndmsg *ndm = NLMSG_DATA(nh);
+    struct lnx_netlink_neigh key;
+    struct lnx_netlink_neigh *nn;
+    struct rtattr *rta_lladdr = NULL;
+    struct rtattr *rta_dst = NULL;
+    struct rtattr *rta;
+    unsigned int rtalen;
+    bool valid;
+    size_t alen;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ndm))) return;
+
+    switch (ndm->ndm_family)
+    {
+        case AF_INET:
+            alen = sizeof(key.nn_addr.ip4);
+            break;
+
+        case AF_INET6:
+            alen = sizeof(key.nn_addr.ip6);
+            break;
+
+        default:
+            return;
+    }
+
+    rtalen = NLMSG_PAYLOAD(nh, sizeof(*ndm));
+    for (rta = (void *)((uint8_t *)ndm + NLMSG_ALIGN(sizeof(*ndm))); RTA_OK(rta, rtalen); rta = RTA_NEXT(rta, rtalen))
+    {
+        switch (rta->rta_type)
+        {
+            case NDA_DST:
+                rta_dst = rta;
+                break;
+
+            case NDA_LLADDR:
+                rta_lladdr = rta;
+                break;
+        }
+    }
+
+    if (rta_dst == NULL || RTA_PAYLOAD(rta_dst) < alen) return;
+
+    memset(&key, 0, sizeof(key));
+    key.nn_ifindex = ndm->ndm_ifindex;
+    key.nn_family = ndm->ndm_family;
+    memcpy(&key.nn_addr, RTA_DATA(rta_dst), alen);
+
+    /*
+     * Keep only entries with a resolved MAC address; FAILED and INCOMPLETE
+     * entries are treated as deleted
+     */
+    valid = nh->nlmsg_type == RTM_NEWNEIGH &&
+            rta_lladdr != NULL &&
+            RTA_PAYLOAD(rta_lladdr) == sizeof(key.nn_lladdr) &&
+            !(ndm->ndm_state & (NUD_FAILED | NUD_INCOMPLETE));
+
+    nn = ds_tree_find(&lnx_netlink_neigh_cache, &key);
+    if (!valid)
+    {
+        if (nn == NULL) return;
+        ds_tree_remove(&lnx_netlink_neigh_cache, nn);
+        lnx_netlink_neigh_notify(nn, NULL, true);
+        FREE(nn);
+        return;
+    }
+
+    if (nn == NULL)
+    {
+        nn = MALLOC(sizeof(*nn));
+        *nn = key;
+        ds_tree_insert(&lnx_netlink_neigh_cache, nn, nn);
+    }
+    /* Reachability state changes are frequent, notify only of MAC address changes */
+    else if (memcmp(nn->nn_lladdr, RTA_DATA(rta_lladdr), sizeof(nn->nn_lladdr)) == 0)
+    {
+        nn->nn_state = ndm->ndm_state;
+        return;
+    }
+
+    memcpy(nn->nn_lladdr, RTA_DATA(rta_lladdr), sizeof(nn->nn_lladdr));
+    nn->nn_state = ndm->ndm_state;
+    lnx_netlink_neigh_notify(nn, NULL, false);
+}
+
+/*
+ * Process a RTM_NEWROUTE or RTM_DELROUTE message
+ */
+void lnx_netlink_route_update(struct nlmsghdr *nh)
+{
+    struct rtmsg *rtm = NLMSG_DATA(nh);
+    struct lnx_netlink_route key;
+    struct lnx_netlink_route *nr;
+    struct rtattr *rta_gateway = NULL;
+    struct rtattr *rta_dst = NULL;
+    struct rtattr *rta;
+    ds_tree_iter_t iter;
+    unsigned int rtalen;
+    size_t alen;
+
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm))) return;
+
+    switch (rtm->rtm_family)
+    {
+        case AF_INET:
+            alen = sizeof(key.nr_dst.ip4);
+            break;
+
+        case AF_INET6:
+            alen = sizeof(key.nr_dst.ip6);
+            break;
+
+        default:
+            return;
+    }
+
+    if (rtm->rtm_type != RTN_UNICAST || (rtm->rtm_flags & RTM_F_CLONED)) return;
+
+    memset(&key, 0, sizeof(key));
+    key.nr_family = rtm->rtm_family;
+    key.nr_table = rtm->rtm_table;
+    key.nr_dst_len = rtm->rtm_dst_len;
+    key.nr_tos = rtm->rtm_tos;
+
+    rtalen = RTM_PAYLOAD(nh);
+    for (rta = RTM_RTA(rtm); RTA_OK(rta, rtalen); rta = RTA_NEXT(rta, rtalen))
+    {
+        switch (rta->rta_type)
+        {
+            case RTA_DST:
+                rta_dst = rta;
+                break;
+
+            case RTA_GATEWAY:
+                rta_gateway = rta;
+                break;
+
+            case RTA_OIF:
+                if (RTA_PAYLOAD(rta) >= sizeof(uint32_t)) key.nr_ifindex = *(uint32_t *)RTA_DATA(rta);
+                break;
+
+            case RTA_PRIORITY:
+                if (RTA_PAYLOAD(rta) >= sizeof(uint32_t)) key.nr_metric = *(uint32_t *)RTA_DATA(rta);
+                break;
+
+            case RTA_TABLE:
+                if (RTA_PAYLOAD(rta) >= sizeof(uint32_t)) key.nr_table = *(uint32_t *)RTA_DATA(rta);
+                break;
+
+            case RTA_MULTIPATH:
+            {
+                /* Use the first next-hop */
+                struct rtnexthop *rtnh = RTA_DATA(rta);
+                struct rtattr *nrta;
+                unsigned int nrtalen;
+
+                if (RTA_PAYLOAD(rta) < sizeof(*rtnh) || rtnh->rtnh_len < sizeof(*rtnh)) break;
+                if (rtnh->rtnh_len > RTA_PAYLOAD(rta)) break;
+
+                key.nr_ifindex = rtnh->rtnh_ifindex;
+                nrtalen = rtnh->rtnh_len - RTNH_LENGTH(0);
+                for (nrta = RTNH_DATA(rtnh); RTA_OK(nrta, nrtalen); nrta = RTA_NEXT(nrta, nrtalen))
+                {
+                    if (nrta->rta_type == RTA_GATEWAY) rta_gateway = nrta;
+                }
+                break;
+            }
+        }
+    }
+
+    if (key.nr_table == RT_TABLE_LOCAL || key.nr_ifindex <= 0) return;
+
+    if (rta_dst != NULL)
+    {
+        if (RTA_PAYLOAD(rta_dst) < alen) return;
+        memcpy(&key.nr_dst, RTA_DATA(rta_dst), alen);
+    }
+
+    if (rta_gateway != NULL && RTA_PAYLOAD(rta_gateway) >= alen)
+    {
+        key.nr_gw_valid = true;
+        memcpy(&key.nr_gw, RTA_DATA(rta_gateway), alen);
+    }
+
+    nr = ds_tree_find(&lnx_netlink_route_cache, &key);
+    if (nh->nlmsg_type == RTM_DELROUTE)
+    {
+        if (nr == NULL) return;
+        ds_tree_remove(&lnx_netlink_route_cache, nr);
+        lnx_netlink_route_notify(nr, NULL, true);
+        FREE(nr);
+        return;
+    }
+
+    if (nr != NULL) return;
+
+    /*
+     * A replaced route keeps its identity (table, destination, TOS and metric)
+     * but the next-hop may have changed; the old entry is not reported
+     */
+    if (nh->nlmsg_flags & NLM_F_REPLACE)
+    {
+        ds_tree_foreach_iter(&lnx_netlink_route_cache, nr, &iter)
+        {
+            if (nr->nr_family != key.nr_family || nr->nr_table != key.nr_table) continue;
+            if (nr->nr_dst_len != key.nr_dst_len || nr->nr_tos != key.nr_tos) continue;
+            if (nr->nr_metric != key.nr_metric) continue;
+            if (memcmp(&nr->nr_dst, &key.nr_dst, sizeof(nr->nr_dst)) != 0) continue;
+
+            ds_tree_iremove(&iter);
+            lnx_netlink_route_notify(nr, NULL, true);
+            FREE(nr);
+        }
+    }
+
+    nr = MALLOC(sizeof(*nr));
+    *nr = key;
+    ds_tree_insert(&lnx_netlink_route_cache, nr, nr);
+    lnx_netlink_route_notify(nr, NULL, false);
+}
+
+bool lnx_netlink_addr_foreach(const char *ifname, int family, lnx_netlink_addr_fn_t *fn, void *ctx)
+{
+    struct lnx_netlink_addr *na;
+    int ifindex;
+
+    if (lnx_netlink_sync_state != LNX_NETLINK_SYNC_DONE) return false;
+
+    /* A non-existent interface has no addresses */
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) return true;
+
+    ds_tree_foreach(&lnx_netlink_addr_cache, na)
+    {
+        if (na->na_ifindex != ifindex || na->na_family != family) continue;
+        fn(ctx, na);
+    }
+
+    return true;
+}
+
+bool lnx_netlink_neigh_foreach(const char *ifname, int family, lnx_netlink_neigh_fn_t *fn, void *ctx)
+{
+    struct lnx_netlink_neigh *nn;
+    int ifindex;
+
+    if (lnx_netlink_sync_state != LNX_NETLINK_SYNC_DONE) return false;
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) return true;
+
+    ds_tree_foreach(&lnx_netlink_neigh_cache, nn)
+    {
+        if (nn->nn_ifindex != ifindex || nn->nn_family != family) continue;
+        fn(ctx, nn);
+    }
+
+    return true;
+}
+
+bool lnx_netlink_route_foreach(const char *ifname, int family, lnx_netlink_route_fn_t *fn, void *ctx)
+{
+    struct lnx_netlink_route *nr;
+    int ifindex;
+
+    if (lnx_netlink_sync_state != LNX_NETLINK_SYNC_DONE) return false;
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) return true;
+
+    ds_tree_foreach(&lnx_netlink_route_cache, nr)
+    {
+        if (nr->nr_ifindex != ifindex || nr->nr_family != family) continue;
+        fn(ctx, nr);
+    }
+
+    return true;
+}
+
+const struct lnx_netlink_neigh *lnx_netlink_neigh_find(int ifindex, int family, const void *addr)
+{
+    struct lnx_netlink_neigh key;
+
+    if (lnx_netlink_sync_state != LNX_NETLINK_SYNC_DONE) return NULL;
+
+    memset(&key, 0, sizeof(key));
+    key.nn_ifindex = ifindex;
+    key.nn_family = family;
+    memcpy(&key.nn_addr, addr, family == AF_INET ? sizeof(key.nn_addr.ip4) : sizeof(key.nn_addr.ip6));
+
+    return ds_tree_find(&lnx_netlink_neigh_cache, &key);
+}
+
+bool lnx_netlink_cache_synced(void)
+{
+    return lnx_netlink_sync_state == LNX_NETLINK_SYNC_DONE;
+}
@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <netinet/in.h>
 
 #include "const.h"
 #include "ds_tree.h"
@@ -41,22 +42,110 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define LNX_NETLINK_IP6ROUTE    (1 << 4)    /* IPv6 route events */
 #define LNX_NETLINK_IP4NEIGH    (1 << 5)    /* IPv4 neighbor report */
 #define LNX_NETLINK_IP6NEIGH    (1 << 6)    /* IPv6 neighbor report */
+#define LNX_NETLINK_SYNC        (1 << 7)    /* Caches were re-synchronized or became unavailable */
 #define LNX_NETLINK_ALL         UINT64_MAX
 
 typedef struct lnx_netlink lnx_netlink_t;
 
+struct lnx_netlink_route;
+struct lnx_netlink_neigh;
+
 typedef void lnx_netlink_fn_t(lnx_netlink_t *nl, uint64_t event, const char *ifname);
 
+/*
+ * Incremental cache update callbacks; these are invoked immediately (without
+ * debouncing) each time a route or neighbor cache entry is added or removed
+ */
+typedef void lnx_netlink_route_update_fn_t(
+        lnx_netlink_t *nl,
+        const struct lnx_netlink_route *route,
+        bool remove);
+
+typedef void lnx_netlink_neigh_update_fn_t(
+        lnx_netlink_t *nl,
+        const struct lnx_netlink_neigh *neigh,
+        bool remove);
+
 struct lnx_netlink
 {
-    bool                nl_active;                  /* True if this object has been started */
-    uint64_t            nl_pending;                 /* List of pending events */
-    uint64_t            nl_events;                  /* Subscribed events */
-    char                nl_ifname[C_IFNAME_LEN];    /* Filter events for this interface */
-    lnx_netlink_fn_t   *nl_fn;                      /* Callback */
-    ds_tree_node_t      nl_tnode;
+    bool                            nl_active;                  /* True if this object has been started */
+    uint64_t                        nl_pending;                 /* List of pending events */
+    uint64_t                        nl_events;                  /* Subscribed events */
+    char                            nl_ifname[C_IFNAME_LEN];    /* Filter events for this interface */
+    lnx_netlink_fn_t               *nl_fn;                      /* Callback */
+    lnx_netlink_route_update_fn_t  *nl_route_fn;                /* Route cache update callback */
+    lnx_netlink_neigh_update_fn_t  *nl_neigh_fn;                /* Neighbor cache update callback */
+    ds_tree_node_t                  nl_tnode;
 };
 
+/*
+ * Interface address, as reported by RTM_NEWADDR
+ */
+struct lnx_netlink_addr
+{
+    int                 na_ifindex;                 /* Interface index */
+    int                 na_family;                  /* AF_INET or AF_INET6 */
+    union
+    {
+        struct in_addr  ip4;
+        struct in6_addr ip6;
+    }                   na_addr;                    /* IPv4 or IPv6 address */
+    int                 na_prefix;                  /* Prefix length */
+    uint32_t            na_valid_lft;               /* Valid lifetime in seconds, UINT32_MAX if infinite */
+    uint32_t            na_pref_lft;                /* Preferred lifetime in seconds, UINT32_MAX if infinite */
+    double              na_tstamp;                  /* Time when the lifetimes were reported (monotonic) */
+    ds_tree_node_t      na_tnode;
+};
+
+/*
+ * Neighbor table entry with a resolved link layer address, as reported by
+ * RTM_NEWNEIGH
+ */
+struct lnx_netlink_neigh
+{
+    int                 nn_ifindex;                 /* Interface index */
+    int                 nn_family;                  /* AF_INET or AF_INET6 */
+    union
+    {
+        struct in_addr  ip4;
+        struct in6_addr ip6;
+    }                   nn_addr;                    /* IPv4 or IPv6 address */
+    uint8_t             nn_lladdr[6];               /* MAC address */
+    uint16_t            nn_state;                   /* NUD_* state */
+    ds_tree_node_t      nn_tnode;
+};
+
+/*
+ * Unicast routing table entry, as reported by RTM_NEWROUTE. Routes in the
+ * local table and cloned routes are not tracked. For multipath routes only
+ * the first next-hop is recorded (this matches /proc/net/route).
+ */
+struct lnx_netlink_route
+{
+    int                 nr_ifindex;                 /* Output interface index */
+    int                 nr_family;                  /* AF_INET or AF_INET6 */
+    uint32_t            nr_table;                   /* Routing table id */
+    union
+    {
+        struct in_addr  ip4;
+        struct in6_addr ip6;
+    }                   nr_dst;                     /* Destination address */
+    int                 nr_dst_len;                 /* Destination prefix length */
+    int                 nr_tos;                     /* Type of service */
+    uint32_t            nr_metric;                  /* Route priority (metric) */
+    bool                nr_gw_valid;                /* True if the route has a gateway */
+    union
+    {
+        struct in_addr  ip4;
+        struct in6_addr ip6;
+    }                   nr_gw;                      /* Gateway address */
+    ds_tree_node_t      nr_tnode;
+};
+
+typedef void lnx_netlink_addr_fn_t(void *ctx, const struct lnx_netlink_addr *addr);
+typedef void lnx_netlink_neigh_fn_t(void *ctx, const struct lnx_netlink_neigh *neigh);
+typedef void lnx_netlink_route_fn_t(void *ctx, const struct lnx_netlink_route *route);
+
 /**
  * Initialize lnx_netlink_t structure. Each time a NETLINK event is received,
  * the fn callback is invoked.
@@ -76,6 +165,23 @@ void lnx_netlink_set_events(lnx_netlink_t *self, uint64_t events);
  */
 void lnx_netlink_set_ifname(lnx_netlink_t *self, const char *ifname);
 
+/**
+ * Set the incremental route cache update callback. The callback receives
+ * changes to routes of the subscribed families (LNX_NETLINK_IP4ROUTE,
+ * LNX_NETLINK_IP6ROUTE) on the subscribed interface, but only while the
+ * cache is synchronized; listeners should subscribe to LNX_NETLINK_SYNC and
+ * do a full refresh with lnx_netlink_route_foreach() when that event is
+ * received.
+ */
+void lnx_netlink_set_route_fn(lnx_netlink_t *self, lnx_netlink_route_update_fn_t *fn);
+
+/**
+ * Set the incremental neighbor cache update callback. The callback is
+ * invoked when a neighbor entry is added, removed or its link layer address
+ * changes. The same rules as for lnx_netlink_set_route_fn() apply.
+ */
+void lnx_netlink_set_neigh_fn(lnx_netlink_t *self, lnx_netlink_neigh_update_fn_t *fn);
+
 /**
  * Start receiving events
  */
@@ -86,4 +192,43 @@ bool lnx_netlink_start(lnx_netlink_t *self);
  */
 bool lnx_netlink_stop(lnx_netlink_t *self);
 
+/**
+ * Traverse the cached list of addresses of family @p family (AF_INET or
+ * AF_INET6) on interface @p ifname.
+ *
+ * The address and neighbor caches are populated by a full dump when the
+ * netlink socket is opened and are kept up-to-date by netlink events
+ * afterwards.
+ *
+ * These functions return false if the cache is not synchronized with the
+ * kernel (the netlink socket is not available or the initial dump is still
+ * in progress); in this case the caller should fall back to polling.
+ */
+bool lnx_netlink_addr_foreach(const char *ifname, int family, lnx_netlink_addr_fn_t *fn, void *ctx);
+
+/**
+ * Traverse the cached neighbor table of family @p family on interface
+ * @p ifname. Only entries with a valid link layer address are reported.
+ */
+bool lnx_netlink_neigh_foreach(const char *ifname, int family, lnx_netlink_neigh_fn_t *fn, void *ctx);
+
+/**
+ * Traverse the cached routing table of family @p family on interface
+ * @p ifname (all routing tables except the local table are reported).
+ */
+bool lnx_netlink_route_foreach(const char *ifname, int family, lnx_netlink_route_fn_t *fn, void *ctx);
+
+/**
+ * Lookup a neighbor cache entry; @p addr is a struct in_addr or a struct
+ * in6_addr depending on @p family. Returns NULL if the entry doesn't exist
+ * or if the cache is not synchronized.
+ */
+const struct lnx_netlink_neigh *lnx_netlink_neigh_find(int ifindex, int family, const void *addr);
+
+/**
+ * Return true if the address, neighbor and route caches are synchronized
+ * with the kernel
+ */
+bool lnx_netlink_cache_synced(void);
+
 #endif /* LNX_NETLINK_H_INCLUDED */
@@ -37,6 +37,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  *  Each queue also adds its own `tc filter` to forward any fw marks to the
  *  specific queue.
+ *
+ *  When CONFIG_OSN_LINUX_QOS_NETLINK is enabled, the configuration is applied
+ *  over rtnetlink instead (see lnx_qos_netlink.c) and only the differences
+ *  from the current configuration are applied. The `tc` commands are used
+ *  as a fallback and for options that are not supported by the rtnetlink
+ *  backend (the "shared" queue option).
  * ===========================================================================
  */
 #include <net/if.h>
@@ -46,6 +52,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "const.h"
 #include "ds_tree.h"
+#include "evx.h"
 #include "execsh.h"
 #include "log.h"
 #include "util.h"
@@ -54,8 +61,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "lnx_qos.h"
 
 #define LNX_QOS_ID_MAX          1024            /**< Maximum ID as allocated by lnx_qos_begin() */
-#define LNX_QOS_MARK_BASE       0x44000000      /**< Base mask for calculating the fwmark. The fwmark is calculated
-                                                     from the lnx_qos_t ID, the qos ID and the queue ID */
 /*
  * Structure representing an allocated Queue ID
  *
@@ -79,6 +84,18 @@ static ds_tree_t lnx_qos_tag_map = DS_TREE_INIT(ds_str_cmp, struct lnx_qos_qid,
 /* Map between queue ID and their respective objects */
 static ds_tree_t lnx_qos_qid_map = DS_TREE_INIT(ds_int_cmp, struct lnx_qos_qid, qi_qid_tnode);
 
+/*
+ * Interfaces with a pending QoS reset, see lnx_qos_fini()
+ */
+struct lnx_qos_reset
+{
+    char            qr_ifname[C_IFNAME_LEN];
+    ds_tree_node_t  qr_tnode;
+};
+
+static ds_tree_t lnx_qos_reset_list = DS_TREE_INIT(ds_str_cmp, struct lnx_qos_reset, qr_tnode);
+static ev_timer lnx_qos_reset_timer;
+
 /*
  * "tc qdisc del" may return an error if there's no qdisc configured on the
  * interface. Ignore errors.
@@ -127,6 +144,10 @@ static char lnx_qos_qdisc_add[] = _S(
 
 
 static bool lnx_qos_reconfigure(lnx_qos_t *self);
+static bool lnx_qos_reset(const char *ifname);
+static void lnx_qos_reset_defer(const char *ifname);
+static void lnx_qos_reset_cancel(const char *ifname);
+static void lnx_qos_reset_fn(struct ev_loop *loop, ev_timer *w, int revent);
 static int lnx_qos_id_get(const char *tag);
 static void lnx_qos_id_put(int qid);
 static lnx_netlink_fn_t lnx_qos_netlink_fn;
@@ -150,16 +171,21 @@ bool lnx_qos_init(lnx_qos_t *self, const char *ifname)
 
 void lnx_qos_fini(lnx_qos_t *self)
 {
-    int rc;
     struct lnx_qos_queue *qp;
 
     lnx_netlink_fini(&self->lq_netlink);
 
-    LOG(INFO, "qos: %s: Resetting QoS.", self->lq_ifname);
-    rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_qos_qdisc_reset, self->lq_ifname);
-    if (rc != 0)
+    if (kconfig_enabled(CONFIG_OSN_LINUX_QOS_NETLINK))
+    {
+        /*
+         * A new configuration is usually applied right after the old one is
+         * removed; defer the reset so the new configuration can be applied
+         * incrementally, without disrupting traffic
+         */
+        lnx_qos_reset_defer(self->lq_ifname);
+    }
+    else if (!lnx_qos_reset(self->lq_ifname))
     {
-        LOG(ERR, "qos: %s: Error resetting QoS.", self->lq_ifname);
         return;
     }
 
@@ -180,6 +206,9 @@ bool lnx_qos_apply(lnx_qos_t *self)
         return false;
     }
 
+    /* The previous configuration of this interface is replaced, not removed */
+    lnx_qos_reset_cancel(self->lq_ifname);
+
     /* Restart netlink monitoring */
     lnx_netlink_stop(&self->lq_netlink);
     self->lq_ifindex = 0;
@@ -297,12 +326,27 @@ bool lnx_qos_reconfigure(lnx_qos_t *self)
     uint32_t mark;
     int rc;
 
+#if defined(CONFIG_OSN_LINUX_QOS_NETLINK)
+    /* The "shared" option is a tc extension, it cannot be configured over rtnetlink */
+    for (qp = self->lq_queue; qp < self->lq_queue_e; qp++)
+    {
+        if (qp->qq_shared != NULL) break;
+    }
+
+    if (qp >= self->lq_queue_e)
+    {
+        LOG(INFO, "qos: %s: Updating QoS configuration.", self->lq_ifname);
+        if (lnx_qos_nl_apply(self)) return true;
+
+        LOG(WARN, "qos: %s: Error applying QoS configuration over netlink, re-initializing.",
+                self->lq_ifname);
+    }
+#endif
+
     LOG(INFO, "qos: %s: Initializing QoS configuration.", self->lq_ifname);
 
-    rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_qos_qdisc_reset, self->lq_ifname);
-    if (rc != 0)
+    if (!lnx_qos_reset(self->lq_ifname))
     {
-        LOG(ERR, "qos: %s: Error resetting QoS configuration.", self->lq_ifname);
         return false;
     }
 
@@ -348,6 +392,81 @@ bool lnx_qos_reconfigure(lnx_qos_t *self)
     return true;
 }
 
+/*
+ * Remove the QoS configuration from interface @p ifname
+ */
+bool lnx_qos_reset(const char *ifname)
+{
+    int rc;
+
+    LOG(INFO, "qos: %s: Resetting QoS.", ifname);
+
+#if defined(CONFIG_OSN_LINUX_QOS_NETLINK)
+    if (lnx_qos_nl_reset(ifname)) return true;
+#endif
+
+    rc = execsh_log(LOG_SEVERITY_DEBUG, lnx_qos_qdisc_reset, ifname);
+    if (rc != 0)
+    {
+        LOG(ERR, "qos: %s: Error resetting QoS.", ifname);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Schedule a QoS reset of interface @p ifname; the reset is executed on the
+ * next event loop iteration unless a new configuration is applied to the
+ * same interface before that
+ */
+void lnx_qos_reset_defer(const char *ifname)
+{
+    struct lnx_qos_reset *qr;
+
+    if (ds_tree_find(&lnx_qos_reset_list, (void *)ifname) != NULL) return;
+
+    qr = CALLOC(1, sizeof(*qr));
+    STRSCPY(qr->qr_ifname, ifname);
+    ds_tree_insert(&lnx_qos_reset_list, qr, qr->qr_ifname);
+
+    if (!ev_is_active(&lnx_qos_reset_timer))
+    {
+        ev_timer_init(&lnx_qos_reset_timer, lnx_qos_reset_fn, 0.0, 0.0);
+        ev_timer_start(EV_DEFAULT, &lnx_qos_reset_timer);
+    }
+}
+
+void lnx_qos_reset_cancel(const char *ifname)
+{
+    struct lnx_qos_reset *qr;
+
+    qr = ds_tree_find(&lnx_qos_reset_list, (void *)ifname);
+    if (qr == NULL) return;
+
+    LOG(DEBUG, "qos: %s: Configuration replaced, skipping QoS reset.", ifname);
+
+    ds_tree_remove(&lnx_qos_reset_list, qr);
+    FREE(qr);
+}
+
+void lnx_qos_reset_fn(struct ev_loop *loop, ev_timer *w, int revent)
+{
+    (void)loop;
+    (void)w;
+    (void)revent;
+
+    struct lnx_qos_reset *qr;
+    ds_tree_iter_t iter;
+
+    ds_tree_foreach_iter(&lnx_qos_reset_list, qr, &iter)
+    {
+        ds_tree_iremove(&iter);
+        (void)lnx_qos_reset(qr->qr_ifname);
+        FREE(qr);
+    }
+}
+
 int lnx_qos_id_get(const char *tag)
 {
     struct lnx_qos_qid *qi;
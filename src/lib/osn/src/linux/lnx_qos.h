@@ -28,9 +28,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define LNX_QOS_H_INCLUDED
 
 #include "const.h"
+#include "kconfig.h"
 #include "lnx_netlink.h"
 #include "osn_qos.h"
 
+#define LNX_QOS_MARK_BASE       0x44000000      /**< Base mask for calculating the fwmark. The fwmark is calculated
+                                                     from the lnx_qos_t ID, the qos ID and the queue ID */
+
 typedef struct lnx_qos lnx_qos_t;
 
 /* Single Queue instance */
@@ -71,4 +75,12 @@ bool lnx_qos_queue_begin(
 
 bool lnx_qos_queue_end(lnx_qos_t *self);
 
+#if defined(CONFIG_OSN_LINUX_QOS_NETLINK)
+/*
+ * rtnetlink backend, private to lnx_qos (lnx_qos_netlink.c)
+ */
+bool lnx_qos_nl_apply(lnx_qos_t *self);
+bool lnx_qos_nl_reset(const char *ifname);
+#endif
+
 #endif /* LNX_QOS_H_INCLUDED */
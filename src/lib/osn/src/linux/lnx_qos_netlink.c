@@ -0,0 +1,700 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * ===========================================================================
+ *  Linux QoS module -- rtnetlink backend
+ *
+ *  This is the rtnetlink (tc) backend of lnx_qos. It builds the same
+ *  configuration as the tc command lines in lnx_qos.c:
+ *
+ *      - HTB root qdisc (handle 1:) with the default class 1:fffe
+ *      - a HTB class (1:QID) and a fq_codel leaf qdisc for each queue
+ *      - a fw filter per queue that forwards the queue fwmark to its class
+ *
+ *  Instead of resetting the root qdisc and re-creating everything, the
+ *  current configuration is dumped from the kernel and only the differences
+ *  are applied. All changes are sent in a single batch of netlink messages.
+ * ===========================================================================
+ */
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/pkt_cls.h>
+#include <linux/pkt_sched.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <libmnl/libmnl.h>
+
+#include "ds_tree.h"
+#include "log.h"
+#include "memutil.h"
+#include "util.h"
+
+#include "lnx_qos.h"
+
+#define LNX_QOS_NL_BATCH_SIZE   (32 * 1024)         /**< Batch buffer size, flushed when full */
+#define LNX_QOS_NL_MSG_MAX      512                 /**< Maximum size of a single message */
+#define LNX_QOS_NL_BATCH_MSGS   64                  /**< Maximum number of messages (acks in flight) per batch */
+
+#define LNX_QOS_NL_HANDLE       TC_H_MAKE(1 << 16, 0)       /**< HTB qdisc handle, 1: */
+#define LNX_QOS_NL_DEFCLS       0xfffe                      /**< Default class minor number */
+#define LNX_QOS_NL_DEFRATE      (3500000000ULL / 8)         /**< Default class rate (3.5gbit) in bytes/s */
+#define LNX_QOS_NL_BURST        (15 * 1024)                 /**< Class burst size in bytes (15k) */
+#define LNX_QOS_NL_R2Q          10                          /**< Rate to quantum ratio (tc default) */
+#define LNX_QOS_NL_FILTER_PRIO  1                           /**< fw filter priority */
+
+/*
+ * Kernel object as reported by a dump; depending on the tree this is a HTB
+ * class, a leaf qdisc (indexed by its parent class) or a fw filter
+ */
+struct lnx_qos_nl_obj
+{
+    uint32_t        no_handle;          /* Class ID, leaf qdisc parent or filter handle */
+    uint32_t        no_info;            /* Filter: priority and protocol */
+    uint64_t        no_rate;            /* Class: rate in bytes/s */
+    uint64_t        no_ceil;            /* Class: ceil in bytes/s */
+    uint32_t        no_prio;            /* Class: priority */
+    uint32_t        no_classid;         /* Filter: target class ID */
+    bool            no_valid;           /* Leaf qdisc: true if fq_codel */
+    bool            no_used;            /* Object is part of the configuration */
+    ds_tree_node_t  no_tnode;
+};
+
+/* Current kernel configuration of an interface */
+struct lnx_qos_nl_state
+{
+    int             ns_ifindex;
+    bool            ns_root;            /* Root qdisc is HTB 1: with the right default class */
+    ds_tree_t       ns_class;           /* HTB classes, indexed by class ID */
+    ds_tree_t       ns_leaf;            /* Leaf qdiscs, indexed by parent class ID */
+    ds_tree_t       ns_filter;          /* fw filters, indexed by handle */
+};
+
+/* Batch of netlink messages */
+struct lnx_qos_nl_batch
+{
+    const char     *nb_ifname;
+    uint8_t        *nb_buf;
+    size_t          nb_len;             /* Length of the complete messages in nb_buf */
+    struct nlmsghdr *nb_msg;            /* Message being built */
+    int             nb_count;           /* Number of messages in nb_buf */
+    int             nb_total;           /* Number of messages sent so far */
+    bool            nb_error;           /* True if any message failed */
+};
+
+static struct mnl_socket *lnx_qos_nl_sock = NULL;
+static uint32_t lnx_qos_nl_seq = 0;
+
+static bool lnx_qos_nl_open(void);
+static struct nlmsghdr *lnx_qos_nl_msg(void *buf, int type, uint16_t flags, int ifindex, uint32_t parent, uint32_t handle);
+static bool lnx_qos_nl_dump(struct lnx_qos_nl_state *ns, int type, uint32_t parent);
+static int lnx_qos_nl_dump_fn(const struct nlmsghdr *nlh, void *data);
+static int lnx_qos_nl_attr_fn(const struct nlattr *attr, void *data);
+static void lnx_qos_nl_state_fini(struct lnx_qos_nl_state *ns);
+static struct lnx_qos_nl_obj *lnx_qos_nl_obj_get(ds_tree_t *tree, uint32_t handle);
+static struct nlmsghdr *lnx_qos_nl_batch_msg(struct lnx_qos_nl_batch *nb, int type, uint16_t flags, int ifindex, uint32_t parent, uint32_t handle);
+static void lnx_qos_nl_batch_close(struct lnx_qos_nl_batch *nb);
+static bool lnx_qos_nl_batch_flush(struct lnx_qos_nl_batch *nb);
+static void lnx_qos_nl_put_class(struct lnx_qos_nl_batch *nb, struct lnx_qos_nl_state *ns, int qid, uint64_t rate, int prio);
+static bool lnx_qos_nl_send(struct nlmsghdr *nlh);
+
+/*
+ * ===========================================================================
+ *  Public (lnx_qos private) interface
+ * ===========================================================================
+ */
+
+/*
+ * Apply the QoS configuration of @p self to the kernel; only the differences
+ * from the current kernel configuration are applied.
+ */
+bool lnx_qos_nl_apply(lnx_qos_t *self)
+{
+    struct lnx_qos_nl_state ns;
+    struct lnx_qos_nl_batch nb;
+    struct lnx_qos_nl_obj *no;
+    struct lnx_qos_queue *qp;
+    struct nlmsghdr *nlh;
+    struct nlattr *nest;
+    uint32_t classid;
+    uint32_t info;
+    uint32_t mark;
+    bool retval;
+
+    retval = false;
+
+    memset(&nb, 0, sizeof(nb));
+    nb.nb_ifname = self->lq_ifname;
+    nb.nb_buf = MALLOC(LNX_QOS_NL_BATCH_SIZE);
+
+    memset(&ns, 0, sizeof(ns));
+    ds_tree_init(&ns.ns_class, ds_int_cmp, struct lnx_qos_nl_obj, no_tnode);
+    ds_tree_init(&ns.ns_leaf, ds_int_cmp, struct lnx_qos_nl_obj, no_tnode);
+    ds_tree_init(&ns.ns_filter, ds_int_cmp, struct lnx_qos_nl_obj, no_tnode);
+
+    ns.ns_ifindex = if_nametoindex(self->lq_ifname);
+    if (ns.ns_ifindex == 0)
+    {
+        LOG(ERR, "qos: %s: Interface does not exist.", self->lq_ifname);
+        goto exit;
+    }
+
+    if (!lnx_qos_nl_open()) goto exit;
+
+    /* Dump the current configuration */
+    if (!lnx_qos_nl_dump(&ns, RTM_GETQDISC, 0)) goto exit;
+
+    if (!ns.ns_root)
+    {
+        /*
+         * The HTB qdisc cannot be changed in place; remove the current root
+         * qdisc (this fails if the root qdisc is the default one) and start
+         * from scratch
+         */
+        LOG(INFO, "qos: %s: Creating root qdisc.", self->lq_ifname);
+
+        (void)lnx_qos_nl_reset(self->lq_ifname);
+        lnx_qos_nl_state_fini(&ns);
+
+        nlh = lnx_qos_nl_batch_msg(&nb, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL,
+                ns.ns_ifindex, TC_H_ROOT, LNX_QOS_NL_HANDLE);
+        mnl_attr_put_strz(nlh, TCA_KIND, "htb");
+        nest = mnl_attr_nest_start(nlh, TCA_OPTIONS);
+        mnl_attr_put(nlh, TCA_HTB_INIT, sizeof(struct tc_htb_glob), &(struct tc_htb_glob)
+                {
+                    .version = 3,
+                    .rate2quantum = LNX_QOS_NL_R2Q,
+                    .defcls = LNX_QOS_NL_DEFCLS,
+                });
+        mnl_attr_nest_end(nlh, nest);
+    }
+    else if (!lnx_qos_nl_dump(&ns, RTM_GETTCLASS, 0) ||
+            !lnx_qos_nl_dump(&ns, RTM_GETTFILTER, LNX_QOS_NL_HANDLE))
+    {
+        goto exit;
+    }
+
+    /*
+     * Mark the kernel objects that match the configuration, everything else
+     * is going to be replaced or removed
+     */
+    info = TC_H_MAKE(LNX_QOS_NL_FILTER_PRIO << 16, htons(ETH_P_IP));
+
+    no = ds_tree_find(&ns.ns_class, &(uint32_t){ TC_H_MAKE(LNX_QOS_NL_HANDLE, LNX_QOS_NL_DEFCLS) });
+    if (no != NULL)
+    {
+        no->no_used = true;
+    }
+
+    for (qp = self->lq_queue; qp < self->lq_queue_e; qp++)
+    {
+        classid = TC_H_MAKE(LNX_QOS_NL_HANDLE, qp->qq_id);
+
+        no = ds_tree_find(&ns.ns_class, &classid);
+        if (no != NULL) no->no_used = true;
+
+        mark = LNX_QOS_MARK_BASE | qp->qq_id;
+        no = ds_tree_find(&ns.ns_filter, &mark);
+        if (no != NULL && no->no_classid == classid && no->no_info == info)
+        {
+            no->no_used = true;
+        }
+    }
+
+    /* Remove stale filters first, classes referenced by filters cannot be deleted */
+    ds_tree_foreach(&ns.ns_filter, no)
+    {
+        if (no->no_used) continue;
+
+        nlh = lnx_qos_nl_batch_msg(&nb, RTM_DELTFILTER, 0, ns.ns_ifindex, LNX_QOS_NL_HANDLE, no->no_handle);
+        ((struct tcmsg *)mnl_nlmsg_get_payload(nlh))->tcm_info = no->no_info;
+        mnl_attr_put_strz(nlh, TCA_KIND, "fw");
+    }
+
+    ds_tree_foreach(&ns.ns_class, no)
+    {
+        if (no->no_used) continue;
+
+        LOG(INFO, "qos: %s: Removing Queue [%u].", self->lq_ifname, TC_H_MIN(no->no_handle));
+        lnx_qos_nl_batch_msg(&nb, RTM_DELTCLASS, 0, ns.ns_ifindex, LNX_QOS_NL_HANDLE, no->no_handle);
+    }
+
+    /* Create or update the classes, leaf qdiscs and filters as needed */
+    lnx_qos_nl_put_class(&nb, &ns, LNX_QOS_NL_DEFCLS, LNX_QOS_NL_DEFRATE, 0);
+
+    for (qp = self->lq_queue; qp < self->lq_queue_e; qp++)
+    {
+        lnx_qos_nl_put_class(&nb, &ns, qp->qq_id, (uint64_t)qp->qq_bandwidth * 1000 / 8, qp->qq_priority);
+
+        mark = LNX_QOS_MARK_BASE | qp->qq_id;
+        no = ds_tree_find(&ns.ns_filter, &mark);
+        if (no != NULL && no->no_used) continue;
+
+        nlh = lnx_qos_nl_batch_msg(&nb, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL,
+                ns.ns_ifindex, LNX_QOS_NL_HANDLE, mark);
+        ((struct tcmsg *)mnl_nlmsg_get_payload(nlh))->tcm_info = info;
+        mnl_attr_put_strz(nlh, TCA_KIND, "fw");
+        nest = mnl_attr_nest_start(nlh, TCA_OPTIONS);
+        mnl_attr_put_u32(nlh, TCA_FW_CLASSID, TC_H_MAKE(LNX_QOS_NL_HANDLE, qp->qq_id));
+        mnl_attr_nest_end(nlh, nest);
+    }
+
+    if (!lnx_qos_nl_batch_flush(&nb)) goto exit;
+
+    if (nb.nb_total == 0)
+    {
+        LOG(INFO, "qos: %s: QoS configuration is up-to-date.", self->lq_ifname);
+    }
+    else
+    {
+        LOG(INFO, "qos: %s: Applied %d QoS configuration change(s).", self->lq_ifname, nb.nb_total);
+    }
+
+    retval = !nb.nb_error;
+
+exit:
+    lnx_qos_nl_state_fini(&ns);
+    FREE(nb.nb_buf);
+
+    return retval;
+}
+
+/*
+ * Remove the root qdisc of interface @p ifname
+ */
+bool lnx_qos_nl_reset(const char *ifname)
+{
+    uint8_t buf[LNX_QOS_NL_MSG_MAX];
+    struct nlmsghdr *nlh;
+    int ifindex;
+
+    ifindex = if_nametoindex(ifname);
+    if (ifindex == 0) return true;
+
+    if (!lnx_qos_nl_open()) return false;
+
+    nlh = lnx_qos_nl_msg(buf, RTM_DELQDISC, 0, ifindex, TC_H_ROOT, 0);
+
+    /* There may be no qdisc configured on the interface, ignore errors */
+    if (!lnx_qos_nl_send(nlh))
+    {
+        LOG(DEBUG, "qos: %s: No root qdisc to remove.", ifname);
+    }
+
+    return true;
+}
+
+/*
+ * ===========================================================================
+ *  Helper functions
+ * ===========================================================================
+ */
+bool lnx_qos_nl_open(void)
+{
+    int opt;
+
+    if (lnx_qos_nl_sock != NULL) return true;
+
+    lnx_qos_nl_sock = mnl_socket_open(NETLINK_ROUTE);
+    if (lnx_qos_nl_sock == NULL)
+    {
+        LOG(ERR, "qos: Error opening rtnetlink socket: %s", strerror(errno));
+        return false;
+    }
+
+    if (mnl_socket_bind(lnx_qos_nl_sock, 0, MNL_SOCKET_AUTOPID) < 0)
+    {
+        LOG(ERR, "qos: Error binding rtnetlink socket: %s", strerror(errno));
+        mnl_socket_close(lnx_qos_nl_sock);
+        lnx_qos_nl_sock = NULL;
+        return false;
+    }
+
+    /*
+     * Do not echo the request back in error acknowledgements; this keeps a
+     * full batch of acks well below the socket receive buffer size
+     */
+    opt = 1;
+    (void)mnl_socket_setsockopt(lnx_qos_nl_sock, NETLINK_CAP_ACK, &opt, sizeof(opt));
+
+    return true;
+}
+
+/*
+ * Initialize a tc message in @p buf
+ */
+struct nlmsghdr *lnx_qos_nl_msg(void *buf, int type, uint16_t flags, int ifindex, uint32_t parent, uint32_t handle)
+{
+    struct nlmsghdr *nlh;
+    struct tcmsg *tcm;
+
+    nlh = mnl_nlmsg_put_header(buf);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    nlh->nlmsg_seq = ++lnx_qos_nl_seq;
+
+    tcm = mnl_nlmsg_put_extra_header(nlh, sizeof(*tcm));
+    tcm->tcm_family = AF_UNSPEC;
+    tcm->tcm_ifindex = ifindex;
+    tcm->tcm_parent = parent;
+    tcm->tcm_handle = handle;
+
+    return nlh;
+}
+
+/*
+ * Dump qdiscs, classes or filters (@p type) of the interface into @p ns
+ */
+bool lnx_qos_nl_dump(struct lnx_qos_nl_state *ns, int type, uint32_t parent)
+{
+    uint8_t buf[MNL_SOCKET_BUFFER_SIZE];
+    struct nlmsghdr *nlh;
+    unsigned int portid;
+    uint32_t seq;
+    ssize_t rc;
+
+    nlh = lnx_qos_nl_msg(buf, type, NLM_F_DUMP, ns->ns_ifindex, parent, 0);
+    nlh->nlmsg_flags &= ~NLM_F_ACK;
+    seq = nlh->nlmsg_seq;
+
+    if (mnl_socket_sendto(lnx_qos_nl_sock, nlh, nlh->nlmsg_len) < 0)
+    {
+        LOG(ERR, "qos: Error sending dump request %d: %s", type, strerror(errno));
+        return false;
+    }
+
+    portid = mnl_socket_get_portid(lnx_qos_nl_sock);
+    do
+    {
+        rc = mnl_socket_recvfrom(lnx_qos_nl_sock, buf, sizeof(buf));
+        if (rc <= 0) break;
+        rc = mnl_cb_run(buf, rc, seq, portid, lnx_qos_nl_dump_fn, ns);
+    }
+    while (rc > MNL_CB_STOP);
+
+    if (rc < 0)
+    {
+        LOG(ERR, "qos: Error dumping tc configuration (%d): %s", type, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+int lnx_qos_nl_attr_fn(const struct nlattr *attr, void *data)
+{
+    const struct nlattr **tb = data;
+    uint16_t type = mnl_attr_get_type(attr);
+
+    /* TCA_MAX covers the nested HTB and fw attributes as well */
+    if (type <= TCA_MAX) tb[type] = attr;
+
+    return MNL_CB_OK;
+}
+
+int lnx_qos_nl_dump_fn(const struct nlmsghdr *nlh, void *data)
+{
+    const struct nlattr *tb[TCA_MAX + 1];
+    const struct nlattr *opt[TCA_MAX + 1];
+    struct lnx_qos_nl_state *ns = data;
+    struct lnx_qos_nl_obj *no;
+    const char *kind;
+    struct tcmsg *tcm;
+
+    tcm = mnl_nlmsg_get_payload(nlh);
+    if (tcm->tcm_ifindex != ns->ns_ifindex) return MNL_CB_OK;
+
+    memset(tb, 0, sizeof(tb));
+    memset(opt, 0, sizeof(opt));
+    if (mnl_attr_parse(nlh, sizeof(*tcm), lnx_qos_nl_attr_fn, tb) < 0) return MNL_CB_ERROR;
+    if (tb[TCA_KIND] == NULL) return MNL_CB_OK;
+    if (tb[TCA_OPTIONS] != NULL) mnl_attr_parse_nested(tb[TCA_OPTIONS], lnx_qos_nl_attr_fn, opt);
+
+    kind = mnl_attr_get_str(tb[TCA_KIND]);
+
+    switch (nlh->nlmsg_type)
+    {
+        case RTM_NEWQDISC:
+            if (tcm->tcm_parent == TC_H_ROOT)
+            {
+                struct tc_htb_glob *glob;
+
+                if (strcmp(kind, "htb") != 0 || tcm->tcm_handle != LNX_QOS_NL_HANDLE) break;
+                if (opt[TCA_HTB_INIT] == NULL || mnl_attr_get_payload_len(opt[TCA_HTB_INIT]) < sizeof(*glob)) break;
+
+                glob = mnl_attr_get_payload(opt[TCA_HTB_INIT]);
+                ns->ns_root = glob->defcls == LNX_QOS_NL_DEFCLS;
+                break;
+            }
+
+            if (TC_H_MAJ(tcm->tcm_parent) != LNX_QOS_NL_HANDLE) break;
+
+            no = lnx_qos_nl_obj_get(&ns->ns_leaf, tcm->tcm_parent);
+            no->no_valid = strcmp(kind, "fq_codel") == 0;
+            break;
+
+        case RTM_NEWTCLASS:
+        {
+            struct tc_htb_opt *hopt;
+
+            if (strcmp(kind, "htb") != 0 || TC_H_MAJ(tcm->tcm_handle) != LNX_QOS_NL_HANDLE) break;
+
+            no = lnx_qos_nl_obj_get(&ns->ns_class, tcm->tcm_handle);
+            if (opt[TCA_HTB_PARMS] == NULL || mnl_attr_get_payload_len(opt[TCA_HTB_PARMS]) < sizeof(*hopt)) break;
+
+            hopt = mnl_attr_get_payload(opt[TCA_HTB_PARMS]);
+            no->no_rate = hopt->rate.rate;
+            no->no_ceil = hopt->ceil.rate;
+            no->no_prio = hopt->prio;
+            if (opt[TCA_HTB_RATE64] != NULL) no->no_rate = mnl_attr_get_u64(opt[TCA_HTB_RATE64]);
+            if (opt[TCA_HTB_CEIL64] != NULL) no->no_ceil = mnl_attr_get_u64(opt[TCA_HTB_CEIL64]);
+            break;
+        }
+
+        case RTM_NEWTFILTER:
+            /* Skip the filter chain header, which has no handle */
+            if (strcmp(kind, "fw") != 0 || tcm->tcm_handle == 0) break;
+
+            no = lnx_qos_nl_obj_get(&ns->ns_filter, tcm->tcm_handle);
+            no->no_info = tcm->tcm_info;
+            if (opt[TCA_FW_CLASSID] != NULL) no->no_classid = mnl_attr_get_u32(opt[TCA_FW_CLASSID]);
+            break;
+    }
+
+    return MNL_CB_OK;
+}
+
+struct lnx_qos_nl_obj *lnx_qos_nl_obj_get(ds_tree_t *tree, uint32_t handle)
+{
+    struct lnx_qos_nl_obj *no;
+
+    no = ds_tree_find(tree, &handle);
+    if (no != NULL) return no;
+
+    no = CALLOC(1, sizeof(*no));
+    no->no_handle = handle;
+    ds_tree_insert(tree, no, &no->no_handle);
+
+    return no;
+}
+
+void lnx_qos_nl_state_fini(struct lnx_qos_nl_state *ns)
+{
+    struct lnx_qos_nl_obj *no;
+    ds_tree_iter_t iter;
+
+    ds_tree_foreach_iter(&ns->ns_class, no, &iter)
+    {
+        ds_tree_iremove(&iter);
+        FREE(no);
+    }
+
+    ds_tree_foreach_iter(&ns->ns_leaf, no, &iter)
+    {
+        ds_tree_iremove(&iter);
+        FREE(no);
+    }
+
+    ds_tree_foreach_iter(&ns->ns_filter, no, &iter)
+    {
+        ds_tree_iremove(&iter);
+        FREE(no);
+    }
+
+    ns->ns_root = false;
+}
+
+/*
+ * Append a message to the batch; the batch is sent if it is full
+ */
+struct nlmsghdr *lnx_qos_nl_batch_msg(
+        struct lnx_qos_nl_batch *nb,
+        int type,
+        uint16_t flags,
+        int ifindex,
+        uint32_t parent,
+        uint32_t handle)
+{
+    lnx_qos_nl_batch_close(nb);
+
+    if (nb->nb_len + LNX_QOS_NL_MSG_MAX > LNX_QOS_NL_BATCH_SIZE ||
+            nb->nb_count >= LNX_QOS_NL_BATCH_MSGS)
+    {
+        (void)lnx_qos_nl_batch_flush(nb);
+    }
+
+    nb->nb_count++;
+    nb->nb_msg = lnx_qos_nl_msg(nb->nb_buf + nb->nb_len, type, flags, ifindex, parent, handle);
+
+    return nb->nb_msg;
+}
+
+/*
+ * The message being built is complete, account for it
+ */
+void lnx_qos_nl_batch_close(struct lnx_qos_nl_batch *nb)
+{
+    if (nb->nb_msg == NULL) return;
+
+    nb->nb_len += NLMSG_ALIGN(nb->nb_msg->nlmsg_len);
+    nb->nb_msg = NULL;
+}
+
+/*
+ * Send all messages in the batch with a single write and process the
+ * acknowledgements; the kernel processes all messages even if some of them
+ * fail
+ */
+bool lnx_qos_nl_batch_flush(struct lnx_qos_nl_batch *nb)
+{
+    uint8_t buf[MNL_SOCKET_BUFFER_SIZE];
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    int acks;
+    ssize_t rc;
+    int len;
+
+    lnx_qos_nl_batch_close(nb);
+    if (nb->nb_count == 0) return true;
+
+    if (mnl_socket_sendto(lnx_qos_nl_sock, nb->nb_buf, nb->nb_len) < 0)
+    {
+        LOG(ERR, "qos: %s: Error sending netlink batch: %s", nb->nb_ifname, strerror(errno));
+        nb->nb_error = true;
+        goto exit;
+    }
+
+    for (acks = 0; acks < nb->nb_count;)
+    {
+        rc = mnl_socket_recvfrom(lnx_qos_nl_sock, buf, sizeof(buf));
+        if (rc <= 0)
+        {
+            LOG(ERR, "qos: %s: Error receiving netlink acknowledgement: %s", nb->nb_ifname, strerror(errno));
+            nb->nb_error = true;
+            goto exit;
+        }
+
+        for (nlh = (void *)buf, len = rc; mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len))
+        {
+            if (nlh->nlmsg_type != NLMSG_ERROR) continue;
+
+            acks++;
+            err = mnl_nlmsg_get_payload(nlh);
+            if (err->error == 0) continue;
+
+            LOG(ERR, "qos: %s: tc %s failed: %s",
+                    nb->nb_ifname,
+                    err->msg.nlmsg_type == RTM_NEWQDISC ? "qdisc" :
+                    err->msg.nlmsg_type == RTM_NEWTCLASS || err->msg.nlmsg_type == RTM_DELTCLASS ? "class" :
+                    "filter",
+                    strerror(-err->error));
+            nb->nb_error = true;
+        }
+    }
+
+exit:
+    nb->nb_total += nb->nb_count;
+    nb->nb_count = 0;
+    nb->nb_len = 0;
+
+    return !nb->nb_error;
+}
+
+/*
+ * Create or update the HTB class 1:@p qid and its fq_codel leaf qdisc, if
+ * they do not match the configuration
+ */
+void lnx_qos_nl_put_class(struct lnx_qos_nl_batch *nb, struct lnx_qos_nl_state *ns, int qid, uint64_t rate, int prio)
+{
+    struct tc_htb_opt hopt;
+    struct lnx_qos_nl_obj *no;
+    struct nlmsghdr *nlh;
+    struct nlattr *nest;
+    uint32_t classid;
+    uint32_t buffer;
+
+    classid = TC_H_MAKE(LNX_QOS_NL_HANDLE, qid);
+
+    no = ds_tree_find(&ns->ns_class, &classid);
+    if (no == NULL || no->no_rate != rate || no->no_ceil != rate || no->no_prio != (uint32_t)prio)
+    {
+        LOG(INFO, "qos: %s: Configuring Queue [%d]: rate=%"PRIu64" bytes/s priority=%d",
+                nb->nb_ifname, qid, rate, prio);
+
+        /* Burst expressed as transmit time in scheduler ticks (64ns), the same as tc does */
+        buffer = (uint32_t)(((uint64_t)LNX_QOS_NL_BURST * 1000000000ULL / rate) >> 6);
+
+        memset(&hopt, 0, sizeof(hopt));
+        hopt.rate.rate = rate > UINT32_MAX ? UINT32_MAX : rate;
+        hopt.rate.linklayer = TC_LINKLAYER_ETHERNET;
+        hopt.ceil = hopt.rate;
+        hopt.buffer = buffer;
+        hopt.cbuffer = buffer;
+        hopt.prio = prio;
+
+        nlh = lnx_qos_nl_batch_msg(nb, RTM_NEWTCLASS, NLM_F_CREATE | NLM_F_REPLACE,
+                ns->ns_ifindex, LNX_QOS_NL_HANDLE, classid);
+        mnl_attr_put_strz(nlh, TCA_KIND, "htb");
+        nest = mnl_attr_nest_start(nlh, TCA_OPTIONS);
+        mnl_attr_put(nlh, TCA_HTB_PARMS, sizeof(hopt), &hopt);
+        if (rate > UINT32_MAX)
+        {
+            mnl_attr_put_u64(nlh, TCA_HTB_RATE64, rate);
+            mnl_attr_put_u64(nlh, TCA_HTB_CEIL64, rate);
+        }
+        mnl_attr_nest_end(nlh, nest);
+    }
+
+    /* A new HTB class gets a pfifo leaf qdisc by default, replace it */
+    no = ds_tree_find(&ns->ns_leaf, &classid);
+    if (no != NULL && no->no_valid) return;
+
+    nlh = lnx_qos_nl_batch_msg(nb, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_REPLACE, ns->ns_ifindex, classid, 0);
+    mnl_attr_put_strz(nlh, TCA_KIND, "fq_codel");
+}
+
+/*
+ * Send a single message and wait for the acknowledgement
+ */
+bool lnx_qos_nl_send(struct nlmsghdr *nlh)
+{
+    uint8_t buf[MNL_SOCKET_BUFFER_SIZE];
+    ssize_t rc;
+
+    if (mnl_socket_sendto(lnx_qos_nl_sock, nlh, nlh->nlmsg_len) < 0)
+    {
+        return false;
+    }
+
+    rc = mnl_socket_recvfrom(lnx_qos_nl_sock, buf, sizeof(buf));
+    if (rc <= 0) return false;
+
+    return mnl_cb_run(buf, rc, nlh->nlmsg_seq, mnl_socket_get_portid(lnx_qos_nl_sock), NULL, NULL) >= 0;
+}
@@ -41,8 +41,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "lnx_route.h"
 
-/* Debounce period - 100ms */
-#define LNX_ROUTE_POLL_DEBOUNCE_MS 100
 #define LNX_ROUTE_PROC_NET_ROUTE   "/proc/net/route"
 #define LNX_ROUTE_PROC_NET_ARP     "/proc/net/arp"
 
@@ -73,7 +71,8 @@ static const char lnx_route_arp_regex[] = "^"
 struct lnx_route_state_cache
 {
     struct osn_route_status     rsc_state;                  /* Current route state */
-    bool                        rsc_valid;                  /* Invalid cache entries will be deleted by lnx_route_flush() */
+    int                         rsc_refcnt;                 /* Number of kernel routes matching this entry, unused
+                                                               entries will be deleted by lnx_route_cache_flush() */
     ds_tree_node_t              rsc_tnode;                  /* Red-black tree node */
 };
 
@@ -98,10 +97,16 @@ struct lnx_route_arp_cache
  * Private functions
  */
 static void lnx_route_netlink_poll(lnx_netlink_t *nl, uint64_t event, const char *ifname);
+static lnx_netlink_route_update_fn_t lnx_route_netlink_route_fn;
+static lnx_netlink_neigh_update_fn_t lnx_route_netlink_neigh_fn;
+static bool lnx_route_refresh(lnx_route_t *self);
+static lnx_netlink_route_fn_t lnx_route_refresh_fn;
+static void lnx_route_status_from_netlink(struct osn_route_status *rts, const struct lnx_netlink_route *nr);
 static void lnx_route_poll(void);
-static void lnx_route_cache_reset(void);
-static void lnx_route_cache_update(const char *ifname, struct osn_route_status *rts);
-static void lnx_route_cache_flush(void);
+static void lnx_route_cache_reset(lnx_route_t *rt);
+static void lnx_route_cache_update(lnx_route_t *rt, struct osn_route_status *rts);
+static void lnx_route_cache_remove(lnx_route_t *rt, struct osn_route_status *rts);
+static void lnx_route_cache_flush(lnx_route_t *rt);
 static void lnx_route_cache_free(lnx_route_t *rt, struct lnx_route_state_cache *rsc);
 static void lnx_route_arp_refresh(void);
 static ds_key_cmp_t lnx_route_state_cmp;
@@ -137,10 +142,15 @@ bool lnx_route_init(lnx_route_t *self, const char *ifname)
 
     lnx_netlink_init(&self->rt_nl, lnx_route_netlink_poll);
     lnx_netlink_set_ifname(&self->rt_nl, self->rt_ifname);
-    lnx_netlink_set_events(&self->rt_nl, LNX_NETLINK_IP4ROUTE | LNX_NETLINK_IP4NEIGH);
+    lnx_netlink_set_events(&self->rt_nl, LNX_NETLINK_IP4ROUTE | LNX_NETLINK_IP4NEIGH | LNX_NETLINK_SYNC);
+    lnx_netlink_set_route_fn(&self->rt_nl, lnx_route_netlink_route_fn);
+    lnx_netlink_set_neigh_fn(&self->rt_nl, lnx_route_netlink_neigh_fn);
     lnx_netlink_start(&self->rt_nl);
 
-    lnx_route_poll();
+    if (!lnx_route_refresh(self))
+    {
+        lnx_route_poll();
+    }
 
     return self;
 
@@ -187,25 +197,143 @@ bool lnx_route_status_notify(lnx_route_t *self, lnx_route_status_fn_t *func)
  * ===========================================================================
  */
 /*
- * Global route initialization.
- *
- * Since we're using Linux specifics to parse the routing table (/proc/net/route) we
- * might as well use netlink sockets to improve performance a bit.
+ * Debounced netlink event handler.
  *
- * Netlink is used for route state change notifications. The netlink protocol itself
- * is used as it is a beast of its own -- netlink messages are just used as a trigger
- * for the actual polling of the /proc/net/route file.
+ * While the lnx_netlink route and neighbor caches are synchronized, changes
+ * are applied incrementally by lnx_route_netlink_route_fn() and
+ * lnx_route_netlink_neigh_fn(). A full refresh is required only when the
+ * caches are (re)synchronized (LNX_NETLINK_SYNC); if the caches are not
+ * available, netlink events are just used as a trigger for polling the
+ * /proc/net/route and /proc/net/arp files.
  */
 void lnx_route_netlink_poll(lnx_netlink_t *nl, uint64_t event, const char *ifname)
 {
-    (void)nl;
-    (void)event;
+    lnx_route_t *self = CONTAINER_OF(nl, lnx_route_t, rt_nl);
+
     (void)ifname;
 
+    if (!(event & LNX_NETLINK_SYNC) && lnx_netlink_cache_synced()) return;
+
+    if (lnx_route_refresh(self)) return;
+
     /* Trigger polling */
     lnx_route_poll();
 }
 
+/*
+ * Incremental route table update from the lnx_netlink route cache
+ */
+void lnx_route_netlink_route_fn(lnx_netlink_t *nl, const struct lnx_netlink_route *nr, bool remove)
+{
+    lnx_route_t *self = CONTAINER_OF(nl, lnx_route_t, rt_nl);
+    struct osn_route_status rts;
+
+    /* /proc/net/route reports only the main table */
+    if (nr->nr_family != AF_INET || nr->nr_table != RT_TABLE_MAIN) return;
+
+    lnx_route_status_from_netlink(&rts, nr);
+
+    if (remove)
+    {
+        lnx_route_cache_remove(self, &rts);
+    }
+    else
+    {
+        lnx_route_cache_update(self, &rts);
+    }
+}
+
+/*
+ * Incremental ARP table update -- update the gateway MAC address of routes
+ * that use this neighbor as a gateway
+ */
+void lnx_route_netlink_neigh_fn(lnx_netlink_t *nl, const struct lnx_netlink_neigh *nn, bool remove)
+{
+    lnx_route_t *self = CONTAINER_OF(nl, lnx_route_t, rt_nl);
+    struct lnx_route_state_cache *rsc;
+    osn_mac_addr_t hwaddr;
+
+    if (nn->nn_family != AF_INET) return;
+
+    hwaddr = OSN_MAC_ADDR_INIT;
+    if (!remove)
+    {
+        memcpy(hwaddr.ma_addr, nn->nn_lladdr, sizeof(hwaddr.ma_addr));
+    }
+
+    ds_tree_foreach(&self->rt_cache, rsc)
+    {
+        if (!rsc->rsc_state.rts_route.gw_valid) continue;
+        if (rsc->rsc_state.rts_route.gw.ia_addr.s_addr != nn->nn_addr.ip4.s_addr) continue;
+        if (osn_mac_addr_cmp(&rsc->rsc_state.rts_gw_hwaddr, &hwaddr) == 0) continue;
+
+        LOG(DEBUG, "route: %s: ARP: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr" |----> "PRI_osn_mac_addr" -> "PRI_osn_mac_addr,
+                self->rt_ifname,
+                FMT_osn_ip_addr(rsc->rsc_state.rts_route.dest),
+                FMT_osn_ip_addr(rsc->rsc_state.rts_route.gw),
+                FMT_osn_mac_addr(rsc->rsc_state.rts_gw_hwaddr),
+                FMT_osn_mac_addr(hwaddr));
+
+        rsc->rsc_state.rts_gw_hwaddr = hwaddr;
+
+        if (self->rt_fn != NULL)
+        {
+            self->rt_fn(self, &rsc->rsc_state, false);
+        }
+    }
+}
+
+/*
+ * Convert a lnx_netlink route cache entry to a route status structure; the
+ * gateway MAC address is resolved from the lnx_netlink neighbor cache
+ */
+void lnx_route_status_from_netlink(struct osn_route_status *rts, const struct lnx_netlink_route *nr)
+{
+    const struct lnx_netlink_neigh *nn;
+
+    *rts = OSN_ROUTE_STATUS_INIT;
+
+    osn_ip_addr_from_in_addr(&rts->rts_route.dest, &nr->nr_dst.ip4);
+    rts->rts_route.dest.ia_prefix = nr->nr_dst_len;
+    rts->rts_route.metric = (int)nr->nr_metric;
+
+    if (!nr->nr_gw_valid) return;
+
+    rts->rts_route.gw_valid = true;
+    osn_ip_addr_from_in_addr(&rts->rts_route.gw, &nr->nr_gw.ip4);
+
+    nn = lnx_netlink_neigh_find(nr->nr_ifindex, AF_INET, &nr->nr_gw.ip4);
+    if (nn != NULL)
+    {
+        memcpy(rts->rts_gw_hwaddr.ma_addr, nn->nn_lladdr, sizeof(rts->rts_gw_hwaddr.ma_addr));
+    }
+}
+
+/*
+ * Refresh the route state cache of @p self from the lnx_netlink route cache.
+ * Returns false if the netlink cache is not available.
+ */
+bool lnx_route_refresh(lnx_route_t *self)
+{
+    if (!lnx_netlink_cache_synced()) return false;
+
+    lnx_route_cache_reset(self);
+
+    if (!lnx_netlink_route_foreach(self->rt_ifname, AF_INET, lnx_route_refresh_fn, self))
+    {
+        return false;
+    }
+
+    lnx_route_cache_flush(self);
+
+    return true;
+}
+
+void lnx_route_refresh_fn(void *ctx, const struct lnx_netlink_route *nr)
+{
+    lnx_route_netlink_route_fn(&((lnx_route_t *)ctx)->rt_nl, nr, false);
+}
+
 bool route_osn_ip_addr_from_hexstr(osn_ip_addr_t *ip, const char *str)
 {
     char s_addr[OSN_IP_ADDR_LEN];
@@ -230,9 +358,15 @@ bool route_osn_ip_addr_from_hexstr(osn_ip_addr_t *ip, const char *str)
     return osn_ip_addr_from_str(ip, s_addr);
 }
 
+/*
+ * Fallback for when the netlink caches are not available -- refresh the
+ * route state cache of all objects by parsing /proc/net/route and
+ * /proc/net/arp
+ */
 void lnx_route_poll(void)
 {
     FILE *frt = NULL;
+    lnx_route_t *rt;
 
     char buf[256];
     regex_t re_route;
@@ -265,7 +399,10 @@ void lnx_route_poll(void)
         goto error;
     }
 
-    lnx_route_cache_reset();
+    ds_tree_foreach(&lnx_route_list, rt)
+    {
+        lnx_route_cache_reset(rt);
+    }
 
     while (fgets(buf, sizeof(buf), frt) != NULL)
     {
@@ -334,11 +471,41 @@ void lnx_route_poll(void)
             }
         }
 
-        lnx_route_cache_update(r_ifname, &rts);
+        rt = ds_tree_find(&lnx_route_list, r_ifname);
+        if (rt == NULL)
+        {
+            /* No lnx_route object, skip this entry */
+            LOG(DEBUG, "route: %s: No match: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr,
+                    r_ifname,
+                    FMT_osn_ip_addr(rts.rts_route.dest),
+                    FMT_osn_ip_addr(rts.rts_route.gw));
+            continue;
+        }
+
+        /* Lookup the MAC address */
+        if (rts.rts_route.gw_valid)
+        {
+            struct lnx_route_arp_cache akey;
+            struct lnx_route_arp_cache *arp;
+
+            strscpy(akey.arp_ifname, r_ifname, sizeof(akey.arp_ifname));
+            memcpy(&akey.arp_ipaddr, &rts.rts_route.gw, sizeof(akey.arp_ipaddr));
+
+            arp = ds_tree_find(&lnx_route_arp_cache, &akey);
+            if (arp != NULL)
+            {
+                rts.rts_gw_hwaddr = arp->arp_hwaddr;
+            }
+        }
+
+        lnx_route_cache_update(rt, &rts);
     }
 
     /* Flush stale entries */
-    lnx_route_cache_flush();
+    ds_tree_foreach(&lnx_route_list, rt)
+    {
+        lnx_route_cache_flush(rt);
+    }
 
 error:
     regfree(&re_route);
@@ -348,45 +515,28 @@ error:
 }
 
 /*
- * Flag all route cache entries for deletion
+ * Flag all route cache entries of @p rt for deletion
  */
-void lnx_route_cache_reset(void)
+void lnx_route_cache_reset(lnx_route_t *rt)
 {
-    lnx_route_t *rt;
     struct lnx_route_state_cache *rsc;
 
-    /* Traverse osn_route objects */
-    ds_tree_foreach(&lnx_route_list, rt)
+    ds_tree_foreach(&rt->rt_cache, rsc)
     {
-        /* Traverse each object's cache */
-        ds_tree_foreach(&rt->rt_cache, rsc)
-        {
-            /* Invalidate the entry */
-            rsc->rsc_valid = false;
-        }
+        /* Invalidate the entry */
+        rsc->rsc_refcnt = 0;
     }
 }
 
 /*
- * Find the osn_route object by @p ifname and update its route state cache
- * If the route state is a new entry, emit a callback
+ * Update the route state cache of @p rt with a route reported by the kernel;
+ * @p rts must have the gateway MAC address resolved. If the route state is a
+ * new entry or the gateway MAC address changed, emit a callback.
  */
-void lnx_route_cache_update(const char *ifname, struct osn_route_status *rts)
+void lnx_route_cache_update(lnx_route_t *rt, struct osn_route_status *rts)
 {
-    lnx_route_t *rt;
     struct lnx_route_state_cache *rsc;
 
-    rt = ds_tree_find(&lnx_route_list, (void *)ifname);
-    if (rt == NULL)
-    {
-        /* No lnx_route object, skip this entry */
-        LOG(DEBUG, "route: %s: No match: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr,
-                ifname,
-                FMT_osn_ip_addr(rts->rts_route.dest),
-                FMT_osn_ip_addr(rts->rts_route.gw));
-        return;
-    }
-
     bool notify = false;
 
     /* Find the cache entry in the inet_route object */
@@ -398,42 +548,26 @@ void lnx_route_cache_update(const char *ifname, struct osn_route_status *rts)
         ds_tree_insert(&rt->rt_cache, rsc, &rsc->rsc_state);
 
         LOG(DEBUG, "route: %s: New: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr,
-                ifname,
+                rt->rt_ifname,
                 FMT_osn_ip_addr(rsc->rsc_state.rts_route.dest),
                 FMT_osn_ip_addr(rsc->rsc_state.rts_route.gw));
 
         notify = true;
     }
 
-    rsc->rsc_valid = true;
+    rsc->rsc_refcnt++;
 
-    /* Lookup the MAC address */
-    struct lnx_route_arp_cache akey;
-    struct lnx_route_arp_cache *arp;
-
-    osn_mac_addr_t gwaddr;
-    strscpy(akey.arp_ifname, ifname, sizeof(akey.arp_ifname));
-    memcpy(&akey.arp_ipaddr, &rts->rts_route.gw, sizeof(akey.arp_ipaddr));
-
-    gwaddr = OSN_MAC_ADDR_INIT;
-    /* If we have a valid ARP entry, compare the MAC addresses */
-    arp = ds_tree_find(&lnx_route_arp_cache, &akey);
-    if (arp != NULL)
-    {
-        gwaddr = arp->arp_hwaddr;
-    }
-
-    if (osn_mac_addr_cmp(&rsc->rsc_state.rts_gw_hwaddr, &gwaddr) != 0)
+    if (osn_mac_addr_cmp(&rsc->rsc_state.rts_gw_hwaddr, &rts->rts_gw_hwaddr) != 0)
     {
         LOG(DEBUG, "route: %s: ARP: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr" |----> "PRI_osn_mac_addr" -> "PRI_osn_mac_addr,
-                ifname,
+                rt->rt_ifname,
                 FMT_osn_ip_addr(rsc->rsc_state.rts_route.dest),
                 FMT_osn_ip_addr(rsc->rsc_state.rts_route.gw),
                 FMT_osn_mac_addr(rsc->rsc_state.rts_gw_hwaddr),
-                FMT_osn_mac_addr(gwaddr));
+                FMT_osn_mac_addr(rts->rts_gw_hwaddr));
 
         notify = true;
-        memcpy(&rsc->rsc_state.rts_gw_hwaddr, &gwaddr, sizeof(rsc->rsc_state.rts_gw_hwaddr));
+        memcpy(&rsc->rsc_state.rts_gw_hwaddr, &rts->rts_gw_hwaddr, sizeof(rsc->rsc_state.rts_gw_hwaddr));
     }
 
     /* Send out notifications */
@@ -443,6 +577,23 @@ void lnx_route_cache_update(const char *ifname, struct osn_route_status *rts)
     }
 }
 
+/*
+ * A kernel route was removed; the route state is deleted when no other
+ * kernel route (for example, with a different metric) maps to it
+ */
+void lnx_route_cache_remove(lnx_route_t *rt, struct osn_route_status *rts)
+{
+    struct lnx_route_state_cache *rsc;
+
+    rsc = ds_tree_find(&rt->rt_cache, rts);
+    if (rsc == NULL) return;
+
+    if (--rsc->rsc_refcnt > 0) return;
+
+    ds_tree_remove(&rt->rt_cache, rsc);
+    lnx_route_cache_free(rt, rsc);
+}
+
 static void lnx_route_cache_free(lnx_route_t *rt, struct lnx_route_state_cache *rsc)
 {
     LOG(DEBUG, "route: %s: Del: "PRI_osn_ip_addr" -> "PRI_osn_ip_addr,
@@ -460,25 +611,19 @@ static void lnx_route_cache_free(lnx_route_t *rt, struct lnx_route_state_cache *
 }
 
 /*
- * Remove all invalid route entries. Send out notifications.
+ * Remove all unused route entries of @p rt. Send out notifications.
  */
-void lnx_route_cache_flush(void)
+void lnx_route_cache_flush(lnx_route_t *rt)
 {
     ds_tree_iter_t iter;
-    lnx_route_t *rt;
     struct lnx_route_state_cache *rsc;
 
-    /* Traverse route objects */
-    ds_tree_foreach(&lnx_route_list, rt)
+    ds_tree_foreach_iter(&rt->rt_cache, rsc, &iter)
     {
-        /* Traverse each object's cache */
-        ds_tree_foreach_iter(&rt->rt_cache, rsc, &iter)
-        {
-            if (rsc->rsc_valid) continue;
+        if (rsc->rsc_refcnt > 0) continue;
 
-            ds_tree_iremove(&iter);
-            lnx_route_cache_free(rt, rsc);
-        }
+        ds_tree_iremove(&iter);
+        lnx_route_cache_free(rt, rsc);
     }
 }
 
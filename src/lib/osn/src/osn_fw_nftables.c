@@ -0,0 +1,1950 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * nf_tables firewall backend
+ *
+ * This backend manages the same 5 tables as the iptables full backend, but
+ * talks to nf_tables directly over netlink. Rules are translated from the
+ * iptables match syntax into nf_tables expressions when they are added, so
+ * an invalid rule is rejected immediately without forking iptables-restore.
+ *
+ * osfw_apply() only sends the difference from the previous apply: new chains,
+ * deleted rules (by kernel handle), new rules (positioned relative to already
+ * installed rules) and deleted chains, all in a single nfnetlink batch. The
+ * kernel applies the batch atomically or not at all.
+ */
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nf_conntrack_common.h>
+
+#include "log.h"
+#include "osn_fw_pri.h"
+#include "os.h"
+#include "const.h"
+#include "util.h"
+#include "memutil.h"
+#include "ds_dlist.h"
+
+#include "kconfig.h"
+
+#define MODULE_ID LOG_MODULE_ID_TARGET
+
+#define OSFW_NFT_BATCH_SIZE (256 * 1024)    /* Maximum size of a batch */
+#define OSFW_NFT_RULE_SIZE (16 * 1024)      /* Maximum size of a rule's expressions */
+#define OSFW_NFT_RULE_ARGC 128              /* Maximum number of match arguments */
+#define OSFW_NFT_RECV_TIMEOUT 2             /* Seconds to wait for the kernel replies */
+
+#define OSFW_NFT_TABLE_MAX (OSFW_TABLE_SECURITY + 1)
+
+#define KCONFIG_DEFAULT_POLICY2(kconfig) \
+    kconfig_enabled(kconfig##_ACCEPT) ? OSFW_STR_TARGET_ACCEPT : \
+            (kconfig_enabled(kconfig##_REJECT) ? OSFW_STR_TARGET_REJECT : \
+                OSFW_STR_TARGET_DROP)
+
+#define KCONFIG_DEFAULT_POLICY(table, chain) \
+    KCONFIG_DEFAULT_POLICY2(CONFIG_OSN_FW_IPTABLES_POLICY_##table##_##chain)
+
+struct osfw_nft_chain {
+	struct ds_dlist_node elt;
+	char chain[OSFW_SIZE_CHAIN];
+	bool isinstalled;           /* The chain exists in the kernel */
+};
+
+struct osfw_nft_rule {
+	struct ds_dlist_node elt;
+	char chain[OSFW_SIZE_CHAIN];
+	int prio;
+	char match[OSFW_SIZE_MATCH];
+	char target[OSFW_SIZE_TARGET];
+	void *exprs;                /* Compiled NFTA_RULE_EXPRESSIONS payload */
+	size_t exprs_len;
+	uint64_t handle;            /* Kernel rule handle, 0 if not installed */
+	uint32_t seq;               /* Sequence number of the pending NEWRULE */
+};
+
+struct osfw_nft_table {
+	int family;
+	enum osfw_table table;
+	bool issupported;
+	struct ds_dlist chains;
+	struct ds_dlist chains_del; /* Installed chains pending deletion */
+	struct ds_dlist rules;      /* Sorted by priority */
+	struct ds_dlist rules_del;  /* Installed rules pending deletion */
+};
+
+struct osfw_nft_inet {
+	int family;
+	bool ismodified;
+	bool isreload;              /* Kernel state unknown, reload all tables */
+	struct osfw_nft_table tables[OSFW_NFT_TABLE_MAX];
+};
+
+struct osfw_nft_batch {
+	struct mnl_nlmsg_batch *b;
+	char *buf;
+	int nacks;
+	bool isoverflow;
+	struct osfw_nft_rule **rules;   /* Rules pending a handle */
+	size_t nrules;
+};
+
+/*
+ * Built-in chains, created with each table
+ */
+struct osfw_nft_hook {
+	enum osfw_table table;
+	const char *chain;
+	const char *type;
+	int hooknum;
+	int prio;
+	const char *policy;
+};
+
+static const struct osfw_nft_hook osfw_nft_hooks[] =
+{
+	{ OSFW_TABLE_FILTER, OSFW_STR_CHAIN_INPUT, "filter", NF_INET_LOCAL_IN, NF_IP_PRI_FILTER,
+		KCONFIG_DEFAULT_POLICY(FILTER, INPUT) },
+	{ OSFW_TABLE_FILTER, OSFW_STR_CHAIN_FORWARD, "filter", NF_INET_FORWARD, NF_IP_PRI_FILTER,
+		KCONFIG_DEFAULT_POLICY(FILTER, FORWARD) },
+	{ OSFW_TABLE_FILTER, OSFW_STR_CHAIN_OUTPUT, "filter", NF_INET_LOCAL_OUT, NF_IP_PRI_FILTER,
+		KCONFIG_DEFAULT_POLICY(FILTER, OUTPUT) },
+	{ OSFW_TABLE_NAT, OSFW_STR_CHAIN_PREROUTING, "nat", NF_INET_PRE_ROUTING, NF_IP_PRI_NAT_DST,
+		KCONFIG_DEFAULT_POLICY(NAT, PREROUTING) },
+	{ OSFW_TABLE_NAT, OSFW_STR_CHAIN_OUTPUT, "nat", NF_INET_LOCAL_OUT, NF_IP_PRI_NAT_DST,
+		KCONFIG_DEFAULT_POLICY(NAT, OUTPUT) },
+	{ OSFW_TABLE_NAT, OSFW_STR_CHAIN_POSTROUTING, "nat", NF_INET_POST_ROUTING, NF_IP_PRI_NAT_SRC,
+		KCONFIG_DEFAULT_POLICY(NAT, POSTROUTING) },
+	{ OSFW_TABLE_MANGLE, OSFW_STR_CHAIN_PREROUTING, "filter", NF_INET_PRE_ROUTING, NF_IP_PRI_MANGLE,
+		KCONFIG_DEFAULT_POLICY(MANGLE, PREROUTING) },
+	{ OSFW_TABLE_MANGLE, OSFW_STR_CHAIN_INPUT, "filter", NF_INET_LOCAL_IN, NF_IP_PRI_MANGLE,
+		KCONFIG_DEFAULT_POLICY(MANGLE, INPUT) },
+	{ OSFW_TABLE_MANGLE, OSFW_STR_CHAIN_FORWARD, "filter", NF_INET_FORWARD, NF_IP_PRI_MANGLE,
+		KCONFIG_DEFAULT_POLICY(MANGLE, FORWARD) },
+	{ OSFW_TABLE_MANGLE, OSFW_STR_CHAIN_OUTPUT, "route", NF_INET_LOCAL_OUT, NF_IP_PRI_MANGLE,
+		KCONFIG_DEFAULT_POLICY(MANGLE, OUTPUT) },
+	{ OSFW_TABLE_MANGLE, OSFW_STR_CHAIN_POSTROUTING, "filter", NF_INET_POST_ROUTING, NF_IP_PRI_MANGLE,
+		KCONFIG_DEFAULT_POLICY(MANGLE, POSTROUTING) },
+	{ OSFW_TABLE_RAW, OSFW_STR_CHAIN_PREROUTING, "filter", NF_INET_PRE_ROUTING, NF_IP_PRI_RAW,
+		KCONFIG_DEFAULT_POLICY(RAW, PREROUTING) },
+	{ OSFW_TABLE_RAW, OSFW_STR_CHAIN_OUTPUT, "filter", NF_INET_LOCAL_OUT, NF_IP_PRI_RAW,
+		KCONFIG_DEFAULT_POLICY(RAW, OUTPUT) },
+	{ OSFW_TABLE_SECURITY, OSFW_STR_CHAIN_INPUT, "filter", NF_INET_LOCAL_IN, NF_IP_PRI_SECURITY,
+		KCONFIG_DEFAULT_POLICY(SECURITY, INPUT) },
+	{ OSFW_TABLE_SECURITY, OSFW_STR_CHAIN_FORWARD, "filter", NF_INET_FORWARD, NF_IP_PRI_SECURITY,
+		KCONFIG_DEFAULT_POLICY(SECURITY, FORWARD) },
+	{ OSFW_TABLE_SECURITY, OSFW_STR_CHAIN_OUTPUT, "filter", NF_INET_LOCAL_OUT, NF_IP_PRI_SECURITY,
+		KCONFIG_DEFAULT_POLICY(SECURITY, OUTPUT) },
+};
+
+static char *osfw_target_builtin[] =
+{
+	"ACCEPT",
+	"CLASSIFY",
+	"DNAT",
+	"DROP",
+	"DSCP",
+	"ECN",
+	"LOG",
+	"MARK",
+	"MASQUERADE",
+	"MIRROR",
+	"NETMAP",
+	"NFLOG",
+	"NFQUEUE",
+	"QUEUE",
+	"REDIRECT",
+	"REJECT",
+	"RETURN",
+	"SAME",
+	"SNAT",
+	"TCPMSS",
+	"TOS",
+	"TPROXY",
+	"TTL",
+	"ULOG"
+};
+
+static struct
+{
+	struct mnl_socket *mnl;
+	uint32_t seq;
+	struct osfw_nft_inet inet;
+	struct osfw_nft_inet inet6;
+} osfw_nft;
+
+static const char *osfw_convert_family(int family)
+{
+	const char *str = OSFW_STR_UNKNOWN;
+
+	switch (family) {
+	case AF_INET:
+		str = OSFW_STR_FAMILY_INET;
+		break;
+
+	case AF_INET6:
+		str = OSFW_STR_FAMILY_INET6;
+		break;
+
+	default:
+		LOGE("Invalid family: %d", family);
+		break;
+	}
+	return str;
+}
+
+static const char *osfw_convert_table(enum osfw_table table)
+{
+	const char *str = OSFW_STR_UNKNOWN;
+
+	switch (table) {
+	case OSFW_TABLE_FILTER:
+		str = OSFW_STR_TABLE_FILTER;
+		break;
+
+	case OSFW_TABLE_NAT:
+		str = OSFW_STR_TABLE_NAT;
+		break;
+
+	case OSFW_TABLE_MANGLE:
+		str = OSFW_STR_TABLE_MANGLE;
+		break;
+
+	case OSFW_TABLE_RAW:
+		str = OSFW_STR_TABLE_RAW;
+		break;
+
+	case OSFW_TABLE_SECURITY:
+		str = OSFW_STR_TABLE_SECURITY;
+		break;
+
+	default:
+		LOGE("Convert firewall table: Invalid table: %d", table);
+		break;
+	}
+
+	return str;
+}
+
+static bool osfw_is_builtin_chain(enum osfw_table table, const char *chain)
+{
+	int ci;
+
+	for (ci = 0; ci < ARRAY_LEN(osfw_target_builtin); ci++) {
+		if (strcmp(chain, osfw_target_builtin[ci]) == 0) {
+			return true;
+		}
+	}
+
+	for (ci = 0; ci < ARRAY_LEN(osfw_nft_hooks); ci++) {
+		if (osfw_nft_hooks[ci].table == table && strcmp(chain, osfw_nft_hooks[ci].chain) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool osfw_is_valid_chain(const char *chain)
+{
+	if (strchr(chain, ' ')) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * ===========================================================================
+ *  Expression encoding
+ * ===========================================================================
+ */
+
+static struct nlattr *osfw_nft_expr_begin(struct nlmsghdr *nlh, const char *name, struct nlattr **data)
+{
+	struct nlattr *elem;
+
+	elem = mnl_attr_nest_start(nlh, NFTA_LIST_ELEM);
+	mnl_attr_put_strz(nlh, NFTA_EXPR_NAME, name);
+	*data = mnl_attr_nest_start(nlh, NFTA_EXPR_DATA);
+	return elem;
+}
+
+static void osfw_nft_expr_end(struct nlmsghdr *nlh, struct nlattr *elem, struct nlattr *data)
+{
+	mnl_attr_nest_end(nlh, data);
+	mnl_attr_nest_end(nlh, elem);
+}
+
+static void osfw_nft_put_data(struct nlmsghdr *nlh, uint16_t type, const void *value, size_t len)
+{
+	struct nlattr *nest;
+
+	nest = mnl_attr_nest_start(nlh, type);
+	mnl_attr_put(nlh, NFTA_DATA_VALUE, len, value);
+	mnl_attr_nest_end(nlh, nest);
+}
+
+static void osfw_nft_put_meta(struct nlmsghdr *nlh, uint32_t key)
+{
+	struct nlattr *elem, *data;
+
+	elem = osfw_nft_expr_begin(nlh, "meta", &data);
+	mnl_attr_put_u32(nlh, NFTA_META_KEY, htonl(key));
+	mnl_attr_put_u32(nlh, NFTA_META_DREG, htonl(NFT_REG_1));
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+static void osfw_nft_put_meta_set(struct nlmsghdr *nlh, uint32_t key)
+{
+	struct nlattr *elem, *data;
+
+	elem = osfw_nft_expr_begin(nlh, "meta", &data);
+	mnl_attr_put_u32(nlh, NFTA_META_KEY, htonl(key));
+	mnl_attr_put_u32(nlh, NFTA_META_SREG, htonl(NFT_REG_1));
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+static void osfw_nft_put_ct(struct nlmsghdr *nlh, uint32_t key)
+{
+	struct nlattr *elem, *data;
+
+	elem = osfw_nft_expr_begin(nlh, "ct", &data);
+	mnl_attr_put_u32(nlh, NFTA_CT_KEY, htonl(key));
+	mnl_attr_put_u32(nlh, NFTA_CT_DREG, htonl(NFT_REG_1));
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+static void osfw_nft_put_payload(struct nlmsghdr *nlh, uint32_t base, uint32_t offset, uint32_t len)
+{
+	struct nlattr *elem, *data;
+
+	elem = osfw_nft_expr_begin(nlh, "payload", &data);
+	mnl_attr_put_u32(nlh, NFTA_PAYLOAD_DREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_PAYLOAD_BASE, htonl(base));
+	mnl_attr_put_u32(nlh, NFTA_PAYLOAD_OFFSET, htonl(offset));
+	mnl_attr_put_u32(nlh, NFTA_PAYLOAD_LEN, htonl(len));
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+static void osfw_nft_put_bitwise(struct nlmsghdr *nlh, const void *mask, const void *xor, size_t len)
+{
+	struct nlattr *elem, *data;
+
+	elem = osfw_nft_expr_begin(nlh, "bitwise", &data);
+	mnl_attr_put_u32(nlh, NFTA_BITWISE_SREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_BITWISE_DREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_BITWISE_LEN, htonl(len));
+	osfw_nft_put_data(nlh, NFTA_BITWISE_MASK, mask, len);
+	osfw_nft_put_data(nlh, NFTA_BITWISE_XOR, xor, len);
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+static void osfw_nft_put_cmp(struct nlmsghdr *nlh, uint32_t op, const void *value, size_t len)
+{
+	struct nlattr *elem, *data;
+
+	elem = osfw_nft_expr_begin(nlh, "cmp", &data);
+	mnl_attr_put_u32(nlh, NFTA_CMP_SREG, htonl(NFT_REG_1));
+	mnl_attr_put_u32(nlh, NFTA_CMP_OP, htonl(op));
+	osfw_nft_put_data(nlh, NFTA_CMP_DATA, value, len);
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+static void osfw_nft_put_immediate(struct nlmsghdr *nlh, uint32_t reg, const void *value, size_t len)
+{
+	struct nlattr *elem, *data;
+
+	elem = osfw_nft_expr_begin(nlh, "immediate", &data);
+	mnl_attr_put_u32(nlh, NFTA_IMMEDIATE_DREG, htonl(reg));
+	osfw_nft_put_data(nlh, NFTA_IMMEDIATE_DATA, value, len);
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+static void osfw_nft_put_verdict(struct nlmsghdr *nlh, int code, const char *chain)
+{
+	struct nlattr *elem, *data, *imm, *verdict;
+
+	elem = osfw_nft_expr_begin(nlh, "immediate", &data);
+	mnl_attr_put_u32(nlh, NFTA_IMMEDIATE_DREG, htonl(NFT_REG_VERDICT));
+	imm = mnl_attr_nest_start(nlh, NFTA_IMMEDIATE_DATA);
+	verdict = mnl_attr_nest_start(nlh, NFTA_DATA_VERDICT);
+	mnl_attr_put_u32(nlh, NFTA_VERDICT_CODE, htonl((uint32_t)code));
+	if (chain != NULL) {
+		mnl_attr_put_strz(nlh, NFTA_VERDICT_CHAIN, chain);
+	}
+	mnl_attr_nest_end(nlh, verdict);
+	mnl_attr_nest_end(nlh, imm);
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+static void osfw_nft_put_counter(struct nlmsghdr *nlh)
+{
+	struct nlattr *elem, *data;
+
+	elem = osfw_nft_expr_begin(nlh, "counter", &data);
+	osfw_nft_expr_end(nlh, elem, data);
+}
+
+/*
+ * ===========================================================================
+ *  iptables match syntax translation
+ * ===========================================================================
+ */
+
+struct osfw_nft_match {
+	struct nlmsghdr *nlh;
+	int family;
+	int l4proto;                /* Protocol given with -p, -1 if none */
+	bool isnegated;             /* Last argument was "!" */
+	/* Target options */
+	uint32_t mark;
+	uint32_t mark_mask;
+	bool has_mark;
+	int reject_type;
+	int reject_code;
+	int queue_num;
+	bool queue_bypass;
+	int log_group;
+	const char *log_prefix;
+	const char *to_addr;
+	int mss;                    /* TCPMSS: -1 for --clamp-mss-to-pmtu */
+};
+
+static const struct {
+	const char *name;
+	int proto;
+} osfw_nft_protos[] = {
+	{ "icmp", IPPROTO_ICMP },
+	{ "igmp", IPPROTO_IGMP },
+	{ "tcp", IPPROTO_TCP },
+	{ "udp", IPPROTO_UDP },
+	{ "gre", IPPROTO_GRE },
+	{ "esp", IPPROTO_ESP },
+	{ "ah", IPPROTO_AH },
+	{ "icmpv6", IPPROTO_ICMPV6 },
+	{ "ipv6-icmp", IPPROTO_ICMPV6 },
+	{ "sctp", IPPROTO_SCTP },
+	{ "udplite", IPPROTO_UDPLITE },
+};
+
+/*
+ * Match modules that do not need a translation on their own; their options
+ * are handled below
+ */
+static const char *osfw_nft_modules[] = {
+	"tcp",
+	"udp",
+	"state",
+	"conntrack",
+	"mark",
+	"comment",
+};
+
+static int osfw_nft_proto_parse(const char *str)
+{
+	char *end;
+	long val;
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(osfw_nft_protos); i++) {
+		if (strcmp(str, osfw_nft_protos[i].name) == 0) {
+			return osfw_nft_protos[i].proto;
+		}
+	}
+
+	val = strtol(str, &end, 10);
+	if (end == str || *end != '\0' || val < 0 || val > 255) {
+		return -1;
+	}
+	return (int)val;
+}
+
+static bool osfw_nft_u32_parse(const char *str, uint32_t *value, uint32_t *mask)
+{
+	unsigned long val;
+	char *end;
+
+	val = strtoul(str, &end, 0);
+	if (end == str) {
+		return false;
+	}
+	*value = (uint32_t)val;
+	*mask = 0xffffffff;
+
+	if (*end == '/') {
+		str = end + 1;
+		val = strtoul(str, &end, 0);
+		if (end == str) {
+			return false;
+		}
+		*mask = (uint32_t)val;
+	}
+	return (*end == '\0');
+}
+
+/*
+ * Split a match string into arguments, honoring double quotes
+ */
+static int osfw_nft_tokenize(char *str, char **argv, int argc_max)
+{
+	int argc = 0;
+	char *p = str;
+
+	while (*p != '\0') {
+		while (*p == ' ' || *p == '\t') p++;
+		if (*p == '\0') break;
+		if (argc >= argc_max) return -1;
+
+		if (*p == '"') {
+			argv[argc++] = ++p;
+			while (*p != '\0' && *p != '"') p++;
+		} else {
+			argv[argc++] = p;
+			while (*p != '\0' && *p != ' ' && *p != '\t') p++;
+		}
+		if (*p != '\0') *p++ = '\0';
+	}
+	return argc;
+}
+
+static bool osfw_nft_match_ifname(struct osfw_nft_match *self, uint32_t key, const char *ifname)
+{
+	char name[IFNAMSIZ];
+	size_t len;
+
+	len = strlen(ifname);
+	if (len == 0 || len >= sizeof(name)) {
+		return false;
+	}
+
+	memset(name, 0, sizeof(name));
+	memcpy(name, ifname, len);
+
+	/* The '+' suffix matches any interface starting with the prefix */
+	if (name[len - 1] == '+') {
+		len--;
+	} else {
+		len++;
+	}
+
+	osfw_nft_put_meta(self->nlh, key);
+	if (len > 0) {
+		osfw_nft_put_cmp(self->nlh, self->isnegated ? NFT_CMP_NEQ : NFT_CMP_EQ, name, len);
+	}
+	return true;
+}
+
+static bool osfw_nft_match_addr(struct osfw_nft_match *self, bool issrc, const char *str)
+{
+	uint8_t addr[16];
+	uint8_t mask[16];
+	uint8_t xor[16];
+	char buf[INET6_ADDRSTRLEN + 8];
+	uint32_t offset;
+	size_t len;
+	char *end;
+	char *pfx;
+	long plen;
+	int i;
+
+	STRSCPY(buf, str);
+	len = (self->family == AF_INET6) ? 16 : 4;
+	plen = len * 8;
+
+	pfx = strchr(buf, '/');
+	if (pfx != NULL) {
+		*pfx++ = '\0';
+		plen = strtol(pfx, &end, 10);
+		if (end == pfx || *end != '\0' || plen < 0 || plen > (long)len * 8) {
+			return false;
+		}
+	}
+
+	if (inet_pton(self->family, buf, addr) != 1) {
+		return false;
+	}
+
+	if (self->family == AF_INET6) {
+		offset = issrc ? 8 : 24;
+	} else {
+		offset = issrc ? 12 : 16;
+	}
+
+	memset(mask, 0, sizeof(mask));
+	for (i = 0; i < plen; i++) {
+		mask[i / 8] |= (0x80 >> (i % 8));
+	}
+	for (i = 0; i < (int)len; i++) {
+		addr[i] &= mask[i];
+	}
+
+	/* Only load the bytes covered by the prefix */
+	len = (plen + 7) / 8;
+	if (len == 0) {
+		return true;
+	}
+
+	osfw_nft_put_payload(self->nlh, NFT_PAYLOAD_NETWORK_HEADER, offset, len);
+	if (plen % 8) {
+		memset(xor, 0, sizeof(xor));
+		osfw_nft_put_bitwise(self->nlh, mask, xor, len);
+	}
+	osfw_nft_put_cmp(self->nlh, self->isnegated ? NFT_CMP_NEQ : NFT_CMP_EQ, addr, len);
+	return true;
+}
+
+static bool osfw_nft_match_port(struct osfw_nft_match *self, bool issrc, const char *str)
+{
+	unsigned long lo, hi;
+	uint16_t port_lo, port_hi;
+	char *end;
+
+	if (self->l4proto != IPPROTO_TCP && self->l4proto != IPPROTO_UDP &&
+			self->l4proto != IPPROTO_SCTP && self->l4proto != IPPROTO_UDPLITE) {
+		return false;
+	}
+
+	lo = strtoul(str, &end, 10);
+	hi = lo;
+	if (*end == ':') {
+		str = end + 1;
+		hi = strtoul(str, &end, 10);
+	}
+	if (end == str || *end != '\0' || lo > 65535 || hi > 65535 || lo > hi) {
+		return false;
+	}
+
+	port_lo = htons((uint16_t)lo);
+	port_hi = htons((uint16_t)hi);
+
+	osfw_nft_put_payload(self->nlh, NFT_PAYLOAD_TRANSPORT_HEADER, issrc ? 0 : 2, sizeof(port_lo));
+	if (lo == hi) {
+		osfw_nft_put_cmp(self->nlh, self->isnegated ? NFT_CMP_NEQ : NFT_CMP_EQ, &port_lo, sizeof(port_lo));
+	} else if (!self->isnegated) {
+		/* Ports are loaded in network order, which compares correctly */
+		osfw_nft_put_cmp(self->nlh, NFT_CMP_GTE, &port_lo, sizeof(port_lo));
+		osfw_nft_put_cmp(self->nlh, NFT_CMP_LTE, &port_hi, sizeof(port_hi));
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool osfw_nft_tcp_flags_parse(const char *str, uint8_t *flags)
+{
+	static const struct {
+		const char *name;
+		uint8_t flag;
+	} names[] = {
+		{ "FIN", 0x01 }, { "SYN", 0x02 }, { "RST", 0x04 }, { "PSH", 0x08 },
+		{ "ACK", 0x10 }, { "URG", 0x20 }, { "ALL", 0x3f }, { "NONE", 0x00 },
+	};
+	char buf[64];
+	char *saveptr;
+	char *tok;
+	int i;
+
+	STRSCPY(buf, str);
+	*flags = 0;
+
+	for (tok = strtok_r(buf, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < ARRAY_LEN(names); i++) {
+			if (strcmp(tok, names[i].name) == 0) break;
+		}
+		if (i == ARRAY_LEN(names)) {
+			return false;
+		}
+		*flags |= names[i].flag;
+	}
+	return true;
+}
+
+static bool osfw_nft_match_tcp_flags(struct osfw_nft_match *self, const char *mask_str, const char *comp_str)
+{
+	uint8_t mask, comp, xor = 0;
+
+	if (self->l4proto != IPPROTO_TCP) {
+		return false;
+	}
+	if (!osfw_nft_tcp_flags_parse(mask_str, &mask) || !osfw_nft_tcp_flags_parse(comp_str, &comp)) {
+		return false;
+	}
+
+	osfw_nft_put_payload(self->nlh, NFT_PAYLOAD_TRANSPORT_HEADER, 13, 1);
+	osfw_nft_put_bitwise(self->nlh, &mask, &xor, 1);
+	osfw_nft_put_cmp(self->nlh, self->isnegated ? NFT_CMP_NEQ : NFT_CMP_EQ, &comp, 1);
+	return true;
+}
+
+static bool osfw_nft_match_ctstate(struct osfw_nft_match *self, const char *str)
+{
+	uint32_t state = 0;
+	uint32_t zero = 0;
+	char buf[128];
+	char *saveptr;
+	char *tok;
+
+	STRSCPY(buf, str);
+	for (tok = strtok_r(buf, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+		if (strcmp(tok, "INVALID") == 0) {
+			state |= NF_CT_STATE_INVALID_BIT;
+		} else if (strcmp(tok, "ESTABLISHED") == 0) {
+			state |= NF_CT_STATE_BIT(IP_CT_ESTABLISHED);
+		} else if (strcmp(tok, "RELATED") == 0) {
+			state |= NF_CT_STATE_BIT(IP_CT_RELATED);
+		} else if (strcmp(tok, "NEW") == 0) {
+			state |= NF_CT_STATE_BIT(IP_CT_NEW);
+		} else if (strcmp(tok, "UNTRACKED") == 0) {
+			state |= NF_CT_STATE_UNTRACKED_BIT;
+		} else {
+			return false;
+		}
+	}
+
+	osfw_nft_put_ct(self->nlh, NFT_CT_STATE);
+	osfw_nft_put_bitwise(self->nlh, &state, &zero, sizeof(state));
+	osfw_nft_put_cmp(self->nlh, self->isnegated ? NFT_CMP_EQ : NFT_CMP_NEQ, &zero, sizeof(zero));
+	return true;
+}
+
+static bool osfw_nft_match_mark(struct osfw_nft_match *self, const char *str)
+{
+	uint32_t value, mask, zero = 0;
+
+	if (!osfw_nft_u32_parse(str, &value, &mask)) {
+		return false;
+	}
+
+	osfw_nft_put_meta(self->nlh, NFT_META_MARK);
+	if (mask != 0xffffffff) {
+		osfw_nft_put_bitwise(self->nlh, &mask, &zero, sizeof(mask));
+	}
+	value &= mask;
+	osfw_nft_put_cmp(self->nlh, self->isnegated ? NFT_CMP_NEQ : NFT_CMP_EQ, &value, sizeof(value));
+	return true;
+}
+
+static bool osfw_nft_reject_parse(struct osfw_nft_match *self, const char *str)
+{
+	static const struct {
+		const char *name;
+		int family;
+		int type;
+		int code;
+	} rejects[] = {
+		{ "icmp-net-unreachable", AF_INET, NFT_REJECT_ICMP_UNREACH, 0 },
+		{ "icmp-host-unreachable", AF_INET, NFT_REJECT_ICMP_UNREACH, 1 },
+		{ "icmp-proto-unreachable", AF_INET, NFT_REJECT_ICMP_UNREACH, 2 },
+		{ "icmp-port-unreachable", AF_INET, NFT_REJECT_ICMP_UNREACH, 3 },
+		{ "icmp-net-prohibited", AF_INET, NFT_REJECT_ICMP_UNREACH, 9 },
+		{ "icmp-host-prohibited", AF_INET, NFT_REJECT_ICMP_UNREACH, 10 },
+		{ "icmp-admin-prohibited", AF_INET, NFT_REJECT_ICMP_UNREACH, 13 },
+		{ "icmp6-no-route", AF_INET6, NFT_REJECT_ICMP_UNREACH, 0 },
+		{ "icmp6-adm-prohibited", AF_INET6, NFT_REJECT_ICMP_UNREACH, 1 },
+		{ "icmp6-addr-unreachable", AF_INET6, NFT_REJECT_ICMP_UNREACH, 3 },
+		{ "icmp6-port-unreachable", AF_INET6, NFT_REJECT_ICMP_UNREACH, 4 },
+		{ "tcp-reset", AF_UNSPEC, NFT_REJECT_TCP_RST, 0 },
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_LEN(rejects); i++) {
+		if (strcmp(str, rejects[i].name) != 0) continue;
+		if (rejects[i].family != AF_UNSPEC && rejects[i].family != self->family) return false;
+
+		self->reject_type = rejects[i].type;
+		self->reject_code = rejects[i].code;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Translate a single option of the match string, return the number of
+ * consumed arguments or -1 if the option is not supported
+ */
+static int osfw_nft_match_option(struct osfw_nft_match *self, int argc, char **argv)
+{
+	const char *opt = argv[0];
+	const char *val = (argc > 1) ? argv[1] : NULL;
+	uint32_t value, mask;
+	long num;
+	char *end;
+	int i;
+
+	if (val == NULL) {
+		/* Options without value */
+		if (strcmp(opt, "--queue-bypass") == 0) {
+			self->queue_bypass = true;
+			return 1;
+		} else if (strcmp(opt, "--clamp-mss-to-pmtu") == 0) {
+			self->mss = -1;
+			return 1;
+		}
+		return -1;
+	}
+
+	if (!strcmp(opt, "-i") || !strcmp(opt, "--in-interface")) {
+		return osfw_nft_match_ifname(self, NFT_META_IIFNAME, val) ? 2 : -1;
+	} else if (!strcmp(opt, "-o") || !strcmp(opt, "--out-interface")) {
+		return osfw_nft_match_ifname(self, NFT_META_OIFNAME, val) ? 2 : -1;
+	} else if (!strcmp(opt, "-s") || !strcmp(opt, "--source")) {
+		return osfw_nft_match_addr(self, true, val) ? 2 : -1;
+	} else if (!strcmp(opt, "-d") || !strcmp(opt, "--destination")) {
+		return osfw_nft_match_addr(self, false, val) ? 2 : -1;
+	} else if (!strcmp(opt, "-p") || !strcmp(opt, "--protocol")) {
+		if (strcmp(val, "all") == 0) return 2;
+		num = osfw_nft_proto_parse(val);
+		if (num < 0) return -1;
+		value = (uint8_t)num;
+		osfw_nft_put_meta(self->nlh, NFT_META_L4PROTO);
+		osfw_nft_put_cmp(self->nlh, self->isnegated ? NFT_CMP_NEQ : NFT_CMP_EQ, &value, 1);
+		return 2;
+	} else if (!strcmp(opt, "-m") || !strcmp(opt, "--match")) {
+		for (i = 0; i < ARRAY_LEN(osfw_nft_modules); i++) {
+			if (strcmp(val, osfw_nft_modules[i]) == 0) return 2;
+		}
+		return -1;
+	} else if (!strcmp(opt, "--sport") || !strcmp(opt, "--source-port")) {
+		return osfw_nft_match_port(self, true, val) ? 2 : -1;
+	} else if (!strcmp(opt, "--dport") || !strcmp(opt, "--destination-port")) {
+		return osfw_nft_match_port(self, false, val) ? 2 : -1;
+	} else if (!strcmp(opt, "--tcp-flags")) {
+		if (argc < 3) return -1;
+		return osfw_nft_match_tcp_flags(self, val, argv[2]) ? 3 : -1;
+	} else if (!strcmp(opt, "--syn")) {
+		return osfw_nft_match_tcp_flags(self, "SYN,RST,ACK,FIN", "SYN") ? 1 : -1;
+	} else if (!strcmp(opt, "--state") || !strcmp(opt, "--ctstate")) {
+		return osfw_nft_match_ctstate(self, val) ? 2 : -1;
+	} else if (!strcmp(opt, "--mark")) {
+		return osfw_nft_match_mark(self, val) ? 2 : -1;
+	} else if (!strcmp(opt, "--comment")) {
+		return 2;
+	}
+
+	/* Target options, may not be negated */
+	if (self->isnegated) {
+		return -1;
+	}
+
+	if (!strcmp(opt, "--set-mark")) {
+		if (!osfw_nft_u32_parse(val, &value, &mask)) return -1;
+		/* --set-mark value/mask is --set-xmark value/(mask|value) */
+		self->mark = value;
+		self->mark_mask = (mask == 0xffffffff) ? mask : (mask | value);
+		self->has_mark = true;
+	} else if (!strcmp(opt, "--set-xmark")) {
+		if (!osfw_nft_u32_parse(val, &value, &mask)) return -1;
+		self->mark = value;
+		self->mark_mask = mask;
+		self->has_mark = true;
+	} else if (!strcmp(opt, "--reject-with")) {
+		if (!osfw_nft_reject_parse(self, val)) return -1;
+	} else if (!strcmp(opt, "--queue-num")) {
+		num = strtol(val, &end, 10);
+		if (end == val || *end != '\0' || num < 0 || num > 65535) return -1;
+		self->queue_num = (int)num;
+	} else if (!strcmp(opt, "--nflog-group")) {
+		num = strtol(val, &end, 10);
+		if (end == val || *end != '\0' || num < 0 || num > 65535) return -1;
+		self->log_group = (int)num;
+	} else if (!strcmp(opt, "--nflog-prefix") || !strcmp(opt, "--log-prefix")) {
+		self->log_prefix = val;
+	} else if (!strcmp(opt, "--to-destination") || !strcmp(opt, "--to-source") || !strcmp(opt, "--to")) {
+		self->to_addr = val;
+	} else if (!strcmp(opt, "--set-mss")) {
+		num = strtol(val, &end, 10);
+		if (end == val || *end != '\0' || num <= 0 || num > 65535) return -1;
+		self->mss = (int)num;
+	} else {
+		return -1;
+	}
+	return 2;
+}
+
+static bool osfw_nft_target_nat(struct osfw_nft_match *self, uint32_t type)
+{
+	struct nlattr *elem, *data;
+	char buf[INET6_ADDRSTRLEN + 8];
+	uint8_t addr[16];
+	uint16_t port = 0;
+	unsigned long num;
+	char *host = buf;
+	char *sport = NULL;
+	char *end;
+
+	if (self->to_addr == NULL) {
+		return false;
+	}
+	STRSCPY(buf, self->to_addr);
+
+	/* [addr]:port for IPv6, addr:port for IPv4 */
+	if (self->family == AF_INET6 && buf[0] == '[') {
+		host = buf + 1;
+		end = strchr(host, ']');
+		if (end == NULL) return false;
+		*end++ = '\0';
+		if (*end == ':') sport = end + 1;
+		else if (*end != '\0') return false;
+	} else if (self->family == AF_INET) {
+		sport = strchr(buf, ':');
+		if (sport != NULL) *sport++ = '\0';
+	}
+
+	if (inet_pton(self->family, host, addr) != 1) {
+		return false;
+	}
+
+	if (sport != NULL) {
+		/* Port ranges are not supported */
+		num = strtoul(sport, &end, 10);
+		if (end == sport || *end != '\0' || num == 0 || num > 65535) return false;
+		if (self->l4proto != IPPROTO_TCP && self->l4proto != IPPROTO_UDP) return false;
+		port = htons((uint16_t)num);
+	}
+
+	osfw_nft_put_immediate(self->nlh, NFT_REG_1, addr, (self->family == AF_INET6) ? 16 : 4);
+	if (port != 0) {
+		osfw_nft_put_immediate(self->nlh, NFT_REG_2, &port, sizeof(port));
+	}
+
+	elem = osfw_nft_expr_begin(self->nlh, "nat", &data);
+	mnl_attr_put_u32(self->nlh, NFTA_NAT_TYPE, htonl(type));
+	mnl_attr_put_u32(self->nlh, NFTA_NAT_FAMILY, htonl(self->family));
+	mnl_attr_put_u32(self->nlh, NFTA_NAT_REG_ADDR_MIN, htonl(NFT_REG_1));
+	if (port != 0) {
+		mnl_attr_put_u32(self->nlh, NFTA_NAT_REG_PROTO_MIN, htonl(NFT_REG_2));
+	}
+	osfw_nft_expr_end(self->nlh, elem, data);
+	return true;
+}
+
+static bool osfw_nft_target_tcpmss(struct osfw_nft_match *self)
+{
+	struct nlattr *elem, *data;
+	uint16_t mss;
+
+	if (self->mss == 0) {
+		return false;
+	}
+
+	if (self->mss < 0) {
+		elem = osfw_nft_expr_begin(self->nlh, "rt", &data);
+		mnl_attr_put_u32(self->nlh, NFTA_RT_KEY, htonl(NFT_RT_TCPMSS));
+		mnl_attr_put_u32(self->nlh, NFTA_RT_DREG, htonl(NFT_REG_1));
+		osfw_nft_expr_end(self->nlh, elem, data);
+	} else {
+		mss = htons((uint16_t)self->mss);
+		osfw_nft_put_immediate(self->nlh, NFT_REG_1, &mss, sizeof(mss));
+	}
+
+	/* tcp option maxseg size set */
+	elem = osfw_nft_expr_begin(self->nlh, "exthdr", &data);
+	mnl_attr_put_u32(self->nlh, NFTA_EXTHDR_SREG, htonl(NFT_REG_1));
+	mnl_attr_put_u8(self->nlh, NFTA_EXTHDR_TYPE, 2);
+	mnl_attr_put_u32(self->nlh, NFTA_EXTHDR_OFFSET, htonl(2));
+	mnl_attr_put_u32(self->nlh, NFTA_EXTHDR_LEN, htonl(2));
+	mnl_attr_put_u32(self->nlh, NFTA_EXTHDR_OP, htonl(NFT_EXTHDR_OP_TCPOPT));
+	osfw_nft_expr_end(self->nlh, elem, data);
+	return true;
+}
+
+static bool osfw_nft_target(struct osfw_nft_match *self, struct osfw_nft_table *nftable, const char *target)
+{
+	struct osfw_nft_chain *nfchain;
+	struct nlattr *elem, *data;
+	uint32_t mask;
+
+	osfw_nft_put_counter(self->nlh);
+
+	if (!strcmp(target, OSFW_STR_TARGET_ACCEPT)) {
+		osfw_nft_put_verdict(self->nlh, NF_ACCEPT, NULL);
+	} else if (!strcmp(target, OSFW_STR_TARGET_DROP)) {
+		osfw_nft_put_verdict(self->nlh, NF_DROP, NULL);
+	} else if (!strcmp(target, OSFW_STR_TARGET_RETURN)) {
+		osfw_nft_put_verdict(self->nlh, NFT_RETURN, NULL);
+	} else if (!strcmp(target, OSFW_STR_TARGET_REJECT)) {
+		if (self->reject_type == NFT_REJECT_TCP_RST && self->l4proto != IPPROTO_TCP) {
+			return false;
+		}
+		elem = osfw_nft_expr_begin(self->nlh, "reject", &data);
+		mnl_attr_put_u32(self->nlh, NFTA_REJECT_TYPE, htonl(self->reject_type));
+		mnl_attr_put_u8(self->nlh, NFTA_REJECT_ICMP_CODE, self->reject_code);
+		osfw_nft_expr_end(self->nlh, elem, data);
+	} else if (!strcmp(target, OSFW_STR_TARGET_MASQUERADE)) {
+		elem = osfw_nft_expr_begin(self->nlh, "masq", &data);
+		osfw_nft_expr_end(self->nlh, elem, data);
+	} else if (!strcmp(target, "DNAT")) {
+		return osfw_nft_target_nat(self, NFT_NAT_DNAT);
+	} else if (!strcmp(target, "SNAT")) {
+		return osfw_nft_target_nat(self, NFT_NAT_SNAT);
+	} else if (!strcmp(target, "MARK")) {
+		if (!self->has_mark) {
+			return false;
+		}
+		/* mark = (mark & ~mask) ^ value */
+		mask = ~self->mark_mask;
+		osfw_nft_put_meta(self->nlh, NFT_META_MARK);
+		osfw_nft_put_bitwise(self->nlh, &mask, &self->mark, sizeof(mask));
+		osfw_nft_put_meta_set(self->nlh, NFT_META_MARK);
+	} else if (!strcmp(target, "NFQUEUE") || !strcmp(target, OSFW_STR_TARGET_QUEUE)) {
+		elem = osfw_nft_expr_begin(self->nlh, "queue", &data);
+		mnl_attr_put_u16(self->nlh, NFTA_QUEUE_NUM, htons(self->queue_num));
+		mnl_attr_put_u16(self->nlh, NFTA_QUEUE_TOTAL, htons(1));
+		if (self->queue_bypass) {
+			mnl_attr_put_u16(self->nlh, NFTA_QUEUE_FLAGS, htons(NFT_QUEUE_FLAG_BYPASS));
+		}
+		osfw_nft_expr_end(self->nlh, elem, data);
+	} else if (!strcmp(target, "NFLOG") || !strcmp(target, "LOG")) {
+		elem = osfw_nft_expr_begin(self->nlh, "log", &data);
+		if (!strcmp(target, "NFLOG")) {
+			mnl_attr_put_u16(self->nlh, NFTA_LOG_GROUP, htons(self->log_group));
+		}
+		if (self->log_prefix != NULL) {
+			mnl_attr_put_strz(self->nlh, NFTA_LOG_PREFIX, self->log_prefix);
+		}
+		osfw_nft_expr_end(self->nlh, elem, data);
+	} else if (!strcmp(target, "TCPMSS")) {
+		return osfw_nft_target_tcpmss(self);
+	} else {
+		/* Jump to a user defined chain */
+		ds_dlist_foreach(&nftable->chains, nfchain) {
+			if (strcmp(nfchain->chain, target) == 0) break;
+		}
+		if (nfchain == NULL) {
+			return false;
+		}
+		osfw_nft_put_verdict(self->nlh, NFT_JUMP, target);
+	}
+	return true;
+}
+
+/*
+ * Compile an iptables style rule into a NFTA_RULE_EXPRESSIONS payload
+ */
+static bool osfw_nft_rule_compile(struct osfw_nft_table *nftable, struct osfw_nft_rule *nfrule)
+{
+	static char buf[OSFW_NFT_RULE_SIZE];
+	char match[OSFW_SIZE_MATCH];
+	char *argv[OSFW_NFT_RULE_ARGC];
+	struct osfw_nft_match self;
+	struct nlattr *nest;
+	int argc;
+	int ai;
+	int rc;
+
+	STRSCPY(match, nfrule->match);
+	argc = osfw_nft_tokenize(match, argv, ARRAY_LEN(argv));
+	if (argc < 0) {
+		LOGE("Compile OSFW rule: too many arguments: %s", nfrule->match);
+		return false;
+	}
+
+	memset(&self, 0, sizeof(self));
+	self.family = nftable->family;
+	self.l4proto = -1;
+	self.reject_type = NFT_REJECT_ICMP_UNREACH;
+	self.reject_code = (nftable->family == AF_INET6) ? 4 : 3;
+
+	/* Port and flag matches depend on the protocol, wherever it is given */
+	for (ai = 0; ai + 1 < argc; ai++) {
+		if (!strcmp(argv[ai], "-p") || !strcmp(argv[ai], "--protocol")) {
+			if (ai > 0 && !strcmp(argv[ai - 1], "!")) continue;
+			self.l4proto = osfw_nft_proto_parse(argv[ai + 1]);
+		}
+	}
+
+	self.nlh = mnl_nlmsg_put_header(buf);
+	nest = mnl_attr_nest_start(self.nlh, NFTA_RULE_EXPRESSIONS);
+
+	for (ai = 0; ai < argc; ai += rc) {
+		if (self.nlh->nlmsg_len > sizeof(buf) - 1024) {
+			LOGE("Compile OSFW rule: rule too long: %s", nfrule->match);
+			return false;
+		}
+
+		if (!strcmp(argv[ai], "!")) {
+			self.isnegated = true;
+			rc = 1;
+			continue;
+		}
+
+		rc = osfw_nft_match_option(&self, argc - ai, &argv[ai]);
+		if (rc < 0) {
+			LOGE("Compile OSFW rule: unsupported option %s in: %s", argv[ai], nfrule->match);
+			return false;
+		}
+		self.isnegated = false;
+	}
+
+	if (self.isnegated || !osfw_nft_target(&self, nftable, nfrule->target)) {
+		LOGE("Compile OSFW rule: unsupported target %s for: %s", nfrule->target, nfrule->match);
+		return false;
+	}
+	mnl_attr_nest_end(self.nlh, nest);
+
+	nfrule->exprs_len = mnl_attr_get_payload_len(nest);
+	nfrule->exprs = MALLOC(nfrule->exprs_len);
+	memcpy(nfrule->exprs, mnl_attr_get_payload(nest), nfrule->exprs_len);
+	return true;
+}
+
+/*
+ * ===========================================================================
+ *  Netlink batches
+ * ===========================================================================
+ */
+
+static void osfw_nft_batch_begin(struct osfw_nft_batch *self)
+{
+	struct nfgenmsg *nfg;
+	struct nlmsghdr *nlh;
+
+	memset(self, 0, sizeof(*self));
+	self->buf = MALLOC(OSFW_NFT_BATCH_SIZE * 2);
+	self->b = mnl_nlmsg_batch_start(self->buf, OSFW_NFT_BATCH_SIZE);
+
+	nlh = mnl_nlmsg_put_header(mnl_nlmsg_batch_current(self->b));
+	nlh->nlmsg_type = NFNL_MSG_BATCH_BEGIN;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	nlh->nlmsg_seq = ++osfw_nft.seq;
+	nfg = mnl_nlmsg_put_extra_header(nlh, sizeof(*nfg));
+	nfg->nfgen_family = AF_UNSPEC;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(NFNL_SUBSYS_NFTABLES);
+	mnl_nlmsg_batch_next(self->b);
+}
+
+static struct nlmsghdr *osfw_nft_msg_begin(struct osfw_nft_batch *self, int family, int type, uint16_t flags)
+{
+	struct nfgenmsg *nfg;
+	struct nlmsghdr *nlh;
+
+	nlh = mnl_nlmsg_put_header(mnl_nlmsg_batch_current(self->b));
+	nlh->nlmsg_type = (NFNL_SUBSYS_NFTABLES << 8) | type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	nlh->nlmsg_seq = ++osfw_nft.seq;
+	nfg = mnl_nlmsg_put_extra_header(nlh, sizeof(*nfg));
+	nfg->nfgen_family = family;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = 0;
+	return nlh;
+}
+
+static void osfw_nft_msg_end(struct osfw_nft_batch *self)
+{
+	self->nacks++;
+	if (!mnl_nlmsg_batch_next(self->b)) {
+		self->isoverflow = true;
+	}
+}
+
+static void osfw_nft_batch_fini(struct osfw_nft_batch *self)
+{
+	mnl_nlmsg_batch_stop(self->b);
+	FREE(self->buf);
+	if (self->rules != NULL) FREE(self->rules);
+	memset(self, 0, sizeof(*self));
+}
+
+static struct osfw_nft_rule *osfw_nft_batch_find_rule(struct osfw_nft_batch *self, uint32_t seq)
+{
+	size_t ri;
+
+	for (ri = 0; ri < self->nrules; ri++) {
+		if (self->rules[ri]->seq == seq) {
+			return self->rules[ri];
+		}
+	}
+	return NULL;
+}
+
+static int osfw_nft_rule_handle_cb(const struct nlattr *attr, void *data)
+{
+	uint64_t *handle = data;
+
+	if (mnl_attr_get_type(attr) == NFTA_RULE_HANDLE && mnl_attr_validate(attr, MNL_TYPE_U64) >= 0) {
+		*handle = be64toh(mnl_attr_get_u64(attr));
+	}
+	return MNL_CB_OK;
+}
+
+/*
+ * Send a batch and process the kernel replies: acks, errors and the echoed
+ * NEWRULE messages that carry the handles of the new rules
+ */
+static bool osfw_nft_batch_send(struct osfw_nft_batch *self)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct osfw_nft_rule *nfrule;
+	const struct nlmsgerr *err;
+	struct nlmsghdr *nlh;
+	bool errcode = true;
+	uint64_t handle;
+	ssize_t len;
+	int nacks = 0;
+	int rlen;
+
+	nlh = mnl_nlmsg_put_header(mnl_nlmsg_batch_current(self->b));
+	nlh->nlmsg_type = NFNL_MSG_BATCH_END;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	nlh->nlmsg_seq = ++osfw_nft.seq;
+	((struct nfgenmsg *)mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg)))->res_id =
+			htons(NFNL_SUBSYS_NFTABLES);
+	if (!mnl_nlmsg_batch_next(self->b) || self->isoverflow) {
+		LOGE("Send OSFW batch: batch too large");
+		return false;
+	}
+
+	len = mnl_socket_sendto(osfw_nft.mnl, mnl_nlmsg_batch_head(self->b), mnl_nlmsg_batch_size(self->b));
+	if (len < 0) {
+		LOGE("Send OSFW batch: send failed: %d - %s", errno, strerror(errno));
+		return false;
+	}
+
+	while (nacks < self->nacks) {
+		len = mnl_socket_recvfrom(osfw_nft.mnl, buf, sizeof(buf));
+		if (len < 0) {
+			/* The kernel may stop replying after the first error */
+			if (!errcode && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+			LOGE("Send OSFW batch: receive failed: %d - %s", errno, strerror(errno));
+			return false;
+		}
+
+		rlen = (int)len;
+		for (nlh = (struct nlmsghdr *)buf; mnl_nlmsg_ok(nlh, rlen); nlh = mnl_nlmsg_next(nlh, &rlen)) {
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				nacks++;
+				err = mnl_nlmsg_get_payload(nlh);
+				if (err->error == 0) continue;
+
+				errcode = false;
+				nfrule = osfw_nft_batch_find_rule(self, nlh->nlmsg_seq);
+				if (nfrule != NULL) {
+					LOGE("Send OSFW batch: rule %s: -j %s %s failed: %s", nfrule->chain,
+							nfrule->target, nfrule->match, strerror(-err->error));
+				} else {
+					LOGE("Send OSFW batch: message %u failed: %s", nlh->nlmsg_seq,
+							strerror(-err->error));
+				}
+			} else if (NFNL_MSG_TYPE(nlh->nlmsg_type) == NFT_MSG_NEWRULE) {
+				nfrule = osfw_nft_batch_find_rule(self, nlh->nlmsg_seq);
+				if (nfrule == NULL) continue;
+
+				handle = 0;
+				mnl_attr_parse(nlh, sizeof(struct nfgenmsg), osfw_nft_rule_handle_cb, &handle);
+				nfrule->handle = handle;
+			}
+		}
+	}
+	return errcode;
+}
+
+static void osfw_nft_put_table(struct osfw_nft_batch *self, struct osfw_nft_table *nftable, int type)
+{
+	struct nlmsghdr *nlh;
+
+	nlh = osfw_nft_msg_begin(self, nftable->family, type, (type == NFT_MSG_NEWTABLE) ? NLM_F_CREATE : 0);
+	mnl_attr_put_strz(nlh, NFTA_TABLE_NAME, osfw_convert_table(nftable->table));
+	osfw_nft_msg_end(self);
+}
+
+static void osfw_nft_put_chain(struct osfw_nft_batch *self, struct osfw_nft_table *nftable,
+		const char *chain, int type, const struct osfw_nft_hook *hook)
+{
+	struct nlmsghdr *nlh;
+	struct nlattr *nest;
+	uint32_t policy;
+
+	nlh = osfw_nft_msg_begin(self, nftable->family, type, (type == NFT_MSG_NEWCHAIN) ? NLM_F_CREATE : 0);
+	mnl_attr_put_strz(nlh, NFTA_CHAIN_TABLE, osfw_convert_table(nftable->table));
+	mnl_attr_put_strz(nlh, NFTA_CHAIN_NAME, chain);
+
+	if (hook != NULL) {
+		nest = mnl_attr_nest_start(nlh, NFTA_CHAIN_HOOK);
+		mnl_attr_put_u32(nlh, NFTA_HOOK_HOOKNUM, htonl(hook->hooknum));
+		mnl_attr_put_u32(nlh, NFTA_HOOK_PRIORITY, htonl((uint32_t)hook->prio));
+		mnl_attr_nest_end(nlh, nest);
+
+		/* Base chains may only accept or drop, REJECT falls back to DROP */
+		policy = strcmp(hook->policy, OSFW_STR_TARGET_ACCEPT) ? NF_DROP : NF_ACCEPT;
+		mnl_attr_put_u32(nlh, NFTA_CHAIN_POLICY, htonl(policy));
+		mnl_attr_put_strz(nlh, NFTA_CHAIN_TYPE, hook->type);
+	}
+	osfw_nft_msg_end(self);
+}
+
+/*
+ * Recreate a table with its built-in chains only, deleting any previous
+ * content; the add/del/add sequence works whether the table exists or not
+ */
+static void osfw_nft_put_table_reset(struct osfw_nft_batch *self, struct osfw_nft_table *nftable)
+{
+	int hi;
+
+	osfw_nft_put_table(self, nftable, NFT_MSG_NEWTABLE);
+	osfw_nft_put_table(self, nftable, NFT_MSG_DELTABLE);
+	osfw_nft_put_table(self, nftable, NFT_MSG_NEWTABLE);
+
+	for (hi = 0; hi < ARRAY_LEN(osfw_nft_hooks); hi++) {
+		if (osfw_nft_hooks[hi].table != nftable->table) continue;
+		osfw_nft_put_chain(self, nftable, osfw_nft_hooks[hi].chain, NFT_MSG_NEWCHAIN, &osfw_nft_hooks[hi]);
+	}
+}
+
+static void osfw_nft_put_rule_del(struct osfw_nft_batch *self, struct osfw_nft_table *nftable,
+		struct osfw_nft_rule *nfrule)
+{
+	struct nlmsghdr *nlh;
+
+	nlh = osfw_nft_msg_begin(self, nftable->family, NFT_MSG_DELRULE, 0);
+	mnl_attr_put_strz(nlh, NFTA_RULE_TABLE, osfw_convert_table(nftable->table));
+	mnl_attr_put_strz(nlh, NFTA_RULE_CHAIN, nfrule->chain);
+	mnl_attr_put_u64(nlh, NFTA_RULE_HANDLE, htobe64(nfrule->handle));
+	osfw_nft_msg_end(self);
+}
+
+/*
+ * Add a rule before the next installed rule of its chain, or at the end of
+ * the chain. Consecutive new rules thus keep the priority order.
+ */
+static void osfw_nft_put_rule_add(struct osfw_nft_batch *self, struct osfw_nft_table *nftable,
+		struct osfw_nft_rule *nfrule)
+{
+	struct osfw_nft_rule *next;
+	struct nlmsghdr *nlh;
+	uint16_t flags;
+
+	for (next = ds_dlist_next(&nftable->rules, nfrule); next != NULL; next = ds_dlist_next(&nftable->rules, next)) {
+		if (next->handle != 0 && strcmp(next->chain, nfrule->chain) == 0) break;
+	}
+
+	flags = NLM_F_CREATE | NLM_F_ECHO;
+	if (next == NULL) flags |= NLM_F_APPEND;
+
+	nlh = osfw_nft_msg_begin(self, nftable->family, NFT_MSG_NEWRULE, flags);
+	mnl_attr_put_strz(nlh, NFTA_RULE_TABLE, osfw_convert_table(nftable->table));
+	mnl_attr_put_strz(nlh, NFTA_RULE_CHAIN, nfrule->chain);
+	if (next != NULL) {
+		mnl_attr_put_u64(nlh, NFTA_RULE_POSITION, htobe64(next->handle));
+	}
+	mnl_attr_put(nlh, NLA_F_NESTED | NFTA_RULE_EXPRESSIONS, nfrule->exprs_len, nfrule->exprs);
+	nfrule->seq = nlh->nlmsg_seq;
+	osfw_nft_msg_end(self);
+
+	self->rules[self->nrules++] = nfrule;
+}
+
+static bool osfw_nft_socket_open(void)
+{
+	struct timeval tv;
+	int bufsz;
+	int fd;
+
+	if (osfw_nft.mnl != NULL) {
+		return true;
+	}
+
+	osfw_nft.mnl = mnl_socket_open(NETLINK_NETFILTER);
+	if (osfw_nft.mnl == NULL) {
+		LOGE("Open OSFW netlink socket failed: %d - %s", errno, strerror(errno));
+		return false;
+	}
+
+	if (mnl_socket_bind(osfw_nft.mnl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		LOGE("Bind OSFW netlink socket failed: %d - %s", errno, strerror(errno));
+		mnl_socket_close(osfw_nft.mnl);
+		osfw_nft.mnl = NULL;
+		return false;
+	}
+
+	fd = mnl_socket_get_fd(osfw_nft.mnl);
+
+	/* Batches and their echoed rules may exceed the default buffer sizes */
+	bufsz = OSFW_NFT_BATCH_SIZE * 2;
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+
+	tv.tv_sec = OSFW_NFT_RECV_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	osfw_nft.seq = (uint32_t)time(NULL);
+	return true;
+}
+
+static void osfw_nft_socket_close(void)
+{
+	if (osfw_nft.mnl == NULL) {
+		return;
+	}
+	mnl_socket_close(osfw_nft.mnl);
+	osfw_nft.mnl = NULL;
+}
+
+/*
+ * ===========================================================================
+ *  Tables
+ * ===========================================================================
+ */
+
+static void osfw_nft_rule_free(struct osfw_nft_rule *nfrule)
+{
+	if (nfrule->exprs != NULL) FREE(nfrule->exprs);
+	FREE(nfrule);
+}
+
+static bool osfw_nft_table_reset(struct osfw_nft_table *self)
+{
+	struct osfw_nft_batch batch;
+	bool errcode;
+
+	osfw_nft_batch_begin(&batch);
+	osfw_nft_put_table_reset(&batch, self);
+	errcode = osfw_nft_batch_send(&batch);
+	osfw_nft_batch_fini(&batch);
+	return errcode;
+}
+
+static void osfw_nft_table_set(struct osfw_nft_table *self, int family, enum osfw_table table)
+{
+	memset(self, 0, sizeof(*self));
+	self->family = family;
+	self->table = table;
+	ds_dlist_init(&self->chains, struct osfw_nft_chain, elt);
+	ds_dlist_init(&self->chains_del, struct osfw_nft_chain, elt);
+	ds_dlist_init(&self->rules, struct osfw_nft_rule, elt);
+	ds_dlist_init(&self->rules_del, struct osfw_nft_rule, elt);
+	self->issupported = osfw_nft_table_reset(self);
+	if (!self->issupported) {
+		LOGI("OSFW table %s %s is not supported", osfw_convert_family(family), osfw_convert_table(table));
+	}
+}
+
+static void osfw_nft_table_unset(struct osfw_nft_table *self)
+{
+	struct osfw_nft_chain *nfchain;
+	struct osfw_nft_rule *nfrule;
+
+	while ((nfrule = ds_dlist_remove_head(&self->rules)) != NULL) {
+		osfw_nft_rule_free(nfrule);
+	}
+	while ((nfrule = ds_dlist_remove_head(&self->rules_del)) != NULL) {
+		osfw_nft_rule_free(nfrule);
+	}
+	while ((nfchain = ds_dlist_remove_head(&self->chains)) != NULL) {
+		FREE(nfchain);
+	}
+	while ((nfchain = ds_dlist_remove_head(&self->chains_del)) != NULL) {
+		FREE(nfchain);
+	}
+}
+
+static struct osfw_nft_chain *osfw_nft_table_get_chain(struct osfw_nft_table *self, const char *chain)
+{
+	struct osfw_nft_chain *nfchain;
+
+	ds_dlist_foreach(&self->chains, nfchain) {
+		if (strncmp(nfchain->chain, chain, sizeof(nfchain->chain)) == 0) {
+			return nfchain;
+		}
+	}
+	return NULL;
+}
+
+static bool osfw_nft_table_add_chain(struct osfw_nft_table *self, const char *chain)
+{
+	struct osfw_nft_chain *nfchain;
+
+	if (!self->issupported) {
+		LOGE("OSFW table add chain: table %s %s is not supported",
+				osfw_convert_family(self->family), osfw_convert_table(self->table));
+		return false;
+	}
+
+	if (osfw_nft_table_get_chain(self, chain) != NULL) {
+		return true;
+	}
+
+	nfchain = CALLOC(1, sizeof(*nfchain));
+	STRSCPY(nfchain->chain, chain);
+	ds_dlist_insert_tail(&self->chains, nfchain);
+	return true;
+}
+
+static bool osfw_nft_table_del_chain(struct osfw_nft_table *self, const char *chain)
+{
+	struct osfw_nft_chain *nfchain;
+
+	nfchain = osfw_nft_table_get_chain(self, chain);
+	if (!nfchain) {
+		LOGE("Chain not found");
+		return false;
+	}
+
+	ds_dlist_remove(&self->chains, nfchain);
+	if (nfchain->isinstalled) {
+		ds_dlist_insert_tail(&self->chains_del, nfchain);
+	} else {
+		FREE(nfchain);
+	}
+	return true;
+}
+
+static bool osfw_nft_table_add_rule(struct osfw_nft_table *self, const char *chain, int prio,
+		const char *match, const char *target)
+{
+	struct osfw_nft_rule *nfrule;
+	struct osfw_nft_rule *next;
+
+	if (!self->issupported) {
+		LOGE("OSFW table add rule: table %s %s is not supported",
+				osfw_convert_family(self->family), osfw_convert_table(self->table));
+		return false;
+	}
+
+	if (!osfw_is_builtin_chain(self->table, chain) && osfw_nft_table_get_chain(self, chain) == NULL) {
+		LOGE("OSFW table add rule: chain %s not found", chain);
+		return false;
+	}
+
+	nfrule = CALLOC(1, sizeof(*nfrule));
+	STRSCPY(nfrule->chain, chain);
+	nfrule->prio = prio;
+	STRSCPY(nfrule->match, match);
+	STRSCPY(nfrule->target, target);
+
+	if (!osfw_nft_rule_compile(self, nfrule)) {
+		osfw_nft_rule_free(nfrule);
+		return false;
+	}
+
+	ds_dlist_foreach(&self->rules, next) {
+		if (nfrule->prio < next->prio) {
+			break;
+		}
+	}
+	if (next) {
+		ds_dlist_insert_before(&self->rules, next, nfrule);
+	} else {
+		ds_dlist_insert_tail(&self->rules, nfrule);
+	}
+	return true;
+}
+
+static bool osfw_nft_table_del_rule(struct osfw_nft_table *self, const char *chain, int prio,
+		const char *match, const char *target)
+{
+	struct osfw_nft_rule *nfrule;
+
+	ds_dlist_foreach(&self->rules, nfrule) {
+		if (nfrule->prio == prio &&
+				!strncmp(nfrule->chain, chain, sizeof(nfrule->chain)) &&
+				!strncmp(nfrule->match, match, sizeof(nfrule->match)) &&
+				!strncmp(nfrule->target, target, sizeof(nfrule->target))) {
+			break;
+		}
+	}
+	if (!nfrule) {
+		LOGE("Rule not found");
+		return false;
+	}
+
+	ds_dlist_remove(&self->rules, nfrule);
+	if (nfrule->handle != 0) {
+		ds_dlist_insert_tail(&self->rules_del, nfrule);
+	} else {
+		osfw_nft_rule_free(nfrule);
+	}
+	return true;
+}
+
+/*
+ * Forget the kernel state of a table, everything is re-added on next apply
+ */
+static void osfw_nft_table_invalidate(struct osfw_nft_table *self)
+{
+	struct osfw_nft_chain *nfchain;
+	struct osfw_nft_rule *nfrule;
+
+	ds_dlist_foreach(&self->chains, nfchain) {
+		nfchain->isinstalled = false;
+	}
+	ds_dlist_foreach(&self->rules, nfrule) {
+		nfrule->handle = 0;
+	}
+	while ((nfrule = ds_dlist_remove_head(&self->rules_del)) != NULL) {
+		osfw_nft_rule_free(nfrule);
+	}
+	while ((nfchain = ds_dlist_remove_head(&self->chains_del)) != NULL) {
+		FREE(nfchain);
+	}
+}
+
+/*
+ * ===========================================================================
+ *  Families
+ * ===========================================================================
+ */
+
+static void osfw_nft_inet_set(struct osfw_nft_inet *self, int family)
+{
+	int ti;
+
+	memset(self, 0, sizeof(*self));
+	self->family = family;
+	self->ismodified = true;
+	for (ti = 0; ti < OSFW_NFT_TABLE_MAX; ti++) {
+		osfw_nft_table_set(&self->tables[ti], family, (enum osfw_table)ti);
+	}
+}
+
+static void osfw_nft_inet_unset(struct osfw_nft_inet *self)
+{
+	int ti;
+
+	for (ti = 0; ti < OSFW_NFT_TABLE_MAX; ti++) {
+		osfw_nft_table_unset(&self->tables[ti]);
+		if (self->tables[ti].issupported) {
+			osfw_nft_table_reset(&self->tables[ti]);
+		}
+	}
+	self->ismodified = false;
+}
+
+static struct osfw_nft_table *osfw_nft_inet_get_table(struct osfw_nft_inet *self, enum osfw_table table)
+{
+	if ((int)table < 0 || (int)table >= OSFW_NFT_TABLE_MAX) {
+		LOGE("OSFW inet get table: invalid table %d", table);
+		return NULL;
+	}
+	return &self->tables[table];
+}
+
+static bool osfw_nft_inet_apply(struct osfw_nft_inet *self)
+{
+	struct osfw_nft_table *nftable;
+	struct osfw_nft_chain *nfchain;
+	struct osfw_nft_rule *nfrule;
+	struct osfw_nft_batch batch;
+	bool errcode = true;
+	size_t nrules = 0;
+	size_t ri;
+	int ti;
+
+	if (!self->ismodified) {
+		return true;
+	}
+
+	osfw_nft_batch_begin(&batch);
+
+	for (ti = 0; ti < OSFW_NFT_TABLE_MAX; ti++) {
+		nftable = &self->tables[ti];
+		if (!nftable->issupported) continue;
+
+		if (self->isreload) {
+			osfw_nft_table_invalidate(nftable);
+			osfw_nft_put_table_reset(&batch, nftable);
+		}
+		ds_dlist_foreach(&nftable->rules, nfrule) {
+			if (nfrule->handle == 0) nrules++;
+		}
+	}
+	batch.rules = CALLOC(nrules + 1, sizeof(*batch.rules));
+
+	/* New chains first, so that new rules may jump to them */
+	for (ti = 0; ti < OSFW_NFT_TABLE_MAX; ti++) {
+		nftable = &self->tables[ti];
+		ds_dlist_foreach(&nftable->chains, nfchain) {
+			if (nfchain->isinstalled) continue;
+			osfw_nft_put_chain(&batch, nftable, nfchain->chain, NFT_MSG_NEWCHAIN, NULL);
+		}
+	}
+
+	for (ti = 0; ti < OSFW_NFT_TABLE_MAX; ti++) {
+		nftable = &self->tables[ti];
+		ds_dlist_foreach(&nftable->rules_del, nfrule) {
+			osfw_nft_put_rule_del(&batch, nftable, nfrule);
+		}
+		ds_dlist_foreach(&nftable->rules, nfrule) {
+			if (nfrule->handle != 0) continue;
+			osfw_nft_put_rule_add(&batch, nftable, nfrule);
+		}
+	}
+
+	/* Deleted chains last, once their rules are gone */
+	for (ti = 0; ti < OSFW_NFT_TABLE_MAX; ti++) {
+		nftable = &self->tables[ti];
+		ds_dlist_foreach(&nftable->chains_del, nfchain) {
+			osfw_nft_put_chain(&batch, nftable, nfchain->chain, NFT_MSG_DELCHAIN, NULL);
+		}
+	}
+
+	if (batch.nacks == 0) {
+		osfw_nft_batch_fini(&batch);
+		self->ismodified = false;
+		return true;
+	}
+
+	errcode = osfw_nft_batch_send(&batch);
+	if (!errcode) {
+		/* The batch was aborted as a whole, the kernel state is unchanged */
+		for (ri = 0; ri < batch.nrules; ri++) {
+			batch.rules[ri]->handle = 0;
+		}
+		osfw_nft_batch_fini(&batch);
+		LOGE("Apply OSFW %s configuration failed", osfw_convert_family(self->family));
+		return false;
+	}
+
+	self->isreload = false;
+	for (ri = 0; ri < batch.nrules; ri++) {
+		if (batch.rules[ri]->handle == 0) {
+			/* Lost echo, the rule exists but can't be referenced */
+			LOGW("Apply OSFW %s configuration: missing rule handle, reloading",
+					osfw_convert_family(self->family));
+			self->isreload = true;
+		}
+	}
+	osfw_nft_batch_fini(&batch);
+
+	for (ti = 0; ti < OSFW_NFT_TABLE_MAX; ti++) {
+		nftable = &self->tables[ti];
+		ds_dlist_foreach(&nftable->chains, nfchain) {
+			nfchain->isinstalled = true;
+		}
+		while ((nfrule = ds_dlist_remove_head(&nftable->rules_del)) != NULL) {
+			osfw_nft_rule_free(nfrule);
+		}
+		while ((nfchain = ds_dlist_remove_head(&nftable->chains_del)) != NULL) {
+			FREE(nfchain);
+		}
+	}
+
+	self->ismodified = self->isreload;
+	return true;
+}
+
+static struct osfw_nft_inet *osfw_nft_get_inet(int family)
+{
+	switch (family) {
+	case AF_INET:
+		return &osfw_nft.inet;
+
+	case AF_INET6:
+		return &osfw_nft.inet6;
+
+	default:
+		LOGE("OSFW base get table: invalid family %d", family);
+		break;
+	}
+	return NULL;
+}
+
+/*
+ * ===========================================================================
+ *  Public API
+ * ===========================================================================
+ */
+
+bool osfw_init(void)
+{
+	if (!osfw_nft_socket_open()) {
+		LOGE("Initialize OSFW: netlink socket failed");
+		return false;
+	}
+
+	osfw_nft_inet_set(&osfw_nft.inet, AF_INET);
+	osfw_nft_inet_set(&osfw_nft.inet6, AF_INET6);
+
+	if (!osfw_apply()) {
+		LOGE("Initialize OSFW: apply failed");
+		return false;
+	}
+	return true;
+}
+
+bool osfw_fini(void)
+{
+	osfw_nft_inet_unset(&osfw_nft.inet);
+	osfw_nft_inet_unset(&osfw_nft.inet6);
+	osfw_nft_socket_close();
+	return true;
+}
+
+bool osfw_chain_add(int family, enum osfw_table table, const char *chain)
+{
+	struct osfw_nft_table *nftable;
+	struct osfw_nft_inet *nfinet;
+
+	if (!chain || !chain[0]) {
+		LOGE("Add OSFW chain: invalid parameters");
+		return false;
+	} else if (!osfw_is_valid_chain(chain)) {
+		LOGE("Add OSFW chain: %s is not a valid chain", chain);
+		return false;
+	} else if (osfw_is_builtin_chain(table, chain)) {
+		LOGD("Add OSFW chain: %s %s is built-in chain", osfw_convert_table(table), chain);
+		return true;
+	}
+
+	nfinet = osfw_nft_get_inet(family);
+	if (!nfinet) {
+		LOGE("Add OSFW chain: %s not found", osfw_convert_family(family));
+		return false;
+	}
+
+	nftable = osfw_nft_inet_get_table(nfinet, table);
+	if (!nftable || !osfw_nft_table_add_chain(nftable, chain)) {
+		LOGE("Add OSFW chain: add chain failed");
+		return false;
+	}
+
+	nfinet->ismodified = true;
+	return true;
+}
+
+bool osfw_chain_del(int family, enum osfw_table table, const char *chain)
+{
+	struct osfw_nft_table *nftable;
+	struct osfw_nft_inet *nfinet;
+
+	if (!chain || !chain[0]) {
+		LOGE("Delete OSFW chain: invalid parameters");
+		return false;
+	} else if (!osfw_is_valid_chain(chain)) {
+		LOGE("Delete OSFW chain: %s is not a valid chain", chain);
+		return false;
+	} else if (osfw_is_builtin_chain(table, chain)) {
+		LOGD("Delete OSFW chain: %s %s is built-in chain", osfw_convert_table(table), chain);
+		return true;
+	}
+
+	nfinet = osfw_nft_get_inet(family);
+	if (!nfinet) {
+		LOGE("Delete OSFW chain: %s not found", osfw_convert_family(family));
+		return false;
+	}
+
+	nftable = osfw_nft_inet_get_table(nfinet, table);
+	if (!nftable || !osfw_nft_table_del_chain(nftable, chain)) {
+		LOGE("Delete OSFW chain: delete chain failed");
+		return false;
+	}
+
+	nfinet->ismodified = true;
+	return true;
+}
+
+bool osfw_rule_add(int family, enum osfw_table table, const char *chain,
+		int prio, const char *match, const char *target)
+{
+	struct osfw_nft_table *nftable;
+	struct osfw_nft_inet *nfinet;
+
+	if (!chain || !chain[0] || !match || !target || !target[0]) {
+		LOGE("Add OSFW rule: invalid parameters");
+		return false;
+	}
+
+	nfinet = osfw_nft_get_inet(family);
+	if (!nfinet) {
+		LOGE("Add OSFW rule: %s not found", osfw_convert_family(family));
+		return false;
+	}
+
+	nftable = osfw_nft_inet_get_table(nfinet, table);
+	if (!nftable || !osfw_nft_table_add_rule(nftable, chain, prio, match, target)) {
+		LOGE("Add OSFW rule: add rule failed");
+		return false;
+	}
+
+	nfinet->ismodified = true;
+	return true;
+}
+
+bool osfw_rule_del(int family, enum osfw_table table, const char *chain,
+		int prio, const char *match, const char *target)
+{
+	struct osfw_nft_table *nftable;
+	struct osfw_nft_inet *nfinet;
+
+	if (!chain || !chain[0] || !match || !target || !target[0]) {
+		LOGE("Delete OSFW rule: invalid parameters");
+		return false;
+	}
+
+	nfinet = osfw_nft_get_inet(family);
+	if (!nfinet) {
+		LOGE("Delete OSFW rule: %s not found", osfw_convert_family(family));
+		return false;
+	}
+
+	nftable = osfw_nft_inet_get_table(nfinet, table);
+	if (!nftable || !osfw_nft_table_del_rule(nftable, chain, prio, match, target)) {
+		LOGE("Delete OSFW rule: delete rule failed");
+		return false;
+	}
+
+	nfinet->ismodified = true;
+	return true;
+}
+
+bool osfw_apply(void)
+{
+	bool errcode = true;
+
+	if (!osfw_nft_inet_apply(&osfw_nft.inet)) {
+		LOGE("Apply OSFW base: apply OSFW inet failed");
+		errcode = false;
+	}
+
+	if (!osfw_nft_inet_apply(&osfw_nft.inet6)) {
+		LOGE("Apply OSFW base: apply OSFW inet6 failed");
+		errcode = false;
+	}
+
+	if (!errcode) {
+		LOGE("Apply OSFW configuration failed");
+	}
+	return errcode;
+}
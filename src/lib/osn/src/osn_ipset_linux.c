@@ -24,9 +24,17 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <arpa/inet.h>
 #include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 
+#include <libmnl/libmnl.h>
+#include <net/if.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+#include "ds_tree.h"
 #include "execsh.h"
 #include "log.h"
 #include "util.h"
@@ -40,6 +48,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define OSN_IPSET_PENDING_MAX   128
 /** Temporary file name used for `ipset restore` */
 #define OSN_IPSET_RESTORE_FILE  "/tmp/ipset_restore.tmp"
+/** Size of the netlink message buffer, must fit OSN_IPSET_PENDING_MAX entries */
+#define OSN_IPSET_NL_BUF_SZ     32768
+/** Maximum size of a single encoded entry */
+#define OSN_IPSET_NL_ENTRY_SZ   128
 
 struct osn_ipset
 {
@@ -49,13 +61,58 @@ struct osn_ipset
     char               *ips_options;
     /* True if this set has an active temporary set */
     bool                ips_tset;
+    /*
+     * True if ips_members reflects the content of the set (after apply) and
+     * osn_ipset_values_set() can update the set incrementally
+     */
+    bool                ips_synced;
+    /** Current set members, struct osn_ipset_member */
+    ds_tree_t           ips_members;
+};
+
+struct osn_ipset_member
+{
+    char               *im_value;
+    /** Used during osn_ipset_values_set() to mark members that are retained */
+    bool                im_keep;
+    ds_tree_node_t      im_tnode;
+};
+
+/*
+ * Element fields, as they appear (comma separated) in an ipset value
+ */
+enum osn_ipset_field
+{
+    OSN_IPSET_FIELD_END = 0,
+    OSN_IPSET_FIELD_IP,         /* Single IP address */
+    OSN_IPSET_FIELD_NET,        /* IP address with an optional /CIDR */
+    OSN_IPSET_FIELD_IP2,        /* Second single IP address */
+    OSN_IPSET_FIELD_NET2,       /* Second IP address with an optional /CIDR */
+    OSN_IPSET_FIELD_PORT,       /* [PROTO:]PORT */
+    OSN_IPSET_FIELD_PORTNUM,    /* PORT without a protocol */
+    OSN_IPSET_FIELD_MAC,        /* MAC address */
+    OSN_IPSET_FIELD_MARK,       /* Packet mark */
+    OSN_IPSET_FIELD_IFACE       /* Interface name */
 };
 
+#define OSN_IPSET_FIELD_MAX     3
+
 static const char *osn_ipset_type_to_str(enum osn_ipset_type type);
 static bool osn_ipset_options_valid(const char *options);
 static bool osn_ipset_write_restore_file(const char *name, const char *values[], int values_len, bool add);
 static void osn_ipset_tmp_name(char *tmp, size_t tmp_len, const char *name);
 static bool osn_ipset_values_modify(osn_ipset_t *self, bool add, const char *values[], int values_len);
+static bool osn_ipset_values_sync(osn_ipset_t *self, const char *values[], int values_len);
+static void osn_ipset_members_update(osn_ipset_t *self, bool add, const char *values[], int values_len);
+static void osn_ipset_members_clear(osn_ipset_t *self);
+static bool osn_ipset_nl_modify(
+        const char *name,
+        enum osn_ipset_type type,
+        bool add,
+        const char *values[],
+        int values_len);
+static bool osn_ipset_nl_entry_put(struct nlmsghdr *nlh, enum osn_ipset_type type, const char *value);
+static bool osn_ipset_nl_send(struct nlmsghdr *nlh);
 
 static bool osn_ipset_cmd_create(
         const char *name,
@@ -89,6 +146,33 @@ const char *osn_ipset_type_str[] =
     [OSN_IPSET_LIST_SET] = "list:set"
 };
 
+/*
+ * Fields of each ipset type, as they are encoded in netlink messages. Types
+ * without fields (list:set) are always handled by `ipset restore`.
+ */
+static const enum osn_ipset_field osn_ipset_type_fields[][OSN_IPSET_FIELD_MAX] =
+{
+    [OSN_IPSET_BITMAP_IP] = { OSN_IPSET_FIELD_IP },
+    [OSN_IPSET_BITMAPIP_MAC] = { OSN_IPSET_FIELD_IP, OSN_IPSET_FIELD_MAC },
+    [OSN_IPSET_BITMAP_PORT] = { OSN_IPSET_FIELD_PORTNUM },
+    [OSN_IPSET_HASH_IP] = { OSN_IPSET_FIELD_IP },
+    [OSN_IPSET_HASH_MAC] = { OSN_IPSET_FIELD_MAC },
+    [OSN_IPSET_HASH_IP_MAC] = { OSN_IPSET_FIELD_IP, OSN_IPSET_FIELD_MAC },
+    [OSN_IPSET_HASH_NET] = { OSN_IPSET_FIELD_NET },
+    [OSN_IPSET_HASH_NET_NET] = { OSN_IPSET_FIELD_NET, OSN_IPSET_FIELD_NET2 },
+    [OSN_IPSET_HASH_IP_PORT] = { OSN_IPSET_FIELD_IP, OSN_IPSET_FIELD_PORT },
+    [OSN_IPSET_HASH_NET_PORT] = { OSN_IPSET_FIELD_NET, OSN_IPSET_FIELD_PORT },
+    [OSN_IPSET_HASH_IP_PORT_IP] = { OSN_IPSET_FIELD_IP, OSN_IPSET_FIELD_PORT, OSN_IPSET_FIELD_IP2 },
+    [OSN_IPSET_HASH_IP_PORT_NET] = { OSN_IPSET_FIELD_IP, OSN_IPSET_FIELD_PORT, OSN_IPSET_FIELD_NET2 },
+    [OSN_IPSET_HASH_IP_MARK] = { OSN_IPSET_FIELD_IP, OSN_IPSET_FIELD_MARK },
+    [OSN_IPSET_HASH_NET_PORT_NET] = { OSN_IPSET_FIELD_NET, OSN_IPSET_FIELD_PORT, OSN_IPSET_FIELD_NET2 },
+    [OSN_IPSET_HASH_NET_IFACE] = { OSN_IPSET_FIELD_NET, OSN_IPSET_FIELD_IFACE },
+    [OSN_IPSET_LIST_SET] = { OSN_IPSET_FIELD_END }
+};
+
+static struct mnl_socket *osn_ipset_nl_sock = NULL;
+static uint32_t osn_ipset_nl_seq = 0;
+
 /*
  * Global initialization function for ipset, called only once
  */
@@ -127,6 +211,7 @@ osn_ipset_t* osn_ipset_new(
     STRSCPY(self->ips_name, name);
     self->ips_type = type;
     self->ips_options = strdup(options);
+    ds_tree_init(&self->ips_members, ds_str_cmp, struct osn_ipset_member, im_tnode);
 
     return self;
 }
@@ -141,6 +226,7 @@ void osn_ipset_del(osn_ipset_t *self)
         LOG(ERR, "ipset: %s: Error destroying ipset.", self->ips_name);
     }
 
+    osn_ipset_members_clear(self);
     FREE(self->ips_options);
     FREE(self);
 }
@@ -165,6 +251,7 @@ bool osn_ipset_apply(osn_ipset_t *self)
     if (!osn_ipset_cmd_swap(tset, self->ips_name))
     {
         LOG(ERR, "ipset: %s: Error swapping temporary restore set %s.", self->ips_name, tset);
+        self->ips_synced = false;
         return false;
     }
 
@@ -176,7 +263,12 @@ bool osn_ipset_apply(osn_ipset_t *self)
 }
 
 /**
- * Use `ipset swap` to guarantee some atomicity when replacing the values in the set
+ * Replace the values in the set.
+ *
+ * If the current content of the set is known, only the difference is applied
+ * by adding and removing individual members. Otherwise (the initial population
+ * of the set or after an error), use `ipset swap` to guarantee some atomicity
+ * when replacing the values in the set.
  */
 bool osn_ipset_values_set(osn_ipset_t *self, const char *values[], int values_len)
 {
@@ -184,6 +276,13 @@ bool osn_ipset_values_set(osn_ipset_t *self, const char *values[], int values_le
 
     bool retval = false;
 
+    if (self->ips_synced && !self->ips_tset)
+    {
+        if (osn_ipset_values_sync(self, values, values_len)) return true;
+
+        LOG(NOTICE, "ipset: %s: Incremental update failed, rebuilding set.", self->ips_name);
+    }
+
     osn_ipset_tmp_name(tset, sizeof(tset), self->ips_name);
 
     /*
@@ -216,9 +315,18 @@ bool osn_ipset_values_set(osn_ipset_t *self, const char *values[], int values_le
         goto error;
     }
 
+    /*
+     * Sets with a timeout expire members on their own; the member list cannot
+     * be tracked so always use a full rebuild for those.
+     */
+    osn_ipset_members_clear(self);
+    osn_ipset_members_update(self, true, values, values_len);
+    self->ips_synced = (strstr(self->ips_options, "timeout") == NULL);
+
     retval = true;
 
 error:
+    if (!retval) self->ips_synced = false;
 
     if (unlink(OSN_IPSET_RESTORE_FILE) != 0)
     {
@@ -238,9 +346,12 @@ bool osn_ipset_values_add(osn_ipset_t *self, const char *values[], int values_le
     if (!osn_ipset_values_modify(self, true, values, values_len))
     {
         LOG(ERR, "ipset: %s: Error adding values.", self->ips_name);
+        self->ips_synced = false;
         return false;
     }
 
+    osn_ipset_members_update(self, true, values, values_len);
+
     return true;
 }
 
@@ -253,9 +364,12 @@ bool osn_ipset_values_del(osn_ipset_t *self, const char *values[], int values_le
     if (!osn_ipset_values_modify(self, false, values, values_len))
     {
         LOG(ERR, "ipset: %s: Error deleting values.", self->ips_name);
+        self->ips_synced = false;
         return false;
     }
 
+    osn_ipset_members_update(self, false, values, values_len);
+
     return true;
 }
 
@@ -350,6 +464,19 @@ bool osn_ipset_values_modify(osn_ipset_t *self, bool add, const char *values[],
         STRSCPY(tset, self->ips_name);
     }
 
+    if (values_len <= 0) return true;
+
+    /*
+     * Try netlink first; values that cannot be encoded (ranges, per-entry
+     * options, ...) or netlink errors fall back to `ipset restore`. Both
+     * methods use -exist semantics, so re-applying already processed
+     * entries is harmless.
+     */
+    if (osn_ipset_nl_modify(tset, self->ips_type, add, values, values_len))
+    {
+        return true;
+    }
+
     if (!osn_ipset_write_restore_file(tset, values, values_len, add))
     {
         LOG(DEBUG, "ipset: %s: Error writing restore file.", self->ips_name);
@@ -375,6 +502,406 @@ error:
     return retval;
 }
 
+/*
+ * Apply the difference between the current set members and @p values
+ */
+bool osn_ipset_values_sync(osn_ipset_t *self, const char *values[], int values_len)
+{
+    struct osn_ipset_member *im;
+    ds_tree_iter_t iter;
+    int nmembers;
+    int ndel;
+    int nadd;
+    int ii;
+
+    bool retval = false;
+
+    nmembers = 0;
+    ds_tree_foreach(&self->ips_members, im)
+    {
+        im->im_keep = false;
+        nmembers++;
+    }
+
+    const char *vadd[values_len > 0 ? values_len : 1];
+    const char *vdel[nmembers > 0 ? nmembers : 1];
+
+    /*
+     * Mark retained members and insert new ones; the new members are
+     * considered part of the set from now on, which is corrected below in
+     * case of an error
+     */
+    nadd = 0;
+    for (ii = 0; ii < values_len; ii++)
+    {
+        im = ds_tree_find(&self->ips_members, (void *)values[ii]);
+        if (im != NULL)
+        {
+            im->im_keep = true;
+            continue;
+        }
+
+        im = CALLOC(1, sizeof(*im));
+        im->im_value = STRDUP(values[ii]);
+        im->im_keep = true;
+        ds_tree_insert(&self->ips_members, im, im->im_value);
+        vadd[nadd++] = im->im_value;
+    }
+
+    ndel = 0;
+    ds_tree_foreach(&self->ips_members, im)
+    {
+        if (!im->im_keep) vdel[ndel++] = im->im_value;
+    }
+
+    LOG(DEBUG, "ipset: %s: Incremental update, %d added, %d removed.",
+            self->ips_name, nadd, ndel);
+
+    if (!osn_ipset_values_modify(self, false, vdel, ndel))
+    {
+        LOG(DEBUG, "ipset: %s: Error removing stale values.", self->ips_name);
+        goto error;
+    }
+
+    if (!osn_ipset_values_modify(self, true, vadd, nadd))
+    {
+        LOG(DEBUG, "ipset: %s: Error adding new values.", self->ips_name);
+        goto error;
+    }
+
+    retval = true;
+
+error:
+    /* Drop the removed members; on error the whole list is rebuilt by the caller */
+    ds_tree_foreach_iter(&self->ips_members, im, &iter)
+    {
+        if (im->im_keep) continue;
+
+        ds_tree_iremove(&iter);
+        FREE(im->im_value);
+        FREE(im);
+    }
+
+    if (!retval) self->ips_synced = false;
+
+    return retval;
+}
+
+void osn_ipset_members_update(osn_ipset_t *self, bool add, const char *values[], int values_len)
+{
+    struct osn_ipset_member *im;
+    int ii;
+
+    for (ii = 0; ii < values_len; ii++)
+    {
+        im = ds_tree_find(&self->ips_members, (void *)values[ii]);
+        if (add && im == NULL)
+        {
+            im = CALLOC(1, sizeof(*im));
+            im->im_value = STRDUP(values[ii]);
+            ds_tree_insert(&self->ips_members, im, im->im_value);
+        }
+        else if (!add && im != NULL)
+        {
+            ds_tree_remove(&self->ips_members, im);
+            FREE(im->im_value);
+            FREE(im);
+        }
+    }
+}
+
+void osn_ipset_members_clear(osn_ipset_t *self)
+{
+    struct osn_ipset_member *im;
+    ds_tree_iter_t iter;
+
+    ds_tree_foreach_iter(&self->ips_members, im, &iter)
+    {
+        ds_tree_iremove(&iter);
+        FREE(im->im_value);
+        FREE(im);
+    }
+}
+
+/*
+ * Add or remove values using NFNL_SUBSYS_IPSET messages. Up to
+ * OSN_IPSET_PENDING_MAX entries are packed in a single IPSET_CMD_ADD/DEL
+ * message as IPSET_ATTR_DATA elements of an IPSET_ATTR_ADT container.
+ *
+ * Return false if any of the values cannot be encoded or if there was a
+ * netlink error.
+ */
+bool osn_ipset_nl_modify(
+        const char *name,
+        enum osn_ipset_type type,
+        bool add,
+        const char *values[],
+        int values_len)
+{
+    static char buf[OSN_IPSET_NL_BUF_SZ];
+
+    struct nlmsghdr *nlh;
+    struct nfgenmsg *nfg;
+    struct nlattr *nadt;
+    struct nlattr *ndata;
+    int nentries;
+    int ii;
+
+    if (type >= ARRAY_LEN(osn_ipset_type_fields) ||
+            osn_ipset_type_fields[type][0] == OSN_IPSET_FIELD_END)
+    {
+        return false;
+    }
+
+    /* Check that all values can be encoded before sending anything */
+    nlh = mnl_nlmsg_put_header(buf);
+    for (ii = 0; ii < values_len; ii++)
+    {
+        nlh->nlmsg_len = MNL_ALIGN(sizeof(struct nlmsghdr));
+        if (!osn_ipset_nl_entry_put(nlh, type, values[ii]))
+        {
+            LOG(DEBUG, "ipset: %s: Value cannot be sent over netlink: %s", name, values[ii]);
+            return false;
+        }
+    }
+
+    if (osn_ipset_nl_sock == NULL)
+    {
+        osn_ipset_nl_sock = mnl_socket_open(NETLINK_NETFILTER);
+        if (osn_ipset_nl_sock == NULL)
+        {
+            LOG(DEBUG, "ipset: Error opening netlink socket: %s", strerror(errno));
+            return false;
+        }
+
+        if (mnl_socket_bind(osn_ipset_nl_sock, 0, MNL_SOCKET_AUTOPID) < 0)
+        {
+            LOG(DEBUG, "ipset: Error binding netlink socket: %s", strerror(errno));
+            mnl_socket_close(osn_ipset_nl_sock);
+            osn_ipset_nl_sock = NULL;
+            return false;
+        }
+    }
+
+    ii = 0;
+    while (ii < values_len)
+    {
+        nlh = mnl_nlmsg_put_header(buf);
+        nlh->nlmsg_type = (NFNL_SUBSYS_IPSET << 8) | (add ? IPSET_CMD_ADD : IPSET_CMD_DEL);
+        /* Without NLM_F_EXCL the kernel applies -exist semantics */
+        nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+        nlh->nlmsg_seq = ++osn_ipset_nl_seq;
+
+        nfg = mnl_nlmsg_put_extra_header(nlh, sizeof(*nfg));
+        nfg->nfgen_family = AF_UNSPEC;
+        nfg->version = NFNETLINK_V0;
+        nfg->res_id = 0;
+
+        mnl_attr_put_u8(nlh, IPSET_ATTR_PROTOCOL, IPSET_PROTOCOL);
+        mnl_attr_put_strz(nlh, IPSET_ATTR_SETNAME, name);
+        /* IPSET_ATTR_LINENO is mandatory with IPSET_ATTR_ADT */
+        mnl_attr_put_u32(nlh, IPSET_ATTR_LINENO, 0);
+
+        nadt = mnl_attr_nest_start(nlh, IPSET_ATTR_ADT);
+        for (nentries = 0;
+                ii < values_len &&
+                nentries < OSN_IPSET_PENDING_MAX &&
+                nlh->nlmsg_len + OSN_IPSET_NL_ENTRY_SZ < sizeof(buf);
+                nentries++, ii++)
+        {
+            ndata = mnl_attr_nest_start(nlh, IPSET_ATTR_DATA);
+            (void)osn_ipset_nl_entry_put(nlh, type, values[ii]);
+            mnl_attr_put_u32(nlh, IPSET_ATTR_LINENO, ii + 1);
+            mnl_attr_nest_end(nlh, ndata);
+        }
+        mnl_attr_nest_end(nlh, nadt);
+
+        if (!osn_ipset_nl_send(nlh))
+        {
+            LOG(DEBUG, "ipset: %s: Netlink %s of %d values failed: %s (%d)",
+                    name, add ? "add" : "del", nentries, strerror(errno), errno);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Encode a single ipset value; the value is a comma separated list of fields
+ * as used by the `ipset` command line tool
+ */
+bool osn_ipset_nl_entry_put(struct nlmsghdr *nlh, enum osn_ipset_type type, const char *value)
+{
+    char sval[OSN_IPSET_NL_ENTRY_SZ];
+    const enum osn_ipset_field *fields;
+    struct in6_addr addr6;
+    struct in_addr addr4;
+    struct nlattr *nip;
+    unsigned long lval;
+    uint8_t mac[6];
+    int maxcidr;
+    char *pcidr;
+    char *pfield;
+    char *pport;
+    char *psave;
+    char *pend;
+    uint8_t proto;
+    int nmac;
+    int ii;
+
+    /* Per-entry options (timeout, nomatch, ...) are not supported */
+    if (strchr(value, ' ') != NULL) return false;
+
+    if (STRSCPY(sval, value) < 0) return false;
+
+    fields = osn_ipset_type_fields[type];
+
+    pfield = strtok_r(sval, ",", &psave);
+    for (ii = 0; ii < OSN_IPSET_FIELD_MAX && fields[ii] != OSN_IPSET_FIELD_END; ii++)
+    {
+        if (pfield == NULL) return false;
+
+        switch (fields[ii])
+        {
+            case OSN_IPSET_FIELD_IP:
+            case OSN_IPSET_FIELD_NET:
+            case OSN_IPSET_FIELD_IP2:
+            case OSN_IPSET_FIELD_NET2:
+            {
+                bool second = (fields[ii] == OSN_IPSET_FIELD_IP2 || fields[ii] == OSN_IPSET_FIELD_NET2);
+
+                pcidr = strchr(pfield, '/');
+                if (pcidr != NULL)
+                {
+                    if (fields[ii] == OSN_IPSET_FIELD_IP || fields[ii] == OSN_IPSET_FIELD_IP2) return false;
+                    *pcidr++ = '\0';
+                }
+
+                nip = mnl_attr_nest_start(nlh, second ? IPSET_ATTR_IP2 : IPSET_ATTR_IP);
+                if (inet_pton(AF_INET, pfield, &addr4) == 1)
+                {
+                    mnl_attr_put(nlh, IPSET_ATTR_IPADDR_IPV4 | NLA_F_NET_BYTEORDER, sizeof(addr4), &addr4);
+                    maxcidr = 32;
+                }
+                else if (inet_pton(AF_INET6, pfield, &addr6) == 1)
+                {
+                    mnl_attr_put(nlh, IPSET_ATTR_IPADDR_IPV6 | NLA_F_NET_BYTEORDER, sizeof(addr6), &addr6);
+                    maxcidr = 128;
+                }
+                else
+                {
+                    /* IP ranges and host names */
+                    return false;
+                }
+                mnl_attr_nest_end(nlh, nip);
+
+                if (pcidr != NULL)
+                {
+                    lval = strtoul(pcidr, &pend, 10);
+                    if (*pcidr == '\0' || *pend != '\0' || lval > (unsigned long)maxcidr) return false;
+                    mnl_attr_put_u8(nlh, second ? IPSET_ATTR_CIDR2 : IPSET_ATTR_CIDR, lval);
+                }
+                break;
+            }
+
+            case OSN_IPSET_FIELD_PORT:
+            case OSN_IPSET_FIELD_PORTNUM:
+                /* The kernel requires a protocol for hash types; ipset defaults to tcp */
+                proto = IPPROTO_TCP;
+                pport = strchr(pfield, ':');
+                if (pport != NULL)
+                {
+                    if (fields[ii] == OSN_IPSET_FIELD_PORTNUM) return false;
+
+                    *pport++ = '\0';
+                    if (strcmp(pfield, "tcp") == 0)
+                        proto = IPPROTO_TCP;
+                    else if (strcmp(pfield, "udp") == 0)
+                        proto = IPPROTO_UDP;
+                    else if (strcmp(pfield, "sctp") == 0)
+                        proto = IPPROTO_SCTP;
+                    else if (strcmp(pfield, "udplite") == 0)
+                        proto = IPPROTO_UDPLITE;
+                    else
+                        return false;
+                }
+                else
+                {
+                    pport = pfield;
+                }
+
+                /* Port ranges and service names */
+                lval = strtoul(pport, &pend, 10);
+                if (*pport == '\0' || *pend != '\0' || lval > UINT16_MAX) return false;
+
+                mnl_attr_put_u16(nlh, IPSET_ATTR_PORT | NLA_F_NET_BYTEORDER, htons(lval));
+                if (fields[ii] == OSN_IPSET_FIELD_PORT)
+                {
+                    mnl_attr_put_u8(nlh, IPSET_ATTR_PROTO, proto);
+                }
+                break;
+
+            case OSN_IPSET_FIELD_MAC:
+                if (sscanf(pfield, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n",
+                            &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5], &nmac) != 6 ||
+                        pfield[nmac] != '\0')
+                {
+                    return false;
+                }
+                mnl_attr_put(nlh, IPSET_ATTR_ETHER, sizeof(mac), mac);
+                break;
+
+            case OSN_IPSET_FIELD_MARK:
+                lval = strtoul(pfield, &pend, 0);
+                if (*pfield == '\0' || *pend != '\0' || lval > UINT32_MAX) return false;
+                mnl_attr_put_u32(nlh, IPSET_ATTR_MARK | NLA_F_NET_BYTEORDER, htonl(lval));
+                break;
+
+            case OSN_IPSET_FIELD_IFACE:
+                /* physdev: and other prefixes are left to `ipset restore` */
+                if (strchr(pfield, ':') != NULL || strlen(pfield) >= IFNAMSIZ) return false;
+                mnl_attr_put_strz(nlh, IPSET_ATTR_IFACE, pfield);
+                break;
+
+            default:
+                return false;
+        }
+
+        pfield = strtok_r(NULL, ",", &psave);
+    }
+
+    /* Trailing fields */
+    return (pfield == NULL);
+}
+
+/*
+ * Send a request and wait for the acknowledgment; errno is set on error
+ */
+bool osn_ipset_nl_send(struct nlmsghdr *nlh)
+{
+    char buf[MNL_SOCKET_BUFFER_SIZE];
+    uint32_t portid;
+    ssize_t rc;
+
+    if (mnl_socket_sendto(osn_ipset_nl_sock, nlh, nlh->nlmsg_len) < 0)
+    {
+        return false;
+    }
+
+    portid = mnl_socket_get_portid(osn_ipset_nl_sock);
+    do
+    {
+        rc = mnl_socket_recvfrom(osn_ipset_nl_sock, buf, sizeof(buf));
+        if (rc <= 0) return false;
+
+        rc = mnl_cb_run(buf, rc, nlh->nlmsg_seq, portid, NULL, NULL);
+    }
+    while (rc > MNL_CB_STOP);
+
+    return (rc == MNL_CB_STOP);
+}
+
 bool osn_ipset_cmd_create(
         const char *name,
         enum osn_ipset_type type,
@@ -81,9 +81,12 @@ UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_QOS_LINUX),src/osn_qos_linux.c)
 UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_FW_NULL),src/osn_fw_null.c)
 UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_FW_IPTABLES_FULL),src/osn_fw_iptables_full.c)
 UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_FW_IPTABLES_THIN),src/osn_fw_iptables_thin.c)
+UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_FW_NFTABLES),src/osn_fw_nftables.c)
+UNIT_LDFLAGS += $(if $(CONFIG_OSN_BACKEND_FW_NFTABLES),-lmnl)
 
 UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_IPSET_NULL),src/osn_ipset_null.c)
 UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_IPSET_LINUX),src/osn_ipset_linux.c)
+UNIT_LDFLAGS += $(if $(CONFIG_OSN_BACKEND_IPSET_LINUX),-lmnl)
 
 UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_MAPT_NULL),src/osn_mapt_null.c)
 UNIT_SRC += $(if $(CONFIG_OSN_BACKEND_MAPT_CERNET),src/osn_mapt_cernet.c)
@@ -115,6 +118,8 @@ UNIT_SRC += $(if $(CONFIG_OSN_LINUX_IPSET),src/linux/lnx_ipset.c)
 UNIT_SRC += $(if $(CONFIG_OSN_LINUX_PPPOE),src/linux/lnx_pppoe.c)
 UNIT_SRC += $(if $(CONFIG_OSN_LINUX_VLAN),src/linux/lnx_vlan.c)
 UNIT_SRC += $(if $(CONFIG_OSN_LINUX_QOS),src/linux/lnx_qos.c)
+UNIT_SRC += $(if $(CONFIG_OSN_LINUX_QOS_NETLINK),src/linux/lnx_qos_netlink.c)
+UNIT_LDFLAGS += $(if $(CONFIG_OSN_LINUX_QOS_NETLINK),-lmnl)
 UNIT_SRC += $(if $(CONFIG_OSN_LINUX_LTE),src/linux/lnx_lte.c)
 
 UNIT_DEPS += src/lib/daemon
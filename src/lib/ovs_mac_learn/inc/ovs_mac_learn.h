@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define OVS_MAC_LEARN_H_INCLUDED
 #include <stdio.h>
 
+#include "ds_dlist.h"
 #include "ds_tree.h"
 #include "const.h"
 #include "schema.h"
@@ -116,6 +117,17 @@ struct iface_flt_node
     ds_tree_node_t              iface_node;
 };
 
+/*
+ * Pending "fdb/show" requests on the ovs-vswitchd control socket; replies
+ * are received in the same order as requests are sent
+ */
+struct ovsmac_ctl_req
+{
+    int                         req_id;
+    char                        req_bridge[C_IFNAME_LEN];
+    ds_dlist_node_t             req_node;
+};
+
 bool ovs_mac_learning_register(target_mac_learning_cb_t *omac_cb);
 
 #endif /* OVS_MAC_LEARN_H_INCLUDED */
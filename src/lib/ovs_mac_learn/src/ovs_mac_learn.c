@@ -24,13 +24,21 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <regex.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <jansson.h>
 
 #include "const.h"
 #include "log.h"
+#include "ds_dlist.h"
 #include "ds_tree.h"
+#include "json_util.h"
 #include "os_regex.h"
 #include "os_util.h"
 #include "os_nif.h"
@@ -40,10 +48,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ovsdb_sync.h"
 #include "ovs_mac_learn.h"
 #include "memutil.h"
+#include "util.h"
 
 #define MODULE_ID LOG_MODULE_ID_MAIN
 
 #define OVSMAC_PERIODIC_TIMER   5000                    /**< Periodic timer in ms */
+#define OVSMAC_RUNDIR           "/var/run/openvswitch"  /**< Default ovs-vswitchd run directory */
+#define OVSMAC_RUNDIR_ENV       "OVS_RUNDIR"            /**< Environment override, same as for ovs-appctl */
+#define OVSMAC_CTL_CHUNK        4096                    /**< Control socket buffer allocation step */
+#define OVSMAC_CTL_MAX          (1024 * 1024)           /**< Maximum size of a single control socket reply */
 
 
 static ovsdb_update_monitor_t   bridge_mon;
@@ -57,6 +70,19 @@ static ovsdb_update_cbk_t       iface_mon_fn;
 static ev_timer                 ovsmac_timer;                   /* Periodic refresh timer */
 static regex_t                  ovs_appctl_re;
 static bool                     ovsmac_scan_br(char *brif);
+static void                     ovsmac_parse_line(char *brif, char *line);
+
+static int                      ovsmac_ctl_fd = -1;             /* ovs-vswitchd unixctl socket */
+static ev_io                    ovsmac_ctl_watcher;
+static char                    *ovsmac_ctl_buf;                 /* Receive buffer */
+static size_t                   ovsmac_ctl_buf_sz;
+static int                      ovsmac_ctl_id;                  /* Last JSON-RPC request ID */
+
+static bool ovsmac_ctl_open(void);
+static void ovsmac_ctl_close(void);
+static bool ovsmac_ctl_request(char *brif);
+static bool ovsmac_ctl_reply(json_t *js);
+static void ovsmac_ctl_read_fn(struct ev_loop *loop, ev_io *w, int revents);
 
 static ds_key_cmp_t ovsmac_cmp_fn;                              /* Key function for ovsmac_node structure s*/
 
@@ -108,6 +134,10 @@ static ds_tree_t iface_flt_list = DS_TREE_INIT(
         struct iface_flt_node,
         iface_node);
 
+static ds_dlist_t ovsmac_ctl_pending = DS_DLIST_INIT(
+        struct ovsmac_ctl_req,
+        req_node);
+
 target_mac_learning_cb_t *g_mac_learning_cb_t;
 
 /*
@@ -221,8 +251,41 @@ void ovsmac_timer_fn(struct ev_loop *loop, ev_timer *w, int revents)
 
     LOG(DEBUG, "OVSMAC: Periodic.");
 
+    if (!ds_dlist_is_empty(&ovsmac_ctl_pending))
+    {
+        LOG(DEBUG, "OVSMAC: Previous refresh is still in progress.");
+        return;
+    }
+
     ovsmac_node_reset();
 
+    /*
+     * Query the forwarding database directly over the ovs-vswitchd control
+     * socket; the replies are processed asynchronously and the cache is
+     * flushed after the last one is received.
+     */
+    if (ovsmac_ctl_open())
+    {
+        ds_tree_foreach(&bridge_list, br)
+        {
+            if (true != ovsmac_check_bridge_flt(br->br_bridge.name)) continue;
+
+            if (!ovsmac_ctl_request(br->br_bridge.name))
+            {
+                ovsmac_ctl_close();
+                break;
+            }
+        }
+
+        if (ovsmac_ctl_fd >= 0)
+        {
+            if (ds_dlist_is_empty(&ovsmac_ctl_pending)) ovsmac_node_flush();
+            return;
+        }
+
+        LOG(WARN, "OVSMAC: Control socket request failed, using ovs-appctl.");
+    }
+
     ds_tree_foreach(&bridge_list, br)
     {
         if (true == ovsmac_check_bridge_flt(br->br_bridge.name))
@@ -261,75 +324,86 @@ bool ovsmac_scan_br(char *brif)
 
     while (fgets(buf, sizeof(buf), ovs_appctl) != NULL)
     {
-        char *ifname;
-        char sofport[16];
-        char svlan[16];
-        char smac[18];
+        ovsmac_parse_line(brif, buf);
+    }
 
-        regmatch_t rem[16];
+    ret = true;
+err_close:
+    pclose(ovs_appctl);
+    return ret;
+}
 
-        if (regexec(&ovs_appctl_re, buf, ARRAY_LEN(rem), rem, 0) != 0)
-        {
-            LOG(ERR, "Error parsing ovs-appctl output: %s\n", buf);
-            continue;
-        }
+/**
+ * Parse a single line of the "fdb/show" output:
+ *
+ *  port  VLAN  MAC                Age
+ *     1     0  00:11:22:33:44:55    5
+ */
+void ovsmac_parse_line(char *brif, char *line)
+{
+    char *ifname;
+    char sofport[16];
+    char svlan[16];
+    char smac[18];
 
-        os_reg_match_cpy(sofport, sizeof(sofport), buf, rem[1]);
-        os_reg_match_cpy(svlan, sizeof(svlan), buf, rem[2]);
-        os_reg_match_cpy(smac, sizeof(smac), buf, rem[3]);
+    regmatch_t rem[16];
 
-        long ofport;
-        long vlan;
-        os_macaddr_t mac;
+    if (regexec(&ovs_appctl_re, line, ARRAY_LEN(rem), rem, 0) != 0)
+    {
+        LOG(ERR, "Error parsing ovs-appctl output: %s\n", line);
+        return;
+    }
 
-        if (!os_atol(svlan, &vlan))
-        {
-            LOG(ERR, "OVSMAC: ovs-appctl: Invalid VLAN: %s", svlan);
-            continue;
-        }
+    os_reg_match_cpy(sofport, sizeof(sofport), line, rem[1]);
+    os_reg_match_cpy(svlan, sizeof(svlan), line, rem[2]);
+    os_reg_match_cpy(smac, sizeof(smac), line, rem[3]);
 
-        if (!os_nif_macaddr_from_str(&mac, smac))
-        {
-            LOG(ERR, "OVSMAC: Invalid MAC addres: %s", smac);
-            continue;
-        }
+    long ofport;
+    long vlan;
+    os_macaddr_t mac;
 
-        if (strcmp(sofport, "LOCAL") == 0)
-        {
-            ifname = brif;
-        }
-        else
-        {
-            if (!os_atol(sofport, &ofport))
-            {
-                LOG(ERR, "OVSMAC: ovs-appctl: Invalid ofport: %s", sofport);
-                continue;
-            }
+    if (!os_atol(svlan, &vlan))
+    {
+        LOG(ERR, "OVSMAC: ovs-appctl: Invalid VLAN: %s", svlan);
+        return;
+    }
 
-            ifname = ovsmac_find_ofport_name(brif, ofport);
-            if (ifname == NULL)
-            {
-                LOG(ERR, "OVSMAC: Unknown ofport %ld in bridge: %s", ofport, brif);
-                continue;
-            }
-        }
+    if (!os_nif_macaddr_from_str(&mac, smac))
+    {
+        LOG(ERR, "OVSMAC: Invalid MAC addres: %s", smac);
+        return;
+    }
 
-        LOG(DEBUG, "OVSMAC: bridge:%s ofport:%s vlan:%s mac:%s\n", brif, ifname, svlan, smac);
+    if (strcmp(sofport, "LOCAL") == 0)
+    {
+        ifname = brif;
+    }
+    else
+    {
+        if (!os_atol(sofport, &ofport))
+        {
+            LOG(ERR, "OVSMAC: ovs-appctl: Invalid ofport: %s", sofport);
+            return;
+        }
 
-        /*
-         * Check if given interface is in interface filter list
-         * Ethernet clients are connected to eth0 interface
-         */
-        if (true == ovsmac_check_iface_flt(ifname))
+        ifname = ovsmac_find_ofport_name(brif, ofport);
+        if (ifname == NULL)
         {
-            ovsmac_node_update(brif, ifname, vlan, mac);
+            LOG(ERR, "OVSMAC: Unknown ofport %ld in bridge: %s", ofport, brif);
+            return;
         }
     }
 
-    ret = true;
-err_close:
-    pclose(ovs_appctl);
-    return ret;
+    LOG(DEBUG, "OVSMAC: bridge:%s ofport:%s vlan:%s mac:%s\n", brif, ifname, svlan, smac);
+
+    /*
+     * Check if given interface is in interface filter list
+     * Ethernet clients are connected to eth0 interface
+     */
+    if (true == ovsmac_check_iface_flt(ifname))
+    {
+        ovsmac_node_update(brif, ifname, vlan, mac);
+    }
 }
 
 /**
@@ -479,6 +553,292 @@ int ovsmac_cmp_fn(void *_a, void *_b)
     return strcmp(a->hwaddr, b->hwaddr);
 }
 
+/*
+ * ===========================================================================
+ *  ovs-vswitchd control socket (unixctl) functions
+ * ===========================================================================
+ */
+
+/**
+ * Connect to the ovs-vswitchd control socket, the same one used by
+ * ovs-appctl: <rundir>/ovs-vswitchd.<pid>.ctl
+ */
+bool ovsmac_ctl_open(void)
+{
+    struct sockaddr_un addr;
+    char pidfile[C_MAXPATH_LEN];
+    const char *rundir;
+    char *spid;
+    long pid;
+    int fd;
+
+    if (ovsmac_ctl_fd >= 0) return true;
+
+    rundir = getenv(OVSMAC_RUNDIR_ENV);
+    if (rundir == NULL || rundir[0] == '\0') rundir = OVSMAC_RUNDIR;
+
+    snprintf(pidfile, sizeof(pidfile), "%s/ovs-vswitchd.pid", rundir);
+    spid = file_get(pidfile);
+    if (spid == NULL)
+    {
+        LOG(DEBUG, "OVSMAC: Unable to read %s.", pidfile);
+        return false;
+    }
+
+    strchomp(spid, " \r\n");
+    if (!os_atol(spid, &pid))
+    {
+        LOG(ERR, "OVSMAC: Invalid ovs-vswitchd PID: %s", spid);
+        FREE(spid);
+        return false;
+    }
+    FREE(spid);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/ovs-vswitchd.%ld.ctl", rundir, pid) >=
+            (int)sizeof(addr.sun_path))
+    {
+        LOG(ERR, "OVSMAC: Control socket path too long.");
+        return false;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        LOG(ERR, "OVSMAC: Error creating control socket: %s", strerror(errno));
+        return false;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        LOG(DEBUG, "OVSMAC: Error connecting to %s: %s", addr.sun_path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    LOG(INFO, "OVSMAC: Connected to %s.", addr.sun_path);
+
+    ovsmac_ctl_fd = fd;
+    ev_io_init(&ovsmac_ctl_watcher, ovsmac_ctl_read_fn, ovsmac_ctl_fd, EV_READ);
+    ev_io_start(EV_DEFAULT, &ovsmac_ctl_watcher);
+
+    return true;
+}
+
+/**
+ * Close the control socket and drop all pending requests
+ */
+void ovsmac_ctl_close(void)
+{
+    struct ovsmac_ctl_req *req;
+
+    if (ovsmac_ctl_fd < 0) return;
+
+    ev_io_stop(EV_DEFAULT, &ovsmac_ctl_watcher);
+    close(ovsmac_ctl_fd);
+    ovsmac_ctl_fd = -1;
+
+    while ((req = ds_dlist_remove_head(&ovsmac_ctl_pending)) != NULL)
+    {
+        FREE(req);
+    }
+
+    FREE(ovsmac_ctl_buf);
+    ovsmac_ctl_buf = NULL;
+    ovsmac_ctl_buf_sz = 0;
+}
+
+/**
+ * Send a "fdb/show" request for bridge @p brif
+ */
+bool ovsmac_ctl_request(char *brif)
+{
+    struct ovsmac_ctl_req *req;
+    json_t *jreq;
+    char *sreq;
+    ssize_t len;
+    ssize_t rc;
+
+    jreq = json_pack("{s:i, s:s, s:[s]}", "id", ++ovsmac_ctl_id, "method", "fdb/show", "params", brif);
+    if (jreq == NULL)
+    {
+        LOG(ERR, "OVSMAC: Error creating control socket request.");
+        return false;
+    }
+
+    sreq = json_dumps(jreq, JSON_COMPACT);
+    json_decref(jreq);
+    if (sreq == NULL) return false;
+
+    /* The request is small, it is either sent at once or the connection is broken */
+    len = strlen(sreq);
+    rc = send(ovsmac_ctl_fd, sreq, len, MSG_NOSIGNAL);
+    json_free(sreq);
+    if (rc != len)
+    {
+        LOG(ERR, "OVSMAC: Error sending control socket request: %s", rc < 0 ? strerror(errno) : "short write");
+        return false;
+    }
+
+    req = CALLOC(1, sizeof(*req));
+    req->req_id = ovsmac_ctl_id;
+    STRSCPY(req->req_bridge, brif);
+    ds_dlist_insert_tail(&ovsmac_ctl_pending, req);
+
+    return true;
+}
+
+/**
+ * Process a single JSON-RPC reply; the "result" is the same text that
+ * ovs-appctl prints
+ */
+bool ovsmac_ctl_reply(json_t *js)
+{
+    struct ovsmac_ctl_req *req;
+    const char *result;
+    json_t *jst;
+    char *text;
+    char *line;
+    char *save;
+    bool retval;
+
+    req = ds_dlist_remove_head(&ovsmac_ctl_pending);
+    if (req == NULL)
+    {
+        LOG(ERR, "OVSMAC: Unexpected control socket reply.");
+        return false;
+    }
+
+    retval = false;
+
+    jst = json_object_get(js, "id");
+    if (!json_is_integer(jst) || json_integer_value(jst) != req->req_id)
+    {
+        LOG(ERR, "OVSMAC: Control socket reply ID mismatch, expected %d.", req->req_id);
+        goto exit;
+    }
+
+    jst = json_object_get(js, "error");
+    if (jst != NULL && !json_is_null(jst))
+    {
+        LOG(ERR, "OVSMAC: fdb/show %s failed: %s", req->req_bridge,
+                json_is_string(jst) ? json_string_value(jst) : "unknown error");
+        /* Not a transport error, keep the connection */
+        retval = true;
+        goto exit;
+    }
+
+    result = json_string_value(json_object_get(js, "result"));
+    if (result == NULL)
+    {
+        LOG(ERR, "OVSMAC: fdb/show %s: Invalid reply.", req->req_bridge);
+        goto exit;
+    }
+
+    text = STRDUP(result);
+
+    /* Skip the first line (header) */
+    line = strtok_r(text, "\n", &save);
+    while ((line = strtok_r(NULL, "\n", &save)) != NULL)
+    {
+        ovsmac_parse_line(req->req_bridge, line);
+    }
+
+    FREE(text);
+    retval = true;
+
+exit:
+    FREE(req);
+    return retval;
+}
+
+void ovsmac_ctl_read_fn(struct ev_loop *loop, ev_io *w, int revents)
+{
+    (void)loop;
+    (void)w;
+
+    json_error_t jerr;
+    size_t used;
+    ssize_t nr;
+    char *next;
+    char *str;
+    json_t *js;
+    char save;
+
+    if (revents & EV_ERROR)
+    {
+        LOG(ERR, "OVSMAC: Control socket error.");
+        goto error;
+    }
+
+    used = ovsmac_ctl_buf != NULL ? strlen(ovsmac_ctl_buf) : 0;
+    if (ovsmac_ctl_buf_sz - used < OVSMAC_CTL_CHUNK)
+    {
+        if (ovsmac_ctl_buf_sz >= OVSMAC_CTL_MAX)
+        {
+            LOG(ERR, "OVSMAC: Control socket reply too large.");
+            goto error;
+        }
+
+        ovsmac_ctl_buf_sz += OVSMAC_CTL_CHUNK;
+        ovsmac_ctl_buf = REALLOC(ovsmac_ctl_buf, ovsmac_ctl_buf_sz);
+        ovsmac_ctl_buf[used] = '\0';
+    }
+
+    nr = recv(ovsmac_ctl_fd, ovsmac_ctl_buf + used, ovsmac_ctl_buf_sz - used - 1, 0);
+    if (nr < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (nr <= 0)
+    {
+        LOG(INFO, "OVSMAC: Control socket closed: %s", nr == 0 ? "EOF" : strerror(errno));
+        goto error;
+    }
+
+    used += nr;
+    ovsmac_ctl_buf[used] = '\0';
+
+    str = ovsmac_ctl_buf;
+    while ((next = json_split(str)) != NULL)
+    {
+        if (next == JSON_SPLIT_ERROR)
+        {
+            LOG(ERR, "OVSMAC: Error parsing control socket reply.");
+            goto error;
+        }
+
+        save = *next;
+        *next = '\0';
+        js = json_loads(str, 0, &jerr);
+        *next = save;
+
+        if (js == NULL)
+        {
+            LOG(ERR, "OVSMAC: Error parsing control socket reply: %s", jerr.text);
+            goto error;
+        }
+
+        if (!ovsmac_ctl_reply(js))
+        {
+            json_decref(js);
+            goto error;
+        }
+
+        json_decref(js);
+        str = next;
+    }
+
+    memmove(ovsmac_ctl_buf, str, strlen(str) + 1);
+
+    /* All bridges were scanned, remove stale entries */
+    if (ds_dlist_is_empty(&ovsmac_ctl_pending)) ovsmac_node_flush();
+
+    return;
+
+error:
+    /* Keep the current cache, the next refresh reconnects */
+    ovsmac_ctl_close();
+}
+
 /*
  * ===========================================================================
  *  Bridge table functions
@@ -37,6 +37,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "schema.h"
 #include "log.h"
 #include "ds_tree.h"
+#include "os_types.h"
 
 
 
@@ -128,11 +129,33 @@ struct om_mapping_tle_flag
 
 #define OM_TLE_VAR_FLAGS(x)     (x & (OM_TLE_FLAG_LOCAL | OM_TLE_FLAG_DEVICE | OM_TLE_FLAG_CLOUD))
 
+/*
+ * Binary form of a tag value. MACs are stored with the AF_PACKET family,
+ * IP addresses with AF_INET or AF_INET6.
+ */
+typedef struct {
+    uint8_t         family;
+    uint8_t         flags;
+    uint8_t         addr[16];
+} om_tag_bin_entry_t;
+
+/*
+ * Open addressing hash set of the tag values which parse as a MAC or an
+ * IP address. Rebuilt each time the tag values change.
+ */
+typedef struct {
+    om_tag_bin_entry_t  *entries;
+    size_t              size;   // Number of slots, power of 2
+    size_t              count;
+} om_tag_bin_set_t;
+
 typedef struct {
     char            *name;
     bool            group;
 
     ds_tree_t       values; // Tree of om_tag_list_entry_t
+    om_tag_bin_set_t
+                    bin_values;
 
     ds_tree_node_t  dst_node;
 } om_tag_t;
@@ -161,6 +184,123 @@ struct tag_mgr {
 };
 
 extern void om_tag_init(struct tag_mgr *mgr);
+
+/**
+ * @brief return the tags generation counter
+ *
+ * The counter changes each time a tag is added, removed or updated,
+ * group tags included. Callers caching the outcome of tag lookups
+ * compare it to detect stale results.
+ */
+extern uint32_t om_tag_get_generation(void);
+
+/******************************************************************************
+ * Tag Handle Definitions
+ *****************************************************************************/
+
+/*
+ * Longest tag or group name, as bounded by the Openflow_Tag schema
+ */
+#define OM_TAG_NAME_MAX         64
+
+/*
+ * Interned tag reference, such as "${@my_tag}". The handle keeps the parsed
+ * name, group and source flags of the reference, and points to the tag
+ * while it exists. Handles are reference counted: each om_tag_handle_get()
+ * is paired with an om_tag_handle_put() when the configuration holding the
+ * handle goes away.
+ */
+typedef struct {
+    char            *ref;
+    char            *name;
+    bool            group;
+    uint8_t         match_flags;
+    int             refcount;
+    om_tag_t        *tag;   // NULL while the tag is not configured
+
+    ds_tree_node_t  dst_node;
+} om_tag_handle_t;
+
+extern void     om_tag_handles_resolve(om_tag_t *tag);
+extern void     om_tag_handles_unresolve(om_tag_t *tag);
+extern void     om_tag_bin_set_build(om_tag_t *tag);
+extern void     om_tag_bin_set_free(om_tag_bin_set_t *set);
+
+/**
+ * @brief return the interned handle of a tag reference
+ *
+ * Meant to be called when a rule is configured. The handle follows the
+ * tag through its additions, updates and removals. The caller owns a
+ * reference to the handle and releases it with om_tag_handle_put().
+ * @param tag_ref the tag reference, i.e. ${tag} or $[group]
+ * @return the handle, NULL if tag_ref is not a tag reference
+ */
+om_tag_handle_t *
+om_tag_handle_get(char *tag_ref);
+
+/**
+ * @brief releases a reference to a handle
+ *
+ * The handle is freed with its last reference.
+ * @param handle the handle returned by om_tag_handle_get()
+ */
+void
+om_tag_handle_put(om_tag_handle_t *handle);
+
+/**
+ * @brief resolves a tag reference without interning it
+ *
+ * Meant for one off lookups, such as om_tag_find() and om_tag_in().
+ * @param tag_ref the tag reference, i.e. ${tag} or $[group]
+ * @param match_flags if not NULL, set to the source flags of the reference
+ * @return the tag, NULL if not configured or not a tag reference
+ */
+om_tag_t *
+om_tag_ref_lookup(char *tag_ref, uint8_t *match_flags);
+
+/**
+ * @brief checks if a tag reference designates a tag
+ *
+ * Works on the parsed reference, so it can be used from the tag update
+ * callback while the tag is being added or removed.
+ * @param tag_ref the tag reference, i.e. ${tag} or $[group]
+ * @param tag the tag
+ * @param match_flags if not NULL, set to the source flags of the reference
+ * @return true if the reference designates the tag
+ */
+bool
+om_tag_ref_matches(char *tag_ref, om_tag_t *tag, uint8_t *match_flags);
+
+/**
+ * @brief checks if a string is included in the tag of a handle
+ *
+ * @param handle the tag handle
+ * @param value the string checked for inclusion
+ */
+bool
+om_tag_handle_in(om_tag_handle_t *handle, char *value);
+
+/**
+ * @brief checks if a binary MAC is included in the tag of a handle
+ *
+ * Constant time lookup in the tag's binary value set.
+ * @param handle the tag handle
+ * @param mac the MAC checked for inclusion
+ */
+bool
+om_tag_handle_in_mac(om_tag_handle_t *handle, os_macaddr_t *mac);
+
+/**
+ * @brief checks if a binary IP address is included in the tag of a handle
+ *
+ * Constant time lookup in the tag's binary value set.
+ * @param handle the tag handle
+ * @param family AF_INET or AF_INET6
+ * @param addr the address in network order
+ */
+bool
+om_tag_handle_in_ip(om_tag_handle_t *handle, int family, const void *addr);
+
 /******************************************************************************
  * Tag Group Definitions
  *****************************************************************************/
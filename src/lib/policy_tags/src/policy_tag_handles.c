@@ -0,0 +1,468 @@
+/*
+Copyright (c) 2015, Plume Design Inc. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+   3. Neither the name of the Plume Design Inc. nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL Plume Design Inc. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Interned tag handles and binary tag value sets
+ */
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "memutil.h"
+#include "policy_tags.h"
+
+#define OM_TAG_BIN_MIN_SIZE     8
+
+/*
+ * Interned handles, keyed by the tag reference string
+ */
+static ds_tree_t om_tag_handles = DS_TREE_INIT((ds_key_cmp_t *)strcmp,
+                                               om_tag_handle_t, dst_node);
+
+/******************************************************************************
+ * Binary value sets
+ *****************************************************************************/
+
+static size_t
+om_tag_bin_addr_len(int family)
+{
+    if (family == AF_INET) return 4;
+    if (family == AF_INET6) return 16;
+
+    return sizeof(os_macaddr_t);
+}
+
+static uint32_t
+om_tag_bin_hash(int family, const uint8_t *addr)
+{
+    uint32_t hash;
+    size_t len;
+    size_t i;
+
+    /* FNV-1a */
+    hash = 2166136261u ^ (uint8_t)family;
+    hash *= 16777619u;
+
+    len = om_tag_bin_addr_len(family);
+    for (i = 0; i < len; i++)
+    {
+        hash ^= addr[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @brief parses a mac in the xx:xx:xx:xx:xx:xx form, any case
+ */
+static bool
+om_tag_bin_parse_mac(const char *str, uint8_t *addr)
+{
+    int consumed;
+    int rc;
+
+    consumed = 0;
+    rc = sscanf(str, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n",
+                &addr[0], &addr[1], &addr[2], &addr[3], &addr[4], &addr[5],
+                &consumed);
+    if (rc != 6) return false;
+
+    return (consumed == 17 && str[consumed] == '\0');
+}
+
+/**
+ * @brief converts a tag value string into its binary form
+ *
+ * @return true if the value is a mac or an ip address
+ */
+static bool
+om_tag_bin_parse(const char *str, om_tag_bin_entry_t *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+
+    if (om_tag_bin_parse_mac(str, entry->addr))
+    {
+        entry->family = AF_PACKET;
+        return true;
+    }
+
+    if (inet_pton(AF_INET, str, entry->addr) == 1)
+    {
+        entry->family = AF_INET;
+        return true;
+    }
+
+    if (inet_pton(AF_INET6, str, entry->addr) == 1)
+    {
+        entry->family = AF_INET6;
+        return true;
+    }
+
+    return false;
+}
+
+static om_tag_bin_entry_t *
+om_tag_bin_lookup(om_tag_bin_set_t *set, int family, const uint8_t *addr)
+{
+    om_tag_bin_entry_t *entry;
+    size_t mask;
+    size_t len;
+    size_t idx;
+
+    if (set->count == 0) return NULL;
+
+    len = om_tag_bin_addr_len(family);
+    mask = set->size - 1;
+    idx = om_tag_bin_hash(family, addr) & mask;
+
+    /* The set is never full, an empty slot ends the probe */
+    for (entry = &set->entries[idx]; entry->family != 0;
+         idx = (idx + 1) & mask, entry = &set->entries[idx])
+    {
+        if (entry->family != family) continue;
+        if (memcmp(entry->addr, addr, len) == 0) return entry;
+    }
+
+    return NULL;
+}
+
+static void
+om_tag_bin_insert(om_tag_bin_set_t *set, om_tag_bin_entry_t *new)
+{
+    om_tag_bin_entry_t *entry;
+    size_t mask;
+    size_t idx;
+
+    entry = om_tag_bin_lookup(set, new->family, new->addr);
+    if (entry != NULL)
+    {
+        /* Same address spelled differently, merge the sources */
+        entry->flags |= new->flags;
+        return;
+    }
+
+    mask = set->size - 1;
+    idx = om_tag_bin_hash(new->family, new->addr) & mask;
+    while (set->entries[idx].family != 0) idx = (idx + 1) & mask;
+
+    set->entries[idx] = *new;
+    set->count++;
+}
+
+/**
+ * @brief releases a binary value set
+ */
+void
+om_tag_bin_set_free(om_tag_bin_set_t *set)
+{
+    if (set->entries != NULL) FREE(set->entries);
+    memset(set, 0, sizeof(*set));
+}
+
+/**
+ * @brief (re)builds the binary value set of a tag from its values
+ *
+ * Called each time the tag values change.
+ * @param tag the tag
+ */
+void
+om_tag_bin_set_build(om_tag_t *tag)
+{
+    om_tag_bin_set_t *set;
+    om_tag_list_entry_t *tle;
+    om_tag_bin_entry_t entry;
+    size_t nvalues;
+    size_t size;
+
+    set = &tag->bin_values;
+    om_tag_bin_set_free(set);
+
+    nvalues = 0;
+    ds_tree_foreach(&tag->values, tle) nvalues++;
+    if (nvalues == 0) return;
+
+    /* Keep the load factor at or below 1/2 */
+    size = OM_TAG_BIN_MIN_SIZE;
+    while (size < (nvalues * 2)) size <<= 1;
+
+    set->entries = CALLOC(size, sizeof(*set->entries));
+    set->size = size;
+
+    ds_tree_foreach(&tag->values, tle)
+    {
+        if (!om_tag_bin_parse(tle->value, &entry)) continue;
+
+        entry.flags = tle->flags;
+        om_tag_bin_insert(set, &entry);
+    }
+
+    LOGT("%s: %s%s: %zu binary values out of %zu", __func__,
+         tag->group ? "group " : "", tag->name, set->count, nvalues);
+}
+
+/******************************************************************************
+ * Tag handles
+ *****************************************************************************/
+
+/**
+ * @brief points the handles referencing the tag to it
+ *
+ * Called when the tag is added.
+ * @param tag the added tag
+ */
+void
+om_tag_handles_resolve(om_tag_t *tag)
+{
+    om_tag_handle_t *handle;
+
+    ds_tree_foreach(&om_tag_handles, handle)
+    {
+        if (handle->group != tag->group) continue;
+        if (strcmp(handle->name, tag->name) != 0) continue;
+
+        handle->tag = tag;
+    }
+}
+
+/**
+ * @brief detaches the handles referencing the tag
+ *
+ * Called when the tag is removed.
+ * @param tag the removed tag
+ */
+void
+om_tag_handles_unresolve(om_tag_t *tag)
+{
+    om_tag_handle_t *handle;
+
+    ds_tree_foreach(&om_tag_handles, handle)
+    {
+        if (handle->tag == tag) handle->tag = NULL;
+    }
+}
+
+/**
+ * @brief splits a tag reference in its name, group and source flags
+ *
+ * @param tag_ref the tag reference, i.e. ${tag} or $[group]
+ * @param group set to true for a group reference
+ * @param match_flags set to the source flags of the reference
+ * @param name_len set to the length of the name
+ * @return the start of the name within tag_ref, NULL if not a tag reference
+ */
+static char *
+om_tag_ref_parse(char *tag_ref, bool *group, uint8_t *match_flags,
+                 size_t *name_len)
+{
+    int tag_type;
+    char *tag_s;
+    size_t len;
+
+    tag_type = om_tag_get_type(tag_ref);
+    if (tag_type == NOT_A_OPENSYNC_TAG) return NULL;
+
+    *group = (tag_type == OPENSYNC_GROUP_TAG);
+    *match_flags = 0;
+
+    tag_s = tag_ref + 2;
+    if (*tag_s == TEMPLATE_DEVICE_CHAR) *match_flags = OM_TLE_FLAG_DEVICE;
+    else if (*tag_s == TEMPLATE_CLOUD_CHAR) *match_flags = OM_TLE_FLAG_CLOUD;
+    else if (*tag_s == TEMPLATE_LOCAL_CHAR) *match_flags = OM_TLE_FLAG_LOCAL;
+    if (*match_flags != 0) tag_s += 1;
+
+    /* Skip the end marker */
+    len = strlen(tag_s);
+    *name_len = (len > 0 ? len - 1 : 0);
+
+    return tag_s;
+}
+
+om_tag_t *
+om_tag_ref_lookup(char *tag_ref, uint8_t *match_flags)
+{
+    om_tag_handle_t *handle;
+    char name[OM_TAG_NAME_MAX];
+    uint8_t flags;
+    size_t len;
+    bool group;
+    char *tag_s;
+
+    if (tag_ref == NULL) return NULL;
+
+    /* Rules referencing the tag already resolved it */
+    handle = ds_tree_find(&om_tag_handles, tag_ref);
+    if (handle != NULL)
+    {
+        if (match_flags != NULL) *match_flags = handle->match_flags;
+        return handle->tag;
+    }
+
+    tag_s = om_tag_ref_parse(tag_ref, &group, &flags, &len);
+    if (tag_s == NULL) return NULL;
+
+    /* Longer names can not be configured */
+    if (len >= sizeof(name)) return NULL;
+
+    memcpy(name, tag_s, len);
+    name[len] = '\0';
+
+    if (match_flags != NULL) *match_flags = flags;
+
+    return om_tag_find_by_name(name, group);
+}
+
+bool
+om_tag_ref_matches(char *tag_ref, om_tag_t *tag, uint8_t *match_flags)
+{
+    uint8_t flags;
+    size_t len;
+    bool group;
+    char *tag_s;
+
+    if (tag_ref == NULL) return false;
+    if (tag == NULL) return false;
+
+    tag_s = om_tag_ref_parse(tag_ref, &group, &flags, &len);
+    if (tag_s == NULL) return false;
+
+    if (group != tag->group) return false;
+    if (strlen(tag->name) != len) return false;
+    if (strncmp(tag_s, tag->name, len) != 0) return false;
+
+    if (match_flags != NULL) *match_flags = flags;
+
+    return true;
+}
+
+om_tag_handle_t *
+om_tag_handle_get(char *tag_ref)
+{
+    om_tag_handle_t *handle;
+    uint8_t flags;
+    size_t len;
+    bool group;
+    char *tag_s;
+
+    if (tag_ref == NULL) return NULL;
+
+    handle = ds_tree_find(&om_tag_handles, tag_ref);
+    if (handle != NULL)
+    {
+        handle->refcount++;
+        return handle;
+    }
+
+    tag_s = om_tag_ref_parse(tag_ref, &group, &flags, &len);
+    if (tag_s == NULL) return NULL;
+
+    handle = CALLOC(1, sizeof(*handle));
+    handle->group = group;
+    handle->match_flags = flags;
+    handle->name = CALLOC(1, len + 1);
+    memcpy(handle->name, tag_s, len);
+
+    handle->ref = STRDUP(tag_ref);
+    handle->refcount = 1;
+    handle->tag = om_tag_find_by_name(handle->name, handle->group);
+    ds_tree_insert(&om_tag_handles, handle, handle->ref);
+
+    LOGD("%s: interned %s, tag %s", __func__, tag_ref,
+         handle->tag != NULL ? "present" : "absent");
+
+    return handle;
+}
+
+void
+om_tag_handle_put(om_tag_handle_t *handle)
+{
+    if (handle == NULL) return;
+
+    handle->refcount--;
+    if (handle->refcount > 0) return;
+
+    LOGD("%s: released %s", __func__, handle->ref);
+
+    ds_tree_remove(&om_tag_handles, handle);
+    FREE(handle->ref);
+    FREE(handle->name);
+    FREE(handle);
+}
+
+bool
+om_tag_handle_in(om_tag_handle_t *handle, char *value)
+{
+    om_tag_list_entry_t *e;
+
+    if (handle == NULL) return false;
+    if (handle->tag == NULL) return false;
+    if (value == NULL) return false;
+
+    e = om_tag_list_entry_find_by_value(&handle->tag->values, value);
+    if (e == NULL) return false;
+
+    if (handle->match_flags && !(e->flags & handle->match_flags)) return false;
+
+    return true;
+}
+
+bool
+om_tag_handle_in_mac(om_tag_handle_t *handle, os_macaddr_t *mac)
+{
+    om_tag_bin_entry_t *e;
+
+    if (handle == NULL) return false;
+    if (handle->tag == NULL) return false;
+    if (mac == NULL) return false;
+
+    e = om_tag_bin_lookup(&handle->tag->bin_values, AF_PACKET, mac->addr);
+    if (e == NULL) return false;
+
+    if (handle->match_flags && !(e->flags & handle->match_flags)) return false;
+
+    return true;
+}
+
+bool
+om_tag_handle_in_ip(om_tag_handle_t *handle, int family, const void *addr)
+{
+    om_tag_bin_entry_t *e;
+
+    if (handle == NULL) return false;
+    if (handle->tag == NULL) return false;
+    if (addr == NULL) return false;
+    if (family != AF_INET && family != AF_INET6) return false;
+
+    e = om_tag_bin_lookup(&handle->tag->bin_values, family, addr);
+    if (e == NULL) return false;
+
+    if (handle->match_flags && !(e->flags & handle->match_flags)) return false;
+
+    return true;
+}
@@ -55,17 +55,36 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /******************************************************************************
  * Local Variables
  *****************************************************************************/
-static ds_tree_t            om_tags = DS_TREE_INIT((ds_key_cmp_t *)strcmp,
-                                                                   om_tag_t, dst_node);
+static int om_tag_cmp(const void *a, const void *b);
+
+static ds_tree_t            om_tags = DS_TREE_INIT(om_tag_cmp,
+                                                   om_tag_t, dst_node);
 
 
 static struct tag_mgr my_mgr_s = { 0 };
 static struct tag_mgr *my_mgr = &my_mgr_s;
 
+// Bumped on every tag change, lets users detect stale cached lookups
+static uint32_t             om_tags_generation = 0;
+
 /******************************************************************************
  * Local Functions
  *****************************************************************************/
 
+// Tags are keyed by name and group, a tag and a group may share a name
+static int
+om_tag_cmp(const void *a, const void *b)
+{
+    const om_tag_t      *tag_a = a;
+    const om_tag_t      *tag_b = b;
+    int                 rc;
+
+    rc = strcmp(tag_a->name, tag_b->name);
+    if (rc != 0) return rc;
+
+    return (int)tag_a->group - (int)tag_b->group;
+}
+
 // Fill in a tag list from schema
 static bool
 om_tag_add_list_from_schema(ds_tree_t *list, struct schema_Openflow_Tag *stag)
@@ -192,6 +211,7 @@ om_tag_free(om_tag_t *tag)
             om_tag_list_entry_free(vp);
             vp = ds_tree_inext(&iter);
         }
+        om_tag_bin_set_free(&tag->bin_values);
 
         // Name
         FREE(tag->name);
@@ -244,15 +264,12 @@ alloc_err:
 om_tag_t *
 om_tag_find_by_name(const char *name, bool group)
 {
-    om_tag_t            *tag;
+    om_tag_t            key;
 
-    ds_tree_foreach(&om_tags, tag) {
-        if (!strcmp(tag->name, name) && tag->group == group) {
-            return tag;
-        }
-    }
+    key.name = (char *)name;
+    key.group = group;
 
-    return NULL;
+    return ds_tree_find(&om_tags, &key);
 }
 
 // Add a tag to the global tree
@@ -267,7 +284,10 @@ om_tag_add(om_tag_t *tag)
         return false;
     }
 
-    ds_tree_insert(&om_tags, tag, tag->name);
+    ds_tree_insert(&om_tags, tag, tag);
+    om_tag_bin_set_build(tag);
+    om_tag_handles_resolve(tag);
+    om_tags_generation++;
 
     om_tag_list_to_buf(&tag->values, 0, dbuf, sizeof(dbuf)-1);
     LOGN("[%s] %sTag added, values:%s",
@@ -290,6 +310,8 @@ om_tag_remove(om_tag_t *tag)
     char                dbuf[2048];
 
     ds_tree_remove(&om_tags, tag);
+    om_tag_handles_unresolve(tag);
+    om_tags_generation++;
 
     om_tag_list_to_buf(&tag->values, 0, dbuf, sizeof(dbuf)-1);
     LOGN("[%s] %sTag removed, values:%s",
@@ -340,6 +362,8 @@ om_tag_update(om_tag_t *tag, ds_tree_t *new_values)
         LOGE("[%s] Failed to allocate memory to apply diff for update", tag->name);
         ret = false;
     }
+    om_tag_bin_set_build(tag);
+    om_tags_generation++;
 
     om_tag_list_diff_free(&diff);
 
@@ -467,6 +491,13 @@ om_local_tag_update_from_schema(struct schema_Openflow_Local_Tag *stag)
     return ret;
 }
 
+// Return the tags generation counter
+uint32_t
+om_tag_get_generation(void)
+{
+    return om_tags_generation;
+}
+
 void
 om_tag_init(struct tag_mgr *mgr) {
     memcpy(&my_mgr_s, mgr, sizeof(my_mgr_s));
@@ -24,6 +24,8 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <arpa/inet.h>
+
 #include "json_util.h"
 #include "log.h"
 #include "policy_tags.h"
@@ -348,6 +350,159 @@ void test_val_in_tag_group(void)
 }
 
 
+void
+test_tag_handles(void)
+{
+    struct schema_Openflow_Tag stag;
+    om_tag_handle_t *handle_group;
+    om_tag_handle_t *handle_dev;
+    om_tag_handle_t *handle;
+    os_macaddr_t mac;
+    uint8_t ip6[16];
+    uint32_t ip4;
+    bool ret;
+
+    memset(&stag, 0, sizeof(stag));
+    stag.name_exists = true;
+    STRSCPY(stag.name, "bin_tag");
+    stag.device_value_len = 2;
+    STRSCPY(stag.device_value[0], "AA:bb:cc:dd:ee:01");
+    STRSCPY(stag.device_value[1], "10.1.2.3");
+    stag.cloud_value_len = 1;
+    STRSCPY(stag.cloud_value[0], "2001:db8::1");
+
+    /* Not a tag reference */
+    handle = om_tag_handle_get("bin_tag");
+    TEST_ASSERT_NULL(handle);
+
+    /* Handles can be interned before the tag exists */
+    handle = om_tag_handle_get("${bin_tag}");
+    TEST_ASSERT_NOT_NULL(handle);
+    TEST_ASSERT_NULL(handle->tag);
+    TEST_ASSERT_TRUE(handle == om_tag_handle_get("${bin_tag}"));
+    TEST_ASSERT_EQUAL_INT(2, handle->refcount);
+    om_tag_handle_put(handle);
+
+    handle_dev = om_tag_handle_get("${@bin_tag}");
+    TEST_ASSERT_NOT_NULL(handle_dev);
+    TEST_ASSERT_FALSE(handle == handle_dev);
+
+    mac.addr[0] = 0xaa; mac.addr[1] = 0xbb; mac.addr[2] = 0xcc;
+    mac.addr[3] = 0xdd; mac.addr[4] = 0xee; mac.addr[5] = 0x01;
+    ip4 = htonl(0x0a010203);
+    inet_pton(AF_INET6, "2001:db8:0:0::1", ip6);
+
+    TEST_ASSERT_FALSE(om_tag_handle_in_mac(handle, &mac));
+
+    /* The tag addition resolves the handles */
+    ret = om_tag_add_from_schema(&stag);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_NOT_NULL(handle->tag);
+    TEST_ASSERT_TRUE(handle->tag == handle_dev->tag);
+
+    /* Binary lookups are case and spelling independent */
+    TEST_ASSERT_TRUE(om_tag_handle_in_mac(handle, &mac));
+    TEST_ASSERT_TRUE(om_tag_handle_in_ip(handle, AF_INET, &ip4));
+    TEST_ASSERT_TRUE(om_tag_handle_in_ip(handle, AF_INET6, ip6));
+    TEST_ASSERT_TRUE(om_tag_handle_in(handle, "10.1.2.3"));
+
+    /* Source flags are honored */
+    TEST_ASSERT_TRUE(om_tag_handle_in_mac(handle_dev, &mac));
+    TEST_ASSERT_TRUE(om_tag_handle_in_ip(handle_dev, AF_INET, &ip4));
+    TEST_ASSERT_FALSE(om_tag_handle_in_ip(handle_dev, AF_INET6, ip6));
+
+    /* Updates are reflected */
+    STRSCPY(stag.device_value[0], "aa:bb:cc:dd:ee:02");
+    ret = om_tag_update_from_schema(&stag);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_FALSE(om_tag_handle_in_mac(handle, &mac));
+    mac.addr[5] = 0x02;
+    TEST_ASSERT_TRUE(om_tag_handle_in_mac(handle, &mac));
+
+    /* The group tag has its own binary set */
+    ip4 = htonl(0x0a010204);
+    handle_group = om_tag_handle_get("$[group_tag]");
+    TEST_ASSERT_FALSE(om_tag_handle_in_ip(handle_group, AF_INET, &ip4));
+    om_tag_handle_put(handle_group);
+
+    /* The tag removal detaches the handles */
+    ret = om_tag_remove_from_schema(&stag);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_NULL(handle->tag);
+    TEST_ASSERT_NULL(handle_dev->tag);
+    TEST_ASSERT_FALSE(om_tag_handle_in_mac(handle, &mac));
+    TEST_ASSERT_FALSE(om_tag_in("10.1.2.3", "${bin_tag}"));
+
+    om_tag_handle_put(handle);
+    om_tag_handle_put(handle_dev);
+}
+
+
+void
+test_tag_lookups_do_not_intern(void)
+{
+    om_tag_handle_t *handle;
+
+    /* One off lookups of unknown references leave no handle behind */
+    TEST_ASSERT_NULL(om_tag_find("${no_such_tag}"));
+    TEST_ASSERT_FALSE(om_tag_in("10.1.2.3", "${no_such_tag}"));
+
+    handle = om_tag_handle_get("${no_such_tag}");
+    TEST_ASSERT_NOT_NULL(handle);
+    TEST_ASSERT_EQUAL_INT(1, handle->refcount);
+
+    /* Lookups go through the handle while it is held */
+    TEST_ASSERT_NULL(om_tag_find("${no_such_tag}"));
+    TEST_ASSERT_EQUAL_INT(1, handle->refcount);
+    om_tag_handle_put(handle);
+
+    /* The last release frees the handle, a new one starts afresh */
+    handle = om_tag_handle_get("${no_such_tag}");
+    TEST_ASSERT_EQUAL_INT(1, handle->refcount);
+    om_tag_handle_put(handle);
+}
+
+
+void
+test_tag_group_handle(void)
+{
+    struct schema_Openflow_Tag stag;
+    om_tag_handle_t *handle;
+    om_tag_t *tag;
+    uint32_t ip4;
+    bool ret;
+
+    /* A tag sharing the group's name does not shadow the group */
+    memset(&stag, 0, sizeof(stag));
+    stag.name_exists = true;
+    STRSCPY(stag.name, "group_tag");
+    stag.device_value_len = 1;
+    STRSCPY(stag.device_value[0], "192.168.1.1");
+    ret = om_tag_add_from_schema(&stag);
+    TEST_ASSERT_TRUE(ret);
+
+    tag = om_tag_find("$[group_tag]");
+    TEST_ASSERT_NOT_NULL(tag);
+    TEST_ASSERT_TRUE(tag->group);
+
+    tag = om_tag_find("${group_tag}");
+    TEST_ASSERT_NOT_NULL(tag);
+    TEST_ASSERT_FALSE(tag->group);
+
+    handle = om_tag_handle_get("$[group_tag]");
+    ip4 = htonl(0xc0a80101);
+    TEST_ASSERT_FALSE(om_tag_handle_in_ip(handle, AF_INET, &ip4));
+    om_tag_handle_put(handle);
+    handle = om_tag_handle_get("${group_tag}");
+    TEST_ASSERT_TRUE(om_tag_handle_in_ip(handle, AF_INET, &ip4));
+    om_tag_handle_put(handle);
+
+    ret = om_tag_remove_from_schema(&stag);
+    TEST_ASSERT_TRUE(ret);
+    TEST_ASSERT_NOT_NULL(om_tag_find("$[group_tag]"));
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -363,6 +518,9 @@ main(int argc, char *argv[])
     RUN_TEST(test_type_of_tag);
     RUN_TEST(test_val_in_tag);
     RUN_TEST(test_val_in_tag_group);
+    RUN_TEST(test_tag_handles);
+    RUN_TEST(test_tag_group_handle);
+    RUN_TEST(test_tag_lookups_do_not_intern);
 
     return UNITY_END();
 }
@@ -73,6 +73,26 @@ struct eth_header
 };
 
 
+/**
+ * @brief compact descriptor of a parsed packet
+ *
+ * Filled while the headers are parsed so plugins do not need to walk
+ * them again. Offsets are counted from the start of the parsed data and
+ * are 0 when the matching header was not parsed.
+ */
+struct net_header_desc
+{
+    uint32_t flow_hash;         /* same value for both flow directions */
+    uint16_t l3_offset;
+    uint16_t l4_offset;
+    uint16_t payload_offset;
+    uint16_t src_port;          /* host order, 0 if neither tcp nor udp */
+    uint16_t dst_port;          /* host order, 0 if neither tcp nor udp */
+    uint8_t ip_version;
+    uint8_t ip_protocol;
+};
+
+
 /**
  * @brief container for parsed pcap data
  */
@@ -111,6 +131,7 @@ struct net_header_parser
     bool eth_header_available;
     uint32_t packet_id;
     uint32_t nfq_queue_num;
+    struct net_header_desc desc;
 };
 
 
@@ -124,6 +145,33 @@ struct net_header_parser
 size_t net_header_parse(struct net_header_parser *parser);
 
 
+/**
+ * @brief parses the network header parts of a burst of packets
+ *
+ * Each parser must have its data, packet_len and pcap_datalink set.
+ * The parsers of the packets successfully parsed are moved to the front
+ * of the array, in their original order.
+ *
+ * @param parsers the array of parsed data containers
+ * @param n the number of packets in the burst
+ * @return the number of packets successfully parsed
+ */
+size_t net_header_parse_batch(struct net_header_parser **parsers, size_t n);
+
+
+/**
+ * @brief computes the flow hash of a parsed packet
+ *
+ * Called by net_header_parse(). Callers parsing the headers piecewise
+ * call it once the transport header is parsed.
+ * The hash is stored in the packet descriptor.
+ *
+ * @param parser the parsed data container
+ * @return the flow hash, 0 for non ip packets
+ */
+uint32_t net_header_flow_hash(struct net_header_parser *parser);
+
+
 /**
  * @brief parse the ethernet header of a pcap capture
  *
@@ -26,6 +26,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <time.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -52,6 +53,7 @@ size_t net_header_parse(struct net_header_parser *parser)
 
     parser->start = parser->data;
     parser->parsed = 0;
+    memset(&parser->desc, 0, sizeof(parser->desc));
 
     /* Parse ethernet header */
     len = net_header_parse_eth(parser);
@@ -66,16 +68,147 @@ size_t net_header_parse(struct net_header_parser *parser)
     if (len == 0) return 0;
 
     ip_protocol = parser->ip_protocol;
-    if (ip_protocol == IPPROTO_TCP) return net_header_parse_tcp(parser);
-    if (ip_protocol == IPPROTO_UDP) return net_header_parse_udp(parser);
-    if (ip_protocol == IPPROTO_ICMP) return net_header_parse_icmp(parser);
-    if (ip_protocol == IPPROTO_ICMPV6) return net_header_parse_icmp6(parser);
+    if (ip_protocol == IPPROTO_TCP) len = net_header_parse_tcp(parser);
+    else if (ip_protocol == IPPROTO_UDP) len = net_header_parse_udp(parser);
+    else if (ip_protocol == IPPROTO_ICMP) len = net_header_parse_icmp(parser);
+    else if (ip_protocol == IPPROTO_ICMPV6) len = net_header_parse_icmp6(parser);
 
     /* If not TCP or UDP, leave the ip payload parsing to the packet owner */
+    if (len == 0) return 0;
+
+    net_header_flow_hash(parser);
+
     return len;
 }
 
 
+/**
+ * @brief parses the network header parts of a burst of packets
+ *
+ * @param parsers the array of parsed data containers
+ * @param n the number of packets in the burst
+ * @return the number of packets successfully parsed
+ */
+size_t net_header_parse_batch(struct net_header_parser **parsers, size_t n)
+{
+    struct net_header_parser *parser;
+    size_t parsed;
+    size_t len;
+    size_t i;
+
+    if (parsers == NULL) return 0;
+
+    parsed = 0;
+    for (i = 0; i < n; i++)
+    {
+        /* Bring the next packet's headers in cache while parsing this one */
+        if ((i + 1) < n) __builtin_prefetch(parsers[i + 1]->data);
+
+        parser = parsers[i];
+        len = net_header_parse(parser);
+        if (len == 0) continue;
+
+        parsers[i] = parsers[parsed];
+        parsers[parsed] = parser;
+        parsed++;
+    }
+
+    return parsed;
+}
+
+
+/**
+ * @brief FNV-1a hash of a byte buffer
+ */
+static uint32_t
+net_header_hash_bytes(uint32_t hash, const void *buf, size_t len)
+{
+    const uint8_t *bytes = buf;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/**
+ * @brief computes the flow hash of a parsed packet
+ *
+ * The endpoints are hashed in a fixed order so both directions of a flow
+ * share the same hash.
+ *
+ * @param parser the parsed data container
+ * @return the flow hash, 0 for non ip packets
+ */
+uint32_t net_header_flow_hash(struct net_header_parser *parser)
+{
+    struct net_header_desc *desc;
+    const void *ip_a;
+    const void *ip_b;
+    const void *tmp;
+    uint16_t port_a;
+    uint16_t port_b;
+    uint16_t port;
+    uint8_t proto;
+    uint32_t hash;
+    size_t ip_len;
+    int cmp;
+
+    desc = &parser->desc;
+    desc->flow_hash = 0;
+
+    if (parser->ip_version == 4)
+    {
+        struct iphdr *hdr = net_header_get_ipv4_hdr(parser);
+
+        if (hdr == NULL) return 0;
+        ip_a = &hdr->saddr;
+        ip_b = &hdr->daddr;
+        ip_len = sizeof(hdr->saddr);
+    }
+    else if (parser->ip_version == 6)
+    {
+        struct ip6_hdr *hdr = net_header_get_ipv6_hdr(parser);
+
+        if (hdr == NULL) return 0;
+        ip_a = &hdr->ip6_src;
+        ip_b = &hdr->ip6_dst;
+        ip_len = sizeof(hdr->ip6_src);
+    }
+    else return 0;
+
+    port_a = desc->src_port;
+    port_b = desc->dst_port;
+
+    cmp = memcmp(ip_a, ip_b, ip_len);
+    if ((cmp > 0) || ((cmp == 0) && (port_a > port_b)))
+    {
+        tmp = ip_a;
+        ip_a = ip_b;
+        ip_b = tmp;
+        port = port_a;
+        port_a = port_b;
+        port_b = port;
+    }
+
+    proto = (uint8_t)parser->ip_protocol;
+    hash = 2166136261u;
+    hash = net_header_hash_bytes(hash, ip_a, ip_len);
+    hash = net_header_hash_bytes(hash, &port_a, sizeof(port_a));
+    hash = net_header_hash_bytes(hash, ip_b, ip_len);
+    hash = net_header_hash_bytes(hash, &port_b, sizeof(port_b));
+    hash = net_header_hash_bytes(hash, &proto, sizeof(proto));
+
+    desc->flow_hash = hash;
+    return hash;
+}
+
+
 /**
  * @brief parse the ethernet header of a pcap capture
  *
@@ -192,10 +325,14 @@ size_t net_header_parse_ipv4(struct net_header_parser *parser)
     /* check ip payload length against the captured packet size */
     if (len < ip_dlen) return 0;
 
+    parser->desc.l3_offset = parser->parsed;
     parser->parsed += ip_hlen;
     parser->data += ip_hlen;
     parser->ip_version = 4;
     parser->ip_protocol = hdr->protocol;
+    parser->desc.ip_version = 4;
+    parser->desc.ip_protocol = hdr->protocol;
+    parser->desc.l4_offset = parser->parsed;
 
     /* Adjust packet length to account for ethernet padding */
     parser->packet_len = parser->parsed + ip_dlen;
@@ -304,9 +441,11 @@ size_t net_header_parse_ipv6(struct net_header_parser *parser)
     /* check ip payload length against the captured packet size */
     if (len < ip_dlen) return 0;
 
+    parser->desc.l3_offset = parser->parsed;
     parser->parsed += ip_hlen;
     parser->data += ip_hlen;
     parser->ip_version = 6;
+    parser->desc.ip_version = 6;
 
     /* Adjust packet length to account for ethernet padding */
     parser->packet_len = parser->parsed + ip_dlen;
@@ -315,6 +454,8 @@ size_t net_header_parse_ipv6(struct net_header_parser *parser)
     len = net_header_get_ipv6_payload(parser);
     if (len == 0) return 0;
 
+    parser->desc.ip_protocol = parser->ip_protocol;
+    parser->desc.l4_offset = parser->parsed;
 
     return parser->parsed;
 }
@@ -458,6 +599,9 @@ size_t net_header_parse_tcp(struct net_header_parser *parser)
 
     parser->parsed += tcp_hlen;
     parser->data += tcp_hlen;
+    parser->desc.src_port = ntohs(hdr->source);
+    parser->desc.dst_port = ntohs(hdr->dest);
+    parser->desc.payload_offset = parser->parsed;
 
     return tcp_hlen;
 }
@@ -484,6 +628,9 @@ size_t net_header_parse_udp(struct net_header_parser *parser)
 
     parser->parsed += udp_hlen;
     parser->data += udp_hlen;
+    parser->desc.src_port = ntohs(hdr->source);
+    parser->desc.dst_port = ntohs(hdr->dest);
+    parser->desc.payload_offset = parser->parsed;
 
     return udp_hlen;
 }
@@ -510,6 +657,7 @@ size_t net_header_parse_icmp(struct net_header_parser *parser)
 
     parser->parsed += icmp_hlen;
     parser->data += icmp_hlen;
+    parser->desc.payload_offset = parser->parsed;
 
     return icmp_hlen;
 }
@@ -536,6 +684,7 @@ size_t net_header_parse_icmp6(struct net_header_parser *parser)
 
     parser->parsed += icmp6_hlen;
     parser->data += icmp6_hlen;
+    parser->desc.payload_offset = parser->parsed;
 
     return icmp6_hlen;
 }
@@ -505,6 +505,96 @@ void test_flow_details(void)
          net_header_fill_info_buf(log_buf, NET_HDR_BUFF_SIZE, parser));
 }
 
+/**
+ * @brief validate the packet descriptor of pcap.c's pkt16608
+ *
+ * pkt16608 is a TCP/IPv4 packet over vlan4.
+ * A copy with swapped addresses and ports has the same flow hash.
+ */
+void test_packet_desc(void)
+{
+    struct net_header_parser *parser;
+    struct net_header_desc *desc;
+    uint8_t reply[sizeof(pkt16608)];
+    uint32_t flow_hash;
+    size_t len;
+
+    PREPARE_UT(pkt16608);
+    parser = &g_parser;
+
+    len = net_header_parse(parser);
+    TEST_ASSERT_TRUE(len != 0);
+
+    desc = &parser->desc;
+    TEST_ASSERT_EQUAL_UINT(18, desc->l3_offset);
+    TEST_ASSERT_EQUAL_UINT(38, desc->l4_offset);
+    TEST_ASSERT_EQUAL_UINT(70, desc->payload_offset);
+    TEST_ASSERT_EQUAL_UINT(parser->parsed, desc->payload_offset);
+    TEST_ASSERT_EQUAL_UINT(4, desc->ip_version);
+    TEST_ASSERT_EQUAL_UINT(IPPROTO_TCP, desc->ip_protocol);
+    TEST_ASSERT_EQUAL_UINT(39762, desc->src_port);
+    TEST_ASSERT_EQUAL_UINT(54321, desc->dst_port);
+    TEST_ASSERT_TRUE(desc->flow_hash != 0);
+    flow_hash = desc->flow_hash;
+
+    /* Swap the ip addresses and the ports */
+    memcpy(reply, pkt16608, sizeof(reply));
+    memcpy(&reply[30], &pkt16608[34], 4);
+    memcpy(&reply[34], &pkt16608[30], 4);
+    memcpy(&reply[38], &pkt16608[40], 2);
+    memcpy(&reply[40], &pkt16608[38], 2);
+
+    memset(&g_parser, 0, sizeof(g_parser));
+    g_parser.packet_len = sizeof(reply);
+    g_parser.data = reply;
+    len = net_header_parse(parser);
+    TEST_ASSERT_TRUE(len != 0);
+    TEST_ASSERT_EQUAL_UINT(54321, desc->src_port);
+    TEST_ASSERT_EQUAL_UINT(39762, desc->dst_port);
+    TEST_ASSERT_EQUAL_UINT32(flow_hash, desc->flow_hash);
+
+    /* Non ip packets have no flow hash */
+    memset(&g_parser, 0, sizeof(g_parser));
+    PREPARE_UT(pkt12176);
+    len = net_header_parse(parser);
+    TEST_ASSERT_TRUE(len != 0);
+    TEST_ASSERT_EQUAL_UINT32(0, desc->flow_hash);
+}
+
+
+/**
+ * @brief parse a burst of packets
+ *
+ * The truncated packet is moved to the back of the burst.
+ */
+void test_parse_batch(void)
+{
+    struct net_header_parser parsers[3];
+    struct net_header_parser *burst[3];
+    size_t parsed;
+    size_t i;
+
+    memset(parsers, 0, sizeof(parsers));
+    parsers[0].data = (uint8_t *)pkt16608;
+    parsers[0].packet_len = sizeof(pkt16608);
+    parsers[1].data = (uint8_t *)pkt16608;
+    parsers[1].packet_len = 40;
+    parsers[2].data = (uint8_t *)pkt1200;
+    parsers[2].packet_len = sizeof(pkt1200);
+    for (i = 0; i < 3; i++) burst[i] = &parsers[i];
+
+    parsed = net_header_parse_batch(burst, 3);
+    TEST_ASSERT_EQUAL_UINT(2, parsed);
+    TEST_ASSERT_TRUE(burst[0] == &parsers[0]);
+    TEST_ASSERT_TRUE(burst[1] == &parsers[2]);
+    TEST_ASSERT_TRUE(burst[2] == &parsers[1]);
+    TEST_ASSERT_EQUAL_UINT(4, burst[0]->desc.ip_version);
+    TEST_ASSERT_EQUAL_UINT(6, burst[1]->desc.ip_version);
+    TEST_ASSERT_EQUAL_UINT(IPPROTO_TCP, burst[1]->desc.ip_protocol);
+    TEST_ASSERT_EQUAL_UINT(burst[1]->parsed, burst[1]->desc.payload_offset);
+}
+
+
 int main(int argc, char *argv[])
 {
     (void)argc;
@@ -523,6 +613,8 @@ int main(int argc, char *argv[])
     RUN_TEST(test_icmp4_reply);
     RUN_TEST(test_udp_ipv4_no_data);
     RUN_TEST(test_flow_details);
+    RUN_TEST(test_packet_desc);
+    RUN_TEST(test_parse_batch);
 
     return UNITY_END();
 }
@@ -108,6 +108,8 @@ extern bool     om_template_tag_update(om_tag_t *tag, ds_tree_t *removed,
 /******************************************************************************
  * Openflow rules add/delete Definitions
  *****************************************************************************/
+extern void     om_flow_begin(void);
+extern bool     om_flow_commit(void);
 extern bool     om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf);
 extern bool     om_del_flow(const char *token, const struct schema_Openflow_Config *ofconf);
 
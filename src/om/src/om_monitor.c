@@ -611,6 +611,9 @@ om_monitor_update_flows(om_action_t type, json_t *js)
 
     memcpy(&ofconf_cpy, &ofconf, sizeof(ofconf_cpy));
 
+    // All the flows generated from this row are applied as one transaction
+    om_flow_begin();
+
     // Handle the condition where a range exists in the rule
     if (om_range_is_range_specified(ofconf.rule)) {
         (void)om_range_clear_range_rules();
@@ -641,6 +644,10 @@ om_monitor_update_flows(om_action_t type, json_t *js)
         ret = om_monitor_update_flows_parsed(type, &ofconf);
     }
 
+    if (!om_flow_commit()) {
+        ret = false;
+    }
+
     // Update the result in Openflow_State table so the cloud knows
     om_monitor_update_openflow_state( &ofconf, type, ret );
 
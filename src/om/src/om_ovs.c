@@ -26,63 +26,257 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /*
  * Openflow Manager - openflow rules processing
+ *
+ * Flow changes are queued while a transaction is open (om_flow_begin() and
+ * om_flow_commit()) and applied per bridge by a single
+ * "ovs-ofctl --bundle add-flows" invocation, which programs all of them as
+ * one atomic OpenFlow bundle. Flows added or deleted outside a transaction
+ * are applied immediately, as a transaction of their own.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "schema.h"
 #include "os.h"
 #include "log.h"
 #include "target.h"
+#include "memutil.h"
+#include "ds_tree.h"
+#include "ds_dlist.h"
 #include "om.h"
 
 /*****************************************************************************/
 #define MODULE_ID LOG_MODULE_ID_MAIN
+
+#define OM_OVS_FLOWS_FILE   "/tmp/om_flows.XXXXXX"
 /*****************************************************************************/
 
-bool om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+typedef struct {
+    om_action_t     type;
+    char            *entry;     // Line in ovs-ofctl add-flows file format
+    char            *rule;      // Rule, for the target hooks
+    ds_dlist_node_t dst_node;
+} om_ovs_flow_t;
+
+typedef struct {
+    char            *bridge;
+    ds_dlist_t      flows;      // List of om_ovs_flow_t, in order
+    int             num_flows;
+    ds_tree_node_t  dst_node;
+} om_ovs_batch_t;
+
+static ds_tree_t    om_ovs_batches = DS_TREE_INIT(ds_str_cmp, om_ovs_batch_t, dst_node);
+static int          om_ovs_txn_depth = 0;
+
+/******************************************************************************
+ * Local Functions
+ *****************************************************************************/
+static om_ovs_batch_t *
+om_ovs_batch_get(const char *bridge)
+{
+    om_ovs_batch_t  *batch;
+
+    if ((batch = ds_tree_find(&om_ovs_batches, (void *)bridge))) {
+        return batch;
+    }
+
+    batch = CALLOC(1, sizeof(*batch));
+    batch->bridge = STRDUP(bridge);
+    ds_dlist_init(&batch->flows, om_ovs_flow_t, dst_node);
+    ds_tree_insert(&om_ovs_batches, batch, batch->bridge);
+
+    return batch;
+}
+
+static void
+om_ovs_batch_free(om_ovs_batch_t *batch)
+{
+    om_ovs_flow_t   *flow;
+    ds_dlist_iter_t iter;
+
+    for (flow = ds_dlist_ifirst(&iter, &batch->flows); flow; flow = ds_dlist_inext(&iter)) {
+        ds_dlist_iremove(&iter);
+        FREE(flow->entry);
+        FREE(flow->rule);
+        FREE(flow);
+    }
+
+    FREE(batch->bridge);
+    FREE(batch);
+}
+
+static bool
+om_ovs_queue_flow(om_action_t type, const struct schema_Openflow_Config *ofconf)
+{
+    om_ovs_batch_t  *batch;
+    om_ovs_flow_t   *flow;
+    char            entry[512];
+    bool            ret;
+    int             len;
+
+    if (om_ovs_txn_depth == 0) {
+        // Flow changed outside of a transaction, apply it right away
+        om_flow_begin();
+        ret = om_ovs_queue_flow(type, ofconf);
+        return om_flow_commit() && ret;
+    }
+
+    if (type == ADD) {
+        len = snprintf(entry, sizeof(entry), "add table=%d,priority=%d%s%s,actions=%s",
+                       ofconf->table, ofconf->priority,
+                       strlen(ofconf->rule) > 0 ? "," : "",
+                       ofconf->rule, ofconf->action);
+    }
+    else {
+        len = snprintf(entry, sizeof(entry), "delete_strict table=%d,priority=%d%s%s",
+                       ofconf->table, ofconf->priority,
+                       strlen(ofconf->rule) > 0 ? "," : "",
+                       ofconf->rule);
+    }
+    if (len >= (int)sizeof(entry)) {
+        LOGE("Flow entry %s failed, too long: %s", (type == ADD) ? "add" : "del", entry);
+        return false;
+    }
+
+    batch = om_ovs_batch_get(ofconf->bridge);
+
+    flow = CALLOC(1, sizeof(*flow));
+    flow->type  = type;
+    flow->entry = STRDUP(entry);
+    flow->rule  = STRDUP(ofconf->rule);
+    ds_dlist_insert_tail(&batch->flows, flow);
+    batch->num_flows++;
+
+    LOGD("Flow entry queued on %s: %s", ofconf->bridge, entry);
+
+    return true;
+}
+
+// Write the queued flows to a file, in ovs-ofctl add-flows format
+static bool
+om_ovs_batch_write(om_ovs_batch_t *batch, char *path)
+{
+    om_ovs_flow_t   *flow;
+    FILE            *fp;
+    int             fd;
+
+    if ((fd = mkstemp(path)) < 0) {
+        LOGE("Failed to create flows file %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    if (!(fp = fdopen(fd, "w"))) {
+        LOGE("Failed to open flows file %s: %s", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return false;
+    }
+
+    ds_dlist_foreach(&batch->flows, flow) {
+        fprintf(fp, "%s\n", flow->entry);
+    }
+
+    if (fclose(fp) != 0) {
+        LOGE("Failed to write flows file %s: %s", path, strerror(errno));
+        unlink(path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+om_ovs_batch_apply(om_ovs_batch_t *batch)
 {
-    char    flow_entry[512];
-    bool    success = false;
+    om_ovs_flow_t   *flow;
+    char            path[] = OM_OVS_FLOWS_FILE;
+    char            cmd[256];
+    bool            success;
+
+    if (!om_ovs_batch_write(batch, path)) {
+        return false;
+    }
+
+    // Apply all the changes as a single atomic bundle
+    snprintf(cmd, sizeof(cmd), "ovs-ofctl --bundle add-flows %s %s", batch->bridge, path);
+    success = (cmd_log(cmd) == 0);
+    if (!success) {
+        // The bundle is rejected as a whole, if either a flow is invalid or
+        // the bridge does not support bundles (OpenFlow 1.4+). Apply the
+        // flows individually, so the valid ones still get programmed.
+        LOGW("Flow bundle of %d entries failed on %s, retrying without bundle",
+             batch->num_flows, batch->bridge);
 
-    snprintf(flow_entry, sizeof( flow_entry ),
-             "ovs-ofctl add-flow %s \"table=%d,priority=%d%s%s,actions=%s\"",
-             ofconf->bridge, ofconf->table, ofconf->priority,
-             strlen(ofconf->rule) > 0 ? "," : "",
-             ofconf->rule, ofconf->action );
+        snprintf(cmd, sizeof(cmd), "ovs-ofctl add-flows %s %s", batch->bridge, path);
+        success = (cmd_log(cmd) == 0);
+    }
+    unlink(path);
 
-    // Execute ovs-ofctl to add the flow
-    // cmd_log returns 0 on success
-    success = (cmd_log(flow_entry) == 0);
-    if(!success) {
-        LOGE("Flow entry add failed: %s", flow_entry);
+    if (!success) {
+        ds_dlist_foreach(&batch->flows, flow) {
+            LOGE("Flow entry %s may have failed on %s: %s",
+                 (flow->type == ADD) ? "add" : "del", batch->bridge, flow->entry);
+        }
+    }
+    else {
+        LOGD("Applied %d flow entries on %s", batch->num_flows, batch->bridge);
     }
 
-    target_om_hook(TARGET_OM_POST_ADD, ofconf->rule); 
+    ds_dlist_foreach(&batch->flows, flow) {
+        target_om_hook((flow->type == ADD) ? TARGET_OM_POST_ADD : TARGET_OM_POST_DEL, flow->rule);
+    }
 
     return success;
 }
 
-bool om_del_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+/******************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+// Open a transaction, flow changes are queued until the outermost commit
+void om_flow_begin(void)
+{
+    om_ovs_txn_depth++;
+}
+
+// Close a transaction; the outermost commit applies all queued flow changes
+bool om_flow_commit(void)
 {
-    char    flow_entry[512];
-    bool    success = false;
+    om_ovs_batch_t  *batch;
+    ds_tree_iter_t  iter;
+    bool            success = true;
 
-    snprintf( flow_entry, sizeof( flow_entry ),
-              "ovs-ofctl del-flows %s \"table=%d,priority=%d%s%s\" --strict",
-              ofconf->bridge, ofconf->table, ofconf->priority,
-              strlen( ofconf->rule ) > 0 ? "," : "",
-              ofconf->rule );
+    if (om_ovs_txn_depth <= 0) {
+        LOGE("Flow commit without a transaction");
+        return false;
+    }
 
-    // Execute ovs-ofctl to del the flow
-    // cmd_log returns 0 on success
-    success = (cmd_log(flow_entry) == 0);
-    if(!success) {
-        LOGE("Flow entry del failed: %s", flow_entry);
+    if (--om_ovs_txn_depth > 0) {
+        return true;
     }
 
-    target_om_hook(TARGET_OM_POST_DEL, ofconf->rule);
+    for (batch = ds_tree_ifirst(&iter, &om_ovs_batches); batch; batch = ds_tree_inext(&iter)) {
+        ds_tree_iremove(&iter);
+        if (!om_ovs_batch_apply(batch)) {
+            success = false;
+        }
+        om_ovs_batch_free(batch);
+    }
 
     return success;
 }
+
+bool om_add_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+{
+    return om_ovs_queue_flow(ADD, ofconf);
+}
+
+bool om_del_flow(const char *token, const struct schema_Openflow_Config *ofconf)
+{
+    return om_ovs_queue_flow(DELETE, ofconf);
+}
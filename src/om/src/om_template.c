@@ -344,18 +344,24 @@ om_template_tflow_update(om_action_t type, om_tflow_t *tflow)
     om_tag_list_entry_t *tle;
     ds_tree_iter_t      iter;
     om_tdata_t          tdata;
+    bool                ret = true;
 
     if (ds_tree_head(&tflow->tags)) {
+        // Program all the expanded flows as a single transaction
+        om_flow_begin();
+
         memset(&tdata, 0, sizeof(tdata));
         tdata.filter     = TAG_FILTER_NORMAL;
         tdata.ignore_err = false;
         tle = ds_tree_ifirst(&iter, &tflow->tags);
-        if (!om_template_apply_tag(type, tflow, tle, &iter, &tdata, 0)) {
-            return false;
+        ret = om_template_apply_tag(type, tflow, tle, &iter, &tdata, 0);
+
+        if (!om_flow_commit()) {
+            ret = false;
         }
     }
 
-    return true;
+    return ret;
 }
 
 // Update system flows based on tag update
@@ -373,6 +379,10 @@ om_template_tag_update(om_tag_t *tag, ds_tree_t *removed,
     // Fetch flow tree
     tflows = om_tflow_get_tree();
 
+    // Apply the whole tag change as a single transaction, so the flows of
+    // all the template flows are updated at once
+    om_flow_begin();
+
     // Walk template flows and find ones which reference this tag
     ds_tree_foreach(tflows, tflow) {
         if (!om_tag_list_entry_find_by_value(&tflow->tags, tag->name)) {
@@ -431,5 +441,9 @@ om_template_tag_update(om_tag_t *tag, ds_tree_t *removed,
         }
     }
 
+    if (!om_flow_commit()) {
+        ret = false;
+    }
+
     return ret;
 }